@@ -117,6 +117,12 @@ static inline int reg_int_cb(struct int_param_s *int_param)
 #define fabs(x)     (((x)>0)?(x):-(x))
 #elif defined EMPL_TARGET_BCM2835
 #include "platform_bcm2835.c"
+const struct mpu_i2c_ops *mpu_i2c_ops;
+
+void mpu_set_i2c_ops(const struct mpu_i2c_ops *ops)
+{
+    mpu_i2c_ops = ops;
+}
 #else
 #error  Gyro driver is missing the system layer implementations.
 #endif
@@ -1843,6 +1849,54 @@ int mpu_read_fifo_stream(unsigned short length, unsigned char *data,
     return 0;
 }
 
+/**
+ *  @brief      Get all the complete packets in the FIFO in one transfer.
+ *  The FIFO count is read once and the packets follow in a single burst
+ *  read, a partial packet is left for the next call. DMP packets, or the
+ *  sensor packets mpu_configure_fifo() set up.
+ *  @param[in]  length      Length of one FIFO packet.
+ *  @param[in]  max_packets Room in @e data, in packets.
+ *  @param[out] data        FIFO packets, back to back.
+ *  @param[out] packets     Number of packets read.
+ *  @param[out] more        Number of remaining packets.
+ *  @return     0 if successful, -2 if the FIFO overflowed and was reset.
+ */
+int mpu_read_fifo_burst(unsigned short length, unsigned short max_packets,
+    unsigned char *data, unsigned short *packets, unsigned char *more)
+{
+    unsigned char tmp[2];
+    unsigned short fifo_count, nr;
+
+    packets[0] = 0;
+    more[0] = 0;
+    if (!st.chip_cfg.dmp_on && !st.chip_cfg.fifo_enable)
+        return -1;
+    if (!st.chip_cfg.sensors || !length)
+        return -1;
+
+    if (i2c_read(st.hw->addr, st.reg->fifo_count_h, 2, tmp))
+        return -1;
+    fifo_count = (tmp[0] << 8) | tmp[1];
+    if (fifo_count < length)
+        return 0;
+    if (fifo_count > (st.hw->max_fifo >> 1)) {
+        /* FIFO is 50% full, better check overflow bit. */
+        if (i2c_read(st.hw->addr, st.reg->int_status, 1, tmp))
+            return -1;
+        if (tmp[0] & BIT_FIFO_OVERFLOW) {
+            mpu_reset_fifo();
+            return -2;
+        }
+    }
+
+    nr = min(fifo_count / length, max_packets);
+    if (i2c_read(st.hw->addr, st.reg->fifo_r_w, nr * length, data))
+        return -1;
+    packets[0] = nr;
+    more[0] = min(fifo_count / length - nr, 0xff);
+    return 0;
+}
+
 /**
  *  @brief      Set device to bypass mode.
  *  @param[in]  bypass_on   1 to enable bypass mode.
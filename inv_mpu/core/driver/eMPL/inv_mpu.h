@@ -115,6 +115,8 @@ int mpu_read_fifo(short *gyro, short *accel, unsigned long *timestamp,
     unsigned char *sensors, unsigned char *more);
 int mpu_read_fifo_stream(unsigned short length, unsigned char *data,
     unsigned char *more);
+int mpu_read_fifo_burst(unsigned short length, unsigned short max_packets,
+    unsigned char *data, unsigned short *packets, unsigned char *more);
 int mpu_reset_fifo(void);
 
 int mpu_write_mem(unsigned short mem_addr, unsigned short length,
@@ -130,5 +132,21 @@ int mpu_run_self_test(long *gyro, long *accel);
 int mpu_run_6500_self_test(long *gyro, long *accel, unsigned char debug);
 int mpu_register_tap_cb(void (*func)(unsigned char, unsigned char));
 
+#ifdef EMPL_TARGET_BCM2835
+/* The bus under i2c_write / i2c_read, NULL for the BSC through libbcm2835.
+ * delay_ms: the waits of the driver on the clock of the device behind the
+ * bus (a simulated one), NULL to sleep.
+ */
+struct mpu_i2c_ops {
+    int (*write)(void *opaque, unsigned char slave_addr, unsigned char reg_addr,
+        unsigned short length, const unsigned char *data);
+    int (*read)(void *opaque, unsigned char slave_addr, unsigned char reg_addr,
+        unsigned short length, unsigned char *data);
+    void *opaque;
+    void (*delay_ms)(void *opaque, unsigned long num_ms);
+};
+void mpu_set_i2c_ops(const struct mpu_i2c_ops *ops);
+#endif
+
 #endif  /* #ifndef _INV_MPU_H_ */
 
@@ -1245,53 +1245,37 @@ int dmp_set_interrupt_mode(unsigned char mode)
 }
 
 /**
- *  @brief      Get one packet from the FIFO.
- *  If @e sensors does not contain a particular sensor, disregard the data
- *  returned to that pointer.
- *  \n @e sensors can contain a combination of the following flags:
- *  \n INV_X_GYRO, INV_Y_GYRO, INV_Z_GYRO
- *  \n INV_XYZ_GYRO
- *  \n INV_XYZ_ACCEL
- *  \n INV_WXYZ_QUAT
- *  \n If the FIFO has no new data, @e sensors will be zero.
- *  \n If the FIFO is disabled, @e sensors will be zero and this function will
- *  return a non-zero error code.
+ *  @brief      Parse one DMP packet.
+ *  @param[in]  fifo_data   The packet.
  *  @param[out] gyro        Gyro data in hardware units.
  *  @param[out] accel       Accel data in hardware units.
  *  @param[out] quat        3-axis quaternion data in hardware units.
- *  @param[out] timestamp   Timestamp in milliseconds.
- *  @param[out] sensors     Mask of sensors read from FIFO.
- *  @param[out] more        Number of remaining packets.
- *  @return     0 if successful.
+ *  @param[out] sensors     Mask of sensors in the packet.
+ *  @return     0 if successful, -1 on a corrupted packet.
  */
-int dmp_read_fifo(short *gyro, short *accel, long *quat,
-    unsigned long *timestamp, short *sensors, unsigned char *more)
+static int parse_packet(unsigned char *fifo_data, short *gyro, short *accel,
+    long *quat, short *sensors)
 {
-    unsigned char fifo_data[MAX_PACKET_LENGTH];
     unsigned char ii = 0;
 
-    /* TODO: sensors[0] only changes when dmp_enable_feature is called. We can
-     * cache this value and save some cycles.
-     */
     sensors[0] = 0;
-
-    /* Get a packet. */
-    if (mpu_read_fifo_stream(dmp.packet_length, fifo_data, more))
-        return -1;
-
-    /* Parse DMP packet. */
     if (dmp.feature_mask & (DMP_FEATURE_LP_QUAT | DMP_FEATURE_6X_LP_QUAT)) {
 #ifdef FIFO_CORRUPTION_CHECK
         long quat_q14[4], quat_mag_sq;
 #endif
-        quat[0] = ((long)fifo_data[0] << 24) | ((long)fifo_data[1] << 16) |
-            ((long)fifo_data[2] << 8) | fifo_data[3];
-        quat[1] = ((long)fifo_data[4] << 24) | ((long)fifo_data[5] << 16) |
-            ((long)fifo_data[6] << 8) | fifo_data[7];
-        quat[2] = ((long)fifo_data[8] << 24) | ((long)fifo_data[9] << 16) |
-            ((long)fifo_data[10] << 8) | fifo_data[11];
-        quat[3] = ((long)fifo_data[12] << 24) | ((long)fifo_data[13] << 16) |
-            ((long)fifo_data[14] << 8) | fifo_data[15];
+        /* Through int32_t: the sign survives a 64-bit long. */
+        quat[0] = (int32_t)(((uint32_t)fifo_data[0] << 24) |
+            ((uint32_t)fifo_data[1] << 16) | ((uint32_t)fifo_data[2] << 8) |
+            fifo_data[3]);
+        quat[1] = (int32_t)(((uint32_t)fifo_data[4] << 24) |
+            ((uint32_t)fifo_data[5] << 16) | ((uint32_t)fifo_data[6] << 8) |
+            fifo_data[7]);
+        quat[2] = (int32_t)(((uint32_t)fifo_data[8] << 24) |
+            ((uint32_t)fifo_data[9] << 16) | ((uint32_t)fifo_data[10] << 8) |
+            fifo_data[11]);
+        quat[3] = (int32_t)(((uint32_t)fifo_data[12] << 24) |
+            ((uint32_t)fifo_data[13] << 16) | ((uint32_t)fifo_data[14] << 8) |
+            fifo_data[15]);
         ii += 16;
 #ifdef FIFO_CORRUPTION_CHECK
         /* We can detect a corrupted FIFO by monitoring the quaternion data and
@@ -1311,7 +1295,6 @@ int dmp_read_fifo(short *gyro, short *accel, long *quat,
         if ((quat_mag_sq < QUAT_MAG_SQ_MIN) ||
             (quat_mag_sq > QUAT_MAG_SQ_MAX)) {
             /* Quaternion is outside of the acceptable threshold. */
-            mpu_reset_fifo();
             sensors[0] = 0;
             return -1;
         }
@@ -1341,10 +1324,103 @@ int dmp_read_fifo(short *gyro, short *accel, long *quat,
     if (dmp.feature_mask & (DMP_FEATURE_TAP | DMP_FEATURE_ANDROID_ORIENT))
         decode_gesture(fifo_data + ii);
 
+    return 0;
+}
+
+/**
+ *  @brief      Get one packet from the FIFO.
+ *  If @e sensors does not contain a particular sensor, disregard the data
+ *  returned to that pointer.
+ *  \n @e sensors can contain a combination of the following flags:
+ *  \n INV_X_GYRO, INV_Y_GYRO, INV_Z_GYRO
+ *  \n INV_XYZ_GYRO
+ *  \n INV_XYZ_ACCEL
+ *  \n INV_WXYZ_QUAT
+ *  \n If the FIFO has no new data, @e sensors will be zero.
+ *  \n If the FIFO is disabled, @e sensors will be zero and this function will
+ *  return a non-zero error code.
+ *  @param[out] gyro        Gyro data in hardware units.
+ *  @param[out] accel       Accel data in hardware units.
+ *  @param[out] quat        3-axis quaternion data in hardware units.
+ *  @param[out] timestamp   Timestamp in milliseconds.
+ *  @param[out] sensors     Mask of sensors read from FIFO.
+ *  @param[out] more        Number of remaining packets.
+ *  @return     0 if successful.
+ */
+int dmp_read_fifo(short *gyro, short *accel, long *quat,
+    unsigned long *timestamp, short *sensors, unsigned char *more)
+{
+    unsigned char fifo_data[MAX_PACKET_LENGTH];
+
+    /* TODO: sensors[0] only changes when dmp_enable_feature is called. We can
+     * cache this value and save some cycles.
+     */
+    sensors[0] = 0;
+
+    /* Get a packet. */
+    if (mpu_read_fifo_stream(dmp.packet_length, fifo_data, more))
+        return -1;
+
+    /* Parse DMP packet. */
+    if (parse_packet(fifo_data, gyro, accel, quat, sensors)) {
+        mpu_reset_fifo();
+        return -1;
+    }
+
     get_ms(timestamp);
     return 0;
 }
 
+/**
+ *  @brief      Get every complete packet in the FIFO.
+ *  The FIFO count is read once, all the packets come in one burst read
+ *  and are parsed in place. The packets are @e dmp.fifo_rate apart, the
+ *  timestamp of each one is back-computed from the time of the read
+ *  (the last one).
+ *  \n On a corrupted packet the FIFO is reset, the packets before it
+ *  are kept: the return is -1, @e count and @e sensors are valid for
+ *  them.
+ *  @param[out] samples     Parsed packets, oldest first.
+ *  @param[in]  max_samples Room in @e samples.
+ *  @param[out] count       Number of good packets.
+ *  @param[out] sensors     Mask of sensors in every good packet.
+ *  @param[out] more        Number of remaining packets.
+ *  @return     0 if successful.
+ */
+int dmp_read_fifo_batch(struct dmp_sample *samples, unsigned short max_samples,
+    unsigned short *count, short *sensors, unsigned char *more)
+{
+    unsigned char fifo_data[DMP_FIFO_SIZE];
+    unsigned short nr, ii;
+    unsigned long now;
+    short mask;
+
+    count[0] = 0;
+    sensors[0] = 0;
+    if (!dmp.packet_length)
+        return -1;
+
+    max_samples = min(max_samples, DMP_FIFO_SIZE / dmp.packet_length);
+    if (mpu_read_fifo_burst(dmp.packet_length, max_samples, fifo_data, &nr, more))
+        return -1;
+
+    get_ms(&now);
+    for (ii = 0; ii < nr; ii++) {
+        if (parse_packet(fifo_data + ii * dmp.packet_length, samples[ii].gyro,
+                samples[ii].accel, samples[ii].quat, &mask)) {
+            mpu_reset_fifo();
+            more[0] = 0;
+            break;
+        }
+        sensors[0] = mask;
+        samples[ii].timestamp = now;
+        if (dmp.fifo_rate)
+            samples[ii].timestamp -= (unsigned long)(nr - 1 - ii) * 1000 / dmp.fifo_rate;
+    }
+    count[0] = ii;
+    return ii < nr ? -1 : 0;
+}
+
 /**
  *  @brief      Register a function to be executed on a tap event.
  *  The tap direction is represented by one of the following:
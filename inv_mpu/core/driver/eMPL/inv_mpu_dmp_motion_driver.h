@@ -93,5 +93,18 @@ int dmp_enable_gyro_cal(unsigned char enable);
 int dmp_read_fifo(short *gyro, short *accel, long *quat,
     unsigned long *timestamp, short *sensors, unsigned char *more);
 
+/* Batched read: drains every complete packet of the FIFO in one transfer. */
+#define DMP_FIFO_SIZE   (1024)
+
+struct dmp_sample {
+    short gyro[3];
+    short accel[3];
+    long quat[4];
+    unsigned long timestamp;    /* ms, back-computed from the FIFO rate */
+};
+
+int dmp_read_fifo_batch(struct dmp_sample *samples, unsigned short max_samples,
+    unsigned short *count, short *sensors, unsigned char *more);
+
 #endif  /* #ifndef _INV_MPU_DMP_MOTION_DRIVER_H_ */
 
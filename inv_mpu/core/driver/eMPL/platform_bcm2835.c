@@ -2,7 +2,8 @@
  * i2c_write(unsigned char slave_addr, unsigned char reg_addr,
  *      unsigned char length, unsigned char const *data)
  * i2c_read(unsigned char slave_addr, unsigned char reg_addr,
- *      unsigned char length, unsigned char *data)
+ *      unsigned short length, unsigned char *data)
+ *      (a whole FIFO in one burst)
  * delay_ms(unsigned long num_ms)
  * get_ms(unsigned long *count)
  * reg_int_cb(void (*cb)(void), unsigned char port, unsigned char pin)
@@ -24,17 +25,28 @@
 #define log_i(...)  do {} while (0)
 #define log_e(...)  do {} while (0)
 #endif
-#define delay_ms    bcm2835_delay
 #define min(a, b)   (((a) < (b)) ? (a) : (b))
 #define __no_operation()    do {} while (0)
 
+/* mpu_set_i2c_ops(), in inv_mpu.c */
+extern const struct mpu_i2c_ops *mpu_i2c_ops;
+
+static void delay_ms(unsigned long num_ms)
+{
+    if (mpu_i2c_ops && mpu_i2c_ops->delay_ms)
+        mpu_i2c_ops->delay_ms(mpu_i2c_ops->opaque, num_ms);
+    else
+        bcm2835_delay(num_ms);
+}
+
+/* CLOCK_MONOTONIC, the clock of raspd */
 static void get_ms(unsigned long *count)
 {
-    struct timeval tv;
+    struct timespec ts;
     if (!count)
         return;
-    gettimeofday(&tv, NULL);
-    *count = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *count = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 static int reg_int_cb(struct int_param_s *int_param)
@@ -58,6 +70,10 @@ static int i2c_write(unsigned char slave_addr, unsigned char reg_addr,
 
     int rs;
 
+    if (mpu_i2c_ops)
+        return mpu_i2c_ops->write(mpu_i2c_ops->opaque, slave_addr, reg_addr,
+                length, data);
+
     if (length <= 63) {
         buf = buffer;
     } else {
@@ -86,10 +102,14 @@ static int i2c_write(unsigned char slave_addr, unsigned char reg_addr,
 }
 
 static int i2c_read(unsigned char slave_addr, unsigned char reg_addr,
-    unsigned char length, unsigned char *data)
+    unsigned short length, unsigned char *data)
 {
     int err;
 
+    if (mpu_i2c_ops)
+        return mpu_i2c_ops->read(mpu_i2c_ops->opaque, slave_addr, reg_addr,
+                length, data);
+
     bcm2835_i2c_setSlaveAddress(slave_addr);
     err = set_reg_ptr(reg_addr, length);
     if (err < 0)
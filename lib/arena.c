@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN     sizeof(void *)
+#define PAGE_SIZE       4096
+
+int arena_init(struct arena *a, size_t size)
+{
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    a->base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (a->base == MAP_FAILED) {
+        a->base = NULL;
+        return -ENOMEM;
+    }
+
+    /* fault every page in now, keep it if we may */
+    memset(a->base, 0, size);
+    mlock(a->base, size);
+
+    a->size = size;
+    a->used = 0;
+    a->peak = 0;
+    return 0;
+}
+
+void arena_destroy(struct arena *a)
+{
+    if (a->base) {
+        munmap(a->base, a->size);
+        a->base = NULL;
+    }
+    a->size = 0;
+    a->used = 0;
+}
+
+/*
+ * returns NULL when exhausted, the caller decides how to fall back
+ */
+void *arena_alloc(struct arena *a, size_t size)
+{
+    size_t off = (a->used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    void *p;
+
+    if (a->base == NULL || size > a->size || off > a->size - size)
+        return NULL;
+
+    p = a->base + off;
+    a->used = off + size;
+    if (a->used > a->peak)
+        a->peak = a->used;
+    return p;
+}
+
+char *arena_strdup(struct arena *a, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *p;
+
+    if ((p = arena_alloc(a, len)) != NULL)
+        memcpy(p, s, len);
+    return p;
+}
@@ -0,0 +1,33 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+/*
+ * bump allocator over a fixed, pre-faulted region
+ *
+ * allocations are released all at once by rewinding to a mark
+ */
+struct arena {
+    char *base;
+    size_t size;
+    size_t used;
+    size_t peak;
+};
+
+int arena_init(struct arena *a, size_t size);
+void arena_destroy(struct arena *a);
+void *arena_alloc(struct arena *a, size_t size);
+char *arena_strdup(struct arena *a, const char *s);
+
+static inline size_t arena_mark(struct arena *a)
+{
+    return a->used;
+}
+
+static inline void arena_rewind(struct arena *a, size_t mark)
+{
+    a->used = mark;
+}
+
+#endif /* __ARENA_H__ */
@@ -0,0 +1,95 @@
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * lock-free single-producer/single-consumer ring of fixed-size elements
+ *
+ * head is only written by the producer, tail only by the consumer,
+ * both run freely and are masked on access, nr must be a power of 2
+ */
+
+#define SPSC_CACHELINE  64
+
+struct spsc {
+    unsigned int head __attribute__((aligned(SPSC_CACHELINE)));
+    unsigned int tail __attribute__((aligned(SPSC_CACHELINE)));
+    unsigned int mask __attribute__((aligned(SPSC_CACHELINE)));
+    size_t esize;
+    char *buf;
+};
+
+static inline int spsc_init(struct spsc *r, void *buf, unsigned int nr, size_t esize)
+{
+    if (nr == 0 || (nr & (nr - 1)))
+        return -EINVAL;
+    r->head = 0;
+    r->tail = 0;
+    r->mask = nr - 1;
+    r->esize = esize;
+    r->buf = buf;
+    return 0;
+}
+
+/*
+ * producer side: claim the next free slot, fill it in place
+ * and publish it, NULL if the ring is full
+ */
+static inline void *spsc_claim(struct spsc *r)
+{
+    unsigned int head = r->head;
+
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->mask)
+        return NULL;
+    return r->buf + (head & r->mask) * r->esize;
+}
+
+static inline void spsc_publish(struct spsc *r)
+{
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * consumer side: the oldest element or NULL if empty,
+ * valid until spsc_release()
+ */
+static inline void *spsc_peek(struct spsc *r)
+{
+    unsigned int tail = r->tail;
+
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+        return NULL;
+    return r->buf + (tail & r->mask) * r->esize;
+}
+
+static inline void spsc_release(struct spsc *r)
+{
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+static inline int spsc_push(struct spsc *r, const void *e)
+{
+    void *slot = spsc_claim(r);
+
+    if (slot == NULL)
+        return -EAGAIN;
+    memcpy(slot, e, r->esize);
+    spsc_publish(r);
+    return 0;
+}
+
+static inline int spsc_pop(struct spsc *r, void *e)
+{
+    void *slot = spsc_peek(r);
+
+    if (slot == NULL)
+        return -EAGAIN;
+    memcpy(e, slot, r->esize);
+    spsc_release(r);
+    return 0;
+}
+
+#endif /* __SPSC_H__ */
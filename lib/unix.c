@@ -13,6 +13,7 @@
 #include <ctype.h>
 
 #include "xmalloc.h"
+#include "arena.h"
 #include "unix.h"
 
 #define DEFAULT_TCP_BUFLEN  (1024 * 8)
@@ -100,22 +101,10 @@ int daemonize(const char *cmd)
     return 0;
 }
 
-/*
- * Split a command line into an array suitable for handing to execv.
- *
- * A note on syntax: words are split on whitespace and '\' escapes characters.
- * '\\' will show up as '\' and '\ ' will leave a space, combining two
- * words.  Examples:
- * "ncat\ experiment -l -k" will be parsed as the following tokens:
- * "ncat experiment", "-l", "-k".
- * "ncat\\ -l -k" will be parsed as "ncat\", "-l", "-k"
- * See the test program, test/test-cmdline-split to see additional cases.
- */
-char **cmdline_split(const char *cmdexec, int *cmd_argv)
+static int count_tokens(const char *cmdexec)
 {
     const char *ptr;
-    char *cur_arg, **cmd_args;
-    int max_tokens = 0, arg_idx = 0, ptr_idx = 0;
+    int max_tokens = 0;
 
     /* Figure out the maximum number of tokens needed */
     ptr = cmdexec;
@@ -130,10 +119,18 @@ char **cmdline_split(const char *cmdexec, int *cmd_argv)
         while (*ptr && !isspace((int)(unsigned char)*ptr))
             ptr++;
     }
+    return max_tokens;
+}
 
-    /* The line is not empty so we've got something to deal with */
-    cmd_args = (char **)xmalloc(sizeof(char *) * (max_tokens + 1));
-    cur_arg = (char *)calloc(sizeof(char), strlen(cmdexec) + 1);
+/*
+ * Copy the tokens one after another into buf, which holds at least
+ * strlen(cmdexec) + 1 bytes, cmd_args points into buf.
+ */
+static int copy_tokens(const char *cmdexec, char **cmd_args, char *buf)
+{
+    const char *ptr;
+    char *cur_arg = buf;
+    int arg_idx = 0, ptr_idx = 0;
 
     /* Get and copy the tokens */
     ptr = cmdexec;
@@ -165,19 +162,66 @@ char **cmdline_split(const char *cmdexec, int *cmd_argv)
         }
         cur_arg[ptr_idx] = '\0';
 
-        cmd_args[arg_idx] = strdup(cur_arg);
-        cur_arg[0] = '\0';
+        cmd_args[arg_idx] = cur_arg;
+        cur_arg += ptr_idx + 1;
         ptr_idx = 0;
         arg_idx++;
     }
 
     cmd_args[arg_idx] = NULL;
+    return arg_idx;
+}
+
+/*
+ * Split a command line into an array suitable for handing to execv.
+ *
+ * A note on syntax: words are split on whitespace and '\' escapes characters.
+ * '\\' will show up as '\' and '\ ' will leave a space, combining two
+ * words.  Examples:
+ * "ncat\ experiment -l -k" will be parsed as the following tokens:
+ * "ncat experiment", "-l", "-k".
+ * "ncat\\ -l -k" will be parsed as "ncat\", "-l", "-k"
+ * See the test program, test/test-cmdline-split to see additional cases.
+ */
+char **cmdline_split(const char *cmdexec, int *cmd_argv)
+{
+    char *buf, **cmd_args;
+    int i, argc;
+
+    /* The line is not empty so we've got something to deal with */
+    cmd_args = (char **)xmalloc(sizeof(char *) * (count_tokens(cmdexec) + 1));
+    buf = (char *)xmalloc(strlen(cmdexec) + 1);
+
+    argc = copy_tokens(cmdexec, cmd_args, buf);
+    for (i = 0; i < argc; i++)
+        cmd_args[i] = strdup(cmd_args[i]);
+
     if (cmd_argv)
-        *cmd_argv = arg_idx;
+        *cmd_argv = argc;
 
     /* Clean up */
-    free(cur_arg);
+    free(buf);
+
+    return cmd_args;
+}
 
+/*
+ * Same as cmdline_split(), everything allocated from the arena,
+ * returns NULL when the arena is exhausted.
+ */
+char **cmdline_split_arena(struct arena *a, const char *cmdexec, int *cmd_argv)
+{
+    char *buf, **cmd_args;
+    int argc;
+
+    cmd_args = arena_alloc(a, sizeof(char *) * (count_tokens(cmdexec) + 1));
+    buf = arena_alloc(a, strlen(cmdexec) + 1);
+    if (cmd_args == NULL || buf == NULL)
+        return NULL;
+
+    argc = copy_tokens(cmdexec, cmd_args, buf);
+    if (cmd_argv)
+        *cmd_argv = argc;
     return cmd_args;
 }
 
@@ -4,7 +4,10 @@
 int write_loop(int fd, char *buf, size_t size);
 int lockfile(int fd);
 int daemonize(const char *cmd);
+struct arena;
+
 char **cmdline_split(const char *cmdexec, int *cmd_argv);
+char **cmdline_split_arena(struct arena *a, const char *cmdexec, int *cmd_argv);
 void free_cmd_argv(char *cmd_argv[]);
 int netexec(int fd, const char *cmdexec);
 int netrun(int fd, const char *cmdexec);
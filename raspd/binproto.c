@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include "module.h"
+#include "binproto.h"
+
+static const struct bincmd *bintab[NR_BINMODS];
+static int nr_binops[NR_BINMODS];
+
+int register_bincmds(int modid, const struct bincmd *cmds, int nr)
+{
+    if (modid <= 0 || modid >= NR_BINMODS || nr > BINPROTO_MAX_OPCODE)
+        return -EINVAL;
+    if (bintab[modid])
+        return -EEXIST;
+    bintab[modid] = cmds;
+    nr_binops[modid] = nr;
+    return 0;
+}
+
+static int decode_args(const struct bincmd *cmd,
+                const uint8_t *p, size_t len, union binarg argv[])
+{
+    const char *t;
+    int i;
+
+    if (len != strlen(cmd->args) * BINPROTO_ARG_SIZE)
+        return -EINVAL;
+
+    for (i = 0, t = cmd->args; *t; i++, t++, p += BINPROTO_ARG_SIZE) {
+        uint32_t v;
+
+        if (p[0] != *t)
+            return -EINVAL;
+        v = get_le32(p + 1);
+        /* both 32 bits wide */
+        memcpy(&argv[i], &v, sizeof(v));
+    }
+    return i;
+}
+
+int binproto_exec(int wfd, const void *buf, size_t len, int *retval)
+{
+    const uint8_t *p = buf;
+    int opcode, modid, length;
+    union binarg argv[BINPROTO_MAX_ARGS];
+    const struct bincmd *cmd;
+    int err;
+
+    if (len < BINPROTO_HDR_SIZE)
+        return 0;
+    if (p[0] != BINPROTO_MAGIC)
+        return -EPROTO;
+
+    opcode = p[1];
+    modid = get_le16(p + 2);
+    length = get_le16(p + 4);
+    if (length > BINPROTO_MAX_ARGS * BINPROTO_ARG_SIZE)
+        return -EMSGSIZE;
+    if (len < BINPROTO_HDR_SIZE + length)
+        return 0;
+
+    err = -ENOENT;
+    if (modid < NR_BINMODS && opcode < nr_binops[modid]) {
+        cmd = &bintab[modid][opcode];
+        err = -ENOSYS;
+        if (cmd->fn) {
+            err = decode_args(cmd, p + BINPROTO_HDR_SIZE, length, argv);
+            if (err >= 0)
+                err = cmd->fn(wfd, argv);
+        }
+    }
+
+    if (retval)
+        *retval = err;
+    return BINPROTO_HDR_SIZE + length;
+}
+
+size_t binproto_pack_hdr(void *buf, int modid, int opcode, size_t length)
+{
+    uint8_t *p = buf;
+
+    p[0] = BINPROTO_MAGIC;
+    p[1] = (uint8_t)opcode;
+    put_le16(p + 2, (uint16_t)modid);
+    put_le16(p + 4, (uint16_t)length);
+    return BINPROTO_HDR_SIZE;
+}
+
+/*
+ * pack the reply of the request frame req
+ */
+size_t binproto_pack_reply(void *buf, const void *req, int retval)
+{
+    const uint8_t *r = req;
+    uint8_t *p = buf;
+
+    p += binproto_pack_hdr(p, get_le16(r + 2), r[1], BINPROTO_ARG_SIZE);
+    p[0] = BA_INT;
+    put_le32(p + 1, (uint32_t)retval);
+    return BINPROTO_HDR_SIZE + BINPROTO_ARG_SIZE;
+}
+
+/*
+ * pack a request frame, buf must hold BINPROTO_MAX_FRAME bytes
+ *      args: i(int), f(double, promoted)
+ */
+size_t binproto_pack(void *buf, int modid, int opcode, const char *args, ...)
+{
+    uint8_t *p = buf;
+    va_list ap;
+    size_t n = strlen(args);
+    uint32_t v;
+    float f;
+
+    if (n > BINPROTO_MAX_ARGS)
+        return 0;
+
+    p += binproto_pack_hdr(p, modid, opcode, n * BINPROTO_ARG_SIZE);
+
+    va_start(ap, args);
+    for (; *args; args++, p += BINPROTO_ARG_SIZE) {
+        switch (*args) {
+        case BA_INT:
+            v = (uint32_t)va_arg(ap, int);
+            break;
+        case BA_FLOAT:
+            f = (float)va_arg(ap, double);
+            memcpy(&v, &f, sizeof(v));
+            break;
+        default:
+            va_end(ap);
+            return 0;
+        }
+        p[0] = *args;
+        put_le32(p + 1, v);
+    }
+    va_end(ap);
+
+    return BINPROTO_HDR_SIZE + n * BINPROTO_ARG_SIZE;
+}
@@ -0,0 +1,115 @@
+#ifndef __BINPROTO_H__
+#define __BINPROTO_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "module.h"
+
+/*
+ * binary command protocol
+ *
+ * shares the listeners with the text protocol, a frame is recognized
+ * by the leading magic byte, not ASCII: it cannot start a text command
+ * line (it may occur inside one, as a UTF-8 continuation byte):
+ *
+ *      magic(1) opcode(1) modid(2) length(2) | args ...
+ *
+ * every argument is a type tag followed by 4 bytes, little endian:
+ *
+ *      'i' int32
+ *      'f' float32
+ *
+ * each request is answered with a frame of the same opcode/modid
+ * carrying a single 'i' argument: the return value of the handler
+ */
+
+#define BINPROTO_MAGIC      0xa5
+#define BINPROTO_HDR_SIZE   6
+#define BINPROTO_ARG_SIZE   5
+#define BINPROTO_MAX_ARGS   8
+#define BINPROTO_MAX_FRAME  (BINPROTO_HDR_SIZE + BINPROTO_MAX_ARGS * BINPROTO_ARG_SIZE)
+
+#define BA_INT      'i'
+#define BA_FLOAT    'f'
+
+/*
+ * well-known module ids, part of the wire protocol
+ *
+ *      module      opcode  args
+ *      euler       0       "fff"   pitch, roll, yaw
+ *      altitude    0       "i"     altitude
+ *      throttle    0       "i"     throttle increment
+ *      telemetry   0       "ii"    subscribe: channels, decimation
+ *                  1       ""      unsubscribe
+ */
+enum {
+    BINMOD_euler = 1,
+    BINMOD_altitude = 2,
+    BINMOD_throttle = 3,
+    BINMOD_telemetry = 4,   /* see telemetry.h */
+    /* the test programs, never registered by raspd */
+    BINMOD_TEST_FIRST = 12,
+    BINMOD_TEST_LAST = 15,
+    NR_BINMODS
+};
+
+#define BINPROTO_MAX_OPCODE 16
+
+union binarg {
+    int32_t i;
+    float f;
+};
+
+/*
+ * typed handler, argv has been checked against args
+ */
+struct bincmd {
+    const char *args;
+    int (*fn)(int wfd, const union binarg argv[]);
+};
+
+int register_bincmds(int modid, const struct bincmd *cmds, int nr);
+
+/*
+ * execute the frame at buf, returns the bytes consumed,
+ * 0 if the frame is not complete or < 0 on malformed frame
+ */
+int binproto_exec(int wfd, const void *buf, size_t len, int *retval);
+
+size_t binproto_pack_hdr(void *buf, int modid, int opcode, size_t length);
+size_t binproto_pack_reply(void *buf, const void *req, int retval);
+size_t binproto_pack(void *buf, int modid, int opcode, const char *args, ...);
+
+static inline uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+            | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+#define DEFINE_BINCMDS(mod)                                         \
+    static __init void __reg_bincmds_ ## mod(void) {                \
+        register_bincmds(BINMOD_ ## mod, mod ## _bincmds,           \
+            sizeof(mod ## _bincmds) / sizeof(mod ## _bincmds[0]));  \
+    }
+
+#endif /* __BINPROTO_H__ */
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+
+#include <xmalloc.h>
+
+#include "module.h"
+#include "rtctrl.h"
+#include "stats.h"
+#include "logger.h"
+#include "blackbox.h"
+
+struct bb_map {
+    int fd;
+    size_t size;
+    struct bb_header *hdr;
+    struct bb_record *recs;
+    uint32_t mask;
+    char *path;
+};
+
+/* owned by the control thread */
+static struct bb_map *rt_map;
+static uint64_t rt_seq;
+
+/* I/O thread view */
+static struct bb_map *cur_map;
+
+int blackbox_active(void)
+{
+    return rt_map != NULL;
+}
+
+void blackbox_append(struct bb_record *r)
+{
+    struct bb_map *map = rt_map;
+
+    if (map == NULL)
+        return;
+    r->seq = ++rt_seq;
+    r->time_ns = raspd_now_ns();
+    memcpy(&map->recs[(r->seq - 1) & map->mask], r, sizeof(*r));
+    __atomic_store_n(&map->hdr->count, r->seq, __ATOMIC_RELEASE);
+}
+
+static void bb_close(struct bb_map *map)
+{
+    munmap(map->hdr, map->size);
+    close(map->fd);
+    free(map->path);
+    free(map);
+}
+
+static struct bb_map *bb_open(const char *path, unsigned int nr_records, int *err)
+{
+    struct bb_map *map;
+    void *base;
+    int fd;
+
+    *err = 0;
+    /* never truncate under a mapping still in use, restarting on it */
+    unlink(path);
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        *err = -errno;
+        return NULL;
+    }
+
+    map = xmalloc(sizeof(*map));
+    map->fd = fd;
+    map->size = BB_HEADER_SIZE + (size_t)nr_records * sizeof(struct bb_record);
+    map->mask = nr_records - 1;
+    map->path = strdup(path);
+
+    /* blocks allocated now, an append never waits for the filesystem */
+    if ((*err = -posix_fallocate(fd, 0, map->size)) < 0)
+        goto fail;
+    base = mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        *err = -errno;
+        goto fail;
+    }
+    map->hdr = base;
+    map->recs = (struct bb_record *)((char *)base + BB_HEADER_SIZE);
+
+    /* not fatal, recording still works with page faults */
+    if (mlock(base, map->size) < 0)
+        rlog_warn("blackbox: mlock(%lu), errno = %d\n",
+                        (unsigned long)map->size, errno);
+
+    memset(base, 0, map->size);
+    memcpy(map->hdr->magic, BB_MAGIC, sizeof(map->hdr->magic));
+    map->hdr->version = BB_VERSION;
+    map->hdr->header_size = BB_HEADER_SIZE;
+    map->hdr->record_size = sizeof(struct bb_record);
+    map->hdr->nr_records = nr_records;
+    map->hdr->start_ns = raspd_now_ns();
+    return map;
+
+fail:
+    close(fd);
+    unlink(path);
+    free(map->path);
+    free(map);
+    return NULL;
+}
+
+/*
+ * the control thread hands the mapping it stopped using back to the
+ * I/O thread, which unmaps it
+ */
+static void bb_release(const void *rec)
+{
+    struct bb_map *map = *(struct bb_map * const *)rec;
+
+    msync(map->hdr, map->size, MS_ASYNC);
+    bb_close(map);
+}
+
+static void bb_switch(const union rtarg argv[])
+{
+    struct bb_map *old = rt_map;
+
+    rt_map = argv[0].p;
+    rt_seq = 0;
+    if (old && rtctrl_report(bb_release, &old, sizeof(old)) < 0)
+        rlog_err("blackbox: %s leaked\n", old->path);
+}
+
+int blackbox_start(const char *path, unsigned int nr_records)
+{
+    union rtarg arg;
+    struct bb_map *map;
+    int err;
+
+    if (nr_records < 2 || (nr_records & (nr_records - 1)))
+        return -EINVAL;
+    if ((map = bb_open(path, nr_records, &err)) == NULL)
+        return err;
+
+    arg.p = map;
+    if ((err = rtctrl_call(bb_switch, &arg, 1)) < 0) {
+        bb_close(map);
+        return err;
+    }
+    cur_map = map;
+    return 0;
+}
+
+void blackbox_stop(void)
+{
+    union rtarg arg;
+
+    if (cur_map == NULL)
+        return;
+    arg.p = NULL;
+    if (rtctrl_call(bb_switch, &arg, 1) < 0)
+        return;
+    cur_map = NULL;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, p, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int blackbox_snapshot(const char *path)
+{
+    struct bb_map *map = cur_map;
+    struct bb_header hdr;
+    char pad[BB_HEADER_SIZE - sizeof(hdr)];
+    uint64_t count;
+    uint32_t nr, first;
+    int fd, err;
+
+    if (map == NULL)
+        return -ENOENT;
+
+    count = __atomic_load_n(&map->hdr->count, __ATOMIC_ACQUIRE);
+    nr = map->mask + 1;
+    if (count < nr)
+        nr = count;
+    first = (count - nr) & map->mask;
+
+    hdr = *map->hdr;
+    hdr.nr_records = nr;
+    hdr.count = nr;
+    memset(pad, 0, sizeof(pad));
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return -errno;
+
+    /*
+     * oldest first, the slots overwritten while copying are caught by
+     * the decoder as seq going backwards
+     */
+    if ((err = write_all(fd, &hdr, sizeof(hdr))) < 0 ||
+        (err = write_all(fd, pad, sizeof(pad))) < 0)
+        goto out;
+    if (first + nr <= map->mask + 1) {
+        err = write_all(fd, &map->recs[first], nr * sizeof(struct bb_record));
+    } else {
+        uint32_t n = map->mask + 1 - first;
+        if ((err = write_all(fd, &map->recs[first], n * sizeof(struct bb_record))) < 0)
+            goto out;
+        err = write_all(fd, map->recs, (nr - n) * sizeof(struct bb_record));
+    }
+out:
+    close(fd);
+    return err;
+}
+
+/*
+ * module
+ */
+static int blackbox_init(void)
+{
+    return 0;
+}
+
+static void blackbox_exit(void)
+{
+    /* the control thread is gone, nothing races with us */
+    if (rt_map) {
+        msync(rt_map->hdr, rt_map->size, MS_SYNC);
+        bb_close(rt_map);
+    }
+    rt_map = NULL;
+    cur_map = NULL;
+}
+
+static int blackbox_main(int fd, int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "start",    no_argument,       NULL, 's' },
+        { "stop",     no_argument,       NULL, 'x' },
+        { "snapshot", required_argument, NULL, 'o' },
+        { "file",     required_argument, NULL, 'f' },
+        { "records",  required_argument, NULL, 'n' },
+        { 0, 0, 0, 0 }
+    };
+    const char *file = BB_DEFAULT_FILE;
+    unsigned int records = BB_DEFAULT_RECORDS;
+    const char *snapshot = NULL;
+    int start = 0, stop = 0;
+    struct bb_map *map;
+    char buffer[256];
+    int c, err, n;
+
+    while ((c = getopt_long(argc, argv, "sxo:f:n:", options, NULL)) != -1) {
+        switch (c) {
+        case 's': start = 1; break;
+        case 'x': stop = 1; break;
+        case 'o': snapshot = optarg; break;
+        case 'f': file = optarg; break;
+        case 'n': records = strtoul(optarg, NULL, 0); break;
+        default:
+            return 1;
+        }
+    }
+
+    if (snapshot && (err = blackbox_snapshot(snapshot)) < 0) {
+        n = snprintf(buffer, sizeof(buffer), "snapshot %s, err = %d\n",
+                        snapshot, err);
+        write(fd, buffer, n);
+        return 1;
+    }
+    if (stop)
+        blackbox_stop();
+    if (start && (err = blackbox_start(file, records)) < 0) {
+        n = snprintf(buffer, sizeof(buffer), "start %s, err = %d\n", file, err);
+        write(fd, buffer, n);
+        return 1;
+    }
+    if (start || stop || snapshot)
+        return 0;
+
+    if ((map = cur_map) == NULL) {
+        write(fd, "stopped\n", 8);
+        return 0;
+    }
+    n = snprintf(buffer, sizeof(buffer), "recording %s, %llu records (%u slots)\n",
+            map->path,
+            (unsigned long long)__atomic_load_n(&map->hdr->count, __ATOMIC_ACQUIRE),
+            map->mask + 1);
+    write(fd, buffer, n);
+    return 0;
+}
+
+DEFINE_MODULE_INIT_EXIT(blackbox);
@@ -0,0 +1,75 @@
+#ifndef __BLACKBOX_H__
+#define __BLACKBOX_H__
+
+#include <stdint.h>
+
+/*
+ * flight data recorder
+ *
+ * every control cycle is appended to a circular array of fixed size
+ * records in an mmap'ed file, preallocated and mlock'ed: an append is
+ * one memcpy and never blocks or faults in a page from disk. the kernel
+ * writes the file back in the background, what was written survives a
+ * crash of raspd.
+ *
+ * file layout, host byte order:
+ *
+ *      struct bb_header, padded to BB_HEADER_SIZE
+ *      struct bb_record [nr_records], record seq goes to slot seq % nr
+ *
+ * the header count is only a hint after a power loss, the decoder
+ * orders the records by seq (0 is an empty slot).
+ */
+
+#define BB_MAGIC            "RASPBBX"
+#define BB_VERSION          2       /* 1: timestamp in ms */
+#define BB_HEADER_SIZE      4096
+#define BB_DEFAULT_RECORDS  32768       /* ~160 s at 200 Hz, 6 MB */
+#define BB_DEFAULT_FILE     "blackbox.bin"
+
+struct bb_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t nr_records;
+    uint64_t count;             /* records appended */
+    uint64_t start_ns;          /* raspd_now_ns() */
+};
+
+struct bb_pid {
+    float error;
+    float sum_err;
+    float dt_err;
+    float output;
+};
+
+struct bb_record {
+    uint64_t seq;               /* from 1 */
+    uint64_t time_ns;           /* raspd_now_ns(), of the append */
+    uint32_t timestamp;         /* sensor, us on raspd_now_ns(), wraps */
+    uint16_t sensors;           /* INV_XYZ_GYRO ... */
+    uint16_t reserved;
+    int32_t quat[4];            /* q30 */
+    int32_t gyro[3];            /* q16 */
+    int32_t accel[3];           /* q16 */
+    float euler[3];
+    float target[3];
+    struct bb_pid angle[3];     /* pid_euler */
+    struct bb_pid rate[3];      /* pid_euler_rate */
+    int16_t esc[4];             /* front, rear, left, right */
+};
+
+_Static_assert(sizeof(struct bb_header) <= BB_HEADER_SIZE, "bb_header");
+_Static_assert(sizeof(struct bb_record) == 192, "bb_record layout");
+
+/* control thread, seq and time_ns are filled in */
+int blackbox_active(void);
+void blackbox_append(struct bb_record *r);
+
+int blackbox_start(const char *path, unsigned int nr_records);
+void blackbox_stop(void);
+/* copy the records in order to path, recording goes on */
+int blackbox_snapshot(const char *path);
+
+#endif /* __BLACKBOX_H__ */
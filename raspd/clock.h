@@ -0,0 +1,28 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * the time base of raspd: ns of CLOCK_MONOTONIC, for every sensor
+ * timestamp, the PID dt, the latency stats and the blackbox.
+ *
+ * CLOCK_MONOTONIC and not CLOCK_MONOTONIC_RAW: the kernel stamps the
+ * GPIO character device edges on CLOCK_MONOTONIC, the interrupt time
+ * of the IMU and of the echo pins is taken there. the NTP slew between
+ * the two is at most 500 ppm, smaller than the skew of the sensor
+ * oscillators measured by the clock sources (stats.h).
+ */
+static inline uint64_t raspd_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define NS_PER_US   1000ULL
+#define NS_PER_MS   1000000ULL
+
+#endif /* __CLOCK_H__ */
@@ -113,7 +113,17 @@ function devicetree_init(dt)
         elseif k == "softpwm" and type(v) == "table" then
 
             -- XXX: softpwm initialized by devtree
-            lr.softpwm_init(v.cycle_time, v.step_time)
+            local step_ns = v.step_time_ns or (v.step_time or 5) * 1000
+            local engine = v.engine
+
+            -- digital ESCs: one frame per control step, the throttles
+            -- stay in steps of the equivalent PWM pulse
+            if type(v.esc) == "table" and v.esc.protocol and v.esc.protocol ~= "pwm" then
+                engine = v.esc.protocol
+                step_ns = (v.step_time or 5) * 1000
+            end
+            lr.softpwm_init(v.cycle_time, v.step_time, engine, step_ns,
+                    v.dma_channel, v.pacer)
 
             for class, devlist in pairs(v) do
                 if class == "esc" and type(devlist) == "table" then
@@ -126,7 +136,7 @@ function devicetree_init(dt)
 
                             -- set throttle
                             lr.softpwm_set_data(d.pin,
-                                    devlist.min_throttle_time / v.step_time)
+                                    devlist.min_throttle_time * 1000 / step_ns)
 
                             -- use pin as dev pointer
                             register_device(d.pin, name)
@@ -137,7 +147,10 @@ function devicetree_init(dt)
         elseif k == "i2c" and type(v) == "table" then
 
             -- XXX: i2c initialized by devtree
-            lr.i2c_init(v.divider)
+            local err = lr.i2c_init(v.divider, v.dev)
+            if err < 0 then
+                io.stderr:write("i2c_init(" .. v.dev .. ") error " .. err .. "\n")
+            end
 
             for class, devlist in pairs(v) do
                 if class == "imu" and type(devlist) == "table" then
@@ -147,7 +160,7 @@ function devicetree_init(dt)
                         request_gpio(d, d.pin_int)
 
                         -- init mpu
-                        err = lr.invmpu_init(d.pin_int, d.sample_rate)
+                        err = lr.invmpu_init(d.pin_int, d.sample_rate, d.mpl_div, d.fusion)
                         if err < 0 then
                             io.stderr:write("invmpu_init() error\n")
                         end
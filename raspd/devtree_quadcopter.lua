@@ -18,7 +18,24 @@ devroot = {
         cycle_time = 2500,  -- 2500 us
         step_time = 5,      -- 5 us
 
+        -- "sample": two DMA control blocks per step
+        -- "edge":   control blocks at the edges only, the step can be
+        --           set in ns (multiple of 100) with step_time_ns
+        -- XXX: the quadcopter throttles are in 5 us steps
+        engine = "sample",
+        --step_time_ns = 500,
+
+        -- DMA channel and the FIFO pacing it: "pwm", or "pcm" to leave
+        -- the PWM to pwm / l298n (steps of 0.8 - 102.4 us, no ESC frames)
+        dma_channel = 5,
+        pacer = "pwm",
+
         esc = {
+            -- "pwm" (the engine above), "oneshot125", "multishot",
+            -- "dshot150", "dshot300", "dshot600": one frame per
+            -- control step on every pin of the softpwm
+            protocol = "pwm",
+
             min_throttle_time = 1000,   -- 1ms
             max_throttle_time = 2000,   -- 2ms
 
@@ -32,6 +49,9 @@ devroot = {
     i2c = {
         -- XXX: must be it
         divider = 313,
+        -- "/dev/i2c-1": through the kernel driver and raspd/i2cq.c,
+        -- nil: the BSC polled by libbcm2835
+        dev = nil,
 
         imu = {
             -- mpu6050, mpu9250
@@ -40,6 +60,13 @@ devroot = {
                 -- XXX: must be it
                 sample_rate = 20,
                 sample_rate_final = 200,    -- FIXME
+                -- > 0: DMP quaternion straight to the controller,
+                -- the MPL gets one sample in mpl_div for the biases
+                mpl_div = 0,
+                -- "mahony", "madgwick", "mahony-fixed": no DMP, no MPL,
+                -- the raw FIFO through raspd/fusion.c at sample_rate
+                -- (up to 1000)
+                fusion = nil,
             }
         },
 
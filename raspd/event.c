@@ -51,9 +51,21 @@ int register_signal(int signum, event_callback_fn cb, void *opaque)
                                 NULL, cb, opaque, NULL);
 }
 
+static __thread int in_loop;
+
 int rasp_event_loop(void)
 {
-    return event_base_dispatch(evbase);
+    int err;
+
+    in_loop = 1;
+    err = event_base_dispatch(evbase);
+    in_loop = 0;
+    return err;
+}
+
+int rasp_event_in_loop(void)
+{
+    return in_loop;
 }
 
 int rasp_event_loopexit(void)
@@ -78,12 +90,15 @@ void rasp_event_exit(void)
         event_base_free(evbase);
 }
 
-int sched_realtime(void)
+/*
+ * priority <= 0: the maximum
+ */
+int sched_realtime(int priority)
 {
 	struct sched_param sp;
 	int err = 0;
 	memset(&sp, 0, sizeof(sp));
-	sp.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	sp.sched_priority = priority > 0 ? priority : sched_get_priority_max(SCHED_FIFO);
 	if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
 		err = -EPERM;
 	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
@@ -17,10 +17,12 @@ int register_timer(short flags, struct timeval *timeout,
 
 int register_signal(int signum, event_callback_fn cb, void *opaque);
 int rasp_event_loop(void);
+/* non zero on the thread running rasp_event_loop(), while it runs */
+int rasp_event_in_loop(void);
 int rasp_event_loopexit(void);
 int rasp_event_init(void);
 void rasp_event_exit(void);
 
-int sched_realtime(void);
+int sched_realtime(int priority);
 
 #endif /* __EVENT_H__ */
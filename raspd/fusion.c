@@ -0,0 +1,399 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "fusion.h"
+
+#define DEG2RAD     ((float)M_PI / 180)
+
+static const char *names[NR_FUSIONS] = {
+    "mahony",
+    "madgwick",
+    "mahony-fixed",
+};
+
+int fusion_algo(const char *name)
+{
+    int i;
+
+    for (i = 0; i < NR_FUSIONS; i++) {
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    }
+    return -EINVAL;
+}
+
+const char *fusion_name(int algo)
+{
+    return algo >= 0 && algo < NR_FUSIONS ? names[algo] : "unknown";
+}
+
+static inline float inv_sqrt(float x)
+{
+    return 1 / sqrtf(x);
+}
+
+static void normalize(float v[], int n)
+{
+    float norm = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        norm += v[i] * v[i];
+    if (norm == 0)
+        return;
+    norm = inv_sqrt(norm);
+    for (i = 0; i < n; i++)
+        v[i] *= norm;
+}
+
+/*
+ * float
+ */
+static void integrate(float q[], float gx, float gy, float gz, float dt)
+{
+    float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+
+    gx *= 0.5f * dt;
+    gy *= 0.5f * dt;
+    gz *= 0.5f * dt;
+    q[0] += -q1 * gx - q2 * gy - q3 * gz;
+    q[1] +=  q0 * gx + q2 * gz - q3 * gy;
+    q[2] +=  q0 * gy - q1 * gz + q3 * gx;
+    q[3] +=  q0 * gz + q1 * gy - q2 * gx;
+    normalize(q, 4);
+}
+
+static void mahony_update(struct fusion *f, float g[], float a[],
+                float *m, float dt)
+{
+    float q0 = f->q[0], q1 = f->q[1], q2 = f->q[2], q3 = f->q[3];
+    float vx, vy, vz, ex, ey, ez;
+
+    if (a[0] == 0 && a[1] == 0 && a[2] == 0) {
+        integrate(f->q, g[0], g[1], g[2], dt);
+        return;
+    }
+    normalize(a, 3);
+
+    /* gravity as the estimate sees it, body frame */
+    vx = 2 * (q1 * q3 - q0 * q2);
+    vy = 2 * (q0 * q1 + q2 * q3);
+    vz = q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3;
+    ex = a[1] * vz - a[2] * vy;
+    ey = a[2] * vx - a[0] * vz;
+    ez = a[0] * vy - a[1] * vx;
+
+    if (m) {
+        float hx, hy, bx, bz, wx, wy, wz;
+
+        normalize(m, 3);
+        /* the measured flux in earth frame, north turned onto x */
+        hx = 2 * (m[0] * (0.5f - q2 * q2 - q3 * q3) + m[1] * (q1 * q2 - q0 * q3)
+                + m[2] * (q1 * q3 + q0 * q2));
+        hy = 2 * (m[0] * (q1 * q2 + q0 * q3) + m[1] * (0.5f - q1 * q1 - q3 * q3)
+                + m[2] * (q2 * q3 - q0 * q1));
+        bx = sqrtf(hx * hx + hy * hy);
+        bz = 2 * (m[0] * (q1 * q3 - q0 * q2) + m[1] * (q2 * q3 + q0 * q1)
+                + m[2] * (0.5f - q1 * q1 - q2 * q2));
+        /* and back in body frame */
+        wx = 2 * (bx * (0.5f - q2 * q2 - q3 * q3) + bz * (q1 * q3 - q0 * q2));
+        wy = 2 * (bx * (q1 * q2 - q0 * q3) + bz * (q0 * q1 + q2 * q3));
+        wz = 2 * (bx * (q0 * q2 + q1 * q3) + bz * (0.5f - q1 * q1 - q2 * q2));
+        ex += m[1] * wz - m[2] * wy;
+        ey += m[2] * wx - m[0] * wz;
+        ez += m[0] * wy - m[1] * wx;
+    }
+
+    if (f->ki > 0) {
+        f->integral[0] += f->ki * ex * dt;
+        f->integral[1] += f->ki * ey * dt;
+        f->integral[2] += f->ki * ez * dt;
+    }
+    integrate(f->q, g[0] + f->kp * ex + f->integral[0],
+                    g[1] + f->kp * ey + f->integral[1],
+                    g[2] + f->kp * ez + f->integral[2], dt);
+}
+
+/* the gradient of the gravity error */
+static void madgwick_gravity(const float q[], const float a[], float s[])
+{
+    float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    float q1q1 = q1 * q1, q2q2 = q2 * q2;
+
+    s[0] = 4 * q0 * q2q2 + 2 * q2 * a[0] + 4 * q0 * q1q1 - 2 * q1 * a[1];
+    s[1] = 4 * q1 * q3 * q3 - 2 * q3 * a[0] + 4 * q0 * q0 * q1 - 2 * q0 * a[1]
+        - 4 * q1 + 8 * q1 * q1q1 + 8 * q1 * q2q2 + 4 * q1 * a[2];
+    s[2] = 4 * q0 * q0 * q2 + 2 * q0 * a[0] + 4 * q2 * q3 * q3 - 2 * q3 * a[1]
+        - 4 * q2 + 8 * q2 * q1q1 + 8 * q2 * q2q2 + 4 * q2 * a[2];
+    s[3] = 4 * q1q1 * q3 - 2 * q1 * a[0] + 4 * q2q2 * q3 - 2 * q2 * a[1];
+}
+
+/* the gradient of the gravity and the flux errors */
+static void madgwick_marg(const float q[], const float a[], const float m[],
+                float s[])
+{
+    float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    float q0q0 = q0 * q0, q0q1 = q0 * q1, q0q2 = q0 * q2, q0q3 = q0 * q3;
+    float q1q1 = q1 * q1, q1q2 = q1 * q2, q1q3 = q1 * q3;
+    float q2q2 = q2 * q2, q2q3 = q2 * q3, q3q3 = q3 * q3;
+    float hx, hy, bx2, bz2, bx4, bz4;
+    float fa0, fa1, fa2, fm0, fm1, fm2;
+
+    /* the measured flux in earth frame, north turned onto x */
+    hx = m[0] * q0q0 - 2 * q0 * m[1] * q3 + 2 * q0 * m[2] * q2 + m[0] * q1q1
+        + 2 * q1 * m[1] * q2 + 2 * q1 * m[2] * q3 - m[0] * q2q2 - m[0] * q3q3;
+    hy = 2 * q0 * m[0] * q3 + m[1] * q0q0 - 2 * q0 * m[2] * q1 + 2 * q1 * m[0] * q2
+        - m[1] * q1q1 + m[1] * q2q2 + 2 * q2 * m[2] * q3 - m[1] * q3q3;
+    bx2 = sqrtf(hx * hx + hy * hy);
+    bz2 = -2 * q0 * m[0] * q2 + 2 * q0 * m[1] * q1 + m[2] * q0q0 + 2 * q1 * m[0] * q3
+        - m[2] * q1q1 + 2 * q2 * m[1] * q3 - m[2] * q2q2 + m[2] * q3q3;
+    bx4 = 2 * bx2;
+    bz4 = 2 * bz2;
+
+    /* the errors, estimate - measure */
+    fa0 = 2 * q1q3 - 2 * q0q2 - a[0];
+    fa1 = 2 * q0q1 + 2 * q2q3 - a[1];
+    fa2 = 1 - 2 * q1q1 - 2 * q2q2 - a[2];
+    fm0 = bx2 * (0.5f - q2q2 - q3q3) + bz2 * (q1q3 - q0q2) - m[0];
+    fm1 = bx2 * (q1q2 - q0q3) + bz2 * (q0q1 + q2q3) - m[1];
+    fm2 = bx2 * (q0q2 + q1q3) + bz2 * (0.5f - q1q1 - q2q2) - m[2];
+
+    s[0] = -2 * q2 * fa0 + 2 * q1 * fa1
+        - bz2 * q2 * fm0 + (-bx2 * q3 + bz2 * q1) * fm1 + bx2 * q2 * fm2;
+    s[1] = 2 * q3 * fa0 + 2 * q0 * fa1 - 4 * q1 * fa2
+        + bz2 * q3 * fm0 + (bx2 * q2 + bz2 * q0) * fm1 + (bx2 * q3 - bz4 * q1) * fm2;
+    s[2] = -2 * q0 * fa0 + 2 * q3 * fa1 - 4 * q2 * fa2
+        + (-bx4 * q2 - bz2 * q0) * fm0 + (bx2 * q1 + bz2 * q3) * fm1
+        + (bx2 * q0 - bz4 * q2) * fm2;
+    s[3] = 2 * q1 * fa0 + 2 * q2 * fa1
+        + (-bx4 * q3 + bz2 * q1) * fm0 + (-bx2 * q0 + bz2 * q2) * fm1 + bx2 * q1 * fm2;
+}
+
+static void madgwick_update(struct fusion *f, float g[], float a[],
+                float *m, float dt)
+{
+    float *q = f->q;
+    float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    float qdot[4], s[4];
+    int i;
+
+    /* the rate of change from the gyro */
+    qdot[0] = 0.5f * (-q1 * g[0] - q2 * g[1] - q3 * g[2]);
+    qdot[1] = 0.5f * ( q0 * g[0] + q2 * g[2] - q3 * g[1]);
+    qdot[2] = 0.5f * ( q0 * g[1] - q1 * g[2] + q3 * g[0]);
+    qdot[3] = 0.5f * ( q0 * g[2] + q1 * g[1] - q2 * g[0]);
+
+    if (a[0] != 0 || a[1] != 0 || a[2] != 0) {
+        normalize(a, 3);
+        if (m && (m[0] != 0 || m[1] != 0 || m[2] != 0)) {
+            normalize(m, 3);
+            madgwick_marg(q, a, m, s);
+        } else {
+            madgwick_gravity(q, a, s);
+        }
+        normalize(s, 4);
+        for (i = 0; i < 4; i++)
+            qdot[i] -= f->beta * s[i];
+    }
+
+    for (i = 0; i < 4; i++)
+        q[i] += qdot[i] * dt;
+    normalize(q, 4);
+}
+
+/*
+ * fixed point Mahony, 6-axis
+ *
+ * quaternion and unit vectors in q30, rates in rad/s q24 (2000 dps is
+ * ~35 rad/s), products in 64 bit. the quaternion is renormalized with
+ * one Newton step, it is never far from 1.
+ */
+#define Q30         (1L << 30)
+#define DPS2RAD_Q30 18740330LL      /* pi / 180 << 30 */
+
+static inline int32_t mul30(int32_t a, int32_t b)
+{
+    return (int32_t)(((int64_t)a * b) >> 30);
+}
+
+static uint32_t isqrt64(uint64_t x)
+{
+    uint64_t r = 0, bit = 1ULL << 62;
+
+    while (bit > x)
+        bit >>= 2;
+    while (bit) {
+        if (x >= r + bit) {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)r;
+}
+
+static void mahony_fixed_update(struct fusion *f, const long gyro[],
+                const long accel[], uint32_t dt_us)
+{
+    int32_t *q = f->qx;
+    int32_t g[3], a[3], e[3], h[3], q0, q1, q2, q3;
+    int32_t vx, vy, vz;
+    int64_t norm, s;
+    int i;
+
+    if (dt_us != f->dt_us) {
+        f->dt_us = dt_us;
+        f->hdt = ((int64_t)dt_us << 31) / 1000000;
+    }
+
+    /* dps q16 -> rad/s q24 */
+    for (i = 0; i < 3; i++)
+        g[i] = (int32_t)(((int64_t)gyro[i] * DPS2RAD_Q30) >> 22);
+
+    norm = (int64_t)accel[0] * accel[0] + (int64_t)accel[1] * accel[1]
+        + (int64_t)accel[2] * accel[2];
+    if (norm) {
+        norm = isqrt64(norm);       /* q16 */
+        for (i = 0; i < 3; i++)
+            a[i] = (int32_t)(((int64_t)accel[i] << 30) / norm);
+
+        vx = 2 * (mul30(q[1], q[3]) - mul30(q[0], q[2]));
+        vy = 2 * (mul30(q[0], q[1]) + mul30(q[2], q[3]));
+        vz = mul30(q[0], q[0]) - mul30(q[1], q[1]) - mul30(q[2], q[2])
+            + mul30(q[3], q[3]);
+        e[0] = mul30(a[1], vz) - mul30(a[2], vy);
+        e[1] = mul30(a[2], vx) - mul30(a[0], vz);
+        e[2] = mul30(a[0], vy) - mul30(a[1], vx);
+
+        for (i = 0; i < 3; i++) {
+            /* q30 * q16 >> 22 = q24 */
+            if (f->kix) {
+                f->ix[i] += (int32_t)(((int64_t)e[i] * f->kix >> 22)
+                        * (int64_t)dt_us / 1000000);
+                g[i] += f->ix[i];
+            }
+            g[i] += (int32_t)((int64_t)e[i] * f->kpx >> 22);
+        }
+    }
+
+    /* half the angle this step, rad q30 */
+    for (i = 0; i < 3; i++)
+        h[i] = (int32_t)(((int64_t)g[i] * f->hdt) >> 26);
+
+    q0 = q[0]; q1 = q[1]; q2 = q[2]; q3 = q[3];
+    q[0] += mul30(-q1, h[0]) - mul30(q2, h[1]) - mul30(q3, h[2]);
+    q[1] += mul30(q0, h[0]) + mul30(q2, h[2]) - mul30(q3, h[1]);
+    q[2] += mul30(q0, h[1]) - mul30(q1, h[2]) + mul30(q3, h[0]);
+    q[3] += mul30(q0, h[2]) + mul30(q1, h[1]) - mul30(q2, h[0]);
+
+    /* 1 / sqrt(s) ~ (3 - s) / 2 near 1 */
+    s = 0;
+    for (i = 0; i < 4; i++)
+        s += (int64_t)q[i] * q[i];
+    s >>= 30;
+    s = (3 * Q30 - s) >> 1;
+    for (i = 0; i < 4; i++)
+        q[i] = (int32_t)(((int64_t)q[i] * s) >> 30);
+}
+
+/*
+ * interface
+ */
+void fusion_reset(struct fusion *f)
+{
+    memset(f->q, 0, sizeof(f->q));
+    memset(f->integral, 0, sizeof(f->integral));
+    memset(f->qx, 0, sizeof(f->qx));
+    memset(f->ix, 0, sizeof(f->ix));
+    f->q[0] = 1;
+    f->qx[0] = Q30;
+}
+
+struct fusion *fusion_new(int algo, float gain, float igain)
+{
+    struct fusion *f;
+
+    if (algo < 0 || algo >= NR_FUSIONS)
+        return NULL;
+    if ((f = malloc(sizeof(*f))) == NULL)
+        return NULL;
+    memset(f, 0, sizeof(*f));
+    f->algo = algo;
+    f->kp = f->beta = gain;
+    f->ki = igain;
+    f->kpx = (int32_t)(gain * 65536);
+    f->kix = (int32_t)(igain * 65536);
+    fusion_reset(f);
+    return f;
+}
+
+void fusion_del(struct fusion *f)
+{
+    free(f);
+}
+
+void fusion_update(struct fusion *f, const long gyro[3],
+                const long accel[3], const long compass[3], uint32_t dt_us)
+{
+    float g[3], a[3], m[3], dt;
+    int i;
+
+    if (f->algo == FUSION_MAHONY_FIXED) {
+        mahony_fixed_update(f, gyro, accel, dt_us);
+        return;
+    }
+
+    for (i = 0; i < 3; i++) {
+        g[i] = gyro[i] * (DEG2RAD / 65536);
+        a[i] = (float)accel[i];
+        if (compass)
+            m[i] = (float)compass[i];
+    }
+    dt = dt_us * 1e-6f;
+    if (f->algo == FUSION_MADGWICK)
+        madgwick_update(f, g, a, compass ? m : NULL, dt);
+    else
+        mahony_update(f, g, a, compass ? m : NULL, dt);
+}
+
+void fusion_get_quat(const struct fusion *f, long quat[4])
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        if (f->algo == FUSION_MAHONY_FIXED)
+            quat[i] = f->qx[i];
+        else
+            quat[i] = (long)(f->q[i] * Q30);
+    }
+}
+
+void fusion_get_euler(const struct fusion *f, float euler[3])
+{
+    float q[4], t1, t2, t3;
+    int i;
+
+    for (i = 0; i < 4; i++)
+        q[i] = f->algo == FUSION_MAHONY_FIXED ? (float)f->qx[i] / Q30 : f->q[i];
+
+    /* Y body axis in world frame: yaw, then pitch */
+    t1 = 2 * (q[1] * q[2] - q[0] * q[3]);
+    t2 = 2 * (q[2] * q[2] + q[0] * q[0]) - 1;
+    t3 = 2 * (q[2] * q[3] + q[0] * q[1]);
+    euler[2] = -atan2f(t1, t2) / DEG2RAD;
+    euler[0] = atan2f(t3, sqrtf(t1 * t1 + t2 * t2)) / DEG2RAD;
+    if (2 * (q[3] * q[3] + q[0] * q[0]) - 1 < 0)
+        euler[0] = (euler[0] >= 0 ? 180 : -180) - euler[0];
+
+    /* Z body axis against the X-Z plane: roll */
+    euler[1] = atan2f(2 * (q[3] * q[3] + q[0] * q[0]) - 1,
+                    2 * (q[1] * q[3] - q[0] * q[2])) / DEG2RAD - 90;
+    if (euler[1] >= 90)
+        euler[1] = 180 - euler[1];
+    if (euler[1] < -90)
+        euler[1] = -180 - euler[1];
+}
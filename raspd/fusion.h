@@ -0,0 +1,63 @@
+#ifndef __FUSION_H__
+#define __FUSION_H__
+
+#include <stdint.h>
+
+/*
+ * attitude from raw gyro and accel (and compass), without the DMP
+ * and the MPL
+ *
+ * Mahony: a PI controller turns the angle between the measured and the
+ * estimated gravity (and north) into a gyro correction. Madgwick: one
+ * gradient descent step towards them per sample, beta weighs it against
+ * the gyro. both in float, Mahony also in fixed point (6-axis only),
+ * for when the FPU is the bottleneck.
+ *
+ * inputs are in the units of the data ready callback, body frame: gyro
+ * dps q16, accel g q16, compass any scale (normalized), NULL for none.
+ * the quaternion is q30, w x y z, as the DMP gives it.
+ */
+
+enum {
+    FUSION_MAHONY,
+    FUSION_MADGWICK,
+    FUSION_MAHONY_FIXED,
+    NR_FUSIONS
+};
+
+#define FUSION_DEFAULT_KP       1.0f
+#define FUSION_DEFAULT_KI       0.05f
+#define FUSION_DEFAULT_BETA     0.1f
+
+struct fusion {
+    int algo;
+    float kp, ki;           /* Mahony */
+    float beta;             /* Madgwick */
+    float q[4];
+    float integral[3];      /* rad/s */
+
+    /* fixed point */
+    int32_t qx[4];          /* q30 */
+    int32_t ix[3];          /* integral, rad/s q24 */
+    int32_t kpx, kix;       /* q16 */
+    uint32_t dt_us;         /* hdt is for this dt */
+    int64_t hdt;            /* dt / 2, s q32 */
+};
+
+/* gain: kp or beta, igain: ki (Mahony) */
+struct fusion *fusion_new(int algo, float gain, float igain);
+void fusion_del(struct fusion *f);
+void fusion_reset(struct fusion *f);
+
+void fusion_update(struct fusion *f, const long gyro[3],
+                const long accel[3], const long compass[3], uint32_t dt_us);
+
+void fusion_get_quat(const struct fusion *f, long quat[4]);
+/* pitch, roll, yaw in degrees, the convention of quadcopter.c */
+void fusion_get_euler(const struct fusion *f, float euler[3]);
+
+/* "mahony", "madgwick", "mahony-fixed" */
+int fusion_algo(const char *name);
+const char *fusion_name(int algo);
+
+#endif /* __FUSION_H__ */
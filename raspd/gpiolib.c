@@ -8,6 +8,9 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
 #include <event2/event.h>
 
 #include <xmalloc.h>
@@ -15,6 +18,7 @@
 #include <bcm2835.h>
 #include <sock.h>
 
+#include "clock.h"
 #include "module.h"
 #include "gpiolib.h"
 #include "event.h"
@@ -36,6 +40,21 @@ static char *edge_str[4] = {
 
 static int fd_export = -1;
 static int fd_unexport = -1;
+static int fd_chip = -1;        /* character device backend if open */
+
+#define NR_GPIOCHIPS        16
+#define CDEV_EVENT_BUFFER   64  /* edges the kernel queues per line */
+
+struct gpio_irq {
+    unsigned int pin;
+    int fd;
+    int cdev;               /* line request, else sysfs value */
+    uint32_t seqno;         /* last line_seqno */
+    unsigned long missed;
+    gpio_edge_fn fn;
+    void *opaque;
+    struct event *ev;
+};
 
 static int gpio_sysfs_open(unsigned int gpio, const char *file)
 {
@@ -172,47 +191,250 @@ int bcm2835_gpio_poll(unsigned int pin,
     return err;
 }
 
+/*
+ * export pin as an interrupt source, the returned fd signals
+ * POLLPRI on every edge, see bcm2835_gpio_irq_ack()
+ */
+int bcm2835_gpio_irqfd(unsigned int pin, enum trigger_edge edge)
+{
+    char buf[8];
+    int fd;
+    int err;
+
+    if ((err = gpio_export(pin)) < 0)
+        return err;
+    bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_INPT);
+    if ((err = gpio_set_edge(pin, edge)) < 0)
+        return err;
+    if ((fd = open_value(pin)) < 0)
+        return -EIO;
+
+    /* FIXME  unblock it ? */
+    unblock_socket(fd);
+    /*
+     * FIXME  need ?
+     */
+    if (read(fd, buf, sizeof(buf)) < 0) {
+        close(fd);
+        return -EPERM;
+    }
+    return fd;
+}
+
+/*
+ * re-arm the interrupt after poll(), not needed with EV_ET
+ */
+void bcm2835_gpio_irq_ack(int fd)
+{
+    char buf[8];
+
+    lseek(fd, 0, SEEK_SET);
+    read(fd, buf, sizeof(buf));
+}
+
 int bcm2835_gpio_signal(unsigned int pin, enum trigger_edge edge,
                 event_callback_fn cb, void *opaque, struct event **ev)
 {
-    char buf[8];
     struct event *evt;
     int fd;
     int err;
 
-    do {
-        if ((err = gpio_export(pin)) < 0)
-            break;
-        bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_INPT);
-        if ((err = gpio_set_edge(pin, edge)) < 0)
-            break;
-        err = -EIO;
-        if ((fd = open_value(pin)) < 0)
-            break;
+    if ((fd = bcm2835_gpio_irqfd(pin, edge)) < 0)
+        return fd;
 
-        /* FIXME  unblock it ? */
-        unblock_socket(fd);
-        /*
-         * FIXME  need ?
-         */
-        err = -EPERM;
-        if (read(fd, buf, sizeof(buf)) < 0)
-            break;
+    err = eventfd_add(fd, EV_PRI | EV_ET | EV_PERSIST,
+                                NULL, cb, opaque, &evt);
+    if (err < 0) {
+        close(fd);
+        return err;
+    }
 
-        err = eventfd_add(fd, EV_PRI | EV_ET | EV_PERSIST,
-                                    NULL, cb, opaque, &evt);
-        if (err < 0) {
-            close(fd);
-            break;
-        }
+    if (ev)
+        *ev = evt;
+    return 0;
+}
 
-        if (ev)
-            *ev = evt;
+/*
+ * character device backend
+ */
+static int cdev_request(unsigned int pin, enum trigger_edge edge)
+{
+    struct gpio_v2_line_request req;
+
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = pin;
+    req.num_lines = 1;
+    req.event_buffer_size = CDEV_EVENT_BUFFER;
+    strncpy(req.consumer, "raspd", sizeof(req.consumer) - 1);
+    /* the kernel timestamps on CLOCK_MONOTONIC by default */
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+    if (edge == EDGE_rising || edge == EDGE_both)
+        req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+    if (edge == EDGE_falling || edge == EDGE_both)
+        req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+    if (ioctl(fd_chip, GPIO_V2_GET_LINE_IOCTL, &req) < 0)
+        return -errno;
+    unblock_fd(req.fd);
+    return req.fd;
+}
 
-        err = 0;
-    } while (0);
+static int cdev_read(struct gpio_irq *irq, struct gpio_edge *edges, int max)
+{
+    struct gpio_v2_line_event events[GPIO_IRQ_BATCH];
+    ssize_t len;
+    int i, nr;
+
+    if (max > GPIO_IRQ_BATCH)
+        max = GPIO_IRQ_BATCH;
+    len = read(irq->fd, events, max * sizeof(events[0]));
+    if (len < 0)
+        return errno == EAGAIN ? 0 : -errno;
+
+    nr = len / sizeof(events[0]);
+    for (i = 0; i < nr; i++) {
+        edges[i].time_ns = events[i].timestamp_ns;
+        edges[i].level = events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+        /* line_seqno starts at 1, a gap is what the kernel dropped */
+        irq->missed += events[i].line_seqno - irq->seqno - 1;
+        irq->seqno = events[i].line_seqno;
+    }
+    return nr;
+}
 
-    return err;
+static int sysfs_read(struct gpio_irq *irq, struct gpio_edge *edges)
+{
+    bcm2835_gpio_irq_ack(irq->fd);
+    edges[0].time_ns = raspd_now_ns();
+    edges[0].level = (int)bcm2835_gpio_lev(irq->pin);
+    return 1;
+}
+
+int gpio_irq_request(unsigned int pin, enum trigger_edge edge,
+                struct gpio_irq **irqp)
+{
+    struct gpio_irq *irq;
+    int fd;
+
+    if (pin >= NR_GPIOS)
+        return -ERANGE;
+    if (fd_chip >= 0)
+        fd = cdev_request(pin, edge);
+    else
+        fd = bcm2835_gpio_irqfd(pin, edge);
+    if (fd < 0)
+        return fd;
+
+    irq = xmalloc(sizeof(*irq));
+    memset(irq, 0, sizeof(*irq));
+    irq->pin = pin;
+    irq->fd = fd;
+    irq->cdev = fd_chip >= 0;
+    *irqp = irq;
+    return 0;
+}
+
+int gpio_irq_fd(const struct gpio_irq *irq)
+{
+    return irq->fd;
+}
+
+short gpio_irq_events(const struct gpio_irq *irq)
+{
+    return irq->cdev ? POLLIN : POLLPRI;
+}
+
+/*
+ * the queued edges, 0 if none. sysfs has only the one that woke
+ * the poll, and re-arms it
+ */
+int gpio_irq_read(struct gpio_irq *irq, struct gpio_edge *edges, int max)
+{
+    if (max <= 0)
+        return -EINVAL;
+    if (irq->cdev)
+        return cdev_read(irq, edges, max);
+    return sysfs_read(irq, edges);
+}
+
+unsigned long gpio_irq_missed(const struct gpio_irq *irq)
+{
+    return irq->missed;
+}
+
+void gpio_irq_free(struct gpio_irq *irq)
+{
+    if (irq->ev)
+        eventfd_del(irq->ev);
+    close(irq->fd);
+    free(irq);
+}
+
+/* one read per callback, the fd stays readable while edges are queued */
+static void irq_signal(int fd, short what, void *arg)
+{
+    struct gpio_irq *irq = arg;
+    struct gpio_edge edges[GPIO_IRQ_BATCH];
+    int nr;
+
+    if ((nr = gpio_irq_read(irq, edges, GPIO_IRQ_BATCH)) > 0)
+        irq->fn(irq->pin, edges, nr, irq->opaque);
+}
+
+int gpio_irq_signal(unsigned int pin, enum trigger_edge edge,
+                gpio_edge_fn fn, void *opaque, struct gpio_irq **irqp)
+{
+    struct gpio_irq *irq;
+    short flags;
+    int err;
+
+    if ((err = gpio_irq_request(pin, edge, &irq)) < 0)
+        return err;
+    irq->fn = fn;
+    irq->opaque = opaque;
+
+    flags = irq->cdev ? EV_READ | EV_PERSIST : EV_PRI | EV_ET | EV_PERSIST;
+    err = eventfd_add(irq->fd, flags, NULL, irq_signal, irq, &irq->ev);
+    if (err < 0) {
+        gpio_irq_free(irq);
+        return err;
+    }
+
+    if (irqp)
+        *irqp = irq;
+    return 0;
+}
+
+static int open_chip(const char *path, struct gpiochip_info *info)
+{
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CLOEXEC)) < 0)
+        return -errno;
+    if (ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, info) < 0) {
+        close(fd);
+        return -ENOTTY;
+    }
+    return fd;
+}
+
+/* the chip of the SoC pins, lines are the BCM numbers */
+static int find_chip(void)
+{
+    struct gpiochip_info info;
+    char path[32];
+    int i, fd;
+
+    for (i = 0; i < NR_GPIOCHIPS; i++) {
+        snprintf(path, sizeof(path), "/dev/gpiochip%d", i);
+        if ((fd = open_chip(path, &info)) < 0)
+            continue;
+        if (strcmp(info.label, "pinctrl-bcm2835") == 0
+                || strcmp(info.label, "pinctrl-bcm2711") == 0)
+            return fd;
+        close(fd);
+    }
+    return -ENODEV;
 }
 
 static int get_gpio_base(void)
@@ -249,16 +471,43 @@ static int get_gpio_base(void)
 
 void gpiolib_init(void)
 {
+    int fd;
+
+    if ((fd = find_chip()) >= 0)
+        fd_chip = fd;
+
+    /* bcm2835_gpio_signal() and friends are sysfs only */
     fd_export = open(SYSFS_GPIO_DIR "export", O_WRONLY);
     fd_unexport = open(SYSFS_GPIO_DIR "unexport", O_WRONLY);
-    if (fd_export == -1 || fd_unexport == -1)
+    if ((fd_export == -1 || fd_unexport == -1) && fd_chip < 0)
         perror("open (un)export");
-    if (get_gpio_base() < 0)
+    if (get_gpio_base() < 0 && fd_chip < 0)
         perror("get_gpio_base()");
 }
 
+/*
+ * gpio-sim or gpio-mockup on a box without the bcm2835, nothing but
+ * gpio_irq_*() then
+ */
+int gpiolib_init_chip(const char *path)
+{
+    struct gpiochip_info info;
+    int fd;
+
+    if ((fd = open_chip(path, &info)) < 0)
+        return fd;
+    if (fd_chip >= 0)
+        close(fd_chip);
+    fd_chip = fd;
+    return 0;
+}
+
 void gpiolib_exit(void)
 {
+    if (fd_chip != -1) {
+        close(fd_chip);
+        fd_chip = -1;
+    }
     if (fd_export != -1)
         close(fd_export);
     if (fd_unexport != -1)
@@ -1,6 +1,7 @@
 #ifndef __GPIO_INT_H__
 #define __GPIO_INT_H__
 
+#include <stdint.h>
 #include <event2/event.h>
 
 enum trigger_edge {
@@ -13,10 +14,56 @@ enum trigger_edge {
 int bcm2835_gpio_poll(unsigned int pin,
         enum trigger_edge edge, int timeout, int *valuep);
 
+int bcm2835_gpio_irqfd(unsigned int pin, enum trigger_edge edge);
+void bcm2835_gpio_irq_ack(int fd);
+
 int bcm2835_gpio_signal(unsigned int pin, enum trigger_edge edge,
                 event_callback_fn cb, void *opaque, struct event **ev);
 
+/*
+ * pin interrupts with the time and the level of every edge
+ *
+ * two backends. the GPIO character device: a line request with edge
+ * detection, the kernel timestamps every edge and queues them, one
+ * read() gets all of the queued ones. sysfs: one edge per POLLPRI, the
+ * level is read back from GPLEV and the time taken when the handler
+ * runs, edges in between are lost. gpiolib_init() takes the character
+ * device of the bcm2835 if there is one.
+ */
+struct gpio_edge {
+    uint64_t time_ns;       /* CLOCK_MONOTONIC */
+    int level;              /* after the edge */
+};
+
+#define GPIO_IRQ_BATCH  16
+
+struct gpio_irq;
+
+/* edges queued since the last call, oldest first */
+typedef void (*gpio_edge_fn)(unsigned int pin,
+                const struct gpio_edge *edges, int nr, void *opaque);
+
+/*
+ * without the event loop: poll gpio_irq_fd() for gpio_irq_events(),
+ * POLLIN on a line request, POLLPRI alone on a sysfs value fd (it
+ * polls readable all the time), gpio_irq_read() re-arms the latter
+ */
+int gpio_irq_request(unsigned int pin, enum trigger_edge edge,
+                struct gpio_irq **irqp);
+int gpio_irq_fd(const struct gpio_irq *irq);
+short gpio_irq_events(const struct gpio_irq *irq);
+int gpio_irq_read(struct gpio_irq *irq, struct gpio_edge *edges, int max);
+/* edges dropped by the kernel, the queue was full */
+unsigned long gpio_irq_missed(const struct gpio_irq *irq);
+void gpio_irq_free(struct gpio_irq *irq);
+
+/* in the event loop, fn may free the irq */
+int gpio_irq_signal(unsigned int pin, enum trigger_edge edge,
+                gpio_edge_fn fn, void *opaque, struct gpio_irq **irqp);
+
 void gpiolib_init(void);
+/* the character device backend on the given chip, lines are pins */
+int gpiolib_init_chip(const char *path);
 void gpiolib_exit(void);
 
 #endif /* __GPIO_INT_H__ */
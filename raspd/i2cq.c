@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "event.h"
+#include "i2cq.h"
+
+struct i2cq {
+    int fd;                         /* /dev/i2c-N, -1 for the mock bus */
+    struct i2c_mock_dev *devs;
+
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            /* pending, or a blocking transfer done */
+    int stop;
+
+    /* FIFO, head out */
+    struct i2cq_xfer *pending, **pending_tail;
+    struct i2cq_xfer *done, **done_tail;
+    unsigned long depth;
+
+    int wakefd;
+    struct event *ev;
+
+    struct i2cq_stats stats;
+};
+
+static int dev_xfer(struct i2cq *q, struct i2cq_xfer *x)
+{
+    struct i2c_msg msgs[2];
+    struct i2c_rdwr_ioctl_data rdwr = { msgs, 0 };
+
+    if (x->wlen) {
+        msgs[rdwr.nmsgs].addr = x->addr;
+        msgs[rdwr.nmsgs].flags = 0;
+        msgs[rdwr.nmsgs].len = x->wlen;
+        msgs[rdwr.nmsgs].buf = (uint8_t *)x->wbuf;
+        rdwr.nmsgs++;
+    }
+    if (x->rlen) {
+        msgs[rdwr.nmsgs].addr = x->addr;
+        msgs[rdwr.nmsgs].flags = I2C_M_RD;
+        msgs[rdwr.nmsgs].len = x->rlen;
+        msgs[rdwr.nmsgs].buf = x->rbuf;
+        rdwr.nmsgs++;
+    }
+    if (ioctl(q->fd, I2C_RDWR, &rdwr) < 0)
+        return -errno;
+    return 0;
+}
+
+/*
+ * the list under the lock, i2cq_mock_add() may run meanwhile. the
+ * devices stay until i2cq_del()
+ */
+static int mock_xfer(struct i2cq *q, struct i2cq_xfer *x)
+{
+    struct i2c_mock_dev *dev;
+
+    pthread_mutex_lock(&q->lock);
+    for (dev = q->devs; dev; dev = dev->next) {
+        if (dev->addr == x->addr)
+            break;
+    }
+    pthread_mutex_unlock(&q->lock);
+    if (dev == NULL)
+        return -ENXIO;
+    return dev->xfer(dev, x->wbuf, x->wlen, x->rbuf, x->rlen);
+}
+
+static void *worker(void *opaque)
+{
+    struct i2cq *q = opaque;
+    struct i2cq_xfer *x;
+    uint64_t v = 1;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (q->pending == NULL && !q->stop)
+            pthread_cond_wait(&q->cond, &q->lock);
+        if (q->pending == NULL)
+            break;
+        x = q->pending;
+        if ((q->pending = x->next) == NULL)
+            q->pending_tail = &q->pending;
+        q->depth--;
+        pthread_mutex_unlock(&q->lock);
+
+        x->status = q->fd >= 0 ? dev_xfer(q, x) : mock_xfer(q, x);
+
+        pthread_mutex_lock(&q->lock);
+        q->stats.completed++;
+        if (x->status < 0)
+            q->stats.errors++;
+        if (x->done == NULL) {
+            /* i2cq_transfer() */
+            x->finished = 1;
+            pthread_cond_broadcast(&q->cond);
+            continue;
+        }
+        x->next = NULL;
+        *q->done_tail = x;
+        q->done_tail = &x->next;
+        write(q->wakefd, &v, sizeof(v));
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+int i2cq_poll(struct i2cq *q)
+{
+    struct i2cq_xfer *x, *next;
+    uint64_t v;
+    int nr = 0;
+
+    read(q->wakefd, &v, sizeof(v));
+
+    pthread_mutex_lock(&q->lock);
+    x = q->done;
+    q->done = NULL;
+    q->done_tail = &q->done;
+    pthread_mutex_unlock(&q->lock);
+
+    /* done may submit again or free x */
+    for (; x; x = next, nr++) {
+        next = x->next;
+        x->done(x, x->opaque);
+    }
+    return nr;
+}
+
+static void cb_done(evutil_socket_t fd, short what, void *opaque)
+{
+    i2cq_poll(opaque);
+}
+
+static struct i2cq *i2cq_new(int fd)
+{
+    struct i2cq *q;
+    int err;
+
+    q = calloc(1, sizeof(*q));
+    if (q == NULL)
+        return NULL;
+    q->fd = fd;
+    q->pending_tail = &q->pending;
+    q->done_tail = &q->done;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+
+    if ((q->wakefd = eventfd(0, EFD_NONBLOCK)) < 0)
+        goto err_free;
+    /* without a loop, the completions run from i2cq_poll() */
+    if (evbase) {
+        err = eventfd_add(q->wakefd, EV_READ | EV_PERSIST, NULL, cb_done, q, &q->ev);
+        if (err < 0) {
+            errno = -err;
+            goto err_close;
+        }
+    }
+    if ((err = pthread_create(&q->worker, NULL, worker, q)) != 0) {
+        errno = err;
+        goto err_event;
+    }
+    return q;
+
+err_event:
+    eventfd_del(q->ev);
+err_close:
+    close(q->wakefd);
+err_free:
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+    return NULL;
+}
+
+struct i2cq *i2cq_open(const char *path)
+{
+    struct i2cq *q;
+    unsigned long funcs;
+    int fd, err;
+
+    if ((fd = open(path, O_RDWR)) < 0)
+        return NULL;
+    err = ioctl(fd, I2C_FUNCS, &funcs) < 0 ? errno : 0;
+    if (err == 0 && !(funcs & I2C_FUNC_I2C))
+        err = EOPNOTSUPP;
+    if (err) {
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    if ((q = i2cq_new(fd)) == NULL) {
+        err = errno;
+        close(fd);
+        errno = err;
+    }
+    return q;
+}
+
+struct i2cq *i2cq_new_mock(void)
+{
+    return i2cq_new(-1);
+}
+
+/* the pending transfers run first */
+void i2cq_del(struct i2cq *q)
+{
+    if (q == NULL)
+        return;
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->worker, NULL);
+
+    eventfd_del(q->ev);
+    close(q->wakefd);
+    if (q->fd >= 0)
+        close(q->fd);
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+}
+
+int i2cq_mock_add(struct i2cq *q, struct i2c_mock_dev *dev)
+{
+    struct i2c_mock_dev *d;
+
+    if (q->fd >= 0)
+        return -EINVAL;
+    pthread_mutex_lock(&q->lock);
+    for (d = q->devs; d; d = d->next) {
+        if (d->addr == dev->addr) {
+            pthread_mutex_unlock(&q->lock);
+            return -EEXIST;
+        }
+    }
+    dev->next = q->devs;
+    q->devs = dev;
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+static int queue(struct i2cq *q, struct i2cq_xfer *x)
+{
+    if ((x->wlen == 0 && x->rlen == 0) || x->wlen > I2CQ_MAX_MSG
+            || x->rlen > I2CQ_MAX_MSG)
+        return -EINVAL;
+
+    x->next = NULL;
+    x->finished = 0;
+    x->status = -EINPROGRESS;
+
+    pthread_mutex_lock(&q->lock);
+    *q->pending_tail = x;
+    q->pending_tail = &x->next;
+    if (++q->depth > q->stats.max_depth)
+        q->stats.max_depth = q->depth;
+    q->stats.submitted++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+int i2cq_submit(struct i2cq *q, struct i2cq_xfer *x)
+{
+    if (x->done == NULL)
+        return -EINVAL;
+    return queue(q, x);
+}
+
+int i2cq_transfer(struct i2cq *q, uint16_t addr, const uint8_t *wbuf,
+                int wlen, uint8_t *rbuf, int rlen)
+{
+    struct i2cq_xfer x = {
+        .addr = addr, .wlen = wlen, .rlen = rlen, .wbuf = wbuf, .rbuf = rbuf,
+    };
+    int err;
+
+    if (wlen < 0 || rlen < 0 || wlen > I2CQ_MAX_MSG || rlen > I2CQ_MAX_MSG)
+        return -EINVAL;
+    /* the loop would wait for the bus */
+    if (rasp_event_in_loop())
+        return -EWOULDBLOCK;
+    if ((err = queue(q, &x)) < 0)
+        return err;
+
+    pthread_mutex_lock(&q->lock);
+    while (!x.finished)
+        pthread_cond_wait(&q->cond, &q->lock);
+    pthread_mutex_unlock(&q->lock);
+    return x.status;
+}
+
+int i2cq_write_reg(struct i2cq *q, uint16_t addr, uint8_t reg,
+                const uint8_t *data, int len)
+{
+    uint8_t buffer[64], *buf = buffer;
+    int err;
+
+    if (len < 0 || len >= I2CQ_MAX_MSG)
+        return -EINVAL;
+    if (len >= (int)sizeof(buffer) && (buf = malloc(len + 1)) == NULL)
+        return -ENOMEM;
+    buf[0] = reg;
+    memcpy(&buf[1], data, len);
+    err = i2cq_transfer(q, addr, buf, len + 1, NULL, 0);
+    if (buf != buffer)
+        free(buf);
+    return err;
+}
+
+int i2cq_read_reg(struct i2cq *q, uint16_t addr, uint8_t reg,
+                uint8_t *data, int len)
+{
+    return i2cq_transfer(q, addr, &reg, 1, data, len);
+}
+
+void i2cq_get_stats(struct i2cq *q, struct i2cq_stats *st)
+{
+    pthread_mutex_lock(&q->lock);
+    *st = q->stats;
+    pthread_mutex_unlock(&q->lock);
+}
+
+/*
+ * register file
+ */
+static int regmap_xfer(struct i2c_mock_dev *dev, const uint8_t *wbuf, int wlen,
+                uint8_t *rbuf, int rlen)
+{
+    struct i2c_regmap_dev *rm = dev->priv;
+    int i;
+
+    if (wlen) {
+        rm->reg = wbuf[0];
+        for (i = 1; i < wlen; i++)
+            rm->regs[rm->reg++] = wbuf[i];
+    }
+    for (i = 0; i < rlen; i++)
+        rbuf[i] = rm->regs[rm->reg++];
+    return 0;
+}
+
+void i2c_regmap_init(struct i2c_regmap_dev *rm, uint16_t addr)
+{
+    memset(rm, 0, sizeof(*rm));
+    rm->dev.addr = addr;
+    rm->dev.xfer = regmap_xfer;
+    rm->dev.priv = rm;
+}
@@ -0,0 +1,98 @@
+#ifndef __I2CQ_H__
+#define __I2CQ_H__
+
+#include <stdint.h>
+
+/*
+ * I2C job queue: transfers are queued and run by a worker thread, one
+ * I2C_RDWR ioctl per transfer on /dev/i2c-N (write, read, or write then
+ * read with a repeated start). i2cq_submit() does not wait for the bus,
+ * the completions run in the event loop, in submit order, woken by an
+ * eventfd. the blocking calls wait on the worker, they are refused on
+ * the event loop while it runs: in raspd the MPU is set up through them
+ * before the loop starts, then read by the rt control thread.
+ *
+ * the mock bus runs the same queue against devices in memory, for the
+ * tests and for simulated sensors.
+ */
+
+#define I2CQ_MAX_MSG    8192
+
+struct i2cq;
+struct i2cq_xfer;
+
+typedef void (*i2cq_done_fn)(struct i2cq_xfer *x, void *opaque);
+
+/*
+ * owned by the caller until done runs. wlen 0: read only, rlen 0: write
+ * only. status: 0 or -errno.
+ */
+struct i2cq_xfer {
+    uint16_t addr;
+    uint16_t wlen, rlen;
+    const uint8_t *wbuf;
+    uint8_t *rbuf;
+    int status;
+
+    i2cq_done_fn done;
+    void *opaque;
+
+    /* private */
+    struct i2cq_xfer *next;
+    int finished;
+};
+
+/*
+ * a device on the mock bus: one call per transfer, a write part and
+ * a read part. -ENXIO for no ack. runs on the worker thread.
+ */
+struct i2c_mock_dev {
+    uint16_t addr;
+    int (*xfer)(struct i2c_mock_dev *dev, const uint8_t *wbuf, int wlen,
+                uint8_t *rbuf, int rlen);
+    void *priv;
+    struct i2c_mock_dev *next;
+};
+
+/* a register file: the first written byte is the register, reads and
+ * writes go on from there */
+struct i2c_regmap_dev {
+    struct i2c_mock_dev dev;
+    uint8_t reg;
+    uint8_t regs[256];
+};
+
+/* NULL with errno set on error */
+struct i2cq *i2cq_open(const char *path);
+struct i2cq *i2cq_new_mock(void);
+void i2cq_del(struct i2cq *q);
+
+int i2cq_mock_add(struct i2cq *q, struct i2c_mock_dev *dev);
+void i2c_regmap_init(struct i2c_regmap_dev *rm, uint16_t addr);
+
+/* done runs in the event loop, or in i2cq_poll() */
+int i2cq_submit(struct i2cq *q, struct i2cq_xfer *x);
+/* runs the completions pending, returns how many */
+int i2cq_poll(struct i2cq *q);
+
+/*
+ * blocks until the transfer is done, for the threads other than the
+ * event loop (the rt control thread, the eMPL driver). -EWOULDBLOCK
+ * on the event loop thread while it runs.
+ */
+int i2cq_transfer(struct i2cq *q, uint16_t addr, const uint8_t *wbuf,
+                int wlen, uint8_t *rbuf, int rlen);
+
+/* register write / read, the eMPL i2c_write / i2c_read */
+int i2cq_write_reg(struct i2cq *q, uint16_t addr, uint8_t reg,
+                const uint8_t *data, int len);
+int i2cq_read_reg(struct i2cq *q, uint16_t addr, uint8_t reg,
+                uint8_t *data, int len);
+
+struct i2cq_stats {
+    unsigned long submitted, completed, errors;
+    unsigned long max_depth;
+};
+void i2cq_get_stats(struct i2cq *q, struct i2cq_stats *st);
+
+#endif /* __I2CQ_H__ */
@@ -1,5 +1,7 @@
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include <event2/event.h>
 
 #include <inv_mpu.h>
@@ -13,6 +15,12 @@
 
 #include "event.h"
 #include "gpiolib.h"
+#include "rtctrl.h"
+#include "clock.h"
+#include "stats.h"
+#include "logger.h"
+#include "fusion.h"
+#include "i2cq.h"
 
 #include "inv_imu.h"
 
@@ -20,8 +28,8 @@
 /* Private typedef -----------------------------------------------------------*/
 #undef LOGE
 #undef LOGI
-#define LOGE(...)   fprintf(stderr, __VA_ARGS__)
-#define LOGI(...)   fprintf(stdout, __VA_ARGS__)
+#define LOGE(...)   rlog_err(__VA_ARGS__)
+#define LOGI(...)   rlog_info(__VA_ARGS__)
 
 /* Data read from MPL. */
 #define PRINT_PEDO      (0x80)
@@ -36,6 +44,12 @@
 #define PEDO_READ_MS    (1000)
 #define TEMP_READ_MS    (500)
 #define COMPASS_READ_MS (100)
+
+/* packets drained per interrupt, a full FIFO of the smallest packet */
+#define INVMPU_MAX_BATCH    (DMP_FIFO_SIZE / 16)
+/* without the DMP: accel and gyro, big endian */
+#define RAW_PACKET          12
+#define RAW_MAX_BATCH       (DMP_FIFO_SIZE / RAW_PACKET)
 struct hal_s {
     unsigned char sensors;
     unsigned long next_temp_ms;
@@ -45,9 +59,24 @@ struct hal_s {
     void (*tap_cb)(unsigned char count, unsigned char direction);
     void (*android_orient_cb)(unsigned char orientation);
     __invmpu_data_ready_cb data_ready_cb;
-    struct event *ev_int;    /* event for pin interrupt */
+    struct gpio_irq *irq;    /* pin interrupt */
+    int irq_fd;              /* on the control thread */
+
+    /* fast path, see fast_path() */
+    int mpl_div;             /* 0: everything through the MPL */
+    int mpl_count;
+    unsigned short orient;   /* chip to body, as given to the MPL */
+    long gyro_sens, accel_sens;
+    long gyro_bias[3];       /* from the MPL, chip frame, hw units << 16 */
+
+    /* in-tree fusion on the raw FIFO, no DMP, no MPL */
+    struct fusion *fusion;
+
+    /* the samples, by the interrupt edges */
+    struct clock_src clk;
+    uint64_t sample_ns;      /* of the newest packet */
 };
-static struct hal_s hal = {0};
+static struct hal_s hal = { .irq_fd = -1 };
 
 unsigned char *mpl_key = (unsigned char *)"eMPL 5.1";
 
@@ -94,21 +123,31 @@ static struct platform_data_s compass_pdata = {
 
 
 /* Private function prototypes -----------------------------------------------*/
+/* for the timers of the slow sensors, the MPL is in ms */
 static int get_clock_ms(unsigned long *count)
 {
-    struct timeval tv;
     if (!count)
         return -1;
-    gettimeofday(&tv, NULL);
-    *count = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    *count = (unsigned long)(raspd_now_ns() / NS_PER_MS);
     return 0;
 }
 
 int _MLPrintLog(int priority, const char *tag, const char *fmt, ...)
 {
     va_list ap;
+    int level;
+
+    if (priority >= MPL_LOG_ERROR)
+        level = LOGL_ERR;
+    else if (priority == MPL_LOG_WARN)
+        level = LOGL_WARN;
+    else if (priority == MPL_LOG_INFO)
+        level = LOGL_INFO;
+    else
+        level = LOGL_DEBUG;
+
     va_start(ap, fmt);
-    vfprintf(stdout, fmt, ap);
+    log_vprintf(level, fmt, ap);
     va_end(ap);
     return 0;
 }
@@ -117,9 +156,19 @@ int _MLPrintLog(int priority, const char *tag, const char *fmt, ...)
 /*
  * The compass rate is never changed.
  */
+static void set_sample_rate(const union rtarg argv[])
+{
+    if (dmp_set_fifo_rate(argv[0].i) == 0)
+        clock_src_set_period(&hal.clk, 1000000000ULL / argv[0].i);
+}
+
 void invmpu_set_sample_rate(int rate)
 {
-    dmp_set_fifo_rate(rate);
+    union rtarg argv[1];
+
+    /* the I2C bus belongs to the control thread */
+    argv[0].i = rate;
+    rtctrl_call(set_sample_rate, argv, 1);
 }
 
 static void tap_cb(unsigned char direction, unsigned char count)
@@ -244,6 +293,22 @@ void invmpu_register_data_ready_cb(__invmpu_data_ready_cb func)
     hal.data_ready_cb = func;
 }
 
+void invmpu_set_fast_path(int mpl_div)
+{
+    hal.mpl_div = mpl_div > 0 ? mpl_div : 0;
+}
+
+int invmpu_set_fusion(int algo, float gain, float igain)
+{
+    struct fusion *f = NULL;
+
+    if (algo >= 0 && (f = fusion_new(algo, gain, igain)) == NULL)
+        return -EINVAL;
+    fusion_del(hal.fusion);
+    hal.fusion = f;
+    return 0;
+}
+
 /*******************************************************************************/
 
 static void read_from_mpl(void)
@@ -272,27 +337,250 @@ static void read_from_mpl(void)
         sensors |= INV_XYZ_COMPASS;
     }
 
+    /* the MPL time is in ms, the edge is the sample */
     if (sensors && hal.data_ready_cb) {
-        hal.data_ready_cb(sensors, timestamp, quat,
+        hal.data_ready_cb(sensors, hal.sample_ns, quat,
             accel, gyro, compass);
     }
 }
 
-static void int_cb(int fd, short what, void *arg)
+/* the MPL integrates every sample, the FIFO rate apart */
+static void build_sample(const struct dmp_sample *s, short sensors)
 {
-    short gyro[3], accel_short[3], sensors;
+    long accel[3];
+
+    if (sensors & INV_XYZ_GYRO)
+        inv_build_gyro(s->gyro, s->timestamp);
+    if (sensors & INV_XYZ_ACCEL) {
+        accel[0] = (long)s->accel[0];
+        accel[1] = (long)s->accel[1];
+        accel[2] = (long)s->accel[2];
+        inv_build_accel(accel, 0, s->timestamp);
+    }
+    if (sensors & INV_WXYZ_QUAT)
+        inv_build_quat(s->quat, 0, s->timestamp);
+}
+
+/*
+ * raw FIFO data to body frame, hw units << 16 bias off, the way the
+ * MPL calibrates it (inv_apply_calibration)
+ */
+static void to_body(const short raw[], const long bias[], long sens, long out[])
+{
+    long raw32[3];
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        raw32[i] = (long)raw[i] << 15;
+        if (bias)
+            raw32[i] -= bias[i] >> 1;
+    }
+    inv_convert_to_body_with_scale(hal.orient, sens << 1, raw32, out);
+}
+
+static void set_gyro_bias(const union rtarg argv[])
+{
+    hal.gyro_bias[0] = argv[0].i;
+    hal.gyro_bias[1] = argv[1].i;
+    hal.gyro_bias[2] = argv[2].i;
+}
+
+/* one sample for the MPL, with the slow sensors read along */
+struct mpl_update {
+    struct dmp_sample s;
+    short sensors;
+    unsigned char new_temp;
+    unsigned char new_compass;
+    long temperature;
+    unsigned long temp_timestamp;
+    long compass[3];
+    unsigned long compass_timestamp;
+};
+_Static_assert(sizeof(struct mpl_update) <= RTCTRL_REPORT_SIZE, "mpl_update");
+
+/* on the I/O thread, the gyro bias goes back to the control thread */
+static void mpl_update(const void *rec)
+{
+    const struct mpl_update *u = rec;
+    union rtarg argv[3];
+    long bias[3];
+
+    if (u->new_temp)
+        inv_build_temp(u->temperature, u->temp_timestamp);
+    build_sample(&u->s, u->sensors);
+    if (u->new_compass)
+        inv_build_compass(u->compass, 0, u->compass_timestamp);
+    inv_execute_on_data();
+
+    inv_get_gyro_bias(bias, NULL);
+    argv[0].i = bias[0];
+    argv[1].i = bias[1];
+    argv[2].i = bias[2];
+    rtctrl_call(set_gyro_bias, argv, 3);
+}
+
+/*
+ * Low-latency mode: the DMP 6-axis quaternion and the gyro, calibrated
+ * with the last bias the MPL found, go to the controller straight from
+ * the newest packet. The MPL sees one sample in mpl_div, with the
+ * compass and the temperature, on the I/O thread; it only keeps the
+ * gyro bias and the compass calibration going. No 9-axis quaternion
+ * and no compass for the controller in this mode.
+ */
+static void fast_path(const struct dmp_sample *batch, int count, short sensors)
+{
+    const struct dmp_sample *s = &batch[count - 1];
+    long quat[4], accel[3], gyro[3], compass[3] = { 0, 0, 0 };
+    struct mpl_update u;
+    unsigned long now;
+    int i, pick = -1;
+#ifdef COMPASS_ENABLED
+    short compass_short[3];
+#endif
+    uint64_t t;
+
+    t = stats_now();
+    for (i = 0; i < 4; i++)
+        quat[i] = s->quat[i];
+    to_body(s->gyro, hal.gyro_bias, hal.gyro_sens, gyro);
+    to_body(s->accel, NULL, hal.accel_sens, accel);
+    stats_record(STAT_mpl, stats_now() - t);
+
+    if (hal.data_ready_cb)
+        hal.data_ready_cb(sensors, hal.sample_ns, quat, accel, gyro, compass);
+
+    for (i = 0; i < count; i++) {
+        if (++hal.mpl_count >= hal.mpl_div) {
+            hal.mpl_count = 0;
+            pick = i;
+        }
+    }
+    if (pick < 0)
+        return;
+
+    memset(&u, 0, sizeof(u));
+    u.s = batch[pick];
+    u.sensors = sensors;
+    get_clock_ms(&now);
+    if ((sensors & INV_XYZ_GYRO) && now > hal.next_temp_ms) {
+        hal.next_temp_ms = now + TEMP_READ_MS;
+        u.new_temp = !mpu_get_temperature(&u.temperature, &u.temp_timestamp);
+    }
+#ifdef COMPASS_ENABLED
+    if ((hal.sensors & COMPASS_ON) && now > hal.next_compass_ms) {
+        hal.next_compass_ms = now + COMPASS_READ_MS;
+        if (!mpu_get_compass_reg(compass_short, &u.compass_timestamp)) {
+            u.compass[0] = (long)compass_short[0];
+            u.compass[1] = (long)compass_short[1];
+            u.compass[2] = (long)compass_short[2];
+            u.new_compass = 1;
+        }
+    }
+#endif
+    rtctrl_report(mpl_update, &u, sizeof(u));
+}
+
+/*
+ * Without the DMP: the FIFO holds raw accel and gyro at the sample
+ * rate, every packet goes through the fusion, the callback gets the
+ * newest attitude once per drain, in the units the MPL would give.
+ */
+static void fusion_cb(void)
+{
+    unsigned char data[RAW_MAX_BATCH * RAW_PACKET];
+    short sensors = INV_XYZ_GYRO | INV_XYZ_ACCEL | INV_WXYZ_QUAT;
+    long quat[4], accel[3], gyro[3], compass[3] = { 0, 0, 0 };
+    short raw_accel[3], raw_gyro[3];
+    unsigned short count = 0;
+    unsigned char more = 0;
+    uint32_t dt_us;
+    int i, k, err;
+    uint64_t t;
+
+    t = stats_now();
+    err = mpu_read_fifo_burst(RAW_PACKET, RAW_MAX_BATCH, data, &count, &more);
+    stats_record(STAT_fifo, stats_now() - t);
+    if (err == -2)
+        LOGE("MPU FIFO overflow, reset\n");
+    if (count == 0)
+        return;
+    clock_src_mark(&hal.clk, hal.sample_ns);
+
+    /* the period of the MPU oscillator, not the one asked for */
+    dt_us = (uint32_t)(clock_src_period(&hal.clk) / NS_PER_US);
+    t = stats_now();
+    for (i = 0; i < count; i++) {
+        const unsigned char *p = &data[i * RAW_PACKET];
+
+        for (k = 0; k < 3; k++) {
+            raw_accel[k] = (short)((p[k * 2] << 8) | p[k * 2 + 1]);
+            raw_gyro[k] = (short)((p[6 + k * 2] << 8) | p[6 + k * 2 + 1]);
+        }
+        to_body(raw_gyro, NULL, hal.gyro_sens, gyro);
+        to_body(raw_accel, NULL, hal.accel_sens, accel);
+        fusion_update(hal.fusion, gyro, accel, NULL, dt_us);
+    }
+    fusion_get_quat(hal.fusion, quat);
+    stats_record(STAT_mpl, stats_now() - t);
+
+    if (hal.data_ready_cb)
+        hal.data_ready_cb(sensors, hal.sample_ns, quat, accel, gyro, compass);
+}
+
+/*
+ * first: the oldest edge queued, the latency starts there. last: the
+ * newest, the time of the newest packet in the FIFO
+ */
+static void int_cb(uint64_t first, uint64_t last)
+{
+    struct dmp_sample batch[INVMPU_MAX_BATCH];
+    unsigned short count = 0;
+    short sensors;
     unsigned char more = 0;
-    long accel[3], quat[4], temperature;
+    long temperature;
     unsigned char new_temp = 0;
     unsigned long timestamp;
     unsigned long sensor_timestamp;
     int new_data = 0;
+    int i, err;
 #ifdef COMPASS_ENABLED
     unsigned char new_compass = 0;
 #endif
+    uint64_t t, mpl;
 
-    get_clock_ms(&timestamp);
+    stats_begin_at(first);
+    hal.sample_ns = last;
+
+    if (hal.fusion) {
+        fusion_cb();
+        return;
+    }
+    if (!hal.sensors) {
+        return;
+    }
+
+    /* Drain the FIFO: one count read, every complete packet in one
+     * burst, parsed in place. When the loop falls behind, the packets
+     * piled up come in one go instead of one per interrupt until the
+     * FIFO overflows. The sensors parameter tells which fields of the
+     * packets were populated, the timestamps are back-computed from
+     * the FIFO rate. The gesture callbacks run from the parser.
+     */
+    t = stats_now();
+    err = dmp_read_fifo_batch(batch, INVMPU_MAX_BATCH, &count, &sensors, &more);
+    stats_record(STAT_fifo, stats_now() - t);
+    if (err == -2)
+        LOGE("MPU FIFO overflow, reset\n");
+    if (count)
+        clock_src_mark(&hal.clk, last);
+
+    if (hal.mpl_div) {
+        if (count && sensors)
+            fast_path(batch, count, sensors);
+        return;
+    }
 
+    get_clock_ms(&timestamp);
 #ifdef COMPASS_ENABLED
     /* We're not using a data ready interrupt for the compass, so we'll
      * make our compass reads timer-based instead.
@@ -311,46 +599,24 @@ static void int_cb(int fd, short what, void *arg)
         new_temp = 1;
     }
 
-    if (!hal.sensors) {
-        return;
-    }
-
-    /* This function gets new data from the FIFO when the DMP is in
-     * use. The FIFO can contain any combination of gyro, accel,
-     * quaternion, and gesture data. The sensors parameter tells the
-     * caller which data fields were actually populated with new data.
-     * For example, if sensors == (INV_XYZ_GYRO | INV_WXYZ_QUAT), then
-     * the FIFO isn't being filled with accel data.
-     * The driver parses the gesture data to determine if a gesture
-     * event has occurred; on an event, the application will be notified
-     * via a callback (assuming that a callback function was properly
-     * registered). The more parameter is non-zero if there are
-     * leftover packets in the FIFO.
-     */
-    dmp_read_fifo(gyro, accel_short, quat,
-                    &sensor_timestamp, (short *)&sensors, &more);
-    if (sensors & INV_XYZ_GYRO) {
-        /* Push the new data to the MPL. */
-        inv_build_gyro(gyro, sensor_timestamp);
-        new_data = 1;
-        if (new_temp) {
-            new_temp = 0;
-            /* Temperature only used for gyro temp comp. */
-            mpu_get_temperature(&temperature, &sensor_timestamp);
-            inv_build_temp(temperature, sensor_timestamp);
-        }
+    if (count && (sensors & INV_XYZ_GYRO) && new_temp) {
+        new_temp = 0;
+        /* Temperature only used for gyro temp comp. */
+        mpu_get_temperature(&temperature, &sensor_timestamp);
+        inv_build_temp(temperature, sensor_timestamp);
     }
-    if (sensors & INV_XYZ_ACCEL) {
-        accel[0] = (long)accel_short[0];
-        accel[1] = (long)accel_short[1];
-        accel[2] = (long)accel_short[2];
-        inv_build_accel(accel, 0, sensor_timestamp);
-        new_data = 1;
+    /* all but the last one, the compass goes with the last */
+    t = stats_now();
+    for (i = 0; i + 1 < count; i++) {
+        build_sample(&batch[i], sensors);
+        inv_execute_on_data();
     }
-    if (sensors & INV_WXYZ_QUAT) {
-        inv_build_quat(quat, 0, sensor_timestamp);
-        new_data = 1;
+    if (count) {
+        build_sample(&batch[count - 1], sensors);
+        sensor_timestamp = batch[count - 1].timestamp;
+        new_data = sensors != 0;
     }
+    mpl = stats_now() - t;
 
 #ifdef COMPASS_ENABLED
     if (new_compass) {
@@ -375,13 +641,122 @@ static void int_cb(int fd, short what, void *arg)
     }
 #endif
 
+    /* the controller gets the newest state once per drain */
     if (new_data) {
+        t = stats_now();
         inv_execute_on_data();
+        stats_record(STAT_mpl, mpl + stats_now() - t);
 
         read_from_mpl();
     }
 }
 
+/*
+ * the oldest queued edge starts the latency, the FIFO drain covers
+ * all of them
+ */
+static void int_rt(int fd, void *arg)
+{
+    struct gpio_edge edges[GPIO_IRQ_BATCH];
+    int nr;
+
+    if ((nr = gpio_irq_read(hal.irq, edges, GPIO_IRQ_BATCH)) > 0)
+        int_cb(edges[0].time_ns, edges[nr - 1].time_ns);
+}
+
+static void int_edges(unsigned int pin,
+                const struct gpio_edge *edges, int nr, void *opaque)
+{
+    int_cb(edges[0].time_ns, edges[nr - 1].time_ns);
+}
+
+/*
+ * on the control thread if there is one, else in the event loop. no
+ * pin: the interrupts come from invmpu_interrupt()
+ */
+static int request_irq(int pin_int)
+{
+    int err;
+
+    if (pin_int < 0)
+        return 0;
+    if (!rtctrl_enabled())
+        return gpio_irq_signal(pin_int, EDGE_both, int_edges, NULL, &hal.irq);
+
+    if ((err = gpio_irq_request(pin_int, EDGE_both, &hal.irq)) < 0)
+        return err;
+    hal.irq_fd = gpio_irq_fd(hal.irq);
+    err = rtctrl_add_irq(hal.irq_fd, gpio_irq_events(hal.irq), int_rt, NULL);
+    if (err < 0) {
+        gpio_irq_free(hal.irq);
+        hal.irq = NULL;
+        hal.irq_fd = -1;
+    }
+    return err;
+}
+
+/*
+ * the sensors straight into the FIFO at up to 1 kHz (the driver's limit
+ * with the DLPF on), no DMP firmware, no MPL
+ */
+static int init_raw(int pin_int, int sample_rate)
+{
+    struct int_param_s int_param;
+    unsigned char accel_fsr;
+    unsigned short gyro_rate, gyro_fsr;
+    int err;
+
+    if (mpu_init(&int_param)) {
+        LOGE("Could not initialize gyro.\n");
+        return -ENODEV;
+    }
+    err = mpu_set_sensors(INV_XYZ_GYRO | INV_XYZ_ACCEL);
+    if (err)
+        LOGE("mpu_set_sensors() error\n");
+    err = mpu_configure_fifo(INV_XYZ_GYRO | INV_XYZ_ACCEL);
+    if (err)
+        LOGE("mpu_configure_fifo() error\n");
+    err = mpu_set_sample_rate(sample_rate);
+    if (err)
+        LOGE("mpu_set_sample_rate() error\n");
+
+    mpu_get_sample_rate(&gyro_rate);
+    mpu_get_gyro_fsr(&gyro_fsr);
+    mpu_get_accel_fsr(&accel_fsr);
+    hal.orient = inv_orientation_matrix_to_scalar(gyro_pdata.orientation);
+    hal.gyro_sens = (long)gyro_fsr<<15;
+    hal.accel_sens = (long)accel_fsr<<15;
+    clock_src_register(&hal.clk, "imu", 1000000000ULL / gyro_rate);
+    hal.sensors = ACCEL_ON | GYRO_ON;
+    fusion_reset(hal.fusion);
+
+    if ((err = request_irq(pin_int)) < 0) {
+        LOGE("request_irq(%d), err = %d\n", pin_int, err);
+        return err;
+    }
+    return 0;
+}
+
+static int i2c_write_q(void *opaque, unsigned char slave_addr,
+        unsigned char reg_addr, unsigned short length, const unsigned char *data)
+{
+    return i2cq_write_reg(opaque, slave_addr, reg_addr, data, length);
+}
+
+static int i2c_read_q(void *opaque, unsigned char slave_addr,
+        unsigned char reg_addr, unsigned short length, unsigned char *data)
+{
+    return i2cq_read_reg(opaque, slave_addr, reg_addr, data, length);
+}
+
+static struct mpu_i2c_ops i2c_ops = { i2c_write_q, i2c_read_q, NULL };
+
+void invmpu_set_i2c(struct i2cq *q)
+{
+    i2c_ops.opaque = q;
+    mpu_set_i2c_ops(q ? &i2c_ops : NULL);
+}
+
 int invmpu_init(int pin_int, int sample_rate)
 {
     int result;
@@ -393,12 +768,15 @@ int invmpu_init(int pin_int, int sample_rate)
     unsigned short compass_fsr;
 #endif
 
-    err = bcm2835_gpio_signal(pin_int, EDGE_both, int_cb, NULL, &hal.ev_int);
-    if (err < 0) {
-        LOGE("gpio_signal(%d), err = %d\n", pin_int, err);
-        return err;
+    /* the blocking I2C queue calls would stall the loop, see i2cq.h */
+    if (i2c_ops.opaque && rasp_event_in_loop()) {
+        LOGE("invmpu_init() with the I2C queue on the event loop\n");
+        return -EWOULDBLOCK;
     }
 
+    if (hal.fusion)
+        return init_raw(pin_int, sample_rate);
+
     result = mpu_init(&int_param);
     if (result) {
         LOGE("Could not initialize gyro.\n");
@@ -506,9 +884,9 @@ int invmpu_init(int pin_int, int sample_rate)
     mpu_get_compass_fsr(&compass_fsr);
 #endif
     /* Sync driver configuration with MPL. */
-    /* Sample rate expected in microseconds. */
-    inv_set_gyro_sample_rate(1000000L / gyro_rate);
-    inv_set_accel_sample_rate(1000000L / gyro_rate);
+    /* Sample rate expected in microseconds, decimated on the fast path. */
+    inv_set_gyro_sample_rate(1000000L / gyro_rate * (hal.mpl_div ? hal.mpl_div : 1));
+    inv_set_accel_sample_rate(1000000L / gyro_rate * (hal.mpl_div ? hal.mpl_div : 1));
 #ifdef COMPASS_ENABLED
     /* The compass rate is independent of the gyro and accel rates. As long as
     * inv_set_compass_sample_rate is called with the correct value, the 9-axis
@@ -525,6 +903,9 @@ int invmpu_init(int pin_int, int sample_rate)
     inv_set_accel_orientation_and_scale(
             inv_orientation_matrix_to_scalar(gyro_pdata.orientation),
             (long)accel_fsr<<15);
+    hal.orient = inv_orientation_matrix_to_scalar(gyro_pdata.orientation);
+    hal.gyro_sens = (long)gyro_fsr<<15;
+    hal.accel_sens = (long)accel_fsr<<15;
 #ifdef COMPASS_ENABLED
     inv_set_compass_orientation_and_scale(
             inv_orientation_matrix_to_scalar(compass_pdata.orientation),
@@ -601,17 +982,37 @@ int invmpu_init(int pin_int, int sample_rate)
     err = dmp_set_fifo_rate(sample_rate);
     if (err)
         LOGE("dmp_set_fifo_rate(), err = %d\n", err);
+    if (dmp_get_fifo_rate(&gyro_rate) == 0 && gyro_rate)
+        clock_src_register(&hal.clk, "imu", 1000000000ULL / gyro_rate);
 
     err = mpu_set_dmp_state(1);
     if (err)
         LOGE("mpu_set_dmp_state(), err = %d\n", err);
 
+    /* last, the handler may run on the control thread right away */
+    result = request_irq(pin_int);
+    if (result < 0) {
+        LOGE("request_irq(%d), err = %d\n", pin_int, result);
+        return result;
+    }
+
     return err;
 }
 
+void invmpu_interrupt(uint64_t edge_ns)
+{
+    int_cb(edge_ns, edge_ns);
+}
+
 void invmpu_exit(void)
 {
     /* TODO */
-    if (hal.ev_int)
-        eventfd_del(hal.ev_int);
+    if (hal.irq_fd >= 0) {
+        rtctrl_del_irq(hal.irq_fd);
+        hal.irq_fd = -1;
+    }
+    if (hal.irq) {
+        gpio_irq_free(hal.irq);
+        hal.irq = NULL;
+    }
 }
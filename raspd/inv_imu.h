@@ -1,7 +1,10 @@
 #ifndef __INV_IMU_H__
 #define __INV_IMU_H__
 
-typedef void (*__invmpu_data_ready_cb)(short sensors, unsigned long timestamp,
+#include <stdint.h>
+
+/* timestamp: ns on raspd_now_ns(), the sample of the newest packet */
+typedef void (*__invmpu_data_ready_cb)(short sensors, uint64_t timestamp,
                     long quat[], long accel[], long gyro[],
                     long compass[]);
 
@@ -13,7 +16,32 @@ void invmpu_set_sample_rate(int rate);
 void invmpu_register_tap_cb(void (*func)(unsigned char, unsigned char));
 void invmpu_register_android_orient_cb(void (*func)(unsigned char));
 void invmpu_register_data_ready_cb(__invmpu_data_ready_cb func);
+/*
+ * before invmpu_init(), mpl_div > 0: the data ready callback gets the
+ * DMP quaternion and gyro straight from the FIFO, the MPL one sample
+ * in mpl_div on the I/O thread. 0: everything through the MPL
+ */
+void invmpu_set_fast_path(int mpl_div);
+/*
+ * before invmpu_init(), algo >= 0 (FUSION_*): no DMP and no MPL, the
+ * raw FIFO goes through raspd/fusion.c at the sample rate, < 0: off
+ */
+int invmpu_set_fusion(int algo, float gain, float igain);
+/*
+ * before invmpu_init(), the register accesses of the eMPL driver go
+ * through the I2C queue, the thread waits on the worker instead of
+ * polling the BSC FIFO. NULL: back to the BSC. with the queue,
+ * invmpu_init() is refused on the running event loop (-EWOULDBLOCK).
+ */
+struct i2cq;
+void invmpu_set_i2c(struct i2cq *q);
+/* pin_int < 0: no GPIO, the interrupts through invmpu_interrupt() */
 int invmpu_init(int pin_int, int sample_rate);
+/*
+ * the INT line went active at edge_ns (raspd_now_ns() or the clock of
+ * a simulated device): drains the FIFO on the caller's thread
+ */
+void invmpu_interrupt(uint64_t edge_ns);
 void invmpu_exit(void);
 
 #endif /* __INV_IMU_H__ */
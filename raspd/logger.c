@@ -0,0 +1,458 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include <spsc.h>
+
+#include "logger.h"
+
+#define LOG_RING        128         /* records per thread */
+#define LOG_MAX_THREADS 8
+#define LOG_STRS_SIZE   352         /* copied %s arguments */
+#define LOG_LINE_MAX    1024
+#define LOG_BATCH       (64 * 1024)
+#define LOG_IDLE_MS     20
+
+struct log_rec {
+    const char *fmt;                /* NULL: preformatted in strs */
+    uint8_t level;
+    uint8_t nargs;
+    uint16_t len;
+    struct log_arg args[LOG_MAX_ARGS];
+    char strs[LOG_STRS_SIZE];
+};
+
+struct log_ring {
+    struct spsc r;
+    unsigned long drops;
+    int dead;                       /* the thread is gone */
+    struct log_rec recs[LOG_RING];
+};
+
+static struct log_ring *rings[LOG_MAX_THREADS];
+static int nr_rings;
+static unsigned long lost_threads;
+static unsigned long retired_drops;
+static __thread struct log_ring *my_ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static int log_fd = -1;
+static int running;
+static int stop;
+static pthread_t log_thread;
+
+/* the drainer frees the ring once it is empty */
+static void put_ring(void *arg)
+{
+    struct log_ring *ring = arg;
+
+    __atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void make_key(void)
+{
+    pthread_key_create(&ring_key, put_ring);
+}
+
+/*
+ * the ring of the calling thread, allocated and touched here so that
+ * the first log call of a real-time thread does neither. the slot goes
+ * back when the thread exits.
+ */
+int log_register_thread(void)
+{
+    struct log_ring *ring, *none;
+    int i;
+
+    if (my_ring)
+        return 0;
+    pthread_once(&ring_once, make_key);
+
+    if ((ring = malloc(sizeof(*ring))) == NULL)
+        return -ENOMEM;
+    memset(ring, 0, sizeof(*ring));
+    spsc_init(&ring->r, ring->recs, LOG_RING, sizeof(ring->recs[0]));
+
+    for (i = 0; i < LOG_MAX_THREADS; i++) {
+        none = NULL;
+        if (__atomic_compare_exchange_n(&rings[i], &none, ring, 0,
+                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (i == LOG_MAX_THREADS) {
+        free(ring);
+        return -ENOSPC;
+    }
+    __atomic_add_fetch(&nr_rings, 1, __ATOMIC_RELAXED);
+    pthread_setspecific(ring_key, ring);
+    my_ring = ring;
+    return 0;
+}
+
+/* the threads that did not register: on their first log call, once */
+static struct log_ring *get_ring(void)
+{
+    static __thread int tried;
+
+    if (my_ring == NULL && !tried) {
+        tried = 1;
+        log_register_thread();
+    }
+    return my_ring;
+}
+
+/* drainer side, the ring is empty */
+static void free_ring(int i, struct log_ring *ring)
+{
+    __atomic_add_fetch(&retired_drops, ring->drops, __ATOMIC_RELAXED);
+    __atomic_store_n(&rings[i], NULL, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&nr_rings, 1, __ATOMIC_RELAXED);
+    free(ring);
+}
+
+static int format_one(char *buf, size_t size, const char *spec,
+                const char *mod, char conv, const struct log_arg *a)
+{
+    char f[32];
+    long long i = a->type == 'd' ? (long long)a->v.d : a->v.i;
+    double d = a->type == 'd' ? a->v.d : (double)a->v.i;
+
+    snprintf(f, sizeof(f), "%s%s%c", spec, mod, conv);
+
+    switch (conv) {
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+        /* the width of the argument, not the one of the format */
+        snprintf(f, sizeof(f), "%s%s%c", spec,
+                a->type == 'L' ? "ll" : a->type == 'l' ? "l" : "", conv);
+        if (a->type == 'L')
+            return snprintf(buf, size, f, i);
+        if (a->type == 'l')
+            return snprintf(buf, size, f, (long)i);
+        return snprintf(buf, size, f, (int)i);
+    case 'c':
+        return snprintf(buf, size, f, (int)i);
+    case 'f': case 'F': case 'e': case 'E':
+    case 'g': case 'G': case 'a': case 'A':
+        snprintf(f, sizeof(f), "%s%c", spec, conv);
+        return snprintf(buf, size, f, d);
+    case 's':
+        return snprintf(buf, size, f, a->type == 's' && a->v.p ?
+                        (const char *)a->v.p : "(null)");
+    case 'p':
+        return snprintf(buf, size, f, a->v.p);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * printf, one conversion at a time, each with its captured argument
+ */
+int log_format(char *buf, size_t size, const char *fmt,
+                const struct log_arg *args, int nargs)
+{
+    const char *p = fmt;
+    size_t n = 0;
+    int ai = 0;
+
+    if (size == 0)
+        return 0;
+
+    while (*p && n < size - 1) {
+        char spec[24], mod[4];
+        const char *s, *m;
+        int len;
+
+        if (*p != '%') {
+            buf[n++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            buf[n++] = '%';
+            p += 2;
+            continue;
+        }
+
+        s = p++;
+        while (*p && strchr("-+ #0'", *p))
+            p++;
+        while (isdigit((unsigned char)*p))
+            p++;
+        if (*p == '.') {
+            p++;
+            while (isdigit((unsigned char)*p))
+                p++;
+        }
+        m = p;
+        while (*p && strchr("hlLqjzt", *p))
+            p++;
+        if (*p == '\0' || m - s >= (int)sizeof(spec) || p - m >= (int)sizeof(mod))
+            break;
+        if (ai >= nargs)
+            break;
+
+        memcpy(spec, s, m - s);
+        spec[m - s] = '\0';
+        memcpy(mod, m, p - m);
+        mod[p - m] = '\0';
+
+        len = format_one(buf + n, size - n, spec, mod, *p++, &args[ai++]);
+        if (len > 0)
+            n += (size_t)len < size - n ? (size_t)len : size - n - 1;
+    }
+    buf[n] = '\0';
+    return (int)n;
+}
+
+static void write_all(const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(log_fd >= 0 ? log_fd : STDERR_FILENO, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+void log_submit(int level, const char *fmt, const struct log_arg *args, int nargs)
+{
+    struct log_ring *ring;
+    struct log_rec *rec;
+    size_t off = 0;
+    int i;
+
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        char line[LOG_LINE_MAX];
+        write_all(line, log_format(line, sizeof(line), fmt, args, nargs));
+        return;
+    }
+
+    if ((ring = get_ring()) == NULL) {
+        __atomic_add_fetch(&lost_threads, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if ((rec = spsc_claim(&ring->r)) == NULL) {
+        ring->drops++;
+        return;
+    }
+
+    rec->fmt = fmt;
+    rec->level = (uint8_t)level;
+    rec->nargs = (uint8_t)(nargs < LOG_MAX_ARGS ? nargs : LOG_MAX_ARGS);
+    for (i = 0; i < rec->nargs; i++) {
+        rec->args[i] = args[i];
+        if (args[i].type != 's' || args[i].v.p == NULL)
+            continue;
+
+        /* the string may not outlive the call, keep an offset */
+        if (off < LOG_STRS_SIZE) {
+            size_t n = strnlen(args[i].v.p, LOG_STRS_SIZE - off - 1);
+            memcpy(rec->strs + off, args[i].v.p, n);
+            rec->strs[off + n] = '\0';
+            rec->args[i].v.i = (long long)off;
+            off += n + 1;
+        } else {
+            rec->args[i].v.p = NULL;
+            rec->args[i].type = 'p';
+        }
+    }
+    spsc_publish(&ring->r);
+}
+
+void log_vprintf(int level, const char *fmt, va_list ap)
+{
+    struct log_ring *ring;
+    struct log_rec *rec;
+    int n;
+
+    if (level > LOG_MAX_LEVEL)
+        return;
+
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        char line[LOG_LINE_MAX];
+        n = vsnprintf(line, sizeof(line), fmt, ap);
+        write_all(line, n < (int)sizeof(line) ? n : (int)sizeof(line) - 1);
+        return;
+    }
+
+    if ((ring = get_ring()) == NULL) {
+        __atomic_add_fetch(&lost_threads, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if ((rec = spsc_claim(&ring->r)) == NULL) {
+        ring->drops++;
+        return;
+    }
+    rec->fmt = NULL;
+    rec->level = (uint8_t)level;
+    n = vsnprintf(rec->strs, LOG_STRS_SIZE, fmt, ap);
+    rec->len = n < LOG_STRS_SIZE ? n : LOG_STRS_SIZE - 1;
+    spsc_publish(&ring->r);
+}
+
+static size_t format_rec(char *buf, size_t size, struct log_rec *rec)
+{
+    int i;
+
+    if (rec->fmt == NULL) {
+        size_t n = rec->len < size ? rec->len : size;
+        memcpy(buf, rec->strs, n);
+        return n;
+    }
+    for (i = 0; i < rec->nargs; i++) {
+        if (rec->args[i].type == 's')
+            rec->args[i].v.p = rec->strs + rec->args[i].v.i;
+    }
+    return log_format(buf, size, rec->fmt, rec->args, rec->nargs);
+}
+
+/*
+ * format everything queued into batch, flushing when full
+ */
+static int drain(char *batch, size_t size, size_t *len)
+{
+    static unsigned long reported;
+    unsigned long drops = lost_threads + retired_drops;
+    struct log_rec *rec;
+    int count = 0;
+    int i, dead;
+
+    for (i = 0; i < LOG_MAX_THREADS; i++) {
+        struct log_ring *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+
+        if (ring == NULL)
+            continue;
+        /* before the drain: whatever it published is visible */
+        dead = __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE);
+        while ((rec = spsc_peek(&ring->r)) != NULL) {
+            if (size - *len < LOG_LINE_MAX) {
+                write_all(batch, *len);
+                *len = 0;
+            }
+            *len += format_rec(batch + *len, LOG_LINE_MAX, rec);
+            spsc_release(&ring->r);
+            count++;
+        }
+        drops += ring->drops;
+        if (dead)
+            free_ring(i, ring);
+    }
+
+    if (drops != reported) {
+        if (size - *len < LOG_LINE_MAX) {
+            write_all(batch, *len);
+            *len = 0;
+        }
+        *len += snprintf(batch + *len, LOG_LINE_MAX,
+                "log: %lu messages dropped\n", drops - reported);
+        reported = drops;
+    }
+    return count;
+}
+
+static void *log_main(void *arg)
+{
+    struct timespec idle = { 0, LOG_IDLE_MS * 1000000L };
+    char *batch;
+    size_t len = 0;
+    int n;
+
+    if ((batch = malloc(LOG_BATCH)) == NULL)
+        return NULL;
+
+    while (1) {
+        int last = __atomic_load_n(&stop, __ATOMIC_ACQUIRE);
+
+        n = drain(batch, LOG_BATCH, &len);
+        if (len > 0) {
+            write_all(batch, len);
+            len = 0;
+        }
+        if (last)
+            break;
+        if (n == 0)
+            nanosleep(&idle, NULL);
+    }
+
+    free(batch);
+    return NULL;
+}
+
+/*
+ * start the drainer writing to fd, until then logging is synchronous
+ */
+int log_init(int fd)
+{
+    pthread_attr_t attr;
+    struct sched_param sp;
+    int err;
+
+    if (running)
+        return -EEXIST;
+
+    log_fd = fd;
+
+    /* below any real-time thread, whatever the caller runs at */
+    memset(&sp, 0, sizeof(sp));
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &sp);
+
+    /* the caller, the I/O thread */
+    log_register_thread();
+
+    stop = 0;
+    err = pthread_create(&log_thread, &attr, log_main, NULL);
+    pthread_attr_destroy(&attr);
+    if (err)
+        return -err;
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * flush and go back to synchronous logging
+ */
+void log_exit(void)
+{
+    char batch[LOG_LINE_MAX * 2];
+    size_t len = 0;
+
+    if (!running)
+        return;
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    pthread_join(log_thread, NULL);
+
+    /* whatever raced with the last drain, we are the consumer now */
+    while (drain(batch, sizeof(batch), &len) > 0 || len > 0) {
+        write_all(batch, len);
+        len = 0;
+    }
+}
+
+unsigned long log_dropped(void)
+{
+    unsigned long drops = lost_threads + retired_drops;
+    int i;
+
+    for (i = 0; i < LOG_MAX_THREADS; i++) {
+        struct log_ring *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (ring)
+            drops += ring->drops;
+    }
+    return drops;
+}
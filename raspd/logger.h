@@ -0,0 +1,142 @@
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+/*
+ * asynchronous logging
+ *
+ * a log call stores the format pointer and the raw arguments in a
+ * lock-free ring of the calling thread, formatting and write() are
+ * done by a low priority drainer thread in large batches. a full ring
+ * drops the message, logging never blocks.
+ *
+ * a thread takes its ring with log_register_thread() when it starts
+ * (else on its first log call), up to 8 of them at a time, the
+ * ring goes back when the thread exits.
+ *
+ * the format must be a string literal (it is kept by pointer), %s
+ * arguments are copied. up to LOG_MAX_ARGS int/long/double/string/
+ * pointer arguments, no '*' width or precision.
+ *
+ * levels above LOG_MAX_LEVEL are compiled out.
+ */
+
+#define LOGL_ERR    0
+#define LOGL_WARN   1
+#define LOGL_INFO   2
+#define LOGL_DEBUG  3
+
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL   LOGL_INFO
+#endif
+
+#define LOG_MAX_ARGS    8
+
+struct log_arg {
+    char type;          /* i, l, L (long long), d, s, p */
+    union {
+        long long i;
+        double d;
+        const void *p;
+    } v;
+};
+
+static inline struct log_arg log_arg_i(long long v)
+{
+    struct log_arg a = { 'i', { .i = v } };
+    return a;
+}
+
+static inline struct log_arg log_arg_l(long long v)
+{
+    struct log_arg a = { 'l', { .i = v } };
+    return a;
+}
+
+static inline struct log_arg log_arg_ll(long long v)
+{
+    struct log_arg a = { 'L', { .i = v } };
+    return a;
+}
+
+static inline struct log_arg log_arg_d(double v)
+{
+    struct log_arg a = { 'd', { .d = v } };
+    return a;
+}
+
+static inline struct log_arg log_arg_s(const char *v)
+{
+    struct log_arg a = { 's', { .p = v } };
+    return a;
+}
+
+static inline struct log_arg log_arg_p(const void *v)
+{
+    struct log_arg a = { 'p', { .p = v } };
+    return a;
+}
+
+#define LOG_ARG(x) _Generic((x),                                    \
+        float: log_arg_d, double: log_arg_d,                        \
+        char *: log_arg_s, const char *: log_arg_s,                 \
+        void *: log_arg_p, const void *: log_arg_p,                 \
+        long: log_arg_l, unsigned long: log_arg_l,                  \
+        long long: log_arg_ll, unsigned long long: log_arg_ll,      \
+        default: log_arg_i)(x)
+
+#define LOG_NARGS(...)  LOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+
+#define LOG_MAP_0()
+#define LOG_MAP_1(a)                    LOG_ARG(a)
+#define LOG_MAP_2(a, ...)   LOG_ARG(a), LOG_MAP_1(__VA_ARGS__)
+#define LOG_MAP_3(a, ...)   LOG_ARG(a), LOG_MAP_2(__VA_ARGS__)
+#define LOG_MAP_4(a, ...)   LOG_ARG(a), LOG_MAP_3(__VA_ARGS__)
+#define LOG_MAP_5(a, ...)   LOG_ARG(a), LOG_MAP_4(__VA_ARGS__)
+#define LOG_MAP_6(a, ...)   LOG_ARG(a), LOG_MAP_5(__VA_ARGS__)
+#define LOG_MAP_7(a, ...)   LOG_ARG(a), LOG_MAP_6(__VA_ARGS__)
+#define LOG_MAP_8(a, ...)   LOG_ARG(a), LOG_MAP_7(__VA_ARGS__)
+#define LOG_MAP__(n, ...)   LOG_MAP_ ## n(__VA_ARGS__)
+#define LOG_MAP_(n, ...)    LOG_MAP__(n, __VA_ARGS__)
+#define LOG_MAP(...)        LOG_MAP_(LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+
+/* never called, lets the compiler check the arguments */
+static inline void __attribute__((format(printf, 1, 2))) log_check(const char *fmt, ...)
+{
+}
+
+#define rlog(level, fmt, ...)                                               \
+    do {                                                                    \
+        if ((level) <= LOG_MAX_LEVEL) {                                     \
+            const struct log_arg __log_args[] = {                           \
+                LOG_MAP(__VA_ARGS__) };                                     \
+            if (0)                                                          \
+                log_check(fmt, ##__VA_ARGS__);                              \
+            log_submit(level, fmt, __log_args, LOG_NARGS(__VA_ARGS__));     \
+        }                                                                   \
+    } while (0)
+
+#define rlog_err(...)   rlog(LOGL_ERR, __VA_ARGS__)
+#define rlog_warn(...)  rlog(LOGL_WARN, __VA_ARGS__)
+#define rlog_info(...)  rlog(LOGL_INFO, __VA_ARGS__)
+#define rlog_debug(...) rlog(LOGL_DEBUG, __VA_ARGS__)
+
+void log_submit(int level, const char *fmt, const struct log_arg *args, int nargs);
+/* formatted by the caller, for va_list users */
+void log_vprintf(int level, const char *fmt, va_list ap);
+
+/* -ENOSPC: no ring left, the messages of the thread are dropped */
+int log_register_thread(void);
+int log_init(int fd);
+void log_exit(void);
+unsigned long log_dropped(void);
+
+/* format a record, exposed for the tests */
+int log_format(char *buf, size_t size, const char *fmt,
+                const struct log_arg *args, int nargs);
+
+#endif /* __LOGGER_H__ */
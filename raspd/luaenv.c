@@ -14,6 +14,7 @@
 #include <bcm2835.h>
 
 #include <xmalloc.h>
+#include <arena.h>
 
 #include "module.h"
 #include "event.h"
@@ -26,7 +27,10 @@
 #include "tankcontrol.h"
 #include "softpwm.h"
 #include "inv_imu.h"
+#include "fusion.h"
+#include "i2cq.h"
 #include "quadcopter.h"
+#include "logger.h"
 
 #include "luaenv.h"
 
@@ -192,11 +196,14 @@ static int lr_l298n(lua_State *L)
     return 0;
 }
 
+static struct cmd_ctx lua_ctx;
+
 static int lr_modexec(lua_State *L)
 {
     int fd;
     const char *cmd;
-    char *buffer;
+    char *buffer, *heap = NULL;
+    size_t mark;
     int n;
     int err;
 
@@ -207,16 +214,23 @@ static int lr_modexec(lua_State *L)
     fd = (int)luaL_checkinteger(L, 1);
     cmd = luaL_checkstring(L, 2);
 
+    /* a copy on the heap if it does not fit the arena */
+    mark = arena_mark(&lua_ctx.arena);
+    if ((buffer = arena_strdup(&lua_ctx.arena, cmd)) == NULL) {
+        heap = buffer = strdup(cmd);
+        module_heap_cmd();
+    }
+
     err = -ENOMEM;
-    if ((buffer = strdup(cmd)) != NULL) {
+    if (buffer != NULL) {
         char *s, *cmdexec, *saveptr;
 
         err = 0;
         for (s = buffer; (cmdexec = strtok_r(s, ";", &saveptr)) != NULL; s = NULL)
-            err |= module_cmdexec(fd, cmdexec);
-
-        free(buffer);
+            err |= module_cmdexec_ctx(&lua_ctx, fd, cmdexec);
     }
+    free(heap);
+    arena_rewind(&lua_ctx.arena, mark);
 
     lua_pushinteger(L, err);
     return 1;
@@ -254,35 +268,42 @@ struct signal_env {
     int nr_trig;
     int count;
     int counted;
-    struct event *ev;
+    struct gpio_irq *irq;
 };
 
-static void cb_gpio_signal_wrap(int fd, short what, void *arg)
+/* the handler runs once per edge: pin, level, time (ns, CLOCK_MONOTONIC) */
+static void cb_gpio_signal_wrap(unsigned int pin,
+                const struct gpio_edge *edges, int nr, void *opaque)
 {
-    struct signal_env *env = arg;
-
-    if (env->count != -1 && env->counted++ >= env->count) {
-        eventfd_del(env->ev);
-        free(env);
-        return;
-    }
-
-    /* get gpio signal table */
-    lua_pushlightuserdata(_L, &_L);
-    lua_rawget(_L, LUA_REGISTRYINDEX);
-    lua_pushinteger(_L, env->pin);
-    lua_gettable(_L, -2);
+    struct signal_env *env = opaque;
+    int i, retval;
 
-    /* call lua handler with one result */
-    lua_pushinteger(_L, env->pin);
-    lua_pushinteger(_L, bcm2835_gpio_lev(env->pin));
-    if (lua_pcall(_L, 2, 1, 0) == 0) {
-        int retval = luaL_checkinteger(_L, -1);
-        if (retval < 0) {
-            eventfd_del(env->ev);
+    for (i = 0; i < nr; i++) {
+        if (env->count != -1 && env->counted++ >= env->count) {
+            gpio_irq_free(env->irq);
             free(env);
+            return;
+        }
+
+        /* get gpio signal table */
+        lua_pushlightuserdata(_L, &_L);
+        lua_rawget(_L, LUA_REGISTRYINDEX);
+        lua_pushinteger(_L, env->pin);
+        lua_gettable(_L, -2);
+
+        /* call lua handler with one result */
+        lua_pushinteger(_L, env->pin);
+        lua_pushinteger(_L, edges[i].level);
+        lua_pushnumber(_L, (lua_Number)edges[i].time_ns);
+        if (lua_pcall(_L, 3, 1, 0) == 0) {
+            retval = luaL_checkinteger(_L, -1);
+            lua_pop(_L, 1); /* pop result */
+            if (retval < 0) {
+                gpio_irq_free(env->irq);
+                free(env);
+                return;
+            }
         }
-        lua_pop(_L, 1); /* pop result */
     }
 }
 
@@ -309,27 +330,69 @@ static int lr_gpio_signal(lua_State *L)
     memset(env, 0, sizeof(*env));
     env->pin = pin;
     env->count = count;
-    if ((err = bcm2835_gpio_signal(pin, EDGE_both,
-                cb_gpio_signal_wrap, env, &env->ev)) < 0) {
+    if ((err = gpio_irq_signal(pin, EDGE_both,
+                cb_gpio_signal_wrap, env, &env->irq)) < 0) {
         free(env);
     }
     lua_pushinteger(L, err);
     return 1;
 }
 
+/*
+ * log(msg [, level]), level 0 (error) .. 3 (debug), default info
+ */
+static int lr_log(lua_State *L)
+{
+    const char *msg = luaL_checkstring(L, 1);
+    int level = (int)luaL_optint(L, 2, LOGL_INFO);
+
+    rlog(level, "%s", msg);
+    return 0;
+}
+
+static struct i2cq *i2c_bus;
+
+/*
+ * divider: of the BSC, dev: /dev/i2c-N, the bus then goes through the
+ * kernel driver and the I2C queue (the clock is set by the device tree)
+ */
 static int lr_i2c_init(lua_State *L)
 {
     int divider = (int)luaL_optint(L, 1, 64);
-    bcm2835_i2c_begin();
-    bcm2835_i2c_setClockDivider(divider);
-    return 0;
+    const char *dev = luaL_optstring(L, 2, NULL);
+    int err = 0;
+
+    if (dev) {
+        if (i2c_bus == NULL && (i2c_bus = i2cq_open(dev)) == NULL)
+            err = -errno;
+        else
+            invmpu_set_i2c(i2c_bus);
+    } else {
+        bcm2835_i2c_begin();
+        bcm2835_i2c_setClockDivider(divider);
+    }
+    lua_pushinteger(L, err);
+    return 1;
 }
 
 static int lr_invmpu_init(lua_State *L)
 {
     int pin_int = (int)luaL_checkinteger(L, 1);
     int sample_rate = (int)luaL_optint(L, 2, 200);
-    int err = invmpu_init(pin_int, sample_rate);
+    int mpl_div = (int)luaL_optint(L, 3, 0);
+    const char *fusion = luaL_optstring(L, 4, NULL);
+    int algo = fusion ? fusion_algo(fusion) : -1;
+    float gain = algo == FUSION_MADGWICK ? FUSION_DEFAULT_BETA : FUSION_DEFAULT_KP;
+    int err;
+
+    if (fusion && algo < 0) {
+        lua_pushinteger(L, -EINVAL);
+        return 1;
+    }
+    invmpu_set_fast_path(mpl_div);
+    invmpu_set_fusion(algo, (float)luaL_optnumber(L, 5, gain),
+                    (float)luaL_optnumber(L, 6, FUSION_DEFAULT_KI));
+    err = invmpu_init(pin_int, sample_rate);
     lua_pushinteger(L, err);
     return 1;
 }
@@ -418,11 +481,46 @@ static int lr_pidctrl_init(lua_State *L)
 /*
  * softpwm
  */
+static const struct {
+    const char *name;
+    int engine;
+} softpwm_engines[] = {
+    { "sample",     SOFTPWM_SAMPLE },
+    { "edge",       SOFTPWM_EDGE },
+    { "oneshot125", SOFTPWM_ONESHOT125 },
+    { "multishot",  SOFTPWM_MULTISHOT },
+    { "dshot150",   SOFTPWM_DSHOT150 },
+    { "dshot300",   SOFTPWM_DSHOT300 },
+    { "dshot600",   SOFTPWM_DSHOT600 },
+};
+
+/*
+ * cycle_time (us), step_time (us), engine ("sample", "edge", an ESC
+ * protocol), step_time_ns, dma_channel, pacer ("pwm", "pcm")
+ */
 static int lr_softpwm_init(lua_State *L)
 {
     int cycle_time_us = (int)luaL_optint(L, 1, 2500);
     int step_time_us = (int)luaL_optint(L, 2, 5);
-    int err = softpwm_init(cycle_time_us, step_time_us);
+    const char *engine = luaL_optstring(L, 3, "sample");
+    int step_time_ns = (int)luaL_optint(L, 4, step_time_us * 1000);
+    int dma_channel = (int)luaL_optint(L, 5, SOFTPWM_DMA_CHANNEL);
+    const char *pacer = luaL_optstring(L, 6, "pwm");
+    int err = -EINVAL;
+    unsigned int i;
+
+    if (strcmp(pacer, "pwm") && strcmp(pacer, "pcm")) {
+        lua_pushinteger(L, err);
+        return 1;
+    }
+    for (i = 0; i < sizeof(softpwm_engines) / sizeof(softpwm_engines[0]); i++) {
+        if (strcmp(engine, softpwm_engines[i].name) == 0) {
+            err = softpwm_init_dma(dma_channel,
+                            strcmp(pacer, "pcm") ? SOFTPWM_PACER_PWM : SOFTPWM_PACER_PCM,
+                            softpwm_engines[i].engine, cycle_time_us, step_time_ns);
+            break;
+        }
+    }
     lua_pushinteger(L, err);
     return 1;
 }
@@ -448,9 +546,10 @@ static int lr_softpwm_set_data(lua_State *L)
     return 1;
 }
 
+/* pinmask up to GPIO 53, a number holds 2^53 exactly */
 static int lr_softpwm_set_multi(lua_State *L)
 {
-    unsigned long pinmask = (unsigned long)luaL_checkinteger(L, 1);
+    uint64_t pinmask = (uint64_t)luaL_checknumber(L, 1);
     int data = (int)luaL_checkinteger(L, 2);
     int err = softpwm_set_multi(pinmask, data);
     lua_pushinteger(L, err);
@@ -875,6 +974,7 @@ static const luaL_Reg luaraspd_lib[] = {
     { "gpio_signal", lr_gpio_signal },
 
     /* misc */
+    { "log",          lr_log          },
     { "i2c_init",     lr_i2c_init     },
     { "pidctrl_init", lr_pidctrl_init },
 
@@ -1087,6 +1187,11 @@ void *luaenv_getdev(const char *name)
 
 int luaenv_init(void)
 {
+    int err;
+
+    if ((err = cmd_ctx_init(&lua_ctx)) < 0)
+        return err;
+
     _L = luaL_newstate();
     luaL_openlibs(_L);
 
@@ -1107,4 +1212,10 @@ void luaenv_exit(void)
 {
     if (_L)
         lua_close(_L);
+    cmd_ctx_destroy(&lua_ctx);
+    if (i2c_bus) {
+        invmpu_set_i2c(NULL);
+        i2cq_del(i2c_bus);
+        i2c_bus = NULL;
+    }
 }
@@ -10,6 +10,7 @@
 #include <tree.h>
 #include <xmalloc.h>
 #include <unix.h>
+#include <arena.h>
 
 #include "module.h"
 
@@ -20,20 +21,133 @@ static int mod_comp(struct module *m1, struct module *m2)
 }
 RB_GENERATE_STATIC(modtree, module, node, mod_comp);
 
+static int nr_modules;
+static unsigned int module_gen = 1;
+
+/*
+ * perfect hash index, rebuilt by module_index_build()
+ * until then lookups go through the tree
+ */
+static struct module **modhash;
+static unsigned int modhash_mask;
+static unsigned int modhash_seed;
+static unsigned int modhash_gen;
+
+/* FNV-1a */
+static inline unsigned int hash_name(const char *name, size_t len,
+                                unsigned int seed)
+{
+    unsigned int h = 2166136261u ^ seed;
+    while (len--) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
 
 void register_module(struct module *m)
 {
-    RB_INSERT(modtree, &modroot, m);
+    if (RB_INSERT(modtree, &modroot, m) == NULL) {
+        nr_modules++;
+        module_gen++;
+    }
 }
 
-static struct module *find_module(const char *name)
+static int try_seed(struct module **table, unsigned int mask, unsigned int seed)
 {
     struct module *m;
+
+    memset(table, 0, (mask + 1) * sizeof(*table));
     RB_FOREACH(m, modtree, &modroot) {
-        if (strcmp(m->name, name) == 0)
+        unsigned int h = hash_name(m->name, strlen(m->name), seed) & mask;
+        if (table[h])
+            return -EEXIST;
+        table[h] = m;
+    }
+    return 0;
+}
+
+/*
+ * called once all __init constructors have run, it may be called
+ * again after late registrations
+ */
+int module_index_build(void)
+{
+    struct module **table;
+    unsigned int size = 4;
+    unsigned int seed;
+
+    while (size < nr_modules * 2)
+        size <<= 1;
+
+    for (; size <= 1 << 16; size <<= 1) {
+        table = xmalloc(size * sizeof(*table));
+        for (seed = 1; seed <= 256; seed++) {
+            if (try_seed(table, size - 1, seed) == 0) {
+                free(modhash);
+                modhash = table;
+                modhash_mask = size - 1;
+                modhash_seed = seed;
+                modhash_gen = module_gen;
+                return 0;
+            }
+        }
+        free(table);
+    }
+    return -ENOSPC;
+}
+
+struct module *module_find(const char *name)
+{
+    struct module key, *m;
+
+    if (modhash_gen == module_gen) {
+        m = modhash[hash_name(name, strlen(name), modhash_seed) & modhash_mask];
+        if (m && strcmp(m->name, name) == 0)
             return m;
+        return NULL;
     }
-    return NULL;
+
+    key.name = name;
+    return RB_FIND(modtree, &modroot, &key);
+}
+
+static struct module *find_module_fallback(const char *name)
+{
+    struct module *m;
+
+    if ((m = module_find(name)) == NULL)
+        m = module_find("luamisc");
+    return m;
+}
+
+/*
+ * resolve name with a per-connection cache of recent names,
+ * fallbacks to luamisc are cached as well
+ */
+struct module *module_find_cached(struct module_cache *cache, const char *name)
+{
+    struct module_cache_entry *ent;
+    size_t len;
+
+    if (cache == NULL)
+        return find_module_fallback(name);
+
+    len = strlen(name);
+    if (len == 0 || len >= MODCACHE_NAMELEN)
+        return find_module_fallback(name);
+
+    ent = &cache->ent[(len ^ (unsigned char)name[len >> 1]
+                    ^ (unsigned char)name[len - 1]) & (MODCACHE_SIZE - 1)];
+    if (ent->gen == module_gen && ent->len == len
+            && memcmp(ent->name, name, len) == 0)
+        return ent->m;
+
+    ent->m = find_module_fallback(name);
+    ent->gen = module_gen;
+    ent->len = len;
+    memcpy(ent->name, name, len);
+    return ent->m;
 }
 
 int foreach_module(int (*fn)(struct module *m, void *opaque), void *opaque)
@@ -48,13 +162,12 @@ int foreach_module(int (*fn)(struct module *m, void *opaque), void *opaque)
     return err;
 }
 
-int module_execv(int wfd, int argc, char *argv[])
+static int execv_cache(struct module_cache *cache,
+                int wfd, int argc, char *argv[])
 {
     struct module *m;
 
-    if ((m = find_module(argv[0])) == NULL)
-        m = find_module("luamisc");
-    if (m == NULL)
+    if ((m = module_find_cached(cache, argv[0])) == NULL)
         return -ENOENT;
 
     /* FIXME  needed? */
@@ -66,59 +179,155 @@ int module_execv(int wfd, int argc, char *argv[])
     return m->main(wfd, argc, argv);
 }
 
+int module_execv(int wfd, int argc, char *argv[])
+{
+    return execv_cache(NULL, wfd, argc, argv);
+}
+
+/*
+ * commands which allocated from the heap: split without a context,
+ * too big for the arena or with too many arguments for module_execl.
+ * stays 0 while every command goes through an arena and fits it.
+ */
+static unsigned long nr_heap_cmds;
+
+unsigned long module_heap_cmds(void)
+{
+    return nr_heap_cmds;
+}
+
+void module_heap_cmd(void)
+{
+    nr_heap_cmds++;
+}
+
+#define EXECL_MAX_ARGS  16
+
 int module_execl(int wfd, const char *modname, /*const char *arg0, ..., 0,*/ ...)
 {
     va_list ap;
     char *p;
     int i;
     int argc = 1;
-    char **argv;
+    char *argv_buf[EXECL_MAX_ARGS + 1];
+    char **argv = argv_buf;
     int err;
 
     va_start(ap, modname);
     while ((p = va_arg(ap, char *)) != NULL)
         argc += 1;
+    va_end(ap);
+
+    if (argc > EXECL_MAX_ARGS) {
+        argv = (char **)xmalloc((argc + 1) * sizeof(char *));
+        nr_heap_cmds++;
+    }
 
     va_start(ap, modname);
-    argv = (char **)xmalloc((argc + 1) * sizeof(char *));
     argv[0] = (char *)modname;
     for (i = 1; (p = va_arg(ap, char *)) != NULL; i++)
         argv[i] = p;
     argv[i] = NULL;
-
     va_end(ap);
 
     err = module_execv(wfd, argc, argv);
 
-    free(argv);
+    if (argv != argv_buf)
+        free(argv);
     return err;
 }
 
-int module_cmdexec(int wfd, const char *cmdexec)
+int cmd_ctx_init(struct cmd_ctx *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    return arena_init(&ctx->arena, CMD_ARENA_SIZE);
+}
+
+void cmd_ctx_destroy(struct cmd_ctx *ctx)
+{
+    arena_destroy(&ctx->arena);
+}
+
+static int cmdexec_heap(struct module_cache *cache,
+                int wfd, const char *cmdexec)
 {
     char **cmd_argv;
     int cmd_argc = 0;
     int err;
 
+    nr_heap_cmds++;
     cmd_argv = cmdline_split(cmdexec, &cmd_argc);
-    if (cmd_argv == NULL || cmd_argc == 0)
+    if (cmd_argv == NULL || cmd_argc == 0) {
+        free_cmd_argv(cmd_argv);
         return -EINVAL;
+    }
 
-    err = module_execv(wfd, cmd_argc, cmd_argv);
+    err = execv_cache(cache, wfd, cmd_argc, cmd_argv);
 
     free_cmd_argv(cmd_argv);
     return err;
 }
 
+/*
+ * tokenize into the arena of ctx, everything is released when the
+ * command returns, falls back to the heap if the arena is exhausted
+ */
+int module_cmdexec_ctx(struct cmd_ctx *ctx, int wfd, const char *cmdexec)
+{
+    char **cmd_argv;
+    int cmd_argc = 0;
+    size_t mark;
+    int err;
+
+    if (ctx == NULL)
+        return cmdexec_heap(NULL, wfd, cmdexec);
+
+    mark = arena_mark(&ctx->arena);
+    cmd_argv = cmdline_split_arena(&ctx->arena, cmdexec, &cmd_argc);
+    if (cmd_argv == NULL) {
+        arena_rewind(&ctx->arena, mark);
+        return cmdexec_heap(&ctx->cache, wfd, cmdexec);
+    }
+
+    err = -EINVAL;
+    if (cmd_argc > 0)
+        err = execv_cache(&ctx->cache, wfd, cmd_argc, cmd_argv);
+
+    arena_rewind(&ctx->arena, mark);
+    return err;
+}
+
+int module_cmdexec(int wfd, const char *cmdexec)
+{
+    return cmdexec_heap(NULL, wfd, cmdexec);
+}
+
 /*********************************************************/
 
 int module_main(int fd, int argc, char *argv[])
 {
     struct module *m;
     char buffer[128];
+    static struct option options[] = {
+        { "stats", no_argument, NULL, 's' },
+        { 0, 0, 0, 0 }
+    };
+    int c, n;
+
+    while ((c = getopt_long(argc, argv, "s", options, NULL)) != -1) {
+        switch (c) {
+        case 's':
+            n = snprintf(buffer, sizeof(buffer), "heap commands: %lu\n",
+                                    nr_heap_cmds);
+            write(fd, buffer, n);
+            return 0;
+        default:
+            return 1;
+        }
+    }
 
     RB_FOREACH(m, modtree, &modroot) {
-        int n = snprintf(buffer, sizeof(buffer), "--> %s\n", m->name);
+        n = snprintf(buffer, sizeof(buffer), "--> %s\n", m->name);
         write(fd, buffer, n);
     }
     return 0;
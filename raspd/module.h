@@ -3,6 +3,7 @@
 
 #include <queue.h>
 #include <tree.h>
+#include <arena.h>
 
 struct module {
     const char *name;
@@ -16,11 +17,43 @@ struct module {
 #define __init  __attribute__((constructor))
 #define __exit  __attribute__((destructor))
 
+#define MODCACHE_SIZE       8   /* power of 2 */
+#define MODCACHE_NAMELEN    24
+
+struct module_cache_entry {
+    unsigned int gen;
+    size_t len;
+    char name[MODCACHE_NAMELEN];
+    struct module *m;
+};
+
+/* zero initialized */
+struct module_cache {
+    struct module_cache_entry ent[MODCACHE_SIZE];
+};
+
+/* per-connection command context */
+#define CMD_ARENA_SIZE      (32 * 1024)
+
+struct cmd_ctx {
+    struct module_cache cache;
+    struct arena arena;
+};
+
+int cmd_ctx_init(struct cmd_ctx *ctx);
+void cmd_ctx_destroy(struct cmd_ctx *ctx);
+
 void register_module(struct module *m);
+int module_index_build(void);
+struct module *module_find(const char *name);
+struct module *module_find_cached(struct module_cache *cache, const char *name);
 int foreach_module(int (*fn)(struct module *m, void *opaque), void *opaque);
 int module_execv(int wfd, int argc, char *argv[]);
 int module_execl(int wfd, const char *modname, /*const char *arg0, ..., 0,*/ ...);
 int module_cmdexec(int wfd, const char *cmdexec);
+int module_cmdexec_ctx(struct cmd_ctx *ctx, int wfd, const char *cmdexec);
+unsigned long module_heap_cmds(void);
+void module_heap_cmd(void);
 
 #define DEFINE_MODULE(mod)                          \
     static struct module __module_ ## mod = {       \
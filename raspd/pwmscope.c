@@ -0,0 +1,319 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <bcm2835.h>
+
+#include "module.h"
+#include "pwmscope.h"
+
+struct capture {
+    struct pwmscope *s;
+    uint64_t duration;      /* us */
+};
+
+static inline uint64_t read_level(volatile uint32_t *lev, uint64_t mask)
+{
+    uint64_t level = lev[0];
+
+    if (mask >> 32)
+        level |= (uint64_t)lev[1] << 32;
+    return level & mask;
+}
+
+static void add_edge(struct pwmscope *s, uint64_t t, uint64_t level)
+{
+    if (s->nr_edges == PWMSCOPE_MAX_EDGES) {
+        s->dropped++;
+        return;
+    }
+    s->edges[s->nr_edges].t = t;
+    s->edges[s->nr_edges].level = level;
+    s->nr_edges++;
+}
+
+/* busy polling, nothing but the timer and the level registers */
+static void *capture_thread(void *arg)
+{
+    struct capture *c = arg;
+    struct pwmscope *s = c->s;
+    volatile uint32_t *lev = bcm2835_gpio + BCM2835_GPLEV0 / 4;
+    uint64_t prev, level, t, end;
+
+    t = bcm2835_st_read();
+    end = t + c->duration;
+    s->start = t;
+
+    /* the first entry is the level at the start */
+    prev = read_level(lev, s->pinmask);
+    add_edge(s, t, prev);
+
+    while ((t = bcm2835_st_read()) < end) {
+        level = read_level(lev, s->pinmask);
+        s->samples++;
+        if (level != prev) {
+            add_edge(s, t, level);
+            prev = level;
+        }
+    }
+    s->end = t;
+    return NULL;
+}
+
+int pwmscope_capture(struct pwmscope *s, uint64_t pinmask, int ms, int cpu)
+{
+    struct capture c = { s, (uint64_t)ms * 1000 };
+    pthread_attr_t attr;
+    pthread_t thread;
+    cpu_set_t cpus;
+    int ncpus, err;
+
+    if (bcm2835_gpio == MAP_FAILED || bcm2835_st == MAP_FAILED)
+        return -ENODEV;
+    if (pinmask == 0 || ms <= 0 || ms > PWMSCOPE_MAX_MS)
+        return -EINVAL;
+
+    memset(s, 0, sizeof(*s));
+    s->pinmask = pinmask;
+    s->edges = malloc(PWMSCOPE_MAX_EDGES * sizeof(*s->edges));
+    if (s->edges == NULL)
+        return -ENOMEM;
+
+    ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu < 0)
+        cpu = ncpus > 1 ? ncpus - 2 : 0;
+    if (cpu >= ncpus) {
+        pwmscope_free(s);
+        return -EINVAL;
+    }
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    err = pthread_create(&thread, &attr, capture_thread, &c);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        pwmscope_free(s);
+        return -err;
+    }
+    pthread_join(thread, NULL);
+    return 0;
+}
+
+void pwmscope_free(struct pwmscope *s)
+{
+    free(s->edges);
+    s->edges = NULL;
+    s->nr_edges = 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+
+    return da < db ? -1 : da > db;
+}
+
+static void summarize(const double v[], unsigned long n, double *avg,
+                double *min, double *max, double *sd)
+{
+    double sum = 0, sum2 = 0;
+    unsigned long i;
+
+    *min = *max = v[0];
+    for (i = 0; i < n; i++) {
+        sum += v[i];
+        sum2 += v[i] * v[i];
+        if (v[i] < *min)
+            *min = v[i];
+        if (v[i] > *max)
+            *max = v[i];
+    }
+    *avg = sum / n;
+    *sd = sqrt(fmax(sum2 / n - *avg * *avg, 0));
+}
+
+int pwmscope_analyze(const struct pwmscope *s, int pin, double nominal,
+                struct scope_stats *st)
+{
+    uint64_t bit = 1ULL << pin, rise = 0;
+    unsigned long i, nr_periods = 0, nr_highs = 0;
+    double *periods, *highs, *sorted;
+    int high;
+
+    memset(st, 0, sizeof(*st));
+    if (pin < 0 || pin >= 64 || !(s->pinmask & bit) || s->nr_edges < 2)
+        return -EINVAL;
+
+    periods = malloc(s->nr_edges * sizeof(double));
+    highs = malloc(s->nr_edges * sizeof(double));
+    sorted = malloc(s->nr_edges * sizeof(double));
+    if (periods == NULL || highs == NULL || sorted == NULL) {
+        free(periods);
+        free(highs);
+        free(sorted);
+        return -ENOMEM;
+    }
+
+    /* a pulse is a rising edge seen in the capture and its falling edge */
+    high = !!(s->edges[0].level & bit);
+    for (i = 1; i < s->nr_edges; i++) {
+        const struct scope_edge *e = &s->edges[i];
+
+        if (!!(e->level & bit) == high)
+            continue;
+        high = !high;
+        if (high) {
+            if (rise)
+                periods[nr_periods++] = e->t - rise;
+            rise = e->t;
+        } else if (rise) {
+            highs[nr_highs++] = e->t - rise;
+        }
+    }
+
+    if (nr_periods == 0 || nr_highs == 0) {
+        free(periods);
+        free(highs);
+        free(sorted);
+        return -ENODATA;
+    }
+
+    summarize(periods, nr_periods, &st->period_avg, &st->period_min,
+                    &st->period_max, &st->period_sd);
+    summarize(highs, nr_highs, &st->high_avg, &st->high_min,
+                    &st->high_max, &st->high_sd);
+    st->pulses = nr_highs;
+    st->duty = st->high_avg / st->period_avg * 100;
+
+    if (nominal <= 0) {
+        memcpy(sorted, periods, nr_periods * sizeof(double));
+        qsort(sorted, nr_periods, sizeof(double), cmp_double);
+        nominal = sorted[nr_periods / 2];
+    }
+    st->nominal = nominal;
+    for (i = 0; i < nr_periods; i++) {
+        if (periods[i] > 1.5 * nominal)
+            st->missed += (unsigned long)(periods[i] / nominal + 0.5) - 1;
+    }
+
+    free(periods);
+    free(highs);
+    free(sorted);
+    return 0;
+}
+
+void pwmscope_report(int fd, const struct pwmscope *s, double nominal)
+{
+    struct scope_stats st;
+    uint64_t span = s->end - s->start;
+    char buffer[256];
+    int pin, n, err;
+
+    n = snprintf(buffer, sizeof(buffer),
+            "%llu us, %lu samples (%.2f/us), %lu edges, %lu dropped\n",
+            (unsigned long long)span, s->samples,
+            span ? (double)s->samples / span : 0, s->nr_edges, s->dropped);
+    write(fd, buffer, n);
+    n = snprintf(buffer, sizeof(buffer), "%-4s %7s %28s %28s %7s %6s (us)\n",
+            "pin", "pulses", "period avg/min/max/sd", "high avg/min/max/sd",
+            "duty", "missed");
+    write(fd, buffer, n);
+
+    for (pin = 0; pin < 64; pin++) {
+        if (!(s->pinmask & (1ULL << pin)))
+            continue;
+        if ((err = pwmscope_analyze(s, pin, nominal, &st)) < 0) {
+            n = snprintf(buffer, sizeof(buffer), "%-4d no pulse train, %s\n", pin,
+                    s->nr_edges && (s->edges[s->nr_edges - 1].level & (1ULL << pin))
+                    ? "high" : "low");
+            write(fd, buffer, n);
+            continue;
+        }
+        n = snprintf(buffer, sizeof(buffer),
+                "%-4d %7lu %7.1f/%6.0f/%6.0f/%6.2f %7.1f/%6.0f/%6.0f/%6.2f %6.2f%% %6lu\n",
+                pin, st.pulses,
+                st.period_avg, st.period_min, st.period_max, st.period_sd,
+                st.high_avg, st.high_min, st.high_max, st.high_sd,
+                st.duty, st.missed);
+        write(fd, buffer, n);
+    }
+}
+
+int pwmscope_parse_pins(const char *s, uint64_t *mask)
+{
+    char *end;
+    long pin;
+
+    *mask = 0;
+    do {
+        pin = strtol(s, &end, 0);
+        if (end == s || pin < 0 || pin > 53)
+            return -EINVAL;
+        *mask |= 1ULL << pin;
+        s = end + 1;
+    } while (*end == ',');
+    return *end ? -EINVAL : 0;
+}
+
+/*
+ * module, runs on the I/O thread: the capture is capped at
+ * PWMSCOPE_CMD_MAX_MS, the longer ones are for test/pwmscope_test
+ */
+static int pwmscope_main(int fd, int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "pins",    required_argument, NULL, 'p' },
+        { "time",    required_argument, NULL, 't' },
+        { "cpu",     required_argument, NULL, 'c' },
+        { "period",  required_argument, NULL, 'P' },
+        { 0, 0, 0, 0 }
+    };
+    struct pwmscope s;
+    uint64_t pinmask = 0;
+    double nominal = 0;
+    int ms = 200, cpu = -1;
+    char buffer[128];
+    int c, err, n;
+
+    while ((c = getopt_long(argc, argv, "p:t:c:P:", options, NULL)) != -1) {
+        switch (c) {
+        case 'p':
+            if (pwmscope_parse_pins(optarg, &pinmask) < 0)
+                return 1;
+            break;
+        case 't': ms = atoi(optarg); break;
+        case 'c': cpu = atoi(optarg); break;
+        case 'P': nominal = atof(optarg); break;
+        default:
+            return 1;
+        }
+    }
+    if (pinmask == 0 || ms > PWMSCOPE_CMD_MAX_MS) {
+        n = snprintf(buffer, sizeof(buffer),
+                "usage: pwmscope -p pin[,pin...] [-t ms <= %d] [-c cpu] [-P period_us]\n",
+                PWMSCOPE_CMD_MAX_MS);
+        write(fd, buffer, n);
+        return 1;
+    }
+
+    if ((err = pwmscope_capture(&s, pinmask, ms, cpu)) < 0) {
+        n = snprintf(buffer, sizeof(buffer), "capture, err = %d\n", err);
+        write(fd, buffer, n);
+        return 1;
+    }
+    pwmscope_report(fd, &s, nominal);
+    pwmscope_free(&s);
+    return 0;
+}
+
+DEFINE_MODULE(pwmscope);
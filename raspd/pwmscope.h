@@ -0,0 +1,56 @@
+#ifndef __PWMSCOPE_H__
+#define __PWMSCOPE_H__
+
+#include <stdint.h>
+
+/*
+ * softpwm output capture
+ *
+ * a thread pinned to a spare core polls GPLEV0/1 against the 1 MHz
+ * free-running system timer and keeps the level changes of the pins.
+ * the analysis rebuilds the pulse train of a pin from them: period,
+ * high time, their jitter and the missed cycles. the resolution is the
+ * 1 us of the timer, the capture blocks the caller.
+ */
+
+#define PWMSCOPE_MAX_EDGES  65536
+#define PWMSCOPE_MAX_MS     5000
+/* the pwmscope command, it blocks the I/O thread */
+#define PWMSCOPE_CMD_MAX_MS 300
+
+struct scope_edge {
+    uint64_t t;             /* us, system timer */
+    uint64_t level;         /* GPLEV1:GPLEV0 after the change */
+};
+
+struct pwmscope {
+    uint64_t pinmask;
+    uint64_t start, end;    /* us */
+    unsigned long samples;  /* GPLEV reads */
+    unsigned long dropped;  /* changes past PWMSCOPE_MAX_EDGES */
+    struct scope_edge *edges;
+    unsigned long nr_edges;
+};
+
+struct scope_stats {
+    unsigned long pulses;
+    double period_avg, period_min, period_max, period_sd;   /* us */
+    double high_avg, high_min, high_max, high_sd;           /* us */
+    double duty;                /* % */
+    double nominal;             /* us, given or the median period */
+    unsigned long missed;       /* periods missing at the nominal rate */
+};
+
+/* cpu < 0: the one before the last, the last runs the control loop */
+int pwmscope_capture(struct pwmscope *s, uint64_t pinmask, int ms, int cpu);
+void pwmscope_free(struct pwmscope *s);
+
+/* nominal period in us, 0: the median */
+int pwmscope_analyze(const struct pwmscope *s, int pin, double nominal,
+                struct scope_stats *st);
+void pwmscope_report(int fd, const struct pwmscope *s, double nominal);
+
+/* "pin[,pin...]", GPIO 0 - 53 */
+int pwmscope_parse_pins(const char *s, uint64_t *mask);
+
+#endif /* __PWMSCOPE_H__ */
@@ -5,16 +5,25 @@
 #include <time.h>
 #include <getopt.h>
 #include <math.h>
+#include <event2/buffer.h>
 
 #include <inv_mpu.h>
 #include <inv_mpu_dmp_motion_driver.h>
 #include <ml_math_func.h>
 
 #include "inv_imu.h"
+#include "event.h"
 #include "module.h"
+#include "binproto.h"
 #include "softpwm.h"
 #include "luaenv.h"
 #include "pid.h"
+#include "rtctrl.h"
+#include "stats.h"
+#include "logger.h"
+#include "telemetry.h"
+#include "raspd.h"
+#include "blackbox.h"
 
 #include "quadcopter.h"
 
@@ -23,8 +32,8 @@
 #define min(x, y) (((x) < (y)) ? (x) : (y))
 #define max(x, y) (((x) > (y)) ? (x) : (y))
 
-#define LOGE(...)   fprintf(stderr, __VA_ARGS__)
-#define LOGI(...)   fprintf(stdout, __VA_ARGS__)
+#define LOGE(...)   rlog_err(__VA_ARGS__)
+#define LOGI(...)   rlog_info(__VA_ARGS__)
 
 #define PITCH 0
 #define ROLL  1
@@ -118,32 +127,82 @@ void eMPL_send_quat(long *quat)
 
 static void update_pwm(void)
 {
+    uint64_t t = stats_now();
+
     esc_front.throttle = max(min(max_throttle, esc_front.throttle), min_throttle);
     esc_rear.throttle  = max(min(max_throttle, esc_rear.throttle),  min_throttle);
     esc_left.throttle  = max(min(max_throttle, esc_left.throttle),  min_throttle);
     esc_right.throttle = max(min(max_throttle, esc_right.throttle), min_throttle);
 
-    softpwm_set_data(esc_front.pin, esc_front.throttle);
-    softpwm_set_data(esc_rear.pin,  esc_rear.throttle);
-    softpwm_set_data(esc_left.pin,  esc_left.throttle);
-    softpwm_set_data(esc_right.pin, esc_right.throttle);
+    /* committed once per control step, see commit_pwm() */
+    softpwm_stage(esc_front.pin, esc_front.throttle);
+    softpwm_stage(esc_rear.pin,  esc_rear.throttle);
+    softpwm_stage(esc_left.pin,  esc_left.throttle);
+    softpwm_stage(esc_right.pin, esc_right.throttle);
+
+    stats_record(STAT_pwm, stats_now() - t);
+}
+
+/* a commit found the DMA on the previous one, the staged widths wait */
+static int pwm_stuck;
+
+static void commit_pwm(void)
+{
+    __atomic_store_n(&pwm_stuck, softpwm_commit() == -EAGAIN, __ATOMIC_RELEASE);
 }
 
 /*
- * executed period
+ * the commits the DMA turned away: the next IMU sample retries them,
+ * the I/O thread does when none comes (IMU stopped, failed or not
+ * running yet)
+ */
+static void retry_pwm(const union rtarg argv[])
+{
+    if (pwm_stuck)
+        commit_pwm();
+}
+
+static void cb_retry_pwm(int fd, short what, void *arg)
+{
+    if (__atomic_load_n(&pwm_stuck, __ATOMIC_ACQUIRE))
+        rtctrl_call(retry_pwm, NULL, 0);
+}
+
+static void post_telemetry(uint64_t timestamp, double target_euler[],
+                double euler[], double gyro[], double pidout1[], double pidout2[])
+{
+    struct tlm_sample sample;
+    int i;
+
+    sample.timestamp = (uint32_t)(timestamp / NS_PER_MS);
+    for (i = 0; i < 3; i++) {
+        sample.euler[i]   = euler[i];
+        sample.target[i]  = target_euler[i];
+        sample.gyro[i]    = gyro[i];
+        sample.pid[i]     = pidout1[i];
+        sample.pid[i + 3] = pidout2[i];
+    }
+    sample.esc[0] = esc_front.throttle;
+    sample.esc[1] = esc_rear.throttle;
+    sample.esc[2] = esc_left.throttle;
+    sample.esc[3] = esc_right.throttle;
+    telemetry_post(&sample);
+}
+
+/*
+ * executed period, dt in ms
  */
 static void attitude_control(double target_euler[], double euler[],
-                        long gyro_long[], long timestamp)
+                        long gyro_long[], double dt, uint64_t now)
 {
     double gyro[3];
-    double dt;
     double pidout1[3];
     double pidout2[3];
+    uint64_t t = stats_now();
 
     gyro[0] = (double)(gyro_long[0] / 65536.f);
     gyro[1] = (double)(gyro_long[1] / 65536.f);
     gyro[2] = (double)(gyro_long[2] / 65536.f);
-    dt = (double)timestamp;
 
     /*
      * angle control is only done on PITCH and ROLL
@@ -164,17 +223,7 @@ static void attitude_control(double target_euler[], double euler[],
     PID(ROLL);
 #undef PID
 
-    fprintf(stdout, "E: %.2f %.2f %.2f E: %.2f %.2f %.2f P: %.2f %.2f %.2f "
-            "G: %.2f %.2f %.2f P: %.2f %.2f %.2f T: %.2f %.2f %.2f %.2f\n",
-            euler[PITCH], euler[ROLL], euler[YAW],
-            target_euler[PITCH], target_euler[ROLL], target_euler[YAW],
-            pidout1[PITCH], pidout1[ROLL], pidout1[YAW],
-            gyro[PITCH], gyro[ROLL], gyro[YAW],
-            pidout2[PITCH], pidout2[ROLL], pidout2[YAW],
-            ( pidout2[PITCH] + pidout2[YAW]),
-            (-pidout2[PITCH] + pidout2[YAW]),
-            ( pidout2[ROLL]  - pidout2[YAW]),
-            (-pidout2[ROLL]  - pidout2[YAW]));
+    stats_record(STAT_attitude, stats_now() - t);
 
     /* set throttle */
     esc_front.throttle += ( pidout2[PITCH] + pidout2[YAW]);
@@ -182,10 +231,13 @@ static void attitude_control(double target_euler[], double euler[],
     esc_left.throttle  += ( pidout2[ROLL]  - pidout2[YAW]);
     esc_right.throttle += (-pidout2[ROLL]  - pidout2[YAW]);
     update_pwm();
+
+    if (telemetry_active())
+        post_telemetry(now, target_euler, euler, gyro, pidout1, pidout2);
 }
 
 static void altitude_control(long target, long current,
-                        long accel_long[], long dt)
+                        long accel_long[], double dt)
 {
     long accel[3];
     double pidout;
@@ -315,19 +367,60 @@ static void quat_to_euler(const long *quat, double *data)
     data[2] = (double)values[2];
 }
 
-static void imu_ready_cb(short sensors, unsigned long timestamp, long quat[],
+static void bb_pid(struct bb_pid *bp, const struct pid_struct *pid)
+{
+    bp->error   = pid->error;
+    bp->sum_err = pid->sum_err;
+    bp->dt_err  = pid->dt_err;
+    bp->output  = pid->output;
+}
+
+static void record_cycle(short sensors, uint64_t timestamp, long quat[],
+            long accel[], long gyro[], double euler[])
+{
+    struct bb_record r;
+    int i;
+
+    r.timestamp = (uint32_t)(timestamp / NS_PER_US);
+    r.sensors = (uint16_t)sensors;
+    r.reserved = 0;
+    for (i = 0; i < 4; i++)
+        r.quat[i] = (int32_t)quat[i];
+    for (i = 0; i < 3; i++) {
+        r.gyro[i]   = (int32_t)gyro[i];
+        r.accel[i]  = (int32_t)accel[i];
+        r.euler[i]  = euler[i];
+        r.target[i] = dst_euler[i];
+        bb_pid(&r.angle[i], &pid_euler[i]);
+        bb_pid(&r.rate[i], &pid_euler_rate[i]);
+    }
+    r.esc[0] = esc_front.throttle;
+    r.esc[1] = esc_rear.throttle;
+    r.esc[2] = esc_left.throttle;
+    r.esc[3] = esc_right.throttle;
+    blackbox_append(&r);
+}
+
+/*
+ * timestamp: ns, of the sample. the gains are for dt in ms, with the
+ * fraction kept: in whole ms it was 4, 5 or 0 (sample dropped) at 200 Hz
+ */
+static void imu_ready_cb(short sensors, uint64_t timestamp, long quat[],
             long accel[], long gyro[], long compass[])
 {
-    static unsigned long prev_timestamp;
-    unsigned long dt;
+    static uint64_t prev_timestamp;
+    double dt;
     long cur_altitude = -1;
+    double euler[3] = { 0, 0, 0 };
+    int attitude = (sensors & INV_XYZ_GYRO) && (sensors & INV_WXYZ_QUAT);
 
     if (prev_timestamp == 0)
         dt = 1;     /* FIXME:  ms ? */
     else
-        dt = timestamp - prev_timestamp;
+        dt = (double)(int64_t)(timestamp - prev_timestamp) / NS_PER_MS;
 
-    if (dt == 0) {
+    /* the same sample again */
+    if (dt <= 0) {
         return;
     }
 
@@ -339,11 +432,19 @@ static void imu_ready_cb(short sensors, unsigned long timestamp, long quat[],
     if (cur_altitude != -1 && (sensors & INV_XYZ_ACCEL))
         altitude_control(dst_altitude, cur_altitude, accel, dt);
 
-    if ((sensors & INV_XYZ_GYRO) && (sensors & INV_WXYZ_QUAT)) {
-        double euler[3];
+    if (attitude) {
         quat_to_euler(quat, euler);
-        attitude_control(dst_euler, euler, gyro, dt);
+        attitude_control(dst_euler, euler, gyro, dt, timestamp);
+    }
 
+    /*
+     * all the ESCs change in the same PWM period, or get one frame each
+     * with a digital ESC protocol
+     */
+    commit_pwm();
+
+    if (attitude) {
+        stats_end(STAT_total);
 
 #ifdef CUBE_HOSTNAME
         eMPL_send_quat(quat);
@@ -358,6 +459,19 @@ static void imu_ready_cb(short sensors, unsigned long timestamp, long quat[],
             euler[0] / 65536.f, euler[1] / 65536.f, euler[2] / 65536.f);
         */
     }
+
+    if (blackbox_active())
+        record_cycle(sensors, timestamp, quat, accel, gyro, euler);
+}
+
+static void arm_escs(const union rtarg argv[])
+{
+    esc_front.throttle = min_throttle;
+    esc_rear.throttle = min_throttle;
+    esc_left.throttle = min_throttle;
+    esc_right.throttle = min_throttle;
+    update_pwm();
+    commit_pwm();
 }
 
 /* TODO */
@@ -380,16 +494,14 @@ int pidctrl_init(int front, int rear, int left, int right,
     }
     */
 
-    esc_front.throttle = min_throttle;
-    esc_rear.throttle = min_throttle;
-    esc_left.throttle = min_throttle;
-    esc_right.throttle = min_throttle;
-
     esc_front.pin = front;
     esc_rear.pin =  rear;
     esc_left.pin =  left;
     esc_right.pin = right;
 
+    /* the ESCs arm on min_throttle, IMU samples or not */
+    rtctrl_call(arm_escs, NULL, 0);
+
     /* which altimeter should be used */
     fptr_get_altitude = get_altitude;
 
@@ -441,13 +553,21 @@ void pidctrl_exit(void)
  * module
  */
 
+#define PWM_RETRY_MS    10
+
 static const char *file_cal;
+static struct event *ev_retry_pwm;
 
 static int euler_init(void)
 {
+    struct timeval tv = { 0, PWM_RETRY_MS * 1000 };
     const char *file = NULL;
     int err;
 
+    err = register_timer(EV_PERSIST, &tv, cb_retry_pwm, NULL, &ev_retry_pwm);
+    if (err < 0)
+        return err;
+
     err = luaenv_getconf_str("_G", "mpu_cal", &file);
     if (err >= 0 && file) {
         file_cal = strdup(file);
@@ -460,14 +580,136 @@ static int euler_init(void)
 
 static void euler_exit(void)
 {
+    if (ev_retry_pwm) {
+        eventfd_del(ev_retry_pwm);
+        ev_retry_pwm = NULL;
+    }
     if (file_cal)
         free((void *)file_cal);
 }
 
+/*
+ * setpoints, executed by the control thread
+ */
+
+/* pitch, roll, yaw and the mask of the ones to set */
+static void set_euler(const union rtarg argv[])
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (argv[3].i & (1 << i))
+            dst_euler[i] = argv[i].f;
+    }
+}
+
+static void set_altitude(const union rtarg argv[])
+{
+    int altitude = argv[0].i;
+
+    if (altitude < 0)
+        altitude = 0;
+    dst_altitude = (long)altitude;
+}
+
+static void incr_throttle(const union rtarg argv[])
+{
+    int incr = argv[0].i;
+
+    /* FIXME: use percent */
+
+    /* set throttle */
+    esc_front.throttle += incr;
+    esc_rear.throttle  += incr;
+    esc_left.throttle  += incr;
+    esc_right.throttle += incr;
+    update_pwm();
+    commit_pwm();
+}
+
+struct cal_result {
+    int wfd;
+    int result;
+    long gyro[3], accel[3];
+};
+
+/* the result line to the client that asked, if still connected */
+static void reply_cal(int wfd, const char *result)
+{
+    struct evbuffer *out;
+
+    if ((out = client_output(wfd)) != NULL)
+        evbuffer_add_printf(out, "self-test: %s\n", result);
+}
+
+/* back on the I/O thread */
+static void save_cal(const void *rec)
+{
+    const struct cal_result *r = rec;
+    time_t t;
+    FILE *fp_cal;
+
+    if (r->result != 0) {
+        if (!(r->result & 0x1))
+            LOGE("Gyro failed.\n");
+        if (!(r->result & 0x2))
+            LOGE("Accel failed.\n");
+        if (!(r->result & 0x4))
+            LOGE("Compass failed.\n");
+        reply_cal(r->wfd, "failed");
+        return;
+    }
+
+    fp_cal = fopen(file_cal, "w+");
+    if (fp_cal == NULL) {
+        fprintf(stderr, "fopen(%s), error\n", file_cal);
+        reply_cal(r->wfd, "passed, the calibration file not written");
+        return;
+    }
+
+    LOGE("Passed!\n");
+    LOGE("accel: %7.4f %7.4f %7.4f\n",
+                r->accel[0]/65536.f,
+                r->accel[1]/65536.f,
+                r->accel[2]/65536.f);
+    LOGE("gyro: %7.4f %7.4f %7.4f\n",
+                r->gyro[0]/65536.f,
+                r->gyro[1]/65536.f,
+                r->gyro[2]/65536.f);
+
+    t = time(NULL);
+    fprintf(fp_cal,
+        "-- automatically generated, do not edit\n"
+        "-- time: %s\n"
+        "\n"
+        "cal_gyro  = { %ld, %ld, %ld }\n"
+        "cal_accel = { %ld, %ld, %ld }\n",
+        ctime(&t),
+        r->gyro[0], r->gyro[1], r->gyro[2],
+        r->accel[0], r->accel[1], r->accel[2]);
+
+    fclose(fp_cal);
+    reply_cal(r->wfd, "passed");
+}
+
+/*
+ * the self test owns the MPU for its duration, the control loop stalls
+ * meanwhile: on the ground only. argv[0]: the client to reply to
+ */
+static void calibrate(const union rtarg argv[])
+{
+    struct cal_result r;
+
+    r.wfd = argv[0].i;
+    r.result = invmpu_get_calibrate_data(r.gyro, r.accel);
+    rtctrl_report(save_cal, &r, sizeof(r));
+}
+
 static int euler_main(int fd, int argc, char *argv[])
 {
     int yaw = 0, pitch = 0, roll = 0;
     int self_test = 0;
+    union rtarg sp[4];
     static struct option options[] = {
         { "yaw",       required_argument, NULL, 'y' },
         { "pitch",     required_argument, NULL, 'p' },
@@ -488,97 +730,93 @@ static int euler_main(int fd, int argc, char *argv[])
         }
     }
 
-    /* self test, get calibrated data */
+    /*
+     * self test, get calibrated data, on the thread of the I2C bus. the
+     * command returns once queued, the result comes on a line of its
+     * own, "self-test: passed" or "self-test: failed", after the reply
+     * when the control thread runs
+     */
     if (file_cal && self_test) {
-        int result;
-        long gyro[3], accel[3];
-        time_t t;
-        FILE *fp_cal;
-
-        result = invmpu_get_calibrate_data(gyro, accel);
-        if (result == 0) {
-            fp_cal = fopen(file_cal, "w+");
-            if (fp_cal == NULL) {
-                fprintf(stderr, "fopen(%s), error\n", file_cal);
-                return 1;
-            }
-
-            LOGE("Passed!\n");
-            LOGE("accel: %7.4f %7.4f %7.4f\n",
-                        accel[0]/65536.f,
-                        accel[1]/65536.f,
-                        accel[2]/65536.f);
-            LOGE("gyro: %7.4f %7.4f %7.4f\n",
-                        gyro[0]/65536.f,
-                        gyro[1]/65536.f,
-                        gyro[2]/65536.f);
-
-            t = time(NULL);
-            fprintf(fp_cal,
-                "-- automatically generated, do not edit\n"
-                "-- time: %s\n"
-                "\n"
-                "cal_gyro  = { %ld, %ld, %ld }\n"
-                "cal_accel = { %ld, %ld, %ld }\n",
-                ctime(&t),
-                gyro[0], gyro[1], gyro[2],
-                accel[0], accel[1], accel[2]);
-
-            fclose(fp_cal);
-            return 0;
-        } else {
-            if (!(result & 0x1))
-                LOGE("Gyro failed.\n");
-            if (!(result & 0x2))
-                LOGE("Accel failed.\n");
-            if (!(result & 0x4))
-                LOGE("Compass failed.\n");
-
-            return 1;
-        }
+        union rtarg arg = { .i = fd };
+        return rtctrl_call(calibrate, &arg, 1) < 0;
     }
 
-    if (yaw)
-        dst_euler[YAW]   = yaw;
-    if (pitch)
-        dst_euler[PITCH] = pitch;
-    if (roll)
-        dst_euler[ROLL]  = roll;
-
-    return 0;
+    sp[PITCH].f = pitch;
+    sp[ROLL].f  = roll;
+    sp[YAW].f   = yaw;
+    sp[3].i = (pitch ? 1 << PITCH : 0) | (roll ? 1 << ROLL : 0)
+                    | (yaw ? 1 << YAW : 0);
+    return rtctrl_call(set_euler, sp, 4) < 0;
 }
 
 static int altitude_main(int fd, int argc, char *argv[])
 {
-    int temp;
+    union rtarg arg;
+
     if (argc < 2)
         return 1;
-    temp = atoi(argv[1]);
-    if (temp < 0)
-        temp = 0;
-
-    dst_altitude = (long)temp;
-    return 0;
+    arg.i = atoi(argv[1]);
+    return rtctrl_call(set_altitude, &arg, 1) < 0;
 }
 
 static int throttle_main(int fd, int argc, char *argv[])
 {
-    int temp;
+    union rtarg arg;
+
     if (argc < 2)
         return 1;
-    temp = atoi(argv[1]);
-
-    /* FIXME: use percent */
-
-    /* set throttle */
-    esc_front.throttle += temp;
-    esc_rear.throttle  += temp;
-    esc_left.throttle  += temp;
-    esc_right.throttle += temp;
-    update_pwm();
-    return 0;
+    arg.i = atoi(argv[1]);
+    return rtctrl_call(incr_throttle, &arg, 1) < 0;
 }
 
 DEFINE_MODULE_INIT_EXIT(euler);
 DEFINE_MODULE(altitude);
 DEFINE_MODULE(throttle);
+
+/*
+ * binary commands, see binproto.h
+ */
+
+/* pitch, roll, yaw */
+static int euler_set_bin(int fd, const union binarg argv[])
+{
+    union rtarg arg[4];
+
+    arg[PITCH].f = argv[0].f;
+    arg[ROLL].f  = argv[1].f;
+    arg[YAW].f   = argv[2].f;
+    arg[3].i = (1 << PITCH) | (1 << ROLL) | (1 << YAW);
+    return rtctrl_call(set_euler, arg, 4);
+}
+
+static int altitude_set_bin(int fd, const union binarg argv[])
+{
+    union rtarg arg;
+
+    arg.i = argv[0].i;
+    return rtctrl_call(set_altitude, &arg, 1);
+}
+
+static int throttle_incr_bin(int fd, const union binarg argv[])
+{
+    union rtarg arg;
+
+    arg.i = argv[0].i;
+    return rtctrl_call(incr_throttle, &arg, 1);
+}
+
+static const struct bincmd euler_bincmds[] = {
+    { "fff", euler_set_bin },
+};
+
+static const struct bincmd altitude_bincmds[] = {
+    { "i", altitude_set_bin },
+};
+
+static const struct bincmd throttle_bincmds[] = {
+    { "i", throttle_incr_bin },
+};
+
+DEFINE_BINCMDS(euler);
+DEFINE_BINCMDS(altitude);
+DEFINE_BINCMDS(throttle);
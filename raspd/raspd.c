@@ -6,10 +6,14 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <sched.h>
 #include <sys/socket.h>
 #include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
 
 #include <xmalloc.h>
+#include <queue.h>
 #include <unix.h>
 #include <sock.h>
 
@@ -17,76 +21,207 @@
 
 #include "inv_imu.h"
 #include "module.h"
+#include "binproto.h"
 #include "event.h"
 #include "luaenv.h"
 #include "gpiolib.h"
 #include "softpwm.h"
+#include "rtctrl.h"
+#include "telemetry.h"
+#include "logger.h"
+#include "raspd.h"
 #include "config.h"
 
-#define BUF_SIZE    1024
+/* longest unterminated text command kept across reads */
+#define MAX_CMDLEN      4096
+/* stop reading from a client which is this far behind */
+#define MAX_INPUT       (64 * 1024)
 
+/*
+ * commands are assembled from the input buffer across reads, the
+ * replies of a whole batch are queued in reply and flushed once.
+ *
+ * NOTE: modules writing to wfd directly bypass the batch
+ */
 struct client_info {
+    LIST_ENTRY(client_info) entry;
     int fd;
-    struct event *ev;
+    int wfd;
+    struct bufferevent *bev;
+    struct evbuffer *reply;
+    struct cmd_ctx ctx;
 };
 
-static int read_cmdexec(int fd, int wfd)
+static LIST_HEAD(, client_info) clients = LIST_HEAD_INITIALIZER(clients);
+
+struct evbuffer *client_output(int wfd)
+{
+    struct client_info *info;
+
+    LIST_FOREACH(info, &clients, entry) {
+        if (info->wfd == wfd)
+            return info->wfd == info->fd ? bufferevent_get_output(info->bev) : NULL;
+    }
+    return NULL;
+}
+
+static void reply_retval(struct client_info *info, int retval)
+{
+    /* must reply */
+    if (retval == 0)
+        evbuffer_add(info->reply, "OK\n", 3);
+    else
+        evbuffer_add_printf(info->reply, "ERR %d\n", retval);
+}
+
+static int is_blank(const char *s)
+{
+    while (*s == ' ' || *s == '\t' || *s == '\r')
+        s++;
+    return *s == '\0';
+}
+
+static void text_cmdexec(struct client_info *info, const char *cmdexec)
 {
-    char buffer[BUF_SIZE];
-    int size;
-
-    size = read(fd, buffer, sizeof(buffer));
-    if (size > 0) {
-        char *str, *cmdexec, *saveptr;
-
-        if (size == sizeof(buffer))
-            buffer[BUF_SIZE - 1] = '\0';
-        else
-            buffer[size] = '\0';
-
-        for (str = buffer; (cmdexec = strtok_r(str, ";", &saveptr)) != NULL; str = NULL) {
-            int retval;
-            char errmsg[32];
-            size_t len;
-
-            retval = module_cmdexec(wfd, cmdexec);
-            /* must reply */
-            if (retval == 0) {
-                write(wfd, "OK\n", 3);
-            } else {
-                len = snprintf(errmsg, sizeof(errmsg), "ERR %d\n", retval);
-                write(wfd, errmsg, len);
+    int retval;
+
+    if (is_blank(cmdexec))
+        return;
+    retval = module_cmdexec_ctx(&info->ctx, info->wfd, cmdexec);
+    reply_retval(info, retval);
+}
+
+/*
+ * execute all complete commands in buf, returns the bytes consumed
+ *
+ * text commands end with ';' or '\n', binary frames (binproto.h)
+ * may be mixed in between them: the magic byte cannot start a text
+ * command, inside one it is text (a UTF-8 continuation byte)
+ */
+static size_t client_cmdexec(struct client_info *info, char *buf, size_t len)
+{
+    char *p = buf, *end = buf + len;
+
+    while (p < end) {
+        char reply[BINPROTO_HDR_SIZE + BINPROTO_ARG_SIZE];
+        char *q;
+        int retval;
+        int n;
+
+        if ((unsigned char)*p == BINPROTO_MAGIC) {
+            n = binproto_exec(info->wfd, p, end - p, &retval);
+            if (n == 0)
+                break;  /* wait for the rest */
+            if (n < 0) {
+                /* cannot resync, drop all */
+                retval = n;
+                n = end - p;
             }
+            evbuffer_add(info->reply, reply,
+                    binproto_pack_reply(reply, p, retval));
+            p += n;
+            continue;
         }
+
+        for (q = p; q < end; q++) {
+            if (*q == ';' || *q == '\n')
+                break;
+        }
+        if (q == end) {
+            if (q - p > MAX_CMDLEN) {
+                reply_retval(info, -EMSGSIZE);
+                p = end;
+            }
+            break;
+        }
+
+        *q = '\0';
+        text_cmdexec(info, p);
+        p = q + 1;
     }
-    return size;
+    return p - buf;
 }
 
-static void cb_read(int fd, short what, void *arg)
+static void client_free(struct client_info *info)
 {
-    struct event *ev = *(void **)arg;
+    telemetry_unsubscribe(info->wfd);
+    LIST_REMOVE(info, entry);
+    bufferevent_free(info->bev);
+    evbuffer_free(info->reply);
+    cmd_ctx_destroy(&info->ctx);
+    free(info);
+}
 
-    if (read_cmdexec(fd, STDOUT_FILENO) < 0)
-        eventfd_del(ev);
+static void cb_client_read(struct bufferevent *bev, void *arg)
+{
+    struct client_info *info = arg;
+    struct evbuffer *input = bufferevent_get_input(bev);
+    size_t len;
+    char *buf;
+
+    len = evbuffer_get_length(input);
+    if ((buf = (char *)evbuffer_pullup(input, len)) == NULL)
+        return;
+    evbuffer_drain(input, client_cmdexec(info, buf, len));
+
+    if (evbuffer_get_length(info->reply) == 0)
+        return;
+    if (info->wfd == info->fd) {
+        bufferevent_write_buffer(bev, info->reply);
+    } else {
+        while (evbuffer_get_length(info->reply) > 0) {
+            if (evbuffer_write(info->reply, info->wfd) < 0) {
+                evbuffer_drain(info->reply, evbuffer_get_length(info->reply));
+                break;
+            }
+        }
+    }
 }
 
-static void cb_recv(int fd, short what, void *arg)
+static void cb_client_event(struct bufferevent *bev, short what, void *arg)
 {
     struct client_info *info = arg;
 
-    if (read_cmdexec(fd, fd) < 0) {
-        eventfd_del(info->ev);
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+        client_free(info);
+}
+
+static struct client_info *client_new(int fd, int wfd, int options)
+{
+    struct client_info *info;
+
+    info = xmalloc(sizeof(*info));
+    memset(info, 0, sizeof(*info));
+    info->fd = fd;
+    info->wfd = wfd;
+    if (cmd_ctx_init(&info->ctx) < 0) {
+        free(info);
+        return NULL;
+    }
+    info->reply = evbuffer_new();
+    info->bev = bufferevent_socket_new(evbase, fd, options);
+    if (info->reply == NULL || info->bev == NULL) {
+        if (info->reply)
+            evbuffer_free(info->reply);
+        if (info->bev)
+            bufferevent_free(info->bev);
+        cmd_ctx_destroy(&info->ctx);
         free(info);
+        return NULL;
     }
+
+    bufferevent_setcb(info->bev, cb_client_read, NULL, cb_client_event, info);
+    bufferevent_setwatermark(info->bev, EV_READ, 0, MAX_INPUT);
+    bufferevent_enable(info->bev, EV_READ | EV_WRITE);
+    LIST_INSERT_HEAD(&clients, info, entry);
+    return info;
 }
 
 static void cb_listen(int fd, short what, void *arg)
 {
     union sockaddr_u remoteaddr;
     socklen_t ss_len;
-    struct client_info *info;
     int fd_cli;
-    int err;
 
     ss_len = sizeof(remoteaddr);
     fd_cli = accept(fd, &remoteaddr.sockaddr, &ss_len);
@@ -100,14 +235,8 @@ static void cb_listen(int fd, short what, void *arg)
         return;
     }
 
-    info = xmalloc(sizeof(*info));
-    info->fd = fd_cli;
-
-    err = eventfd_add(fd_cli, EV_READ | EV_PERSIST,
-                NULL, cb_recv, info, &info->ev);
-    if (err < 0) {
-        fprintf(stderr, "eventfd_add(), err = %d\n", err);
-        free(info);
+    if (client_new(fd_cli, fd_cli, BEV_OPT_CLOSE_ON_FREE) == NULL) {
+        fprintf(stderr, "client_new(), err = %d\n", -ENOMEM);
         close(fd_cli);
         return;
     }
@@ -137,6 +266,8 @@ static int modexec_exit(struct module *m, void *opaque)
 /* shutdown -- its super important to reset the DMA before quitting */
 static void terminate(int dummy)
 {
+    rtctrl_exit();
+
     /* uninitialize all modules */
     foreach_module(modexec_exit, NULL);
 
@@ -148,6 +279,7 @@ static void terminate(int dummy)
     gpiolib_exit();
     bcm2835_close();
     rasp_event_exit();
+    log_exit();
     exit(1);
 }
 
@@ -177,6 +309,8 @@ static void usage(FILE *fp)
         "  -u, --unix-listen <sock>  listen on the unix socket file\n"
         "  -e, --logerr <file>       specify the error log file\n"
         "  -c, --lua-config <file>   specify the lua config file\n"
+        "  -r, --rt-cpu <cpu>        pin the control thread to cpu (default: last)\n"
+        "  -s, --single-thread       run the control loop in the event loop\n"
         "  -h, --help                display this help screen\n"
         );
 
@@ -189,6 +323,8 @@ static void usage(FILE *fp)
  *      name xxx yyy zzz; name2 xxxfff
  *      name yyy=xxx fff
  *      cmd1; cmd2; cmd3; ...
+ *
+ * or binary frames, see binproto.h
  */
 
 int main(int argc, char *argv[])
@@ -199,6 +335,8 @@ int main(int argc, char *argv[])
         { "unix-listen", required_argument, NULL, 'u' },
         { "logerr",      required_argument, NULL, 'e' },
         { "lua-config",  required_argument, NULL, 'c' },
+        { "rt-cpu",      required_argument, NULL, 'r' },
+        { "single-thread", no_argument,     NULL, 's' },
         { "help",        no_argument,       NULL, 'h' },
         { 0, 0, 0, 0 }
     };
@@ -208,17 +346,21 @@ int main(int argc, char *argv[])
     char *logerr = NULL;
     char *lua_conf = DEFAULT_LUA_CONFIG;
     long listen_port = 0;
+    int rt_cpu = -1;
+    int single_thread = 0;
     union sockaddr_u addr;
     int fd = -1;
     int err;
 
-    while ((c = getopt_long(argc, argv, "dl:u:e:c:h", options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "dl:u:e:c:r:sh", options, NULL)) != -1) {
         switch (c) {
         case 'd': daemon = 1; break;
         case 'l': listen_port = strtol(optarg, NULL, 10); break;
         case 'u': unixlisten = optarg; break;
         case 'e': logerr = optarg; break;
         case 'c': lua_conf = optarg; break;
+        case 'r': rt_cpu = atoi(optarg); break;
+        case 's': single_thread = 1; break;
         case 'h': usage(stdout); break;
         default:
             usage(stderr);
@@ -263,6 +405,8 @@ int main(int argc, char *argv[])
             close(logfd);
         }
     }
+    if ((err = log_init(STDERR_FILENO)) < 0)
+        fprintf(stderr, "log_init(), err = %d\n", err);
 
     /* initialize bcm2835 */
     if (!bcm2835_init()) {
@@ -272,14 +416,19 @@ int main(int argc, char *argv[])
     /* init gpiolib */
     gpiolib_init();
 
+    /* all modules are registered by the constructors */
+    if ((err = module_index_build()) < 0)
+        fprintf(stderr, "module_index_build(), err = %d\n", err);
+
     /* early init */
     if ((err = foreach_module(modexec_early_init, NULL)) < 0) {
         fprintf(stderr, "foreach_module(modexec_early_init), err = %d\n", err);
         return 1;
     }
 
-    /* set realtime task */
-    if ((err = sched_realtime()) < 0)
+    /* set realtime task, below the control thread if there is one */
+    err = sched_realtime(single_thread ? 0 : sched_get_priority_max(SCHED_FIFO) / 2);
+    if (err < 0)
     	fprintf(stderr, "sched_realtime(), err = %d\n", err);
 
     /* initialize event base */
@@ -288,6 +437,10 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    /* before the devtree, drivers look for the control thread */
+    if (!single_thread && (err = rtctrl_init(rt_cpu, 0)) < 0)
+        fprintf(stderr, "rtctrl_init(), err = %d\n", err);
+
     /*
      * run the lua file
      * initialize devtree
@@ -304,11 +457,8 @@ int main(int argc, char *argv[])
 
     /* if not daemon, get data from stdin */
     if (!daemon) {
-        static struct event *ev_stdin;
-        err = eventfd_add(STDIN_FILENO, EV_READ | EV_PERSIST,
-                        NULL, cb_read, (void *)&ev_stdin, &ev_stdin);
-        if (err < 0) {
-            fprintf(stderr, "eventfd_add(STDIN_FILENO), err = %d\n", err);
+        if (client_new(STDIN_FILENO, STDOUT_FILENO, 0) == NULL) {
+            fprintf(stderr, "client_new(STDIN_FILENO), err = %d\n", -ENOMEM);
             return 1;
         }
     }
@@ -365,9 +515,16 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (rtctrl_enabled() && (err = rtctrl_start()) < 0) {
+        fprintf(stderr, "rtctrl_start(), err = %d\n", err);
+        return 1;
+    }
+
     /* main loop */
     rasp_event_loop();
 
+    rtctrl_exit();
+
     if (fd != -1)
         close(fd);
 
@@ -378,6 +535,7 @@ int main(int argc, char *argv[])
     gpiolib_exit();
     bcm2835_close();
     rasp_event_exit();
+    log_exit();
 
     return 0;
 }
@@ -0,0 +1,12 @@
+#ifndef __RASPD_H__
+#define __RASPD_H__
+
+struct evbuffer;
+
+/*
+ * output buffer of the socket client writing to wfd, for data
+ * pushed outside of the command replies (telemetry)
+ */
+struct evbuffer *client_output(int wfd);
+
+#endif /* __RASPD_H__ */
@@ -0,0 +1,465 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include <event2/event.h>
+
+#include <spsc.h>
+
+#include "clock.h"
+#include "event.h"
+#include "module.h"
+#include "logger.h"
+#include "rtctrl.h"
+
+#define CALL_RING       64
+#define REPORT_RING     256
+#define DRAIN_MS        10
+#define STACK_PREFAULT  (64 * 1024)
+
+struct rtcall {
+    rtctrl_fn fn;
+    union rtarg argv[RTCTRL_MAX_ARGS];
+};
+
+struct rtreport {
+    rtctrl_report_fn fn;
+    char rec[RTCTRL_REPORT_SIZE];
+};
+
+struct rtirq {
+    int fd;
+    short events;
+    rtctrl_irq_fn fn;
+    void *opaque;
+    long long last;
+    struct rtctrl_stats st;
+};
+
+static struct {
+    int enabled;
+    int running;
+    int cpu;
+    int priority;
+    pthread_t thread;
+    int wakefd;
+    int stop;
+
+    struct spsc calls;
+    struct rtcall call_buf[CALL_RING];
+    unsigned long call_drops;
+
+    struct spsc reports;
+    struct rtreport report_buf[REPORT_RING];
+    unsigned long report_drops;
+    struct event *ev_drain;
+
+    /* owned by the control thread once running */
+    struct rtirq irqs[RTCTRL_MAX_IRQS];
+    int nr_irqs;
+} rt = {
+    .wakefd = -1,
+};
+
+static inline long long now_ns(void)
+{
+    return (long long)raspd_now_ns();
+}
+
+static void reset_stats(struct rtirq *irq)
+{
+    memset(&irq->st, 0, sizeof(irq->st));
+    irq->last = 0;
+}
+
+/* argv[4]: the result, when run in place */
+static void do_add_irq(const union rtarg argv[])
+{
+    struct rtirq *irq;
+    int *err = argv[4].p;
+
+    if (rt.nr_irqs >= RTCTRL_MAX_IRQS) {
+        rlog_err("rtctrl: no room for the irq of fd %d\n", argv[0].i);
+        if (err)
+            *err = -ENOSPC;
+        return;
+    }
+    irq = &rt.irqs[rt.nr_irqs++];
+    irq->fd = argv[0].i;
+    irq->fn = (rtctrl_irq_fn)argv[1].p;
+    irq->opaque = argv[2].p;
+    irq->events = (short)argv[3].i;
+    reset_stats(irq);
+}
+
+static void do_del_irq(const union rtarg argv[])
+{
+    int i;
+
+    for (i = 0; i < rt.nr_irqs; i++) {
+        if (rt.irqs[i].fd == argv[0].i) {
+            rt.irqs[i] = rt.irqs[--rt.nr_irqs];
+            return;
+        }
+    }
+}
+
+static void do_reset_stats(const union rtarg argv[])
+{
+    int i;
+
+    for (i = 0; i < rt.nr_irqs; i++)
+        reset_stats(&rt.irqs[i]);
+}
+
+static void dispatch_irq(struct rtirq *irq)
+{
+    long long t0, t1;
+
+    t0 = now_ns();
+    if (irq->last) {
+        long long period = t0 - irq->last;
+
+        if (irq->st.count == 0 || period < irq->st.period_min)
+            irq->st.period_min = period;
+        if (period > irq->st.period_max)
+            irq->st.period_max = period;
+        irq->st.period_sum += period;
+        irq->st.count++;
+    }
+    irq->last = t0;
+
+    irq->fn(irq->fd, irq->opaque);
+
+    t1 = now_ns();
+    if (t1 - t0 > irq->st.run_max)
+        irq->st.run_max = t1 - t0;
+}
+
+static void drain_calls(void)
+{
+    struct rtcall *c;
+
+    while ((c = spsc_peek(&rt.calls)) != NULL) {
+        c->fn(c->argv);
+        spsc_release(&rt.calls);
+    }
+}
+
+static void *rtctrl_thread(void *arg)
+{
+    struct pollfd pfd[RTCTRL_MAX_IRQS + 1];
+    char stack[STACK_PREFAULT];
+    sigset_t set;
+    uint64_t v;
+    int nr, i;
+
+    /* signals are for the I/O thread */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    /* no page faults on the stack later on */
+    memset(stack, 0, sizeof(stack));
+    /* nor an allocation on the first log call */
+    if (log_register_thread() < 0)
+        fprintf(stderr, "rtctrl: no log ring, the thread logs nothing\n");
+
+    pfd[0].fd = rt.wakefd;
+    pfd[0].events = POLLIN;
+
+    while (!__atomic_load_n(&rt.stop, __ATOMIC_ACQUIRE)) {
+        nr = rt.nr_irqs;
+        for (i = 0; i < nr; i++) {
+            pfd[i + 1].fd = rt.irqs[i].fd;
+            pfd[i + 1].events = rt.irqs[i].events;
+        }
+
+        if (poll(pfd, nr + 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            rlog_err("rtctrl: poll(), errno = %d\n", errno);
+            break;
+        }
+
+        /* interrupts first, setpoints are applied right after */
+        for (i = 0; i < nr; i++) {
+            if (pfd[i + 1].revents & rt.irqs[i].events)
+                dispatch_irq(&rt.irqs[i]);
+        }
+
+        if (pfd[0].revents & POLLIN)
+            read(rt.wakefd, &v, sizeof(v));
+        drain_calls();
+    }
+    return NULL;
+}
+
+/*
+ * I/O thread, deliver the telemetry of the control thread
+ */
+static void cb_drain(int fd, short what, void *arg)
+{
+    struct rtreport *r;
+
+    while ((r = spsc_peek(&rt.reports)) != NULL) {
+        r->fn(r->rec);
+        spsc_release(&rt.reports);
+    }
+}
+
+int rtctrl_call(rtctrl_fn fn, const union rtarg argv[], int argc)
+{
+    struct rtcall *c;
+    uint64_t v = 1;
+
+    if (argc > RTCTRL_MAX_ARGS)
+        return -EINVAL;
+
+    if (!rt.running) {
+        fn(argv);
+        return 0;
+    }
+
+    if ((c = spsc_claim(&rt.calls)) == NULL) {
+        rt.call_drops++;
+        return -EAGAIN;
+    }
+    c->fn = fn;
+    if (argc > 0)
+        memcpy(c->argv, argv, argc * sizeof(argv[0]));
+    spsc_publish(&rt.calls);
+
+    write(rt.wakefd, &v, sizeof(v));
+    return 0;
+}
+
+int rtctrl_report(rtctrl_report_fn fn, const void *rec, size_t len)
+{
+    struct rtreport *r;
+
+    if (len > RTCTRL_REPORT_SIZE)
+        return -EMSGSIZE;
+
+    if (!rt.running) {
+        fn(rec);
+        return 0;
+    }
+
+    /* drop rather than block the control loop */
+    if ((r = spsc_claim(&rt.reports)) == NULL) {
+        rt.report_drops++;
+        return -ENOBUFS;
+    }
+    r->fn = fn;
+    memcpy(r->rec, rec, len);
+    spsc_publish(&rt.reports);
+    return 0;
+}
+
+int rtctrl_add_irq(int fd, short events, rtctrl_irq_fn fn, void *opaque)
+{
+    union rtarg argv[5];
+    int err = 0, ret;
+
+    if (!rt.enabled)
+        return -ENODEV;
+
+    /* nr_irqs belongs to the control thread, do_add_irq() checks it */
+    argv[0].i = fd;
+    argv[1].p = (void *)fn;
+    argv[2].p = opaque;
+    argv[3].i = events;
+    argv[4].p = rt.running ? NULL : &err;
+    if ((ret = rtctrl_call(do_add_irq, argv, 5)) < 0)
+        return ret;
+    return err;
+}
+
+void rtctrl_del_irq(int fd)
+{
+    union rtarg argv[1];
+
+    argv[0].i = fd;
+    rtctrl_call(do_del_irq, argv, 1);
+}
+
+int rtctrl_get_stats(int irq, struct rtctrl_stats *st)
+{
+    if (irq < 0 || irq >= rt.nr_irqs)
+        return -ENOENT;
+    /* racy snapshot, good enough for diagnostics */
+    *st = rt.irqs[irq].st;
+    return 0;
+}
+
+int rtctrl_enabled(void)
+{
+    return rt.enabled;
+}
+
+int rtctrl_start(void)
+{
+    pthread_attr_t attr;
+    struct sched_param sp;
+    cpu_set_t cpus;
+    int ncpus, i;
+    int err;
+
+    if (!rt.enabled || rt.running)
+        return -EINVAL;
+
+    ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    CPU_ZERO(&cpus);
+    CPU_SET(rt.cpu, &cpus);
+
+    memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = rt.priority;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &sp);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+
+    rt.stop = 0;
+    err = pthread_create(&rt.thread, &attr, rtctrl_thread, NULL);
+    if (err == EPERM) {
+        /* not privileged, keep the thread and the pinning anyway */
+        fprintf(stderr, "rtctrl: SCHED_FIFO not permitted\n");
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        err = pthread_create(&rt.thread, &attr, rtctrl_thread, NULL);
+    }
+    pthread_attr_destroy(&attr);
+    if (err)
+        return -err;
+
+    /* keep the I/O thread off the control core */
+    if (ncpus > 1) {
+        CPU_ZERO(&cpus);
+        for (i = 0; i < ncpus; i++) {
+            if (i != rt.cpu)
+                CPU_SET(i, &cpus);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    rt.running = 1;
+    return 0;
+}
+
+void rtctrl_stop(void)
+{
+    uint64_t v = 1;
+
+    if (!rt.running)
+        return;
+    __atomic_store_n(&rt.stop, 1, __ATOMIC_RELEASE);
+    write(rt.wakefd, &v, sizeof(v));
+    pthread_join(rt.thread, NULL);
+    rt.running = 0;
+
+    /* leftovers are executed in place */
+    drain_calls();
+    cb_drain(-1, 0, NULL);
+}
+
+/*
+ * cpu < 0: the last online cpu, priority <= 0: the maximum
+ */
+int rtctrl_init(int cpu, int priority)
+{
+    struct timeval tv = { 0, DRAIN_MS * 1000 };
+    int ncpus;
+    int err;
+
+    if (rt.enabled)
+        return -EEXIST;
+
+    ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu < 0 || cpu >= ncpus)
+        cpu = ncpus - 1;
+    if (priority <= 0)
+        priority = sched_get_priority_max(SCHED_FIFO);
+    rt.cpu = cpu;
+    rt.priority = priority;
+
+    spsc_init(&rt.calls, rt.call_buf, CALL_RING, sizeof(rt.call_buf[0]));
+    spsc_init(&rt.reports, rt.report_buf, REPORT_RING, sizeof(rt.report_buf[0]));
+
+    if ((rt.wakefd = eventfd(0, EFD_NONBLOCK)) < 0)
+        return -errno;
+
+    err = register_timer(EV_PERSIST, &tv, cb_drain, NULL, &rt.ev_drain);
+    if (err < 0) {
+        close(rt.wakefd);
+        rt.wakefd = -1;
+        return err;
+    }
+
+    rt.enabled = 1;
+    return 0;
+}
+
+void rtctrl_exit(void)
+{
+    if (!rt.enabled)
+        return;
+    rtctrl_stop();
+    eventfd_del(rt.ev_drain);
+    rt.ev_drain = NULL;
+    close(rt.wakefd);
+    rt.wakefd = -1;
+    rt.enabled = 0;
+}
+
+/*
+ * module
+ */
+static int rtctrl_main(int fd, int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "reset", no_argument, NULL, 'r' },
+        { 0, 0, 0, 0 }
+    };
+    struct rtctrl_stats st;
+    char buffer[256];
+    int c, i, n;
+
+    while ((c = getopt_long(argc, argv, "r", options, NULL)) != -1) {
+        switch (c) {
+        case 'r':
+            return rtctrl_call(do_reset_stats, NULL, 0) < 0;
+        default:
+            return 1;
+        }
+    }
+
+    n = snprintf(buffer, sizeof(buffer), "%s cpu %d prio %d, "
+            "call drops %lu, report drops %lu\n",
+            rt.running ? "running" : "stopped", rt.cpu, rt.priority,
+            rt.call_drops, rt.report_drops);
+    write(fd, buffer, n);
+
+    for (i = 0; rtctrl_get_stats(i, &st) == 0; i++) {
+        n = snprintf(buffer, sizeof(buffer), "irq %d: %lu periods, "
+                "min %lld avg %lld max %lld us, jitter %lld us, run max %lld us\n",
+                i, st.count, st.period_min / 1000,
+                st.count ? st.period_sum / st.count / 1000 : 0,
+                st.period_max / 1000,
+                (st.period_max - st.period_min) / 1000, st.run_max / 1000);
+        write(fd, buffer, n);
+    }
+    return 0;
+}
+
+DEFINE_MODULE(rtctrl);
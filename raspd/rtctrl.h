@@ -0,0 +1,67 @@
+#ifndef __RTCTRL_H__
+#define __RTCTRL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * real-time control thread
+ *
+ * the IMU interrupt -> fusion -> PID -> softpwm chain runs on its own
+ * SCHED_FIFO thread pinned to a core, away from the libevent loop.
+ * the I/O thread hands setpoints over with rtctrl_call(), the control
+ * thread hands telemetry back with rtctrl_report(), both through
+ * lock-free SPSC rings.
+ *
+ * until rtctrl_start() (or when the thread is disabled) calls and
+ * reports are executed in place, the caller is the control loop.
+ */
+
+#define RTCTRL_MAX_ARGS     5
+#define RTCTRL_MAX_IRQS     4
+#define RTCTRL_REPORT_SIZE  112
+
+union rtarg {
+    int32_t i;
+    float f;
+    void *p;
+};
+
+typedef void (*rtctrl_fn)(const union rtarg argv[]);
+typedef void (*rtctrl_report_fn)(const void *rec);
+typedef void (*rtctrl_irq_fn)(int fd, void *opaque);
+
+struct rtctrl_stats {
+    unsigned long count;
+    long long period_min;       /* ns */
+    long long period_max;
+    long long period_sum;
+    long long run_max;          /* handler runtime, ns */
+};
+
+int rtctrl_init(int cpu, int priority);
+void rtctrl_exit(void);
+int rtctrl_start(void);
+void rtctrl_stop(void);
+int rtctrl_enabled(void);
+
+/*
+ * fd signals events (POLLIN or POLLPRI) on every interrupt, fn must
+ * acknowledge it: read the queue empty, or re-arm a sysfs value fd
+ * (lseek and read, bcm2835_gpio_irq_ack()). sysfs value fds poll
+ * readable all the time, they take POLLPRI alone. -ENOSPC for more
+ * than RTCTRL_MAX_IRQS before rtctrl_start(), once running a full
+ * table is only logged
+ */
+int rtctrl_add_irq(int fd, short events, rtctrl_irq_fn fn, void *opaque);
+void rtctrl_del_irq(int fd);
+
+/* I/O thread -> control thread */
+int rtctrl_call(rtctrl_fn fn, const union rtarg argv[], int argc);
+
+/* control thread -> I/O thread, rec is copied */
+int rtctrl_report(rtctrl_report_fn fn, const void *rec, size_t len);
+
+int rtctrl_get_stats(int irq, struct rtctrl_stats *st);
+
+#endif /* __RTCTRL_H__ */
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <stdint.h>
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -18,14 +19,25 @@
 #define PAGE_SIZE   4096
 #define PAGE_SHIFT  12
 
-/* kernel mapped address */
-#define DMA_BASE    0x20007000
-#define DMA_LEN     0x24
+/* kernel mapped address, channel n at DMA_BASE + n * DMA_CHAN_LEN */
+#define DMA_BASE        0x20007000
+#define DMA_CHAN_LEN    0x100
+#define DMA_LEN         0x24
+/* channel 15 is elsewhere */
+#define NR_DMA_CHANNELS 15
+
+#define PCM_BASE        0x20203000
+#define PCM_LEN         0x24
 
 /* bus address */
 #define PHYS_GPIO       0x7e200000
 #define PHYS_GPCLR0     (PHYS_GPIO + 0x28)
+#define PHYS_GPCLR1     (PHYS_GPIO + 0x2c)
 #define PHYS_GPSET0     (PHYS_GPIO + 0x1c)
+#define PHYS_GPSET1     (PHYS_GPIO + 0x20)
+/* XXX  ??? */
+#define PHYS_PWM_FIFO   ((BCM2835_GPIO_PWM | 0x7e000000) + (BCM2835_PWM_FIF1 * 4))
+#define PHYS_PCM_FIFO   0x7e203004
 
 /* reg index */
 #define DMA_CS          (0x00 / 4)
@@ -37,15 +49,28 @@
 #define PWM_RNG1        (0x10 / 4)
 #define PWM_FIFO        (0x18 / 4)
 
+#define PCM_CS          (0x00 / 4)
+#define PCM_FIFO        (0x04 / 4)
+#define PCM_MODE        (0x08 / 4)
+#define PCM_RXC         (0x0c / 4)
+#define PCM_TXC         (0x10 / 4)
+#define PCM_DREQ        (0x14 / 4)
+
+#define PCMCLK_CNTL     38
+#define PCMCLK_DIV      39
 #define PWMCLK_CNTL     40
 #define PWMCLK_DIV      41
 
 /* flags */
 #define DMA_NO_WIDE_BURSTS  (1 << 26)
 #define DMA_WAIT_RESP       (1 << 3)
+#define DMA_DEST_INC        (1 << 4)
+#define DMA_SRC_INC         (1 << 8)
 #define DMA_D_DREQ          (1 << 6)
+#define DMA_SRC_IGNORE      (1 << 11)
 #define DMA_PER_MAP(x)      ((x) << 16)
 #define DMA_END             (1 << 1)
+#define DMA_ACTIVE          (1 << 0)
 #define DMA_RESET           (1 << 31)
 #define DMA_INT             (1 << 2)
 
@@ -57,6 +82,18 @@
 #define PWMDMAC_ENAB        (1 << 31)
 #define PWMDMAC_THRSHLD     ((15 << 8) | (15 << 0))
 
+#define PCMCS_EN            (1 << 0)
+#define PCMCS_TXON          (1 << 2)
+#define PCMCS_TXCLR         (1 << 3)
+#define PCMCS_RXCLR         (1 << 4)
+#define PCMCS_DMAEN         (1 << 9)
+
+#define PCMTXC_CH1EN        (1 << 30)
+#define PCMMODE_FLEN(x)     ((x) << 10)
+#define PCMMODE_MIN_FLEN    8       /* the 8 bit channel */
+#define PCMMODE_MAX_FLEN    1024
+#define PCMDREQ_TX(x)       (((x) << 24) | ((x) << 8))
+
 /* defined by bcm2835, 8 words, 256 bits */
 struct control_blk {
     unsigned long info;
@@ -73,27 +110,109 @@ struct page_map {
     unsigned long phys_addr;
 };
 
-volatile static unsigned long *ioreg_clk;
-volatile static unsigned long *ioreg_pwm;
-volatile static unsigned long *ioreg_dma = MAP_FAILED;
-
-static unsigned char *virtbase = MAP_FAILED;
-static struct control_blk *cb;
-static unsigned long *sample;
-static struct page_map *pagemaps;
+/*
+ * the FIFO the DMA writes a word to per step, its DREQ and depth. the
+ * PCM sends one word per frame of PCM_MODE FLEN + 1 bit clocks.
+ */
+static const struct {
+    int dreq;
+    unsigned long fifo;
+    int fifo_depth;
+} pacers[] = {
+    [SOFTPWM_PACER_PWM] = { 5, PHYS_PWM_FIFO, 16 },
+    [SOFTPWM_PACER_PCM] = { 2, PHYS_PCM_FIFO, 64 },
+};
 
-static int cycle_time_us;  /* us */
-static int sample_time_us; /* us */
+/*
+ * GPIO 0 - 53, a step is one 64 bit mask: bank 1 registers follow the
+ * bank 0 ones, an 8 byte DMA write sets (clears) both banks at once.
+ * the DMA moves 32 bit words, the write needs DMA_GPIO_INC to step
+ * the source and the destination from bank 0 to bank 1.
+ */
+#define MAX_CHANNEl     54
+#define GPIO_WORD       sizeof(uint64_t)
+#define DMA_GPIO_INC    (DMA_SRC_INC | DMA_DEST_INC)
+#define FIFO_WORD       sizeof(uint32_t)
 
-static int nr_samples;
-static int nr_pages;
+/*
+ * one sample table and its control block loop, the DMA runs one while
+ * the other one is written
+ */
+struct pwm_buf {
+    struct control_blk *cb;
+    int nr_cbs;                 /* allocated */
+    struct control_blk *last;   /* loops back to cb */
+    uint64_t *sample;           /* sample table, or the edge masks */
+    /* first sample clearing the pin, what sample[] holds right now */
+    int width[MAX_CHANNEl];
+};
 
-#define MAX_CHANNEl     32
+/* a group of pins on one DMA channel */
+struct softpwm_dev {
+    int dma_channel;
+    int pacer;
+    int engine;
+    int cycle_time_us;          /* us */
+    int step_time_ns;           /* ns */
+    int data_unit_ns;           /* frame engines */
+
+    int nr_samples;             /* steps per cycle */
+    int nr_pages;
+
+    volatile unsigned long *ioreg_clk;
+    volatile unsigned long *ioreg_pacer;
+    volatile unsigned long *ioreg_dma;
+    void *dma_map;              /* the page of the DMA channels */
+    void *pcm_map;
+
+    unsigned char *virtbase;
+    struct page_map *pagemaps;
+
+    struct pwm_buf bufs[2];
+    int active;                 /* last committed */
+    int pending;                /* the DMA has not jumped to it yet */
+
+    /* staged */
+    uint64_t channel_mask;
+    uint64_t channel_used;              /* ever staged */
+    int channel_data[MAX_CHANNEl];      /* pin0 - pin53 */
+    int channel_width[MAX_CHANNEl];
+    int dirty;
+
+    int initialized;
+    int simulated;
+};
 
-static unsigned long channel_mask;
-static int channel_data[MAX_CHANNEl];   /* pin1 - pin32 */
+/* by DMA channel, one group per pacer */
+static struct softpwm_dev *channels[NR_DMA_CHANNELS];
+/* pins staged on a group */
+static uint64_t claimed;
+/* softpwm_init(), softpwm_stage(), ... */
+static struct softpwm_dev *softpwm_default;
 
-static int initialized;
+/*
+ * simulated backend: the registers and the DMA memory are ordinary
+ * memory, softpwm_sim_run() interprets the control blocks of every
+ * running channel
+ */
+static struct {
+    unsigned long dma[NR_DMA_CHANNELS][DMA_LEN / 4];
+    unsigned long clk[PWMCLK_DIV + 1];
+    unsigned long pwm[PWM_FIFO + 1];
+    unsigned long pcm[PCM_DREQ + 1];
+    struct {
+        uint64_t at;            /* ns, ready for the next word or block */
+        unsigned long words;    /* of the running control block */
+    } chan[NR_DMA_CHANNELS];
+    uint64_t drain[2];          /* the pacer FIFO is empty at */
+    uint64_t now;               /* ns */
+    uint64_t level;             /* GPIO */
+    int cb_time;                /* ns, control block load */
+    int users;                  /* simulated groups */
+    softpwm_edge_fn edge_fn;
+    void *edge_arg;
+    struct softpwm_sim_stats stats;
+} sim;
 
 static void udelay(int us)
 {
@@ -101,83 +220,423 @@ static void udelay(int us)
     nanosleep(&ts, NULL);
 }
 
-static unsigned long virt_to_phys(void *virt)
+static unsigned long virt_to_phys(struct softpwm_dev *dev, void *virt)
+{
+    unsigned long offset = (unsigned char *)virt - dev->virtbase;
+    return dev->pagemaps[offset >> PAGE_SHIFT].phys_addr + (offset % PAGE_SIZE);
+}
+
+static void *phys_to_virt(struct softpwm_dev *dev, unsigned long phys)
 {
-    unsigned long offset = (unsigned char *)virt - virtbase;
-    return pagemaps[offset >> PAGE_SHIFT].phys_addr + (offset % PAGE_SIZE);
+    int i;
+
+    for (i = 0; i < dev->nr_pages; i++) {
+        if (dev->pagemaps[i].phys_addr == (phys & ~(PAGE_SIZE - 1)))
+            return dev->virtbase + i * PAGE_SIZE + (phys & (PAGE_SIZE - 1));
+    }
+    return NULL;
+}
+
+/* the DMA goes on while waiting when simulated */
+static void wait_us(struct softpwm_dev *dev, int us)
+{
+    if (dev->simulated)
+        softpwm_sim_run((uint64_t)us * 1000);
+    else
+        udelay(us);
 }
 
-static void init_ctrl_data(void)
+static void init_samples(struct softpwm_dev *dev, struct pwm_buf *b)
 {
     struct control_blk *cbp;
-    unsigned long phys_fifo_addr;
     int i;
 
-    cbp = cb;
-    /* XXX  ??? */
-    phys_fifo_addr = (BCM2835_GPIO_PWM | 0x7e000000) + (BCM2835_PWM_FIF1 * 4);
+    cbp = b->cb;
 
-    memset(sample, 0, nr_samples * sizeof(unsigned long));
+    memset(b->sample, 0, dev->nr_samples * GPIO_WORD);
+    for (i = 0; i < MAX_CHANNEl; i++)
+        b->width[i] = dev->nr_samples;
 
 	/*
      * Initialize all the DMA commands. They come in pairs.
-	 *  - 1st command copies a value from the sample memory to a destination 
+	 *  - 1st command copies a value from the sample memory to a destination
 	 *    address which can be either the gpclr0 register or the gpset0 register
 	 *  - 2nd command waits for a trigger from an external source (PWM or PCM)
 	 */
-    for (i = 0; i < nr_samples; i++) {
+    for (i = 0; i < dev->nr_samples; i++) {
         /* first DMA command */
-        cbp->info = DMA_NO_WIDE_BURSTS | DMA_WAIT_RESP;
-        cbp->src = virt_to_phys(sample + i);
+        cbp->info = DMA_NO_WIDE_BURSTS | DMA_WAIT_RESP | DMA_GPIO_INC;
+        cbp->src = virt_to_phys(dev, b->sample + i);
         cbp->dst = PHYS_GPCLR0;
-        cbp->length = sizeof(unsigned long);
+        cbp->length = GPIO_WORD;
         cbp->stride = 0;
-        cbp->next = virt_to_phys(cbp + 1);
+        cbp->next = virt_to_phys(dev, cbp + 1);
         cbp++;
 
         /* second DMA command */
         cbp->info = DMA_NO_WIDE_BURSTS | DMA_WAIT_RESP
-                            | DMA_D_DREQ | DMA_PER_MAP(5/*PWM*/);
-        cbp->src = virt_to_phys(sample);    /* any data will do */
-        cbp->dst = phys_fifo_addr;
-        cbp->length = sizeof(unsigned long);
+                            | DMA_D_DREQ | DMA_PER_MAP(pacers[dev->pacer].dreq);
+        cbp->src = virt_to_phys(dev, b->sample);    /* any data will do */
+        cbp->dst = pacers[dev->pacer].fifo;
+        cbp->length = FIFO_WORD;
         cbp->stride = 0;
-        cbp->next = virt_to_phys(cbp + 1);
+        cbp->next = virt_to_phys(dev, cbp + 1);
         cbp++;
     }
     cbp--;
-    cbp->next = virt_to_phys(cb); /* do loop */
+    cbp->next = virt_to_phys(dev, b->cb); /* do loop */
+    b->last = cbp;
+}
+
+/*
+ * edge engine
+ *
+ * control blocks only where a pin changes: set the active pins, then
+ * for every distinct width a FIFO write of the dwell (one word per
+ * step, paced by the DREQ of the PWM or the PCM) followed by the clear
+ * of the pins ending there, and the dwell up to the end of the period.
+ *
+ * the DMA does one FIFO write per step and no control block load or
+ * GPIO write in between edges, the step can go down to the 100 ns of
+ * the pacer clock. edges closer than a control block load (~1 us) are
+ * delayed by it.
+ */
+#define EDGE_CBS    (2 * MAX_CHANNEl + 3)
+#define EDGE_WORDS  (MAX_CHANNEl + 1)
+
+static struct control_blk *gpio_cb(struct softpwm_dev *dev,
+                struct control_blk *cbp, uint64_t *word, unsigned long dst)
+{
+    cbp->info = DMA_NO_WIDE_BURSTS | DMA_WAIT_RESP | DMA_GPIO_INC;
+    cbp->src = virt_to_phys(dev, word);
+    cbp->dst = dst;
+    cbp->length = GPIO_WORD;
+    cbp->stride = 0;
+    cbp->next = virt_to_phys(dev, cbp + 1);
+    return cbp + 1;
+}
+
+static struct control_blk *dwell_cb(struct softpwm_dev *dev,
+                struct control_blk *cbp, int steps)
+{
+    cbp->info = DMA_NO_WIDE_BURSTS | DMA_WAIT_RESP | DMA_SRC_IGNORE
+                            | DMA_D_DREQ | DMA_PER_MAP(pacers[dev->pacer].dreq);
+    cbp->src = 0;
+    cbp->dst = pacers[dev->pacer].fifo;
+    cbp->length = steps * FIFO_WORD;
+    cbp->stride = 0;
+    cbp->next = virt_to_phys(dev, cbp + 1);
+    return cbp + 1;
+}
+
+/*
+ * dwell and clear for every distinct width of the pins, shortest
+ * first, from step *at on. stops at a width of a full period.
+ */
+static struct control_blk *falling_edges(struct softpwm_dev *dev,
+                struct control_blk *cbp, uint64_t **word, uint64_t pins,
+                const int width[], int *at)
+{
+    uint64_t left;
+    int pin;
+
+    while (pins) {
+        uint64_t clr = 0;
+        int w = dev->nr_samples;
+
+        for (left = pins; left; left &= left - 1) {
+            pin = __builtin_ctzll(left);
+            if (width[pin] < w)
+                w = width[pin];
+        }
+        /* full cycle, never cleared */
+        if (w >= dev->nr_samples)
+            break;
+        for (left = pins; left; left &= left - 1) {
+            pin = __builtin_ctzll(left);
+            if (width[pin] == w)
+                clr |= 1ULL << pin;
+        }
+        pins &= ~clr;
+
+        cbp = dwell_cb(dev, cbp, w - *at);
+        **word = clr;
+        cbp = gpio_cb(dev, cbp, (*word)++, PHYS_GPCLR0);
+        *at = w;
+    }
+    return cbp;
+}
+
+static void build_edges(struct softpwm_dev *dev, struct pwm_buf *b)
+{
+    struct control_blk *cbp = b->cb;
+    uint64_t *word = b->sample;
+    int prev = 0;
+    int pin;
+
+    /* rising edge */
+    *word = dev->channel_mask;
+    cbp = gpio_cb(dev, cbp, word++, dev->channel_mask ? PHYS_GPSET0 : PHYS_GPCLR0);
+    cbp = falling_edges(dev, cbp, &word, dev->channel_used, dev->channel_width, &prev);
+
+    cbp = dwell_cb(dev, cbp, dev->nr_samples - prev);
+    cbp--;
+    cbp->next = virt_to_phys(dev, b->cb);
+    b->last = cbp;
+    for (pin = 0; pin < MAX_CHANNEl; pin++)
+        b->width[pin] = dev->channel_width[pin];
+}
+
+/*
+ * ESC frame engines
+ *
+ * no period: every commit puts out one frame on the staged pins and
+ * the DMA stops at the end of it, the command rate is the rate of the
+ * control loop. the steps are the 100 ns of the pacer, the data is
+ * the width of the equivalent 1 - 2 ms PWM pulse in data_unit_ns:
+ *
+ *  oneshot125: one pulse of 125 - 250 us
+ *  multishot:  one pulse of 5 - 25 us
+ *  dshot:      16 bits, MSB first: throttle 49 - 2047 above 1 ms, 0
+ *              (motor stop) at 1 ms and below, telemetry bit, CRC. a
+ *              bit is a pulse of 3/8 (0) or 3/4 (1) of the bit time.
+ *
+ * the pacer FIFO fills up at once when the DMA starts, a dwell of the
+ * FIFO depth first keeps the pacing of the frame.
+ */
+#define FRAME_STEP_NS   100
+#define PULSE_CBS       (2 * MAX_CHANNEl + 2)
+#define PULSE_WORDS     (MAX_CHANNEl + 1)
+#define DSHOT_BITS      16
+#define DSHOT_CBS       (6 * DSHOT_BITS + 1)
+#define DSHOT_WORDS     (DSHOT_BITS + 1)
+
+static const struct {
+    int bit_ns;
+    int t1h_ns;
+    int t0h_ns;
+} dshot_timing[] = {
+    [SOFTPWM_DSHOT150 - SOFTPWM_DSHOT150] = { 6667, 5000, 2500 },
+    [SOFTPWM_DSHOT300 - SOFTPWM_DSHOT150] = { 3333, 2500, 1250 },
+    [SOFTPWM_DSHOT600 - SOFTPWM_DSHOT150] = { 1667, 1250,  625 },
+};
+
+static int is_frame(int type)
+{
+    return type >= SOFTPWM_ONESHOT125 && type <= SOFTPWM_DSHOT600;
+}
+
+static int is_dshot(int type)
+{
+    return type >= SOFTPWM_DSHOT150 && type <= SOFTPWM_DSHOT600;
+}
+
+static int frame_ticks(int ns)
+{
+    return (ns + FRAME_STEP_NS / 2) / FRAME_STEP_NS;
+}
+
+/* 0 - 1000 us above the 1 ms of a PWM ESC */
+static int esc_throttle_us(struct softpwm_dev *dev, int data)
+{
+    long long us = (long long)data * dev->data_unit_ns / 1000 - 1000;
+
+    return us < 0 ? 0 : us > 1000 ? 1000 : (int)us;
+}
+
+uint16_t softpwm_dshot_packet(int value, int telemetry)
+{
+    uint16_t v = ((value & 0x7ff) << 1) | !!telemetry;
+
+    return (v << 4) | ((v ^ (v >> 4) ^ (v >> 8)) & 0xf);
+}
+
+static void build_pulses(struct softpwm_dev *dev, struct pwm_buf *b)
+{
+    struct control_blk *cbp = b->cb;
+    uint64_t *word = b->sample, left;
+    int width[MAX_CHANNEl];
+    int min_ns = dev->engine == SOFTPWM_ONESHOT125 ? 125000 : 5000;
+    int max_ns = dev->engine == SOFTPWM_ONESHOT125 ? 250000 : 25000;
+    int prev = 0;
+    int pin;
+
+    for (left = dev->channel_mask; left; left &= left - 1) {
+        pin = __builtin_ctzll(left);
+        width[pin] = frame_ticks(min_ns + esc_throttle_us(dev, dev->channel_data[pin])
+                        * (max_ns - min_ns) / 1000);
+    }
+
+    cbp = dwell_cb(dev, cbp, pacers[dev->pacer].fifo_depth);
+    *word = dev->channel_mask;
+    cbp = gpio_cb(dev, cbp, word++, PHYS_GPSET0);
+    cbp = falling_edges(dev, cbp, &word, dev->channel_mask, width, &prev);
+    cbp[-1].next = 0;
+    b->last = cbp - 1;
+}
+
+static void build_dshot(struct softpwm_dev *dev, struct pwm_buf *b)
+{
+    int timing = dev->engine - SOFTPWM_DSHOT150;
+    int bit_ticks = frame_ticks(dshot_timing[timing].bit_ns);
+    int t1h = frame_ticks(dshot_timing[timing].t1h_ns);
+    int t0h = frame_ticks(dshot_timing[timing].t0h_ns);
+    struct control_blk *cbp = b->cb;
+    uint64_t *all = b->sample, *word = all + 1, left;
+    uint16_t packet[MAX_CHANNEl];
+    int bit, pin, throttle;
+
+    for (left = dev->channel_used; left; left &= left - 1) {
+        pin = __builtin_ctzll(left);
+        throttle = dev->channel_data[pin] > 0
+                ? esc_throttle_us(dev, dev->channel_data[pin]) : 0;
+        packet[pin] = softpwm_dshot_packet(throttle ? 47 + throttle * 2 : 0, 0);
+    }
+
+    *all = dev->channel_used;
+    cbp = dwell_cb(dev, cbp, pacers[dev->pacer].fifo_depth);
+    for (bit = DSHOT_BITS - 1; bit >= 0; bit--) {
+        uint64_t zero = 0;
+
+        for (left = dev->channel_used; left; left &= left - 1) {
+            pin = __builtin_ctzll(left);
+            if (!(packet[pin] & (1 << bit)))
+                zero |= 1ULL << pin;
+        }
+        cbp = gpio_cb(dev, cbp, all, PHYS_GPSET0);
+        cbp = dwell_cb(dev, cbp, t0h);
+        *word = zero;
+        cbp = gpio_cb(dev, cbp, word++, PHYS_GPCLR0);
+        cbp = dwell_cb(dev, cbp, t1h - t0h);
+        cbp = gpio_cb(dev, cbp, all, PHYS_GPCLR0);
+        cbp = dwell_cb(dev, cbp, bit_ticks - t1h);
+    }
+    cbp[-1].next = 0;
+    b->last = cbp - 1;
+}
+
+static void buf_size(struct softpwm_dev *dev, int *nr_cbs, int *nr_words)
+{
+    if (is_dshot(dev->engine)) {
+        *nr_cbs = DSHOT_CBS;
+        *nr_words = DSHOT_WORDS;
+    } else if (is_frame(dev->engine)) {
+        *nr_cbs = PULSE_CBS;
+        *nr_words = PULSE_WORDS;
+    } else if (dev->engine == SOFTPWM_EDGE) {
+        *nr_cbs = EDGE_CBS;
+        *nr_words = EDGE_WORDS;
+    } else {
+        *nr_cbs = dev->nr_samples * 2;
+        *nr_words = dev->nr_samples;
+    }
+}
+
+/*
+ * memory layout: control blocks of buffer 0 and 1, then the samples
+ * (edge masks) of buffer 0 and 1
+ */
+static void init_ctrl_data(struct softpwm_dev *dev)
+{
+    int nr_cbs, nr_words;
+    int i;
+
+    buf_size(dev, &nr_cbs, &nr_words);
+    for (i = 0; i < MAX_CHANNEl; i++)
+        dev->channel_width[i] = dev->nr_samples;
+    dev->channel_mask = 0;
+    dev->channel_used = 0;
+
+    for (i = 0; i < 2; i++) {
+        struct pwm_buf *b = &dev->bufs[i];
+
+        b->cb = (struct control_blk *)dev->virtbase + i * nr_cbs;
+        b->nr_cbs = nr_cbs;
+        b->sample = (uint64_t *)((struct control_blk *)dev->virtbase
+                            + 2 * nr_cbs) + i * nr_words;
+        if (dev->engine == SOFTPWM_EDGE)
+            build_edges(dev, b);
+        else if (dev->engine == SOFTPWM_SAMPLE)
+            init_samples(dev, b);
+    }
+    dev->active = 0;
+    dev->pending = 0;
+    dev->dirty = 0;
 }
 
-static void init_hardware(void)
+static void dma_start(struct softpwm_dev *dev, struct control_blk *cb)
 {
-    /* initialize PWM */
-    ioreg_pwm[PWM_CTL] = 0;
+    dev->ioreg_dma[DMA_CS] = DMA_INT | DMA_END;
+    dev->ioreg_dma[DMA_CONBLK_AD] = virt_to_phys(dev, cb);
+    dev->ioreg_dma[DMA_DEBUG] = 7;
+    dev->ioreg_dma[DMA_CS] = 0x10880001; /* go */
+}
+
+static void init_pwm(struct softpwm_dev *dev)
+{
+    volatile unsigned long *pwm = dev->ioreg_pacer;
+
+    pwm[PWM_CTL] = 0;
     udelay(10);
     /* src = PLLD (500MHz) */
-    ioreg_clk[PWMCLK_CNTL] = 0x5a000006;
+    dev->ioreg_clk[PWMCLK_CNTL] = 0x5a000006;
     udelay(100);
-    ioreg_clk[PWMCLK_DIV] = 0x5a000000 | (50 << 12);  /* 10MHz */
+    dev->ioreg_clk[PWMCLK_DIV] = 0x5a000000 | (50 << 12);  /* 10MHz */
     udelay(100);
     /* src = PLLD, enable */
-    ioreg_clk[PWMCLK_CNTL] = 0x5a000016;
+    dev->ioreg_clk[PWMCLK_CNTL] = 0x5a000016;
     udelay(100);
-    ioreg_pwm[PWM_RNG1] = sample_time_us * 10;  /* XXX  ??? */
+    pwm[PWM_RNG1] = dev->step_time_ns / 100;   /* 10MHz */
     udelay(10);
-    ioreg_pwm[PWM_DMAC] = PWMDMAC_ENAB | PWMDMAC_THRSHLD;
+    pwm[PWM_DMAC] = PWMDMAC_ENAB | PWMDMAC_THRSHLD;
     udelay(10);
-    ioreg_pwm[PWM_CTL] = PWMCTL_CLRF;
+    pwm[PWM_CTL] = PWMCTL_CLRF;
     udelay(10);
-    ioreg_pwm[PWM_CTL] = PWMCTL_USEF1 | PWMCTL_PWEN1;
+    pwm[PWM_CTL] = PWMCTL_USEF1 | PWMCTL_PWEN1;
     udelay(10);
+}
 
-    /* initialize DMA */
-    ioreg_dma[DMA_CS] = DMA_RESET;
+/* no pin needed, one 8 bit channel, a frame of step_time_ns */
+static void init_pcm(struct softpwm_dev *dev)
+{
+    volatile unsigned long *pcm = dev->ioreg_pacer;
+
+    pcm[PCM_CS] = PCMCS_EN;
+    udelay(100);
+    /* src = PLLD (500MHz) */
+    dev->ioreg_clk[PCMCLK_CNTL] = 0x5a000006;
+    udelay(100);
+    dev->ioreg_clk[PCMCLK_DIV] = 0x5a000000 | (50 << 12);  /* 10MHz */
+    udelay(100);
+    /* src = PLLD, enable */
+    dev->ioreg_clk[PCMCLK_CNTL] = 0x5a000016;
+    udelay(100);
+    pcm[PCM_TXC] = PCMTXC_CH1EN;
+    udelay(100);
+    pcm[PCM_MODE] = PCMMODE_FLEN(dev->step_time_ns / 100 - 1);
+    udelay(100);
+    pcm[PCM_CS] |= PCMCS_TXCLR | PCMCS_RXCLR;
+    udelay(100);
+    pcm[PCM_DREQ] = PCMDREQ_TX(pacers[SOFTPWM_PACER_PCM].fifo_depth);
+    udelay(100);
+    pcm[PCM_CS] |= PCMCS_DMAEN;
+    udelay(100);
+    pcm[PCM_CS] |= PCMCS_TXON;
+    udelay(100);
+}
+
+static void init_hardware(struct softpwm_dev *dev)
+{
+    if (dev->pacer == SOFTPWM_PACER_PCM)
+        init_pcm(dev);
+    else
+        init_pwm(dev);
+
+    /* initialize DMA, the frame engines start it on commit */
+    dev->ioreg_dma[DMA_CS] = DMA_RESET;
     udelay(10);
-    ioreg_dma[DMA_CS] = DMA_INT | DMA_END;
-    ioreg_dma[DMA_CONBLK_AD] = virt_to_phys(cb);
-    ioreg_dma[DMA_DEBUG] = 7;
-    ioreg_dma[DMA_CS] = 0x10880001; /* go */
+    if (!is_frame(dev->engine))
+        dma_start(dev, dev->bufs[dev->active].cb);
 }
 
 /*
@@ -198,65 +657,213 @@ static void init_hardware(void)
  * in case someone wants to generate more complex signals.
  */
 
+/*
+ * move the falling edge of one pin from sample old to sample new,
+ * only the words in between change
+ */
+static void move_edge(uint64_t *sample, uint64_t bit, int old, int new)
+{
+    int i;
+
+    for (i = new; i < old; i++)
+        sample[i] |= bit;
+    for (i = old; i < new; i++)
+        sample[i] &= ~bit;
+}
+
 /*
  * data:
  *   < 0 : delete pwm
  *   = 0 : set 0 & clear enable mask
  *   > 0 : set data
  */
-static void set_mask_data(unsigned long pinmask, int data)
+static void stage_mask_data(struct softpwm_dev *dev, uint64_t pinmask, int data)
 {
-    if (data > nr_samples)
-        data = nr_samples;
+    uint64_t left;
+    int width;
+
+    pinmask &= (1ULL << MAX_CHANNEl) - 1;
+    if (data > dev->nr_samples)
+        data = dev->nr_samples;
 
     if (data <= 0)
-        channel_mask &= ~pinmask;
+        dev->channel_mask &= ~pinmask;
     else
-        channel_mask |= pinmask;
-
-    /* do update */
-    if (channel_mask) {
-        int i;
-        cb[0].dst = PHYS_GPSET0;
-        sample[0] = channel_mask;
-
-        for (i = 1; i < data; i++)
-            sample[i] &= ~pinmask;
-        for (i = max(data, 1); i < nr_samples; i++)
-            sample[i] |= pinmask;
+        dev->channel_mask |= pinmask;
+
+    width = max(data, 1);
+    for (left = pinmask; left; left &= left - 1)
+        dev->channel_width[__builtin_ctzll(left)] = width;
+    dev->channel_used |= pinmask;
+    claimed |= pinmask;
+    dev->dirty = 1;
+}
+
+/* a pin is driven by the group it was first staged on */
+static int pins_busy(struct softpwm_dev *dev, uint64_t pinmask)
+{
+    return !!(pinmask & claimed & ~dev->channel_used);
+}
+
+/*
+ * is the DMA running the control blocks of buffer b
+ */
+static int dma_in_buf(struct softpwm_dev *dev, struct pwm_buf *b)
+{
+    unsigned char *virt = phys_to_virt(dev, dev->ioreg_dma[DMA_CONBLK_AD]);
+
+    return virt >= (unsigned char *)b->cb
+            && virt < (unsigned char *)(b->cb + b->nr_cbs);
+}
+
+/*
+ * one frame per commit, staged or not: the ESCs want a command every
+ * control step. -EAGAIN while the previous frame is going out.
+ */
+static int commit_frame(struct softpwm_dev *dev)
+{
+    struct pwm_buf *next = &dev->bufs[!dev->active];
+
+    if (dev->ioreg_dma[DMA_CS] & DMA_ACTIVE)
+        return -EAGAIN;
+    if (!(is_dshot(dev->engine) ? dev->channel_used : dev->channel_mask))
+        return 0;
+
+    if (is_dshot(dev->engine))
+        build_dshot(dev, next);
+    else
+        build_pulses(dev, next);
+    __sync_synchronize();
+    dma_start(dev, next->cb);
+
+    dev->active = !dev->active;
+    dev->dirty = 0;
+    return 0;
+}
+
+/*
+ * write the staged widths to the idle buffer and link it after the
+ * running loop: the DMA finishes the current period and goes on with
+ * the new table, every pin changes in the same period.
+ *
+ * -EAGAIN while the DMA has not taken the previous commit yet (more
+ * than one commit per PWM period), the staged values are kept for the
+ * next commit.
+ */
+int softpwm_dev_commit(struct softpwm_dev *dev)
+{
+    struct pwm_buf *cur, *next;
+    uint64_t left;
+    int pin;
+
+    if (dev == NULL || !dev->initialized)
+        return -ENOENT;
+    if (is_frame(dev->engine))
+        return commit_frame(dev);
+    if (!dev->dirty)
+        return 0;
+    if (dev->pending) {
+        if (!dma_in_buf(dev, &dev->bufs[dev->active]))
+            return -EAGAIN;
+        dev->pending = 0;
+    }
+
+    cur = &dev->bufs[dev->active];
+    next = &dev->bufs[!dev->active];
+    if (dev->engine == SOFTPWM_EDGE) {
+        build_edges(dev, next);
     } else {
-        cb[0].dst = PHYS_GPCLR0;
-        sample[0] = channel_mask;
-        /* FIXME */
+        for (left = dev->channel_used; left; left &= left - 1) {
+            pin = __builtin_ctzll(left);
+            if (next->width[pin] == dev->channel_width[pin])
+                continue;
+            move_edge(next->sample, 1ULL << pin, next->width[pin],
+                            dev->channel_width[pin]);
+            next->width[pin] = dev->channel_width[pin];
+        }
+        next->cb[0].dst = dev->channel_mask ? PHYS_GPSET0 : PHYS_GPCLR0;
+        next->sample[0] = dev->channel_mask;
+        next->last->next = virt_to_phys(dev, next->cb);
     }
+
+    /* the table is in memory before the DMA can jump to it */
+    __sync_synchronize();
+    cur->last->next = virt_to_phys(dev, next->cb);
+
+    dev->active = !dev->active;
+    dev->pending = 1;
+    dev->dirty = 0;
+    return 0;
 }
 
-int softpwm_set_data(int pin, int data)
+/* at most two periods */
+static int commit_wait(struct softpwm_dev *dev)
 {
-    unsigned long pinmask = (1 << pin);
+    int err, us;
 
-    if (!initialized)
+    for (us = 0; (err = softpwm_dev_commit(dev)) == -EAGAIN
+                    && us < 2 * dev->cycle_time_us;
+                    us += dev->cycle_time_us / 8)
+        wait_us(dev, dev->cycle_time_us / 8);
+    return err;
+}
+
+int softpwm_dev_stage(struct softpwm_dev *dev, int pin, int data)
+{
+    if (dev == NULL || !dev->initialized)
         return -ENOENT;
-    if (pin >= MAX_CHANNEl)
+    if (pin < 0 || pin >= MAX_CHANNEl)
         return -EINVAL;
+    if (pins_busy(dev, 1ULL << pin))
+        return -EBUSY;
 
-    channel_data[pin] = data;
-    set_mask_data(pinmask, data);
-
+    dev->channel_data[pin] = data;
+    stage_mask_data(dev, 1ULL << pin, data);
     return 0;
 }
 
-int softpwm_set_multi(unsigned long pinmask, int data)
+int softpwm_dev_set_data(struct softpwm_dev *dev, int pin, int data)
+{
+    int err;
+
+    if ((err = softpwm_dev_stage(dev, pin, data)) < 0)
+        return err;
+    return commit_wait(dev);
+}
+
+int softpwm_dev_set_multi(struct softpwm_dev *dev, uint64_t pinmask, int data)
 {
     int i;
-    if (!initialized)
+    if (dev == NULL || !dev->initialized)
         return -ENOENT;
+    if (pins_busy(dev, pinmask & ((1ULL << MAX_CHANNEl) - 1)))
+        return -EBUSY;
     for (i = 0; i < MAX_CHANNEl; i++) {
-        if (pinmask & (1 << i))
-            channel_data[i] = data;
+        if (pinmask & (1ULL << i))
+            dev->channel_data[i] = data;
     }
-    set_mask_data(pinmask, data);
-    return 0;
+    stage_mask_data(dev, pinmask, data);
+    return commit_wait(dev);
+}
+
+int softpwm_stage(int pin, int data)
+{
+    return softpwm_dev_stage(softpwm_default, pin, data);
+}
+
+int softpwm_commit(void)
+{
+    return softpwm_dev_commit(softpwm_default);
+}
+
+int softpwm_set_data(int pin, int data)
+{
+    return softpwm_dev_set_data(softpwm_default, pin, data);
+}
+
+int softpwm_set_multi(uint64_t pinmask, int data)
+{
+    return softpwm_dev_set_multi(softpwm_default, pinmask, data);
 }
 
 /*
@@ -273,7 +880,7 @@ int softpwm_set_multi(unsigned long pinmask, int data)
  *  * Bit  62    page swapped
  *  * Bit  63    page present
  */
-static int make_pagemap(void)
+static int make_pagemap(struct softpwm_dev *dev)
 {
     char pagemap_file[128];
     pid_t pid;
@@ -282,8 +889,8 @@ static int make_pagemap(void)
     int i;
     int err = 0;
 
-    pagemaps = malloc(nr_pages * sizeof(struct page_map));
-    if (pagemaps == NULL)
+    dev->pagemaps = malloc(dev->nr_pages * sizeof(struct page_map));
+    if (dev->pagemaps == NULL)
         return -ENOMEM;
     if ((memfd = open("/dev/mem", O_RDWR)) < 0)
         return -EIO;
@@ -295,16 +902,16 @@ static int make_pagemap(void)
         goto fail_open;
 
     /* (virt >> 12) * 8 */
-    offset = (unsigned int)(intptr_t)virtbase >> 9;
+    offset = (unsigned int)(intptr_t)dev->virtbase >> 9;
     err = -ERANGE;
     if (lseek(fd, offset, SEEK_SET) != offset)
         goto ret;
 
-    for (i = 0; i < nr_pages; i++) {
+    for (i = 0; i < dev->nr_pages; i++) {
         unsigned long long pfn;
-        pagemaps[i].virt_addr = virtbase + i * PAGE_SIZE;
+        dev->pagemaps[i].virt_addr = dev->virtbase + i * PAGE_SIZE;
         /* following line forces page to be allocated */
-        pagemaps[i].virt_addr[0] = 0;
+        dev->pagemaps[i].virt_addr[0] = 0;
 
         err = -EFAULT;
         if (read(fd, &pfn, sizeof(pfn)) != sizeof(pfn))
@@ -313,7 +920,7 @@ static int make_pagemap(void)
         if (((pfn >> 55) & 0x1bf) != 0x10c)
             goto ret;
 
-        pagemaps[i].phys_addr = (unsigned long)pfn << PAGE_SHIFT | 0x40000000;
+        dev->pagemaps[i].phys_addr = (unsigned long)pfn << PAGE_SHIFT | 0x40000000;
     }
 
     err = 0;
@@ -336,90 +943,423 @@ static void *map_peripheral(unsigned long base, size_t len)
     return virt_addr;
 }
 
-void softpwm_stop(void)
+/* simulated, bus addresses in the SDRAM range like the real ones */
+static int sim_pagemap(struct softpwm_dev *dev)
+{
+    int i;
+
+    dev->pagemaps = malloc(dev->nr_pages * sizeof(struct page_map));
+    if (dev->pagemaps == NULL)
+        return -ENOMEM;
+    for (i = 0; i < dev->nr_pages; i++) {
+        dev->pagemaps[i].virt_addr = dev->virtbase + i * PAGE_SIZE;
+        dev->pagemaps[i].phys_addr = 0x40100000
+                + (dev->dma_channel * 0x1000 + i) * PAGE_SIZE;
+    }
+    return 0;
+}
+
+void softpwm_dev_stop(struct softpwm_dev *dev)
 {
     int i;
-    if (ioreg_dma == MAP_FAILED || virtbase == MAP_FAILED)
+    if (dev == NULL || dev->ioreg_dma == MAP_FAILED || dev->virtbase == MAP_FAILED)
         return;
 
     for (i = 0; i < MAX_CHANNEl; i++) {
-        if (channel_data[i] > 0)
-            softpwm_set_data(i, 0);
+        if (dev->channel_data[i] > 0)
+            softpwm_dev_stage(dev, i, 0);
     }
-    udelay(cycle_time_us);
-    ioreg_dma[DMA_CS] = DMA_RESET;
+    commit_wait(dev);
+    wait_us(dev, dev->cycle_time_us);
+    dev->ioreg_dma[DMA_CS] = DMA_RESET;
     udelay(10);
-    initialized = 0;
+    dev->initialized = 0;
 }
 
-void softpwm_exit(void)
+void softpwm_del(struct softpwm_dev *dev)
 {
-    softpwm_stop();
-    if (ioreg_dma != MAP_FAILED)
-        munmap((void *)ioreg_dma, DMA_LEN);
-    if (virtbase != MAP_FAILED)
-        munmap(virtbase, nr_pages * PAGE_SIZE);
-    if (pagemaps)
-        free(pagemaps);
+    if (dev == NULL)
+        return;
+
+    softpwm_dev_stop(dev);
+    if (dev->dma_map != MAP_FAILED)
+        munmap(dev->dma_map, PAGE_SIZE);
+    if (dev->pcm_map != MAP_FAILED)
+        munmap(dev->pcm_map, PCM_LEN);
+    if (dev->virtbase != MAP_FAILED)
+        munmap(dev->virtbase, dev->nr_pages * PAGE_SIZE);
+    free(dev->pagemaps);
+
+    claimed &= ~dev->channel_used;
+    if (channels[dev->dma_channel] == dev)
+        channels[dev->dma_channel] = NULL;
+    if (dev->simulated) {
+        memset(sim.dma[dev->dma_channel], 0, sizeof(sim.dma[0]));
+        memset(&sim.chan[dev->dma_channel], 0, sizeof(sim.chan[0]));
+        sim.users--;
+    }
+    free(dev);
 }
 
-int softpwm_init(int cycle_time, int step_time)
+static int init_engine(struct softpwm_dev *dev, int type, int cycle_time,
+                int step_time)
 {
+    int nr_cbs, nr_words;
     int size, i;
-    int err;
 
     /*
      * 10 ms (100Hz), step = 5us
      * range (0, 2000)
      * (1ms, 2ms) : (200, 400)
-     */ 
-    cycle_time_us = cycle_time ?: 10000;
-    sample_time_us = step_time ?: 5;
+     */
+    dev->cycle_time_us = cycle_time ?: 10000;
+    dev->step_time_ns = step_time ?: 5000;
 
-    nr_samples = cycle_time_us / sample_time_us;
+    /* the clock pacing the DMA runs at 10MHz */
+    if (type != SOFTPWM_SAMPLE && type != SOFTPWM_EDGE && !is_frame(type))
+        return -EINVAL;
+    if (dev->step_time_ns < 100 || (dev->step_time_ns % 100 && !is_frame(type)))
+        return -EINVAL;
+    /*
+     * a PCM frame holds the 8 bit channel and is at most 1024 bit
+     * clocks, the 100 ns steps of the frame engines need the PWM
+     */
+    if (dev->pacer == SOFTPWM_PACER_PCM && (is_frame(type)
+                || dev->step_time_ns < PCMMODE_MIN_FLEN * 100
+                || dev->step_time_ns > PCMMODE_MAX_FLEN * 100))
+        return -EINVAL;
+    dev->engine = type;
+
+    dev->nr_samples = (int)((long long)dev->cycle_time_us * 1000 / dev->step_time_ns);
+    if (is_frame(type)) {
+        /* the step is the data unit, the frame is as long as it takes */
+        dev->data_unit_ns = dev->step_time_ns;
+        dev->step_time_ns = FRAME_STEP_NS;
+        if (is_dshot(type))
+            dev->nr_samples = DSHOT_BITS
+                    * frame_ticks(dshot_timing[type - SOFTPWM_DSHOT150].bit_ns);
+        else
+            dev->nr_samples = frame_ticks(type == SOFTPWM_ONESHOT125 ? 250000 : 25000) + 1;
+        dev->cycle_time_us = (pacers[dev->pacer].fifo_depth + dev->nr_samples)
+                * FRAME_STEP_NS / 1000 + 1;
+    }
+
+    /* two buffers */
+    buf_size(dev, &nr_cbs, &nr_words);
+    size = 2 * (nr_cbs * sizeof(struct control_blk)
+            + nr_words * GPIO_WORD);
+    dev->nr_pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+    for (i = 0; i < MAX_CHANNEl; i++)
+        dev->channel_data[i] = -1;
+    return 0;
+}
+
+static int new_dev(struct softpwm_dev **devp, int dma_channel, int pacer,
+                int type, int cycle_time, int step_time, int simulate)
+{
+    struct softpwm_dev *dev;
+    int i, err;
+
+    if (dma_channel < 0 || dma_channel >= NR_DMA_CHANNELS
+            || (pacer != SOFTPWM_PACER_PWM && pacer != SOFTPWM_PACER_PCM))
+        return -EINVAL;
+    /* a channel runs one group, two groups on a FIFO would share its pace */
+    if (channels[dma_channel])
+        return -EBUSY;
+    for (i = 0; i < NR_DMA_CHANNELS; i++) {
+        if (channels[i] && channels[i]->pacer == pacer)
+            return -EBUSY;
+    }
+
+    if ((dev = malloc(sizeof(*dev))) == NULL)
+        return -ENOMEM;
+    memset(dev, 0, sizeof(*dev));
+    dev->dma_channel = dma_channel;
+    dev->pacer = pacer;
+    dev->ioreg_dma = MAP_FAILED;
+    dev->dma_map = MAP_FAILED;
+    dev->pcm_map = MAP_FAILED;
+    dev->virtbase = MAP_FAILED;
+
+    if ((err = init_engine(dev, type, cycle_time, step_time)) < 0) {
+        free(dev);
+        return err;
+    }
 
-    assert(sizeof(struct control_blk) == 32);
-    size = nr_samples * 2 * sizeof(struct control_blk)
-            + nr_samples * sizeof(unsigned long);
-    nr_pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    /* the DMA reads 32 bytes control blocks, only the simulator does not */
+    dev->simulated = simulate;
+    assert(dev->simulated || sizeof(struct control_blk) == 32);
+    channels[dma_channel] = dev;
 
     /* get io reg mapped */
     err = -ENOMEM;
-    ioreg_dma = map_peripheral(DMA_BASE, DMA_LEN);
-    ioreg_clk = (volatile unsigned long *)bcm2835_regbase(BCM2835_REGBASE_CLK);
-    ioreg_pwm = (volatile unsigned long *)bcm2835_regbase(BCM2835_REGBASE_PWM);
-    if (ioreg_dma == MAP_FAILED
-            || ioreg_clk == MAP_FAILED || ioreg_pwm == MAP_FAILED)
+    if (dev->simulated) {
+        if (sim.users++ == 0) {
+            memset(&sim, 0, sizeof(sim));
+            sim.users = 1;
+        }
+        dev->ioreg_dma = sim.dma[dma_channel];
+        dev->ioreg_clk = sim.clk;
+        dev->ioreg_pacer = pacer == SOFTPWM_PACER_PCM ? sim.pcm : sim.pwm;
+    } else {
+        dev->dma_map = map_peripheral(DMA_BASE, PAGE_SIZE);
+        if (dev->dma_map != MAP_FAILED)
+            dev->ioreg_dma = (volatile unsigned long *)((unsigned char *)dev->dma_map
+                                + dma_channel * DMA_CHAN_LEN);
+        dev->ioreg_clk = (volatile unsigned long *)bcm2835_regbase(BCM2835_REGBASE_CLK);
+        if (pacer == SOFTPWM_PACER_PCM) {
+            dev->pcm_map = map_peripheral(PCM_BASE, PCM_LEN);
+            dev->ioreg_pacer = dev->pcm_map;
+        } else {
+            dev->ioreg_pacer = (volatile unsigned long *)bcm2835_regbase(BCM2835_REGBASE_PWM);
+        }
+    }
+    if (dev->ioreg_dma == MAP_FAILED
+            || dev->ioreg_clk == MAP_FAILED || dev->ioreg_pacer == MAP_FAILED)
         goto fail;
 
     /* alloc mem */
-    virtbase = mmap(NULL, nr_pages * PAGE_SIZE, PROT_READ | PROT_WRITE,
-            MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE | MAP_LOCKED, -1, 0);
+    dev->virtbase = mmap(NULL, dev->nr_pages * PAGE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE
+            | (dev->simulated ? 0 : MAP_LOCKED), -1, 0);
     err = -ENOMEM;
-    if (virtbase == MAP_FAILED)
+    if (dev->virtbase == MAP_FAILED)
         goto fail;
     err = -EFAULT;
-    if ((unsigned long)virtbase & (PAGE_SIZE - 1))
+    if ((unsigned long)dev->virtbase & (PAGE_SIZE - 1))
         goto fail;
 
-    cb = (struct control_blk *)virtbase;
-    sample = (unsigned long *)(cb + (nr_samples * 2));
-
-    err = make_pagemap();
+    err = dev->simulated ? sim_pagemap(dev) : make_pagemap(dev);
     if (err < 0)
         goto fail;
 
-    for (i = 0; i < MAX_CHANNEl; i++)
-        channel_data[i] = -1;
-
-    init_ctrl_data();
-    init_hardware();
-
-    initialized = 1;
+    init_ctrl_data(dev);
+    init_hardware(dev);
 
+    dev->initialized = 1;
+    *devp = dev;
     return 0;
 
 fail:
-    softpwm_exit();
+    softpwm_del(dev);
     return err;
 }
+
+struct softpwm_dev *softpwm_new(int dma_channel, int pacer, int engine,
+                                int cycle_time, int step_time)
+{
+    struct softpwm_dev *dev = NULL;
+    int err;
+
+    if ((err = new_dev(&dev, dma_channel, pacer, engine, cycle_time, step_time, 0)) < 0)
+        errno = -err;
+    return dev;
+}
+
+void softpwm_stop(void)
+{
+    softpwm_dev_stop(softpwm_default);
+}
+
+void softpwm_exit(void)
+{
+    softpwm_del(softpwm_default);
+    softpwm_default = NULL;
+}
+
+int softpwm_init_dma(int dma_channel, int pacer, int engine, int cycle_time,
+                int step_time)
+{
+    softpwm_exit();
+    return new_dev(&softpwm_default, dma_channel, pacer, engine,
+                    cycle_time, step_time, 0);
+}
+
+int softpwm_init_engine(int type, int cycle_time, int step_time)
+{
+    return softpwm_init_dma(SOFTPWM_DMA_CHANNEL, SOFTPWM_PACER_PWM,
+                    type, cycle_time, step_time);
+}
+
+int softpwm_init(int cycle_time, int step_time)
+{
+    return softpwm_init_engine(SOFTPWM_SAMPLE, cycle_time, (step_time ?: 5) * 1000);
+}
+
+/*
+ * simulated backend
+ *
+ * the interpreter runs the control blocks at CONBLK_AD of every active
+ * channel, the one with the earliest next action first:
+ *  - a write to GPSET0 / GPCLR0 changes the GPIO level right away
+ *  - a DREQ paced write goes to the FIFO of the pacer it is mapped to,
+ *    the PWM takes a word every PWM_RNG1 x 100 ns, the PCM one every
+ *    PCM_MODE FLEN + 1 x 100 ns, the DMA waits while the FIFO is full
+ *  - loading the next control block takes cb_time (0 by default, the
+ *    timing of the table itself)
+ *  - the DMA stops at a next of 0
+ * CONBLK_AD follows, commit and dma_in_buf() see the DMA move.
+ */
+int softpwm_init_sim(int type, int cycle_time, int step_time)
+{
+    softpwm_exit();
+    return new_dev(&softpwm_default, SOFTPWM_DMA_CHANNEL, SOFTPWM_PACER_PWM,
+                    type, cycle_time, step_time, 1);
+}
+
+struct softpwm_dev *softpwm_new_sim(int dma_channel, int pacer, int engine,
+                                    int cycle_time, int step_time)
+{
+    struct softpwm_dev *dev = NULL;
+    int err;
+
+    if ((err = new_dev(&dev, dma_channel, pacer, engine, cycle_time, step_time, 1)) < 0)
+        errno = -err;
+    return dev;
+}
+
+/*
+ * one 32 bit word at a time, as the DMA: the source and the register
+ * only step with DMA_SRC_INC and DMA_DEST_INC, bank 1 follows bank 0
+ */
+static void sim_gpio(unsigned long info, unsigned long dst, const uint32_t *src, int nr)
+{
+    uint64_t level = sim.level, changed, bits;
+    int i, pin;
+
+    for (i = 0; i < nr; i++) {
+        bits = src ? *src : 0;
+        if (src && (info & DMA_SRC_INC))
+            src++;
+        if (dst == PHYS_GPSET1 || dst == PHYS_GPCLR1)
+            bits <<= 32;
+        if (dst == PHYS_GPSET0 || dst == PHYS_GPSET1)
+            level |= bits;
+        else if (dst == PHYS_GPCLR0 || dst == PHYS_GPCLR1)
+            level &= ~bits;
+        if (info & DMA_DEST_INC)
+            dst += sizeof(uint32_t);
+    }
+    sim.stats.gpio_writes++;
+
+    changed = level ^ sim.level;
+    sim.level = level;
+    for (; changed && sim.edge_fn; changed &= changed - 1) {
+        pin = __builtin_ctzll(changed);
+        sim.edge_fn(pin, !!(level & (1ULL << pin)), sim.now, sim.edge_arg);
+    }
+}
+
+/* ns per FIFO word */
+static uint64_t sim_pace(int pacer)
+{
+    if (pacer == SOFTPWM_PACER_PCM)
+        return (((sim.pcm[PCM_MODE] >> 10) & 0x3ff) + 1) * 100ULL;
+    return (uint64_t)sim.pwm[PWM_RNG1] * 100;
+}
+
+/* the running control block of a channel and when it can go on */
+static struct control_blk *sim_next(int ch, uint64_t *t)
+{
+    struct softpwm_dev *dev = channels[ch];
+    struct control_blk *cbp;
+    uint64_t step, room;
+    int pacer, depth;
+
+    if (dev == NULL || !dev->simulated || !(sim.dma[ch][DMA_CS] & DMA_ACTIVE))
+        return NULL;
+    if ((cbp = phys_to_virt(dev, sim.dma[ch][DMA_CONBLK_AD])) == NULL)
+        return NULL;
+
+    *t = max(sim.now, sim.chan[ch].at);
+    if ((cbp->info & DMA_D_DREQ) && sim.chan[ch].words < cbp->length / FIFO_WORD) {
+        /* waits for room in the FIFO */
+        pacer = cbp->dst == PHYS_PCM_FIFO;
+        step = sim_pace(pacer);
+        depth = pacers[pacer].fifo_depth;
+        room = sim.drain[pacer] > (depth - 1) * step
+                ? sim.drain[pacer] - (depth - 1) * step : 0;
+        *t = max(*t, room);
+    }
+    return cbp;
+}
+
+uint64_t softpwm_sim_run(uint64_t ns)
+{
+    uint64_t end = sim.now + ns, t, first;
+    struct control_blk *cbp, *run;
+    int ch, pacer, next;
+
+    if (sim.users == 0)
+        return 0;
+
+    for (;;) {
+        run = NULL;
+        first = end;
+        next = 0;
+        for (ch = 0; ch < NR_DMA_CHANNELS; ch++) {
+            if ((cbp = sim_next(ch, &t)) != NULL && t < first) {
+                run = cbp;
+                first = t;
+                next = ch;
+            }
+        }
+        /* stops in the middle of a dwell at the end of the run */
+        if (run == NULL)
+            break;
+        ch = next;
+        sim.now = first;
+
+        if (run->info & DMA_D_DREQ) {
+            if (sim.chan[ch].words < run->length / FIFO_WORD) {
+                pacer = run->dst == PHYS_PCM_FIFO;
+                sim.drain[pacer] = max(sim.drain[pacer], sim.now) + sim_pace(pacer);
+                sim.stats.paced_words++;
+                sim.chan[ch].at = sim.now;
+                if (++sim.chan[ch].words < run->length / FIFO_WORD)
+                    continue;
+            }
+        } else {
+            sim_gpio(run->info, run->dst, phys_to_virt(channels[ch], run->src),
+                            run->length / sizeof(uint32_t));
+        }
+
+        sim.chan[ch].words = 0;
+        sim.dma[ch][DMA_CONBLK_AD] = run->next;
+        sim.chan[ch].at = sim.now + sim.cb_time;
+        sim.stats.cbs++;
+        /* end of the chain */
+        if (run->next == 0)
+            sim.dma[ch][DMA_CS] = (sim.dma[ch][DMA_CS] & ~DMA_ACTIVE) | DMA_END;
+    }
+    if (sim.now < end)
+        sim.now = end;
+    return sim.now;
+}
+
+void softpwm_sim_watch(softpwm_edge_fn fn, void *arg)
+{
+    sim.edge_fn = fn;
+    sim.edge_arg = arg;
+}
+
+void softpwm_sim_cb_time(int ns)
+{
+    sim.cb_time = ns;
+}
+
+uint64_t softpwm_sim_now(void)
+{
+    return sim.now;
+}
+
+uint64_t softpwm_sim_level(void)
+{
+    return sim.level;
+}
+
+void softpwm_sim_stats(struct softpwm_sim_stats *st)
+{
+    *st = sim.stats;
+}
@@ -1,10 +1,106 @@
 #ifndef __SOFTPWM_H__
 #define __SOFTPWM_H__
 
+#include <stdint.h>
+
+/*
+ * engines:
+ *  sample: two DMA control blocks per step, the whole period is a table
+ *  edge:   control blocks at the pin edges only, the dwell in between is
+ *          paced by writes to the pacer FIFO, steps down to 100 ns
+ *
+ * the data of the pins is in steps
+ */
+#define SOFTPWM_SAMPLE  0
+#define SOFTPWM_EDGE    1
+
+/*
+ * ESC frame engines: one frame per commit on the staged pins, no
+ * period. the data is the width of the equivalent 1 - 2 ms PWM pulse,
+ * in units of the step given to init (cycle is unused).
+ */
+#define SOFTPWM_ONESHOT125  2
+#define SOFTPWM_MULTISHOT   3
+#define SOFTPWM_DSHOT150    4
+#define SOFTPWM_DSHOT300    5
+#define SOFTPWM_DSHOT600    6
+
+/*
+ * groups: each group of pins runs its own engine, cycle and step on its
+ * own DMA channel (0 - 14), paced by the DREQ of the PWM or of the PCM,
+ * one group per pacer. a 400 Hz ESC group and a 50 Hz servo group run
+ * side by side, each with a table of its own period. the PCM pacer
+ * leaves the PWM to pwm / l298n, its step is 800 ns - 102.4 us and it
+ * does not run the frame engines. a pin belongs to the group it was
+ * first staged on (-EBUSY on the others). the DMA channel must not be
+ * one the kernel uses.
+ */
+#define SOFTPWM_PACER_PWM   0
+#define SOFTPWM_PACER_PCM   1
+
+/* of the default group, softpwm_init() and the calls without a group */
+#define SOFTPWM_DMA_CHANNEL 5
+
+struct softpwm_dev;
+
+/* cycle in us, step in ns, NULL with errno set on error */
+struct softpwm_dev *softpwm_new(int dma_channel, int pacer, int engine,
+                                int cycle_time, int step_time);
+void softpwm_del(struct softpwm_dev *dev);
+void softpwm_dev_stop(struct softpwm_dev *dev);
+int softpwm_dev_stage(struct softpwm_dev *dev, int pin, int data);
+int softpwm_dev_commit(struct softpwm_dev *dev);
+int softpwm_dev_set_data(struct softpwm_dev *dev, int pin, int data);
+int softpwm_dev_set_multi(struct softpwm_dev *dev, uint64_t pinmask, int data);
+
+/* cycle in us, step in us */
 int softpwm_init(int cycle_time, int step_time);
+/* cycle in us, step in ns (multiple of 100) */
+int softpwm_init_engine(int engine, int cycle_time, int step_time);
+int softpwm_init_dma(int dma_channel, int pacer, int engine,
+                     int cycle_time, int step_time);
+/* 11 bit value, telemetry request, with the CRC */
+uint16_t softpwm_dshot_packet(int value, int telemetry);
 void softpwm_exit(void);
 void softpwm_stop(void);
+/* stage and commit, waiting for the previous commit to be taken */
 int softpwm_set_data(int pin, int data);
-int softpwm_set_multi(unsigned long pinmask, int data);
+/* pins 0 - 53, bit n is GPIO n */
+int softpwm_set_multi(uint64_t pinmask, int data);
+
+/*
+ * transactional update: stage any number of pins, then commit them
+ * all at once at the next PWM period boundary
+ */
+int softpwm_stage(int pin, int data);
+int softpwm_commit(void);
+
+/*
+ * simulated backend, no /dev/mem: the DMA memory and the registers are
+ * ordinary memory and a software DMA runs the control blocks on a
+ * virtual clock, to test and profile the engines off the target.
+ * init, stage, commit and exit work as on the hardware.
+ */
+struct softpwm_sim_stats {
+    uint64_t cbs;               /* control blocks run */
+    uint64_t gpio_writes;
+    uint64_t paced_words;       /* pacer FIFO writes */
+};
+
+typedef void (*softpwm_edge_fn)(int pin, int level, uint64_t time_ns, void *arg);
+
+/* cycle in us, step in ns */
+int softpwm_init_sim(int engine, int cycle_time, int step_time);
+struct softpwm_dev *softpwm_new_sim(int dma_channel, int pacer, int engine,
+                                    int cycle_time, int step_time);
+/* run the DMA channels of the groups for ns, returns the virtual time */
+uint64_t softpwm_sim_run(uint64_t ns);
+/* called on every GPIO level change */
+void softpwm_sim_watch(softpwm_edge_fn fn, void *arg);
+/* ns to load a control block, 0 by default */
+void softpwm_sim_cb_time(int ns);
+uint64_t softpwm_sim_now(void);
+uint64_t softpwm_sim_level(void);
+void softpwm_sim_stats(struct softpwm_sim_stats *st);
 
 #endif /* __SOFTPWM_H__ */
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "module.h"
+#include "rtctrl.h"
+#include "stats.h"
+
+static const char *stat_names[NR_STATS] = {
+    [STAT_fifo]     = "fifo",
+    [STAT_mpl]      = "mpl",
+    [STAT_attitude] = "attitude",
+    [STAT_pwm]      = "pwm",
+    [STAT_total]    = "total",
+};
+
+static struct hist stat_hists[NR_STATS];
+static uint64_t stat_start;
+
+static struct clock_src *sources[STATS_MAX_SOURCES];
+static int nr_sources;
+
+static inline int bucket_index(uint64_t v)
+{
+    int shift;
+
+    if (v < STATS_SUB_COUNT)
+        return (int)v;
+
+    /* v >> shift is in [SUB_COUNT, 2 * SUB_COUNT) */
+    shift = 63 - __builtin_clzll(v) - STATS_SUB_BITS;
+    if (shift > STATS_MAX_SHIFT)
+        return STATS_NR_BUCKETS - 1;
+    return STATS_SUB_COUNT * (shift + 1) + (int)(v >> shift) - STATS_SUB_COUNT;
+}
+
+/* the highest value of bucket i */
+static inline uint64_t bucket_value(int i)
+{
+    int shift, sub;
+
+    if (i < STATS_SUB_COUNT)
+        return (uint64_t)i;
+    shift = i / STATS_SUB_COUNT - 1;
+    sub = i % STATS_SUB_COUNT;
+    return ((uint64_t)(STATS_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void hist_reset(struct hist *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void hist_record(struct hist *h, uint64_t v)
+{
+    h->counts[bucket_index(v)]++;
+    if (h->count == 0 || v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->sum += v;
+    h->count++;
+}
+
+uint64_t hist_quantile(const struct hist *h, double q)
+{
+    uint64_t rank, seen = 0;
+    int i;
+
+    if (h->count == 0)
+        return 0;
+
+    rank = (uint64_t)(q * h->count);
+    if (rank >= h->count)
+        return h->max;
+
+    for (i = 0; i < STATS_NR_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen > rank) {
+            uint64_t v = bucket_value(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+void stats_record(int stage, uint64_t ns)
+{
+    hist_record(&stat_hists[stage], ns);
+}
+
+/*
+ * stage measured from stats_begin(), unmatched ends are ignored
+ */
+void stats_begin(void)
+{
+    stat_start = stats_now();
+}
+
+void stats_begin_at(uint64_t t)
+{
+    stat_start = t;
+}
+
+void stats_end(int stage)
+{
+    if (stat_start) {
+        hist_record(&stat_hists[stage], stats_now() - stat_start);
+        stat_start = 0;
+    }
+}
+
+const char *stats_name(int stage)
+{
+    return stat_names[stage];
+}
+
+const struct hist *stats_hist(int stage)
+{
+    return &stat_hists[stage];
+}
+
+/*
+ * clock sources
+ */
+int clock_src_register(struct clock_src *src, const char *name,
+                uint64_t period_ns)
+{
+    int i;
+
+    for (i = 0; i < nr_sources; i++) {
+        if (sources[i] == src)
+            break;
+    }
+    if (i == nr_sources) {
+        if (nr_sources == STATS_MAX_SOURCES)
+            return -ENOSPC;
+        sources[nr_sources++] = src;
+    }
+    src->name = name;
+    hist_reset(&src->latency);
+    clock_src_set_period(src, period_ns);
+    return 0;
+}
+
+void clock_src_unregister(struct clock_src *src)
+{
+    int i;
+
+    for (i = 0; i < nr_sources; i++) {
+        if (sources[i] == src) {
+            sources[i] = sources[--nr_sources];
+            return;
+        }
+    }
+}
+
+void clock_src_set_period(struct clock_src *src, uint64_t period_ns)
+{
+    src->period_ns = period_ns;
+    src->interval = 0;
+    src->periods = 0;
+    src->count = 0;
+    hist_reset(&src->jitter);
+}
+
+void clock_src_mark(struct clock_src *src, uint64_t t)
+{
+    uint64_t now = raspd_now_ns(), interval, n;
+    int64_t dev;
+
+    if (now >= t)
+        hist_record(&src->latency, now - t);
+    if (src->count == 0) {
+        src->first = src->last = t;
+        src->count = 1;
+        return;
+    }
+    /* the same event again */
+    if (t <= src->last)
+        return;
+
+    interval = t - src->last;
+    if (src->period_ns) {
+        n = (interval + src->period_ns / 2) / src->period_ns;
+        if (n == 0)
+            n = 1;
+        src->periods += n;
+        dev = (int64_t)(interval - n * src->period_ns);
+        hist_record(&src->jitter, dev < 0 ? -dev : dev);
+    } else if (src->interval) {
+        dev = (int64_t)(interval - src->interval);
+        hist_record(&src->jitter, dev < 0 ? -dev : dev);
+    }
+    src->interval = interval;
+    src->last = t;
+    src->count++;
+}
+
+uint64_t clock_src_period(const struct clock_src *src)
+{
+    uint64_t span = src->last - src->first;
+
+    if (src->count < 2 || span < 1000000000ULL)
+        return src->period_ns;
+    if (src->period_ns)
+        return span / src->periods;
+    return span / (src->count - 1);
+}
+
+double clock_src_skew_ppm(const struct clock_src *src)
+{
+    uint64_t span = src->last - src->first;
+
+    if (src->period_ns == 0 || src->periods == 0)
+        return 0;
+    return ((double)span / src->periods - src->period_ns) * 1e6 / src->period_ns;
+}
+
+/*
+ * module
+ */
+
+/* the histograms are written by the control thread only */
+static void reset_all(const union rtarg argv[])
+{
+    int i;
+
+    for (i = 0; i < NR_STATS; i++)
+        hist_reset(&stat_hists[i]);
+    stat_start = 0;
+    for (i = 0; i < nr_sources; i++) {
+        hist_reset(&sources[i]->latency);
+        clock_src_set_period(sources[i], sources[i]->period_ns);
+    }
+}
+
+static int stats_main(int fd, int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "reset", no_argument, NULL, 'r' },
+        { 0, 0, 0, 0 }
+    };
+    char buffer[256];
+    int c, i, n;
+
+    while ((c = getopt_long(argc, argv, "r", options, NULL)) != -1) {
+        switch (c) {
+        case 'r':
+            return rtctrl_call(reset_all, NULL, 0) < 0;
+        default:
+            return 1;
+        }
+    }
+
+    n = snprintf(buffer, sizeof(buffer), "%-10s %10s %9s %9s %9s %9s %9s (us)\n",
+            "stage", "count", "min", "p50", "p99", "p999", "max");
+    write(fd, buffer, n);
+
+    for (i = 0; i < NR_STATS; i++) {
+        const struct hist *h = &stat_hists[i];
+
+        n = snprintf(buffer, sizeof(buffer),
+                "%-10s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+                stat_names[i], (unsigned long long)h->count,
+                h->min / 1000.0,
+                hist_quantile(h, 0.50) / 1000.0,
+                hist_quantile(h, 0.99) / 1000.0,
+                hist_quantile(h, 0.999) / 1000.0,
+                h->max / 1000.0);
+        write(fd, buffer, n);
+    }
+
+    if (nr_sources == 0)
+        return 0;
+    n = snprintf(buffer, sizeof(buffer),
+            "\n%-10s %10s %9s %9s %9s %9s %9s %9s (us, ppm)\n",
+            "source", "count", "period", "skew", "lat p50", "lat p99",
+            "jit p50", "jit p99");
+    write(fd, buffer, n);
+
+    for (i = 0; i < nr_sources; i++) {
+        const struct clock_src *src = sources[i];
+
+        n = snprintf(buffer, sizeof(buffer),
+                "%-10s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+                src->name, (unsigned long long)src->count,
+                clock_src_period(src) / 1000.0,
+                clock_src_skew_ppm(src),
+                hist_quantile(&src->latency, 0.50) / 1000.0,
+                hist_quantile(&src->latency, 0.99) / 1000.0,
+                hist_quantile(&src->jitter, 0.50) / 1000.0,
+                hist_quantile(&src->jitter, 0.99) / 1000.0);
+        write(fd, buffer, n);
+    }
+    return 0;
+}
+
+DEFINE_MODULE(stats);
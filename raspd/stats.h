@@ -0,0 +1,102 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+
+#include "clock.h"
+
+/*
+ * control loop latency, one log-linear (HDR style) histogram per stage
+ *
+ * every power of two is split in 2^STATS_SUB_BITS linear buckets, so
+ * any recorded value is reported within 1/16 (6.25%) of its real value.
+ * all memory is static, recording is a handful of instructions.
+ *
+ * stages are probed on the control thread:
+ *
+ *      int_cb -> dmp_read_fifo_batch -> inv_execute_on_data ->
+ *              attitude_control -> softpwm_stage -> softpwm_commit
+ *
+ * total runs from the interrupt edge to softpwm_commit(): the kernel
+ * timestamp with the GPIO character device, int_cb entry with sysfs.
+ * all on raspd_now_ns(), the clock of the edge timestamps
+ */
+
+enum {
+    STAT_fifo,          /* dmp_read_fifo_batch */
+    STAT_mpl,           /* inv_execute_on_data, the whole batch, the
+                           conversion on the fast path, or the fusion */
+    STAT_attitude,      /* PID */
+    STAT_pwm,           /* softpwm_stage x 4 */
+    STAT_total,
+    NR_STATS
+};
+
+#define STATS_SUB_BITS      4
+#define STATS_SUB_COUNT     (1 << STATS_SUB_BITS)
+#define STATS_MAX_SHIFT     36      /* ~ 68 s */
+#define STATS_NR_BUCKETS    (STATS_SUB_COUNT * (STATS_MAX_SHIFT + 2))
+
+struct hist {
+    uint32_t counts[STATS_NR_BUCKETS];
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+};
+
+static inline uint64_t stats_now(void)
+{
+    return raspd_now_ns();
+}
+
+void hist_reset(struct hist *h);
+void hist_record(struct hist *h, uint64_t v);
+/* the value below which q (0..1) of the samples fall */
+uint64_t hist_quantile(const struct hist *h, double q);
+
+void stats_record(int stage, uint64_t ns);
+void stats_begin(void);
+/* t on the stats_now() clock, an interrupt edge */
+void stats_begin_at(uint64_t t);
+void stats_end(int stage);
+const char *stats_name(int stage);
+const struct hist *stats_hist(int stage);
+
+/*
+ * a source of timestamps (the IMU samples, the echo edges), marked
+ * with the time of each event on raspd_now_ns():
+ *
+ *  latency: from the event to the mark
+ *  jitter:  of the interval, against a whole number of nominal periods,
+ *           or against the previous interval without one
+ *  skew:    of the mean period against the nominal one, the sensor
+ *           oscillator against the raspberry, in ppm
+ *
+ * marked by one thread, the stats module reads it racy.
+ */
+#define STATS_MAX_SOURCES   8
+
+struct clock_src {
+    const char *name;
+    uint64_t period_ns;         /* nominal, 0 for none */
+    uint64_t first, last;
+    uint64_t interval;          /* the last one */
+    uint64_t periods;           /* since first */
+    uint64_t count;
+    struct hist latency;
+    struct hist jitter;
+};
+
+/* listed by the stats module until unregistered */
+int clock_src_register(struct clock_src *src, const char *name,
+                uint64_t period_ns);
+void clock_src_unregister(struct clock_src *src);
+/* restarts the skew and jitter, period_ns 0: none */
+void clock_src_set_period(struct clock_src *src, uint64_t period_ns);
+void clock_src_mark(struct clock_src *src, uint64_t t);
+/* measured, the nominal one until a second of marks */
+uint64_t clock_src_period(const struct clock_src *src);
+double clock_src_skew_ppm(const struct clock_src *src);
+
+#endif /* __STATS_H__ */
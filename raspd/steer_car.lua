@@ -7,7 +7,7 @@ local l298n_stat = 0
 local ultrasonic_done
 
 ultrasonic_done = function(distance)
-    io.stderr:write("auto: distance = " .. distance .. " cm\n")
+    lr.log("auto: distance = " .. distance .. " cm\n")
     if distance <= 20 then
         lr.blink(__DEV("led_warn"), 5, 300)
 
@@ -30,7 +30,7 @@ function automatic()
 
     lr.l298n_set(__DEV("l298n"), 3000, 3000)
 
-    io.stderr:write("automatic leave\n")
+    lr.log("automatic leave\n")
 end
 
 
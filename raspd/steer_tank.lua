@@ -7,7 +7,7 @@ local l298n_stat = 0
 local ultrasonic_done
 
 ultrasonic_done = function(distance)
-    io.stderr:write("auto: distance = " .. distance .. " cm\n")
+    lr.log("auto: distance = " .. distance .. " cm\n")
     if distance <= 30 then
         lr.blink(__DEV("led_warn"), 5, 300)
         --lr.modexec(-1, "l298n_lbrake; l298n_rbrake")
@@ -25,7 +25,7 @@ ultrasonic_done = function(distance)
 end
 
 function automatic_v1()
-    io.stderr:write("automatic enter\n")
+    lr.log("automatic enter\n")
 
     --if lr.ultrasonic_is_using() then
     --    lr.ultrasonic_scope0(nil, 0, -1)
@@ -38,7 +38,7 @@ function automatic_v1()
     --lr.modexec(-1, "l298n_lspeedup; l298n_rspeedup")
     --lr.modexec(-1, "l298n_lspeedup; l298n_rspeedup")
 
-    io.stderr:write("automatic leave\n")
+    lr.log("automatic leave\n")
 end
 
 
@@ -46,7 +46,7 @@ local stepmotor_done
 local direction = 1
 
 stepmotor_done = function()
-    --io.stderr:write("stepmotor: done\n")
+    --lr.log("stepmotor: done\n")
     direction = -direction;
     lr.stepmotor(__DEV("stepmotor"), 180 * direction, 1, stepmotor_done)
     return 0
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <event2/buffer.h>
+
+#include <queue.h>
+#include <xmalloc.h>
+
+#include "module.h"
+#include "binproto.h"
+#include "rtctrl.h"
+#include "raspd.h"
+#include "telemetry.h"
+
+struct subscriber {
+    LIST_ENTRY(subscriber) entry;
+    int wfd;
+    unsigned int channels;
+    int decimate;
+    int skip;
+    unsigned int lost;
+    unsigned long sent;
+    unsigned long drops;
+};
+
+static LIST_HEAD(, subscriber) subscribers = LIST_HEAD_INITIALIZER(subscribers);
+static int nr_subscribers;
+static uint32_t tlm_seq;
+
+static const char *channel_names[] = {
+    "euler", "target", "gyro", "pid", "esc",
+};
+
+#define NR_CHANNELS (sizeof(channel_names) / sizeof(channel_names[0]))
+
+static inline uint8_t *put_floats(uint8_t *p, const float *f, int n)
+{
+    uint32_t v;
+    int i;
+
+    for (i = 0; i < n; i++, p += 4) {
+        memcpy(&v, &f[i], sizeof(v));
+        put_le32(p, v);
+    }
+    return p;
+}
+
+int telemetry_pack(void *buf, const struct tlm_sample *s,
+                unsigned int channels, unsigned int lost)
+{
+    uint8_t *p = (uint8_t *)buf + BINPROTO_HDR_SIZE;
+    int i, len;
+
+    put_le32(p, s->seq);
+    put_le32(p + 4, s->timestamp);
+    put_le16(p + 8, (uint16_t)channels);
+    put_le16(p + 10, (uint16_t)(lost > 0xffff ? 0xffff : lost));
+    p += TLM_HDR_SIZE;
+
+    if (channels & TLM_EULER)
+        p = put_floats(p, s->euler, 3);
+    if (channels & TLM_TARGET)
+        p = put_floats(p, s->target, 3);
+    if (channels & TLM_GYRO)
+        p = put_floats(p, s->gyro, 3);
+    if (channels & TLM_PID)
+        p = put_floats(p, s->pid, 6);
+    if (channels & TLM_ESC) {
+        for (i = 0; i < 4; i++, p += 2)
+            put_le16(p, (uint16_t)s->esc[i]);
+    }
+
+    len = p - (uint8_t *)buf - BINPROTO_HDR_SIZE;
+    binproto_pack_hdr(buf, BINMOD_telemetry, 0, len);
+    return BINPROTO_HDR_SIZE + len;
+}
+
+/*
+ * I/O thread, fan the sample out to the subscribers
+ */
+static void publish(const void *rec)
+{
+    const struct tlm_sample *s = rec;
+    uint8_t buf[BINPROTO_HDR_SIZE + TLM_MAX_RECORD];
+    struct subscriber *sub;
+    struct evbuffer *out;
+
+    LIST_FOREACH(sub, &subscribers, entry) {
+        if (++sub->skip < sub->decimate)
+            continue;
+        sub->skip = 0;
+
+        if ((out = client_output(sub->wfd)) == NULL)
+            continue;
+        if (evbuffer_get_length(out) > TLM_MAX_BACKLOG) {
+            sub->drops++;
+            sub->lost++;
+            continue;
+        }
+        evbuffer_add(out, buf, telemetry_pack(buf, s, sub->channels, sub->lost));
+        sub->sent++;
+        sub->lost = 0;
+    }
+}
+
+int telemetry_active(void)
+{
+    return __atomic_load_n(&nr_subscribers, __ATOMIC_RELAXED) > 0;
+}
+
+/*
+ * control thread, seq is assigned here so that records lost on the
+ * way to the I/O thread show up as gaps
+ */
+void telemetry_post(struct tlm_sample *s)
+{
+    s->seq = tlm_seq++;
+    rtctrl_report(publish, s, sizeof(*s));
+}
+
+static struct subscriber *find_subscriber(int wfd)
+{
+    struct subscriber *sub;
+
+    LIST_FOREACH(sub, &subscribers, entry) {
+        if (sub->wfd == wfd)
+            return sub;
+    }
+    return NULL;
+}
+
+int telemetry_subscribe(int wfd, unsigned int channels, int decimate)
+{
+    struct subscriber *sub;
+
+    if (channels == 0 || channels & ~TLM_ALL || decimate <= 0)
+        return -EINVAL;
+    /* only the socket clients have an output buffer */
+    if (client_output(wfd) == NULL)
+        return -ENOTSUP;
+
+    if ((sub = find_subscriber(wfd)) == NULL) {
+        sub = xmalloc(sizeof(*sub));
+        memset(sub, 0, sizeof(*sub));
+        sub->wfd = wfd;
+        LIST_INSERT_HEAD(&subscribers, sub, entry);
+        __atomic_add_fetch(&nr_subscribers, 1, __ATOMIC_RELAXED);
+    }
+    sub->channels = channels;
+    sub->decimate = decimate;
+    sub->skip = 0;
+    return 0;
+}
+
+void telemetry_unsubscribe(int wfd)
+{
+    struct subscriber *sub;
+
+    if ((sub = find_subscriber(wfd)) == NULL)
+        return;
+    LIST_REMOVE(sub, entry);
+    __atomic_sub_fetch(&nr_subscribers, 1, __ATOMIC_RELAXED);
+    free(sub);
+}
+
+/*
+ * module
+ */
+static int parse_channels(char *list, unsigned int *channels)
+{
+    char *s, *name, *saveptr;
+    unsigned int i;
+
+    *channels = 0;
+    for (s = list; (name = strtok_r(s, ",", &saveptr)) != NULL; s = NULL) {
+        if (strcmp(name, "all") == 0) {
+            *channels |= TLM_ALL;
+            continue;
+        }
+        for (i = 0; i < NR_CHANNELS; i++) {
+            if (strcmp(name, channel_names[i]) == 0)
+                break;
+        }
+        if (i == NR_CHANNELS)
+            return -EINVAL;
+        *channels |= 1 << i;
+    }
+    return 0;
+}
+
+static void list_subscribers(int fd)
+{
+    struct subscriber *sub;
+    char buffer[128];
+    int n;
+
+    LIST_FOREACH(sub, &subscribers, entry) {
+        n = snprintf(buffer, sizeof(buffer),
+                "fd %d: channels 0x%02x, 1/%d, sent %lu, dropped %lu\n",
+                sub->wfd, sub->channels, sub->decimate, sub->sent, sub->drops);
+        write(fd, buffer, n);
+    }
+}
+
+static int telemetry_main(int fd, int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "channels", required_argument, NULL, 'c' },
+        { "decimate", required_argument, NULL, 'd' },
+        { "off",      no_argument,       NULL, 'o' },
+        { "list",     no_argument,       NULL, 'l' },
+        { 0, 0, 0, 0 }
+    };
+    unsigned int channels = TLM_EULER;
+    int decimate = 1;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "c:d:ol", options, NULL)) != -1) {
+        switch (c) {
+        case 'c':
+            if (parse_channels(optarg, &channels) < 0)
+                return 1;
+            break;
+        case 'd': decimate = atoi(optarg); break;
+        case 'o':
+            telemetry_unsubscribe(fd);
+            return 0;
+        case 'l':
+            list_subscribers(fd);
+            return 0;
+        default:
+            return 1;
+        }
+    }
+
+    return telemetry_subscribe(fd, channels, decimate) < 0;
+}
+
+DEFINE_MODULE(telemetry);
+
+static int telemetry_subscribe_bin(int fd, const union binarg argv[])
+{
+    return telemetry_subscribe(fd, (unsigned int)argv[0].i, argv[1].i);
+}
+
+static int telemetry_unsubscribe_bin(int fd, const union binarg argv[])
+{
+    telemetry_unsubscribe(fd);
+    return 0;
+}
+
+static const struct bincmd telemetry_bincmds[] = {
+    { "ii", telemetry_subscribe_bin },
+    { "",   telemetry_unsubscribe_bin },
+};
+
+DEFINE_BINCMDS(telemetry);
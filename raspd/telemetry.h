@@ -0,0 +1,65 @@
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <stdint.h>
+
+/*
+ * telemetry stream
+ *
+ * a connection subscribes to channels at a decimation rate with
+ *
+ *      telemetry -c euler,gyro,pid,esc -d 10
+ *
+ * (or the binary command, see binproto.h) and from then on receives
+ * a binproto frame of BINMOD_telemetry, opcode 0 for every n-th sample,
+ * payload little endian:
+ *
+ *      seq(4) timestamp_ms(4) channels(2) lost(2) | blocks
+ *
+ * lost counts the records dropped for this subscriber since the
+ * previous one. blocks follow in the order of the channel bits:
+ *
+ *      TLM_EULER   3 x float32     pitch, roll, yaw (deg)
+ *      TLM_TARGET  3 x float32     setpoint pitch, roll, yaw
+ *      TLM_GYRO    3 x float32     (dps)
+ *      TLM_PID     6 x float32     angle loop p/r/y, rate loop p/r/y
+ *      TLM_ESC     4 x int16       front, rear, left, right
+ *
+ * a subscriber more than TLM_MAX_BACKLOG bytes behind loses records,
+ * the control loop never waits.
+ */
+
+#define TLM_EULER       (1 << 0)
+#define TLM_TARGET      (1 << 1)
+#define TLM_GYRO        (1 << 2)
+#define TLM_PID         (1 << 3)
+#define TLM_ESC         (1 << 4)
+#define TLM_ALL         0x1f
+
+#define TLM_HDR_SIZE    12
+#define TLM_MAX_RECORD  (TLM_HDR_SIZE + 15 * 4 + 4 * 2)
+#define TLM_MAX_BACKLOG (16 * 1024)
+
+struct tlm_sample {
+    uint32_t seq;
+    uint32_t timestamp;
+    float euler[3];
+    float target[3];
+    float gyro[3];
+    float pid[6];
+    int16_t esc[4];
+};
+
+/* control thread */
+int telemetry_active(void);
+void telemetry_post(struct tlm_sample *s);
+
+/* I/O thread */
+int telemetry_subscribe(int wfd, unsigned int channels, int decimate);
+void telemetry_unsubscribe(int wfd);
+
+/* record for s, returns its size */
+int telemetry_pack(void *buf, const struct tlm_sample *s,
+                unsigned int channels, unsigned int lost);
+
+#endif /* __TELEMETRY_H__ */
@@ -14,6 +14,7 @@
 #include "event.h"
 #include "gpiolib.h"
 #include "luaenv.h"
+#include "logger.h"
 
 #include "ultrasonic.h"
 
@@ -43,16 +44,6 @@
         }                                                 \
     } while (0)
 
-#define timeval_sub(t, u, v)                        \
-    do {                                            \
-        (v)->tv_sec = (t)->tv_sec - (u)->tv_sec;    \
-        (v)->tv_usec = (t)->tv_usec - (u)->tv_usec; \
-        if ((v)->tv_usec < 0) {                     \
-            (v)->tv_sec--;                          \
-            (v)->tv_usec += 1000000;                \
-        }                                           \
-    } while (0)
-
 /************************************************************/
 
 static int do_trig(struct ultrasonic_dev *dev)
@@ -77,27 +68,32 @@ static int do_delay_trig(struct ultrasonic_dev *dev)
     return 0;
 }
 
-static void echo_signal(int fd, short what, void *arg)
+/*
+ * echo pulse from the edge timestamps, a pair of edges may come in
+ * one batch when the loop was late
+ */
+static void echo_signal(unsigned int pin,
+                const struct gpio_edge *edges, int nr, void *opaque)
 {
-    struct ultrasonic_dev *dev = arg;
-    struct timeval tv, elapse;
-    unsigned long microsec;
+    struct ultrasonic_dev *dev = opaque;
     double distance;
-    int level;
-
-    dev->nr_echo++;
-    gettimeofday(&tv, NULL);
-    level = (int)bcm2835_gpio_lev(dev->pin_echo);
-
-    if (level) {
-        dev->echo_tv = tv;
-    } else {
-        timeval_sub(&tv, &dev->echo_tv, &elapse);
-        microsec = elapse.tv_sec * 1000000 + elapse.tv_usec;
-        distance = US2VELOCITY(microsec);
+    int i;
+
+    for (i = 0; i < nr; i++) {
+        dev->nr_echo++;
+        if (edges[i].level) {
+            dev->echo_ns = edges[i].time_ns;
+            continue;
+        }
+        if (dev->echo_ns == 0)
+            continue;
+
+        distance = US2VELOCITY((double)(edges[i].time_ns - dev->echo_ns) / NS_PER_US);
+        dev->echo_ns = 0;
         /* save data */
         dev->distance = (float)distance;
-        dev->timestamp = tv.tv_sec * 1000000 + tv.tv_usec;
+        dev->timestamp = (unsigned long)(edges[i].time_ns / NS_PER_US);
+        clock_src_mark(&dev->clk, edges[i].time_ns);
 
         if (dev->cb) {
             int err;
@@ -160,14 +156,19 @@ struct ultrasonic_dev *ultrasonic_new(int pin_trig,
             return NULL;
         }
 
-        if (bcm2835_gpio_signal(dev->pin_echo, EDGE_both,
-                        echo_signal, dev, &dev->ev_echo) < 0) {
+        if (gpio_irq_signal(dev->pin_echo, EDGE_both,
+                        echo_signal, dev, &dev->irq_echo) < 0) {
             ultrasonic_del(dev);
             return NULL;
         }
 
         bcm2835_gpio_fsel(dev->pin_trig, BCM2835_GPIO_FSEL_OUTP);
         bcm2835_gpio_write(dev->pin_trig, LOW);
+
+        /* no period, the triggers are not paced */
+        snprintf(dev->clk_name, sizeof(dev->clk_name), MODNAME "%d", dev->pin_echo);
+        if (clock_src_register(&dev->clk, dev->clk_name, 0) < 0)
+            rlog_warn("%s: no clock source left, not in stats\n", dev->clk_name);
     }
     return dev;
 }
@@ -175,10 +176,11 @@ struct ultrasonic_dev *ultrasonic_new(int pin_trig,
 void ultrasonic_del(struct ultrasonic_dev *dev)
 {
     if (dev) {
+        clock_src_unregister(&dev->clk);
         if (dev->ev_timer)
             eventfd_del(dev->ev_timer);
-        if (dev->ev_echo)
-            eventfd_del(dev->ev_echo);
+        if (dev->irq_echo)
+            gpio_irq_free(dev->irq_echo);
         if (dev->ev_trig_done)
             eventfd_del(dev->ev_trig_done);
         if (dev->ev_delay)
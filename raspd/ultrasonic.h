@@ -1,9 +1,12 @@
 #ifndef __ULTRASONIC_H__
 #define __ULTRASONIC_H__
 
+#include <stdint.h>
 #include <time.h>
 #include <event2/event.h>
 
+#include "stats.h"
+
 int ultrasonic_scope0(int count, int interval,
             int (*urgent_cb)(double distance/* cm */, void *opaque),
             void *opaque);
@@ -26,8 +29,8 @@ struct ultrasonic_dev {
     struct event *ev_timer;
     struct event *ev_trig_done;
     struct event *ev_delay;
-    struct event *ev_echo;
-    struct timeval echo_tv;
+    struct gpio_irq *irq_echo;
+    uint64_t echo_ns;       /* rising edge */
     int nr_trig;
     int nr_echo;
     int count;
@@ -36,7 +39,9 @@ struct ultrasonic_dev {
 #define UF_IMMEDIATE    1
 
     float distance;
-    unsigned long timestamp;
+    unsigned long timestamp;    /* us on raspd_now_ns(), falling edge */
+    struct clock_src clk;       /* the echoes */
+    char clk_name[16];          /* MODNAME and the echo pin */
 
     __cb_ultrasonic cb;
     void *opaque;
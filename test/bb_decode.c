@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../raspd/blackbox.h"
+
+/*
+ * decode a raspd blackbox file (or snapshot) to CSV, oldest first
+ *
+ *      bb_decode file [last]
+ */
+
+static const struct bb_record *recs;
+
+static int cmp_seq(const void *a, const void *b)
+{
+    uint64_t sa = recs[*(const uint32_t *)a].seq;
+    uint64_t sb = recs[*(const uint32_t *)b].seq;
+
+    return sa < sb ? -1 : sa > sb;
+}
+
+static void print_pid(const char *sep, const struct bb_pid *p)
+{
+    fprintf(stdout, "%s%g,%g,%g,%g", sep, p->error, p->sum_err, p->dt_err, p->output);
+}
+
+static void print_record(const struct bb_record *r, uint64_t start_ns)
+{
+    int i;
+
+    fprintf(stdout, "%llu,%.6f,%u,0x%x",
+            (unsigned long long)r->seq,
+            (double)(r->time_ns - start_ns) / 1e9, r->timestamp, r->sensors);
+    for (i = 0; i < 4; i++)
+        fprintf(stdout, ",%d", r->quat[i]);
+    for (i = 0; i < 3; i++)
+        fprintf(stdout, ",%d", r->gyro[i]);
+    for (i = 0; i < 3; i++)
+        fprintf(stdout, ",%d", r->accel[i]);
+    for (i = 0; i < 3; i++)
+        fprintf(stdout, ",%.3f", r->euler[i]);
+    for (i = 0; i < 3; i++)
+        fprintf(stdout, ",%.3f", r->target[i]);
+    for (i = 0; i < 3; i++)
+        print_pid(",", &r->angle[i]);
+    for (i = 0; i < 3; i++)
+        print_pid(",", &r->rate[i]);
+    for (i = 0; i < 4; i++)
+        fprintf(stdout, ",%d", r->esc[i]);
+    fprintf(stdout, "\n");
+}
+
+static void print_columns(void)
+{
+    static const char *axis[] = { "pitch", "roll", "yaw" };
+    static const char *esc[] = { "front", "rear", "left", "right" };
+    int i;
+
+    fprintf(stdout, "seq,time,timestamp_us,sensors,qw,qx,qy,qz,"
+            "gx,gy,gz,ax,ay,az");
+    for (i = 0; i < 3; i++)
+        fprintf(stdout, ",euler_%s", axis[i]);
+    for (i = 0; i < 3; i++)
+        fprintf(stdout, ",target_%s", axis[i]);
+    for (i = 0; i < 6; i++) {
+        const char *a = axis[i % 3], *k = i < 3 ? "angle" : "rate";
+        fprintf(stdout, ",%s_%s_err,%s_%s_sum,%s_%s_dt,%s_%s_out",
+                k, a, k, a, k, a, k, a);
+    }
+    for (i = 0; i < 4; i++)
+        fprintf(stdout, ",esc_%s", esc[i]);
+    fprintf(stdout, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const struct bb_header *hdr;
+    unsigned long last = argc > 2 ? strtoul(argv[2], NULL, 0) : 0;
+    uint32_t *order, nr, i, valid = 0;
+    uint64_t prev = 0, gaps = 0;
+    struct stat st;
+    void *base;
+    int fd;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s file [last]\n", argv[0]);
+        return 1;
+    }
+    if ((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (st.st_size < BB_HEADER_SIZE) {
+        fprintf(stderr, "%s: too short\n", argv[1]);
+        return 1;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    hdr = base;
+    if (memcmp(hdr->magic, BB_MAGIC, sizeof(BB_MAGIC)) ||
+        hdr->version != BB_VERSION ||
+        hdr->record_size != sizeof(struct bb_record) ||
+        hdr->header_size < sizeof(*hdr)) {
+        fprintf(stderr, "%s: not a blackbox v%d file\n", argv[1], BB_VERSION);
+        return 1;
+    }
+
+    /* a file cut short by a crash still has its first slots */
+    nr = hdr->nr_records;
+    if ((uint64_t)st.st_size < hdr->header_size + (uint64_t)nr * hdr->record_size)
+        nr = (st.st_size - hdr->header_size) / hdr->record_size;
+    recs = (const struct bb_record *)((const char *)base + hdr->header_size);
+
+    if ((order = malloc(sizeof(*order) * (nr ? nr : 1))) == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    for (i = 0; i < nr; i++) {
+        if (recs[i].seq != 0)
+            order[valid++] = i;
+    }
+    qsort(order, valid, sizeof(*order), cmp_seq);
+
+    fprintf(stderr, "%s: %u/%u records, count %llu\n", argv[1], valid,
+            hdr->nr_records, (unsigned long long)hdr->count);
+
+    print_columns();
+    for (i = last && last < valid ? valid - last : 0; i < valid; i++) {
+        const struct bb_record *r = &recs[order[i]];
+
+        if (prev && r->seq != prev + 1)
+            gaps++;
+        prev = r->seq;
+        print_record(r, hdr->start_ns);
+    }
+    if (gaps)
+        fprintf(stderr, "%llu gaps in seq\n", (unsigned long long)gaps);
+
+    free(order);
+    munmap(base, st.st_size);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "../raspd/module.h"
+#include "../raspd/binproto.h"
+
+/*
+ * compare the text command path (cmdline_split + getopt_long)
+ * with the binary frame path, both dispatched in process
+ */
+
+/* a test module id, see binproto.h */
+#define BINMOD_bench    BINMOD_TEST_FIRST
+
+static volatile double sink[3];
+
+static int bench_main(int fd, int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "yaw",   required_argument, NULL, 'y' },
+        { "pitch", required_argument, NULL, 'p' },
+        { "roll",  required_argument, NULL, 'r' },
+        { 0, 0, 0, 0 }
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "y:p:r:", options, NULL)) != -1) {
+        switch (c) {
+        case 'y': sink[2] = atoi(optarg); break;
+        case 'p': sink[0] = atoi(optarg); break;
+        case 'r': sink[1] = atoi(optarg); break;
+        default:
+            return 1;
+        }
+    }
+    return 0;
+}
+
+DEFINE_MODULE(bench);
+
+static int bench_set_bin(int fd, const union binarg argv[])
+{
+    sink[0] = argv[0].f;
+    sink[1] = argv[1].f;
+    sink[2] = argv[2].f;
+    return 0;
+}
+
+static const struct bincmd bench_bincmds[] = {
+    { "fff", bench_set_bin },
+};
+
+DEFINE_BINCMDS(bench);
+
+static inline long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, long long *lat, int n, long long total)
+{
+    qsort(lat, n, sizeof(*lat), cmp_ll);
+    fprintf(stdout, "%-6s %10.0f cmd/s  latency(ns) min %lld  p50 %lld  "
+            "p99 %lld  max %lld\n", name, n * 1e9 / total,
+            lat[0], lat[n / 2], lat[n * 99 / 100], lat[n - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+    int count = 200000;
+    char text[64];
+    unsigned char frame[BINPROTO_MAX_FRAME];
+    size_t frame_len;
+    long long *lat;
+    long long t0, t1, start;
+    int retval;
+    int i;
+
+    if (argc > 1)
+        count = atoi(argv[1]);
+    if (count <= 0)
+        return 1;
+
+    lat = malloc(count * sizeof(*lat));
+    if (lat == NULL)
+        return 1;
+
+    snprintf(text, sizeof(text), "bench --pitch %d --roll %d --yaw %d", 10, -5, 3);
+    frame_len = binproto_pack(frame, BINMOD_bench, 0, "fff", 10.0, -5.0, 3.0);
+
+    /* text */
+    start = now_ns();
+    for (i = 0; i < count; i++) {
+        t0 = now_ns();
+        retval = module_cmdexec(-1, text);
+        t1 = now_ns();
+        lat[i] = t1 - t0;
+        if (retval != 0) {
+            fprintf(stderr, "module_cmdexec(), err = %d\n", retval);
+            return 1;
+        }
+    }
+    report("text", lat, count, now_ns() - start);
+
+    /* binary */
+    start = now_ns();
+    for (i = 0; i < count; i++) {
+        t0 = now_ns();
+        if (binproto_exec(-1, frame, frame_len, &retval) != frame_len
+                || retval != 0) {
+            fprintf(stderr, "binproto_exec(), err = %d\n", retval);
+            return 1;
+        }
+        t1 = now_ns();
+        lat[i] = t1 - t0;
+    }
+    report("binary", lat, count, now_ns() - start);
+
+    free(lat);
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "../raspd/module.h"
+
+/*
+ * count the heap allocations made by the text command path,
+ * the arena path (module_cmdexec_ctx) must not make any once warm
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long nr_allocs;
+
+void *malloc(size_t size)
+{
+    nr_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    nr_allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    nr_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+static volatile int sink[3];
+
+static int alloc_main(int fd, int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "yaw",   required_argument, NULL, 'y' },
+        { "pitch", required_argument, NULL, 'p' },
+        { "roll",  required_argument, NULL, 'r' },
+        { 0, 0, 0, 0 }
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "y:p:r:", options, NULL)) != -1) {
+        switch (c) {
+        case 'y': sink[2] = atoi(optarg); break;
+        case 'p': sink[0] = atoi(optarg); break;
+        case 'r': sink[1] = atoi(optarg); break;
+        default:
+            return 1;
+        }
+    }
+    return 0;
+}
+
+DEFINE_MODULE(alloc);
+
+static unsigned long run(struct cmd_ctx *ctx, const char *cmdexec, int count)
+{
+    unsigned long start = nr_allocs;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        int err = ctx ? module_cmdexec_ctx(ctx, -1, cmdexec)
+                      : module_cmdexec(-1, cmdexec);
+        if (err != 0) {
+            fprintf(stderr, "cmdexec(%s), err = %d\n", cmdexec, err);
+            exit(1);
+        }
+    }
+    return nr_allocs - start;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *cmdexec = "alloc --pitch 10 --roll -5 --yaw 3";
+    struct cmd_ctx ctx;
+    int count = 100000;
+    unsigned long n;
+    int err;
+
+    if (argc > 1)
+        count = atoi(argv[1]);
+    if (count <= 0)
+        return 1;
+
+    if ((err = cmd_ctx_init(&ctx)) < 0) {
+        fprintf(stderr, "cmd_ctx_init(), err = %d\n", err);
+        return 1;
+    }
+    module_index_build();
+
+    n = run(NULL, cmdexec, count);
+    fprintf(stdout, "heap:  %lu allocations / %d commands\n", n, count);
+
+    /* warm up: getopt, stdio and the module cache */
+    run(&ctx, cmdexec, 16);
+
+    n = run(&ctx, cmdexec, count);
+    fprintf(stdout, "arena: %lu allocations / %d commands, peak %zu bytes\n",
+            n, count, ctx.arena.peak);
+    fprintf(stdout, "heap commands: %lu\n", module_heap_cmds());
+
+    cmd_ctx_destroy(&ctx);
+    return n == 0 ? 0 : 1;
+}
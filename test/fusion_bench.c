@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <inv_mpu.h>
+
+#include "../raspd/fusion.h"
+#include "../raspd/blackbox.h"
+#include "../raspd/stats.h"
+
+/*
+ * raspd/fusion.c, every variant over the same input: time per update
+ * and the tilt error, the angle between the gravity of the estimate and
+ * the reference. yaw is left out, it drifts without a compass.
+ *
+ * synthetic: a known attitude trajectory (pitch/roll oscillation, yaw
+ * drift) integrated at the rate, gyro with noise and a constant bias,
+ * accel with noise and vibration, compass with -m. the reference is
+ * the truth, the run fails if a variant ends above -e degrees rms.
+ *
+ * blackbox: the recorded raw gyro/accel, the reference is the recorded
+ * DMP quaternion, dt from the sensor timestamps.
+ *
+ *      fusion_bench [-r rate_hz] [-n samples] [-m] [-e max_deg] [-b blackbox]
+ */
+
+struct sample {
+    long gyro[3];           /* dps q16 */
+    long accel[3];          /* g q16 */
+    long compass[3];
+    double ref[4];          /* reference quaternion */
+    uint32_t dt_us;
+};
+
+static struct sample *samples;
+static unsigned long nr_samples;
+
+static uint32_t lcg = 4321;
+
+static double noise(double amplitude)
+{
+    lcg = lcg * 1103515245 + 12345;
+    return amplitude * ((double)(lcg >> 8) / (1 << 24) - 0.5);
+}
+
+/* v in body frame of the body-to-world q: q* v q */
+static void to_body(const double q[], const double v[], double out[])
+{
+    double w = q[0], x = q[1], y = q[2], z = q[3];
+
+    out[0] = (1 - 2 * (y * y + z * z)) * v[0] + 2 * (x * y + w * z) * v[1]
+        + 2 * (x * z - w * y) * v[2];
+    out[1] = 2 * (x * y - w * z) * v[0] + (1 - 2 * (x * x + z * z)) * v[1]
+        + 2 * (y * z + w * x) * v[2];
+    out[2] = 2 * (x * z + w * y) * v[0] + 2 * (y * z - w * x) * v[1]
+        + (1 - 2 * (x * x + y * y)) * v[2];
+}
+
+static void synthesize(unsigned long n, int rate, int compass)
+{
+    static const double up[3] = { 0, 0, 1 };
+    /* 60 degrees of dip, north on x */
+    static const double flux[3] = { 0.5, 0, -0.866 };
+    double q[4] = { 1, 0, 0, 0 }, w[3], v[3], h, norm;
+    double dt = 1.0 / rate, t;
+    unsigned long i;
+    int k;
+
+    samples = calloc(n, sizeof(*samples));
+    nr_samples = n;
+    for (i = 0; i < n; i++) {
+        struct sample *s = &samples[i];
+
+        t = (double)i / rate;
+        /* body rates, rad/s: a 0.5 Hz tilt oscillation of 30 degrees */
+        w[0] = 0.52 * M_PI * cos(M_PI * t);
+        w[1] = -0.52 * M_PI * sin(M_PI * t);
+        w[2] = 0.2;
+
+        /* the truth, a small rotation per sample */
+        h = dt / 2;
+        v[0] = q[0]; v[1] = q[1]; v[2] = q[2];
+        q[0] += (-v[1] * w[0] - v[2] * w[1] - q[3] * w[2]) * h;
+        q[1] += ( v[0] * w[0] + v[2] * w[2] - q[3] * w[1]) * h;
+        q[2] += ( v[0] * w[1] - v[1] * w[2] + q[3] * w[0]) * h;
+        q[3] += ( v[0] * w[2] + v[1] * w[1] - v[2] * w[0]) * h;
+        norm = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        for (k = 0; k < 4; k++)
+            s->ref[k] = q[k] /= norm;
+
+        /* 0.5 dps of bias, 1 dps of noise */
+        for (k = 0; k < 3; k++)
+            s->gyro[k] = (long)((w[k] * 180 / M_PI + 0.5 + noise(1)) * 65536);
+        to_body(q, up, v);
+        for (k = 0; k < 3; k++)
+            s->accel[k] = (long)((v[k] + noise(0.1)) * 65536);
+        if (compass) {
+            to_body(q, flux, v);
+            for (k = 0; k < 3; k++)
+                s->compass[k] = (long)((v[k] + noise(0.02)) * 65536);
+        }
+        s->dt_us = 1000000 / rate;
+    }
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+    uint64_t sa = (*(const struct bb_record * const *)a)->seq;
+    uint64_t sb = (*(const struct bb_record * const *)b)->seq;
+
+    return sa < sb ? -1 : sa > sb;
+}
+
+static int load_blackbox(const char *file)
+{
+    const struct bb_header *hdr;
+    const struct bb_record *recs, **order;
+    unsigned long valid = 0, i;
+    struct stat st;
+    uint32_t nr, prev = 0;
+    void *base;
+    int fd, k;
+
+    if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+        return -errno;
+    if (st.st_size < BB_HEADER_SIZE)
+        return -EINVAL;
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+        return -errno;
+
+    hdr = base;
+    if (memcmp(hdr->magic, BB_MAGIC, sizeof(BB_MAGIC)) ||
+        hdr->version != BB_VERSION ||
+        hdr->record_size != sizeof(struct bb_record))
+        return -EINVAL;
+    nr = hdr->nr_records;
+    if ((uint64_t)st.st_size < hdr->header_size + (uint64_t)nr * hdr->record_size)
+        nr = (st.st_size - hdr->header_size) / hdr->record_size;
+    recs = (const struct bb_record *)((const char *)base + hdr->header_size);
+
+    order = malloc(sizeof(*order) * (nr ? nr : 1));
+    samples = calloc(nr ? nr : 1, sizeof(*samples));
+    if (order == NULL || samples == NULL)
+        return -ENOMEM;
+    for (i = 0; i < nr; i++) {
+        if (recs[i].seq != 0)
+            order[valid++] = &recs[i];
+    }
+    qsort(order, valid, sizeof(*order), cmp_seq);
+
+    for (i = 0; i < valid; i++) {
+        const struct bb_record *r = order[i];
+        struct sample *s = &samples[nr_samples];
+
+        if (!(r->sensors & INV_XYZ_GYRO) || i == 0) {
+            prev = r->timestamp;
+            continue;
+        }
+        for (k = 0; k < 4; k++)
+            s->ref[k] = r->quat[k] / (double)(1 << 30);
+        for (k = 0; k < 3; k++) {
+            s->gyro[k] = r->gyro[k];
+            s->accel[k] = r->accel[k];
+        }
+        s->dt_us = r->timestamp - prev;
+        prev = r->timestamp;
+        if (s->dt_us)
+            nr_samples++;
+    }
+
+    free(order);
+    munmap(base, st.st_size);
+    close(fd);
+    return 0;
+}
+
+/* the angle between the world z of both, in body frame */
+static double tilt_error(const long quat[], const double ref[])
+{
+    static const double up[3] = { 0, 0, 1 };
+    double q[4], a[3], b[3], dot;
+    int k;
+
+    for (k = 0; k < 4; k++)
+        q[k] = quat[k] / (double)(1 << 30);
+    to_body(q, up, a);
+    to_body(ref, up, b);
+    dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    dot /= sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+    return acos(fmin(fmax(dot, -1), 1)) * 180 / M_PI;
+}
+
+/* the whole rotation between both, yaw included */
+static double angle_error(const long quat[], const double ref[])
+{
+    double dot = 0;
+    int k;
+
+    for (k = 0; k < 4; k++)
+        dot += quat[k] / (double)(1 << 30) * ref[k];
+    return 2 * acos(fmin(fabs(dot), 1)) * 180 / M_PI;
+}
+
+static int run(int algo, int compass, double max_err)
+{
+    struct fusion *f;
+    unsigned long i, settle = nr_samples / 10, nr = 0;
+    double err, sum2 = 0, worst = 0, asum2 = 0;
+    long quat[4];
+    uint64_t t;
+    float gain = algo == FUSION_MADGWICK ? FUSION_DEFAULT_BETA : FUSION_DEFAULT_KP;
+
+    f = fusion_new(algo, gain, FUSION_DEFAULT_KI);
+    if (f == NULL)
+        return -ENOMEM;
+
+    /* timing alone, no error bookkeeping in the loop */
+    t = stats_now();
+    for (i = 0; i < nr_samples; i++)
+        fusion_update(f, samples[i].gyro, samples[i].accel,
+                compass ? samples[i].compass : NULL, samples[i].dt_us);
+    t = stats_now() - t;
+
+    fusion_reset(f);
+    for (i = 0; i < nr_samples; i++) {
+        fusion_update(f, samples[i].gyro, samples[i].accel,
+                compass ? samples[i].compass : NULL, samples[i].dt_us);
+        if (i < settle)
+            continue;
+        fusion_get_quat(f, quat);
+        err = tilt_error(quat, samples[i].ref);
+        sum2 += err * err;
+        if (err > worst)
+            worst = err;
+        err = angle_error(quat, samples[i].ref);
+        asum2 += err * err;
+        nr++;
+    }
+    fusion_del(f);
+
+    err = nr ? sqrt(sum2 / nr) : 0;
+    fprintf(stdout, "%-13s %8.1f ns/update  tilt rms %6.3f max %6.3f deg",
+            fusion_name(algo), (double)t / nr_samples, err, worst);
+    /* heading only holds with the compass */
+    if (compass)
+        fprintf(stdout, "  attitude rms %6.3f deg", nr ? sqrt(asum2 / nr) : 0);
+    fprintf(stdout, "%s\n", max_err > 0 && err > max_err ? "  FAIL" : "");
+    return max_err > 0 && err > max_err ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "rate",     required_argument, NULL, 'r' },
+        { "samples",  required_argument, NULL, 'n' },
+        { "compass",  no_argument,       NULL, 'm' },
+        { "error",    required_argument, NULL, 'e' },
+        { "blackbox", required_argument, NULL, 'b' },
+        { 0, 0, 0, 0 }
+    };
+    const char *blackbox = NULL;
+    int rate = 1000, compass = 0, algo, c, err, failed = 0;
+    unsigned long n = 0;
+    double max_err = 2;
+
+    while ((c = getopt_long(argc, argv, "r:n:me:b:", options, NULL)) != -1) {
+        switch (c) {
+        case 'r': rate = atoi(optarg); break;
+        case 'n': n = strtoul(optarg, NULL, 0); break;
+        case 'm': compass = 1; break;
+        case 'e': max_err = atof(optarg); break;
+        case 'b': blackbox = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-r rate_hz] [-n samples] [-m] [-e max_deg] "
+                    "[-b blackbox]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (rate <= 0 || rate > 8000) {
+        fprintf(stderr, "rate: 1 - 8000 Hz\n");
+        return 1;
+    }
+
+    if (blackbox) {
+        if ((err = load_blackbox(blackbox)) < 0) {
+            fprintf(stderr, "%s, err = %d\n", blackbox, err);
+            return 1;
+        }
+        compass = 0;
+        max_err = 0;
+        fprintf(stdout, "%s: %lu samples, reference: the DMP quaternion\n",
+                blackbox, nr_samples);
+    } else {
+        synthesize(n ? n : 60UL * rate, rate, compass);
+        fprintf(stdout, "synthetic: %lu samples at %d Hz%s\n", nr_samples, rate,
+                compass ? ", with compass" : "");
+    }
+    if (nr_samples == 0) {
+        fprintf(stderr, "no samples\n");
+        return 1;
+    }
+
+    for (algo = 0; algo < NR_FUSIONS; algo++) {
+        if (compass && algo == FUSION_MAHONY_FIXED)
+            continue;
+        if (run(algo, compass, max_err) < 0)
+            failed = 1;
+    }
+    free(samples);
+    return failed;
+}
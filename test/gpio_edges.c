@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+
+#include "../raspd/gpiolib.h"
+
+/*
+ * the character device backend of gpiolib against a simulated chip,
+ * no raspberry needed. the line is driven through the simulator:
+ *
+ * gpio-sim (configfs):
+ *      modprobe gpio-sim
+ *      mkdir -p /sys/kernel/config/gpio-sim/raspd/bank0
+ *      echo 54 > /sys/kernel/config/gpio-sim/raspd/bank0/num_lines
+ *      echo 1 > /sys/kernel/config/gpio-sim/raspd/live
+ *      chip=$(cat /sys/kernel/config/gpio-sim/raspd/bank0/chip_name)
+ *      dev=$(cat /sys/kernel/config/gpio-sim/raspd/dev_name)
+ *      gpio_edges -c /dev/$chip -p 17 \
+ *              -d /sys/devices/platform/$dev/$chip/sim_gpio17/pull
+ *
+ * gpio-mockup (debugfs):
+ *      modprobe gpio-mockup gpio_mockup_ranges=-1,54
+ *      gpio_edges -c /dev/gpiochipN -p 17 -d /sys/kernel/debug/gpio-mockup/gpiochipN/17
+ *
+ * checks one edge per toggle with its level and a kernel timestamp
+ * within the toggle, a burst read at once, and the dropped edges
+ * accounted for when the queue overflows.
+ */
+
+static int fd_drive = -1;
+static int sim_pull;            /* gpio-sim pull, else gpio-mockup 0/1 */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int drive(int level)
+{
+    const char *s;
+
+    if (sim_pull)
+        s = level ? "pull-up" : "pull-down";
+    else
+        s = level ? "1" : "0";
+    if (pwrite(fd_drive, s, strlen(s), 0) < 0) {
+        perror("drive");
+        return -errno;
+    }
+    return 0;
+}
+
+static int wait_edge(struct gpio_irq *irq, int timeout)
+{
+    struct pollfd pfd = { gpio_irq_fd(irq), POLLIN, 0 };
+
+    return poll(&pfd, 1, timeout);
+}
+
+/* the simulators raise the edge from irq_work, give them a moment */
+static void settle(void)
+{
+    struct timespec ts = { 0, 20 * 1000000L };
+
+    nanosleep(&ts, NULL);
+}
+
+static int test_single(struct gpio_irq *irq, int count)
+{
+    struct gpio_edge e;
+    uint64_t before, after, last = 0;
+    int i, level, nr;
+
+    for (i = 0; i < count; i++) {
+        level = !(i & 1);
+        before = now_ns();
+        if (drive(level) < 0)
+            return -1;
+        if (wait_edge(irq, 1000) <= 0) {
+            fprintf(stderr, "single %d: no edge\n", i);
+            return -1;
+        }
+        after = now_ns();
+        if ((nr = gpio_irq_read(irq, &e, 1)) != 1) {
+            fprintf(stderr, "single %d: read %d\n", i, nr);
+            return -1;
+        }
+        if (e.level != level) {
+            fprintf(stderr, "single %d: level %d, expected %d\n", i, e.level, level);
+            return -1;
+        }
+        if (e.time_ns < before || e.time_ns > after || e.time_ns <= last) {
+            fprintf(stderr, "single %d: time %llu not in [%llu, %llu]\n", i,
+                    (unsigned long long)e.time_ns, (unsigned long long)before,
+                    (unsigned long long)after);
+            return -1;
+        }
+        last = e.time_ns;
+    }
+    printf("single: %d edges\n", count);
+    return 0;
+}
+
+/* toggles without reading, one read gets them all */
+static int test_burst(struct gpio_irq *irq, int count)
+{
+    struct gpio_edge edges[GPIO_IRQ_BATCH];
+    int i, nr;
+
+    if (count > GPIO_IRQ_BATCH)
+        count = GPIO_IRQ_BATCH;
+    for (i = 0; i < count; i++) {
+        if (drive(!(i & 1)) < 0)
+            return -1;
+        settle();
+    }
+    if ((nr = gpio_irq_read(irq, edges, GPIO_IRQ_BATCH)) != count) {
+        fprintf(stderr, "burst: read %d, expected %d\n", nr, count);
+        return -1;
+    }
+    for (i = 0; i < nr; i++) {
+        if (edges[i].level != !(i & 1)
+                || (i && edges[i].time_ns <= edges[i - 1].time_ns)) {
+            fprintf(stderr, "burst: edge %d out of order\n", i);
+            return -1;
+        }
+    }
+    printf("burst: %d edges in one read\n", nr);
+    return 0;
+}
+
+/* more than the kernel queues, read + missed must add up */
+static int test_overflow(struct gpio_irq *irq, int count)
+{
+    struct gpio_edge edges[GPIO_IRQ_BATCH];
+    unsigned long missed = gpio_irq_missed(irq);
+    int i, nr, total = 0;
+
+    for (i = 0; i < count; i++) {
+        if (drive(!(i & 1)) < 0)
+            return -1;
+        settle();
+    }
+    while ((nr = gpio_irq_read(irq, edges, GPIO_IRQ_BATCH)) > 0)
+        total += nr;
+    missed = gpio_irq_missed(irq) - missed;
+    if (nr < 0 || total + missed != (unsigned long)count) {
+        fprintf(stderr, "overflow: %d read, %lu missed, %d edges\n",
+                total, missed, count);
+        return -1;
+    }
+    printf("overflow: %d read, %lu missed\n", total, missed);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "chip",   required_argument, NULL, 'c' },
+        { "pin",    required_argument, NULL, 'p' },
+        { "drive",  required_argument, NULL, 'd' },
+        { "count",  required_argument, NULL, 'n' },
+        { 0, 0, 0, 0 }
+    };
+    const char *chip = NULL, *path = NULL;
+    struct gpio_irq *irq;
+    int pin = -1, count = 20;
+    int c, err;
+
+    while ((c = getopt_long(argc, argv, "c:p:d:n:", options, NULL)) != -1) {
+        switch (c) {
+        case 'c': chip = optarg; break;
+        case 'p': pin = atoi(optarg); break;
+        case 'd': path = optarg; break;
+        case 'n': count = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s -c /dev/gpiochipN -p pin -d drive [-n count]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (chip == NULL || path == NULL || pin < 0) {
+        fprintf(stderr, "must specify the chip, the pin and the drive file\n");
+        return 1;
+    }
+
+    if ((err = gpiolib_init_chip(chip)) < 0) {
+        fprintf(stderr, "gpiolib_init_chip(%s), err = %d\n", chip, err);
+        return 1;
+    }
+    if ((fd_drive = open(path, O_WRONLY)) < 0) {
+        perror(path);
+        return 1;
+    }
+    sim_pull = strlen(path) > 5 && strcmp(path + strlen(path) - 5, "/pull") == 0;
+
+    /* start low, the request comes after */
+    if (drive(0) < 0)
+        return 1;
+    settle();
+    if ((err = gpio_irq_request(pin, EDGE_both, &irq)) < 0) {
+        fprintf(stderr, "gpio_irq_request(%d), err = %d\n", pin, err);
+        return 1;
+    }
+
+    err = test_single(irq, count & ~1);
+    if (err == 0)
+        err = test_burst(irq, 10);
+    if (err == 0)
+        err = test_overflow(irq, 100);
+
+    gpio_irq_free(irq);
+    close(fd_drive);
+    gpiolib_exit();
+    return err < 0;
+}
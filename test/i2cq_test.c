@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "../raspd/event.h"
+#include "../raspd/i2cq.h"
+
+/*
+ * raspd/i2cq.c on the mock bus, no raspberry needed: completions in
+ * submit order on the event loop thread, a chain resubmitted from the
+ * completions, no ack, the blocking calls from another thread and
+ * refused on the running loop, and the pending transfers run by
+ * i2cq_del().
+ *
+ * with -d, one blocking register read on a real bus:
+ *      i2cq_test -d /dev/i2c-1 -a 0x68 -r 0x75     (MPU WHO_AM_I)
+ */
+
+#define ADDR        0x68
+#define NR_ASYNC    256
+#define NR_CHAIN    1000
+
+static struct i2cq *q;
+static struct i2c_regmap_dev regmap;
+static pthread_t loop_thread;
+
+struct job {
+    struct i2cq_xfer x;
+    uint8_t w[2], r[1];
+    int index;
+};
+
+static struct job jobs[NR_ASYNC];
+static int next_done, failed;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void async_done(struct i2cq_xfer *x, void *opaque)
+{
+    struct job *j = opaque;
+
+    if (!pthread_equal(pthread_self(), loop_thread)) {
+        fprintf(stderr, "async %d: done off the event loop\n", j->index);
+        failed = 1;
+    }
+    if (j->index != next_done++ || x->status != 0
+            || j->r[0] != (uint8_t)(j->index * 7)) {
+        fprintf(stderr, "async %d: order %d, status %d, read %02x\n",
+                j->index, next_done - 1, x->status, j->r[0]);
+        failed = 1;
+    }
+    if (next_done == NR_ASYNC)
+        rasp_event_loopexit();
+}
+
+/* write-reads of the register the previous write set, all queued at once */
+static int test_async(void)
+{
+    int i, err;
+
+    for (i = 0; i < NR_ASYNC; i++) {
+        regmap.regs[i] = (uint8_t)(i * 7);
+        jobs[i].index = i;
+        jobs[i].w[0] = i;
+        jobs[i].x.addr = ADDR;
+        jobs[i].x.wbuf = jobs[i].w;
+        jobs[i].x.wlen = 1;
+        jobs[i].x.rbuf = jobs[i].r;
+        jobs[i].x.rlen = 1;
+        jobs[i].x.done = async_done;
+        jobs[i].x.opaque = &jobs[i];
+        if ((err = i2cq_submit(q, &jobs[i].x)) < 0) {
+            fprintf(stderr, "i2cq_submit(%d), err = %d\n", i, err);
+            return -1;
+        }
+    }
+    rasp_event_loop();
+    if (failed || next_done != NR_ASYNC)
+        return -1;
+    printf("async: %d transfers in order on the loop\n", NR_ASYNC);
+    return 0;
+}
+
+static struct job chain;
+static int chain_count;
+static uint64_t chain_start;
+
+/* a driver state machine: each completion queues the next step */
+static void chain_done(struct i2cq_xfer *x, void *opaque)
+{
+    if (x->status != 0) {
+        fprintf(stderr, "chain %d: status %d\n", chain_count, x->status);
+        failed = 1;
+    }
+    if (++chain_count == NR_CHAIN || failed) {
+        rasp_event_loopexit();
+        return;
+    }
+    chain.w[1] = chain_count;
+    i2cq_submit(q, x);
+}
+
+static int test_chain(void)
+{
+    chain.w[0] = 0x10;
+    chain.x.addr = ADDR;
+    chain.x.wbuf = chain.w;
+    chain.x.wlen = 2;
+    chain.x.done = chain_done;
+    chain_start = now_ns();
+    if (i2cq_submit(q, &chain.x) < 0)
+        return -1;
+    rasp_event_loop();
+    if (failed || regmap.regs[0x10] != (uint8_t)(NR_CHAIN - 1))
+        return -1;
+    printf("chain: %d steps, %.1f us per round trip\n", NR_CHAIN,
+            (now_ns() - chain_start) / 1000.0 / NR_CHAIN);
+    return 0;
+}
+
+static int test_nack(void)
+{
+    uint8_t r;
+    int err;
+
+    if ((err = i2cq_read_reg(q, 0x10, 0, &r, 1)) != -ENXIO) {
+        fprintf(stderr, "nack: err = %d\n", err);
+        return -1;
+    }
+    printf("nack: -ENXIO\n");
+    return 0;
+}
+
+static void *blocking_thread(void *opaque)
+{
+    static const uint8_t data[] = { 0xde, 0xad, 0xbe, 0xef };
+    uint8_t r[sizeof(data)];
+    long err;
+
+    err = i2cq_write_reg(q, ADDR, 0x40, data, sizeof(data));
+    if (err == 0)
+        err = i2cq_read_reg(q, ADDR, 0x40, r, sizeof(r));
+    if (err == 0 && memcmp(r, data, sizeof(data)))
+        err = -EIO;
+    return (void *)err;
+}
+
+static int test_blocking(void)
+{
+    pthread_t th;
+    void *ret;
+
+    pthread_create(&th, NULL, blocking_thread, NULL);
+    pthread_join(th, &ret);
+    if ((long)ret != 0) {
+        fprintf(stderr, "blocking: err = %ld\n", (long)ret);
+        return -1;
+    }
+    printf("blocking: write + read back from a thread\n");
+    return 0;
+}
+
+static int loop_err;
+
+static void cb_loop_read(int fd, short what, void *opaque)
+{
+    uint8_t r;
+
+    loop_err = i2cq_read_reg(q, ADDR, 0, &r, 1);
+    rasp_event_loopexit();
+}
+
+/* the blocking calls never wait on the event loop */
+static int test_loop(void)
+{
+    struct timeval tv = { 0, 0 };
+    struct event *ev;
+
+    if (register_timer(EV_TIMEOUT, &tv, cb_loop_read, NULL, &ev) < 0)
+        return -1;
+    rasp_event_loop();
+    eventfd_del(ev);
+    if (loop_err != -EWOULDBLOCK || rasp_event_in_loop()) {
+        fprintf(stderr, "loop: err = %d\n", loop_err);
+        return -1;
+    }
+    printf("loop: blocking read refused\n");
+    return 0;
+}
+
+static int nr_drained;
+
+static void drain_done(struct i2cq_xfer *x, void *opaque)
+{
+    nr_drained++;
+}
+
+/* queued, then the queue deleted: still run, the completions by hand */
+static int test_del(void)
+{
+    struct i2cq_stats st;
+    int i;
+
+    for (i = 0; i < NR_ASYNC; i++) {
+        jobs[i].x.done = drain_done;
+        i2cq_submit(q, &jobs[i].x);
+    }
+    while (nr_drained < NR_ASYNC)
+        i2cq_poll(q);
+    i2cq_get_stats(q, &st);
+    i2cq_del(q);
+    q = NULL;
+    printf("del: %lu submitted, %lu completed, %lu errors, max depth %lu\n",
+            st.submitted, st.completed, st.errors, st.max_depth);
+    return st.submitted == st.completed ? 0 : -1;
+}
+
+static int read_dev(const char *dev, int addr, int reg)
+{
+    struct i2cq *bus;
+    uint8_t r;
+    int err;
+
+    if ((bus = i2cq_open(dev)) == NULL) {
+        perror(dev);
+        return 1;
+    }
+    err = i2cq_read_reg(bus, addr, reg, &r, 1);
+    if (err == 0)
+        printf("%s 0x%02x reg 0x%02x: 0x%02x\n", dev, addr, reg, r);
+    else
+        fprintf(stderr, "%s 0x%02x reg 0x%02x, err = %d\n", dev, addr, reg, err);
+    i2cq_del(bus);
+    return err < 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "dev",  required_argument, NULL, 'd' },
+        { "addr", required_argument, NULL, 'a' },
+        { "reg",  required_argument, NULL, 'r' },
+        { 0, 0, 0, 0 }
+    };
+    const char *dev = NULL;
+    int addr = ADDR, reg = 0x75;
+    int c, err;
+
+    while ((c = getopt_long(argc, argv, "d:a:r:", options, NULL)) != -1) {
+        switch (c) {
+        case 'd': dev = optarg; break;
+        case 'a': addr = strtol(optarg, NULL, 0); break;
+        case 'r': reg = strtol(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-d /dev/i2c-N [-a addr] [-r reg]]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (dev)
+        return read_dev(dev, addr, reg);
+
+    if ((err = rasp_event_init()) < 0) {
+        fprintf(stderr, "rasp_event_init(), err = %d\n", err);
+        return 1;
+    }
+    loop_thread = pthread_self();
+    if ((q = i2cq_new_mock()) == NULL) {
+        perror("i2cq_new_mock");
+        return 1;
+    }
+    i2c_regmap_init(&regmap, ADDR);
+    i2cq_mock_add(q, &regmap.dev);
+
+    err = test_async();
+    if (err == 0)
+        err = test_chain();
+    if (err == 0)
+        err = test_nack();
+    if (err == 0)
+        err = test_blocking();
+    if (err == 0)
+        err = test_loop();
+    if (err == 0)
+        err = test_del();
+
+    i2cq_del(q);
+    rasp_event_exit();
+    return err < 0;
+}
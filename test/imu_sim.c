@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+
+#include <inv_mpu.h>
+#include <inv_mpu_dmp_motion_driver.h>
+#include <invensense_adv.h>
+
+#include "../raspd/clock.h"
+#include "../raspd/stats.h"
+#include "../raspd/fusion.h"
+#include "../raspd/i2cq.h"
+#include "../raspd/inv_imu.h"
+#include "mpu_sim.h"
+
+/*
+ * raspd/inv_imu.c and the eMPL driver on the simulated MPU (mpu_sim.c),
+ * no raspberry needed: the init against the registers (reset, the DMP
+ * image loaded and verified, the features, the FIFO), then the samples
+ * through the INT pin, the FIFO drain and the data ready callback.
+ *
+ * the attitude of the callback against the truth of the motion, the
+ * callback timestamps against the INT edges. the init time and the cost
+ * per sample: on the host, and on the bus at -b Hz.
+ *
+ * the device runs on its own clock as fast as the host goes, the driver
+ * calls straight into it. -R: in real time, -q: through the I2C queue
+ * (its worker thread, the delays sleep), implies -R.
+ *
+ *      imu_sim [-r rate_hz] [-n samples] [-m mpl_div | -F algo] [-b bus_hz]
+ *              [-s skew_ppm] [-e max_deg] [-S] [-q] [-R]
+ */
+
+#ifdef MPU9250
+#define SIM_CHIP    MPU_SIM_9250
+#else
+#define SIM_CHIP    MPU_SIM_6050
+#endif
+
+static struct mpu_sim *sim;
+static struct hist cost;
+static unsigned long nr_cb, nr_settle, nr_bad_ts, nr_err;
+static uint64_t edge;
+static double sum2, worst, asum2, max_err = 2;
+static int fusion = -1;
+
+/* a script for -S: tilts and turns, held in between */
+static const struct mpu_sim_keyframe script[] = {
+    { 0.0,    0,   0,   0 },
+    { 1.0,    0,   0,   0 },
+    { 1.5,   30,   0,   0 },
+    { 2.5,   30,   0,   0 },
+    { 3.0,  -20,  25,   0 },
+    { 4.0,  -20,  25,  90 },
+    { 5.0,    0,   0,  90 },
+    { 6.0,    0,   0,   0 },
+};
+static struct mpu_sim_script script_opaque = {
+    script, sizeof(script) / sizeof(script[0]),
+};
+
+/* the angle between the world z of both, in body frame */
+static double tilt_error(const double q[], const double ref[])
+{
+    double a[3], b[3], dot;
+
+    /* the third row of each rotation matrix */
+    a[0] = 2 * (q[1] * q[3] - q[0] * q[2]);
+    a[1] = 2 * (q[2] * q[3] + q[0] * q[1]);
+    a[2] = 1 - 2 * (q[1] * q[1] + q[2] * q[2]);
+    b[0] = 2 * (ref[1] * ref[3] - ref[0] * ref[2]);
+    b[1] = 2 * (ref[2] * ref[3] + ref[0] * ref[1]);
+    b[2] = 1 - 2 * (ref[1] * ref[1] + ref[2] * ref[2]);
+    dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    return acos(fmin(fmax(dot, -1), 1)) * 180 / M_PI;
+}
+
+static void data_ready(short sensors, uint64_t timestamp, long quat[],
+                long accel[], long gyro[], long compass[])
+{
+    struct mpu_sim_motion truth;
+    double q[4], norm = 0, dot = 0, err;
+    int k;
+
+    if (timestamp != edge)
+        nr_bad_ts++;
+    if (!(sensors & INV_WXYZ_QUAT) || nr_cb++ < nr_settle)
+        return;
+
+    mpu_sim_truth(sim, &truth);
+    for (k = 0; k < 4; k++) {
+        q[k] = quat[k] / (double)(1 << 30);
+        norm += q[k] * q[k];
+    }
+    norm = sqrt(norm);
+    for (k = 0; k < 4; k++) {
+        q[k] /= norm;
+        dot += q[k] * truth.quat[k];
+    }
+    err = tilt_error(q, truth.quat);
+    sum2 += err * err;
+    if (err > worst)
+        worst = err;
+    /* yaw drifts without a compass on the raw fusion */
+    err = 2 * acos(fmin(fabs(dot), 1)) * 180 / M_PI;
+    asum2 += err * err;
+    nr_err++;
+}
+
+static int sim_write(void *opaque, unsigned char slave_addr,
+        unsigned char reg_addr, unsigned short length, const unsigned char *data)
+{
+    uint8_t buffer[64], *buf = buffer;
+    int err;
+
+    if (length >= sizeof(buffer) && (buf = malloc(length + 1)) == NULL)
+        return -ENOMEM;
+    buf[0] = reg_addr;
+    memcpy(&buf[1], data, length);
+    err = mpu_sim_xfer(opaque, slave_addr, buf, length + 1, NULL, 0);
+    if (buf != buffer)
+        free(buf);
+    return err;
+}
+
+static int sim_read(void *opaque, unsigned char slave_addr,
+        unsigned char reg_addr, unsigned short length, unsigned char *data)
+{
+    return mpu_sim_xfer(opaque, slave_addr, &reg_addr, 1, data, length);
+}
+
+static void sim_delay(void *opaque, unsigned long num_ms)
+{
+    mpu_sim_advance(opaque, num_ms * NS_PER_MS);
+}
+
+static struct mpu_i2c_ops sim_ops = { sim_write, sim_read, NULL, sim_delay };
+
+int main(int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "rate",     required_argument, NULL, 'r' },
+        { "samples",  required_argument, NULL, 'n' },
+        { "mpl-div",  required_argument, NULL, 'm' },
+        { "fusion",   required_argument, NULL, 'F' },
+        { "bus",      required_argument, NULL, 'b' },
+        { "skew",     required_argument, NULL, 's' },
+        { "error",    required_argument, NULL, 'e' },
+        { "script",   no_argument,       NULL, 'S' },
+        { "queue",    no_argument,       NULL, 'q' },
+        { "realtime", no_argument,       NULL, 'R' },
+        { 0, 0, 0, 0 }
+    };
+    struct mpu_sim_stats st0, st;
+    struct i2cq *q = NULL;
+    unsigned long n = 0, i, bus_hz = 400000;
+    int rate = 200, mpl_div = 4, scripted = 0, queue = 0, realtime = 0;
+    double skew = 50;
+    uint64_t t, sim_t, host;
+    int c, err, failed = 0;
+
+    while ((c = getopt_long(argc, argv, "r:n:m:F:b:s:e:SqR", options, NULL)) != -1) {
+        switch (c) {
+        case 'r': rate = atoi(optarg); break;
+        case 'n': n = strtoul(optarg, NULL, 0); break;
+        case 'm': mpl_div = atoi(optarg); break;
+        case 'F': fusion = atoi(optarg); break;
+        case 'b': bus_hz = strtoul(optarg, NULL, 0); break;
+        case 's': skew = atof(optarg); break;
+        case 'e': max_err = atof(optarg); break;
+        case 'S': scripted = 1; break;
+        case 'q': queue = realtime = 1; break;
+        case 'R': realtime = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-r rate_hz] [-n samples] [-m mpl_div | -F algo] "
+                    "[-b bus_hz] [-s skew_ppm] [-e max_deg] [-S] [-q] [-R]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (rate <= 0 || rate > 1000 || (fusion < 0 && rate > 200)) {
+        fprintf(stderr, "rate: 4 - 200 Hz on the DMP, up to 1000 with -F\n");
+        return 1;
+    }
+    if (fusion >= NR_FUSIONS) {
+        fprintf(stderr, "fusion: 0 - %d\n", NR_FUSIONS - 1);
+        return 1;
+    }
+    if (n == 0)
+        n = scripted ? 7UL * rate : 20UL * rate;
+
+    if ((sim = mpu_sim_new(SIM_CHIP)) == NULL) {
+        perror("mpu_sim_new");
+        return 1;
+    }
+    mpu_sim_set_bus(sim, bus_hz);
+    mpu_sim_set_errors(sim, skew, 0.5, 0.05, 0.005);
+    if (scripted)
+        mpu_sim_set_motion(sim, mpu_sim_scripted, &script_opaque);
+    mpu_sim_set_realtime(sim, realtime);
+
+    if (queue) {
+        if ((q = i2cq_new_mock()) == NULL) {
+            perror("i2cq_new_mock");
+            return 1;
+        }
+        mpu_sim_attach(sim, q);
+        invmpu_set_i2c(q);
+    } else {
+        sim_ops.opaque = sim;
+        mpu_set_i2c_ops(&sim_ops);
+    }
+
+    if (fusion >= 0) {
+        invmpu_set_fusion(fusion, fusion == FUSION_MADGWICK ? FUSION_DEFAULT_BETA :
+                FUSION_DEFAULT_KP, FUSION_DEFAULT_KI);
+        /* from identity, 2 s to converge */
+        nr_settle = 2UL * rate;
+    } else {
+        invmpu_set_fast_path(mpl_div);
+    }
+    invmpu_register_data_ready_cb(data_ready);
+
+    mpu_sim_get_stats(sim, &st0);
+    sim_t = mpu_sim_now(sim);
+    t = stats_now();
+    err = invmpu_init(-1, rate);
+    host = stats_now() - t;
+    mpu_sim_get_stats(sim, &st);
+    fprintf(stdout, "init: err %d, %.1f ms host, %.1f ms device (%.1f ms on the bus, "
+            "%lu transfers, %lu bytes)\n", err, host / 1e6,
+            (mpu_sim_now(sim) - sim_t) / 1e6, (st.bus_ns - st0.bus_ns) / 1e6,
+            st.xfers - st0.xfers, st.bytes - st0.bytes);
+    if (err < 0)
+        return 1;
+
+    /* no edge queued before the pin was taken */
+    mpu_sim_wait_irq(sim, 0);
+    st0 = st;
+    hist_reset(&cost);
+    for (i = 0; i < n; i++) {
+        if ((edge = mpu_sim_wait_irq(sim, NS_PER_MS * 1000)) == 0) {
+            fprintf(stderr, "no interrupt after %lu samples\n", i);
+            failed = 1;
+            break;
+        }
+        t = stats_now();
+        invmpu_interrupt(edge);
+        hist_record(&cost, stats_now() - t);
+    }
+    mpu_sim_get_stats(sim, &st);
+
+    fprintf(stdout, "%s%s: %lu interrupts, %lu packets, %lu callbacks, %lu overflows\n",
+            fusion >= 0 ? fusion_name(fusion) : "dmp",
+            scripted ? " scripted" : "", st.irqs - st0.irqs,
+            st.packets - st0.packets, nr_cb, st.overflows - st0.overflows);
+    fprintf(stdout, "per interrupt: host p50 %.1f us p99 %.1f us, bus %.1f us "
+            "(%.1f transfers, %.1f bytes)\n",
+            hist_quantile(&cost, 0.5) / 1e3, hist_quantile(&cost, 0.99) / 1e3,
+            (st.bus_ns - st0.bus_ns) / 1e3 / n,
+            (double)(st.xfers - st0.xfers) / n, (double)(st.bytes - st0.bytes) / n);
+    sum2 = nr_err ? sqrt(sum2 / nr_err) : 0;
+    asum2 = nr_err ? sqrt(asum2 / nr_err) : 0;
+    fprintf(stdout, "attitude: tilt rms %.3f max %.3f deg", sum2, worst);
+    if (fusion < 0)
+        fprintf(stdout, ", with yaw rms %.3f deg", asum2);
+    fprintf(stdout, ", %lu bad timestamps\n", nr_bad_ts);
+
+#ifndef __arm__
+    /* the whole MPL (-m 0) lacks its algorithms on the host, see below */
+    if (fusion < 0 && mpl_div == 0) {
+        fprintf(stdout, "attitude: the MPL without core/mpl, not checked\n");
+        max_err = 180;
+    }
+#endif
+    if (nr_err == 0 || sum2 > max_err || (fusion < 0 && asum2 > max_err)
+            || nr_bad_ts || st.overflows != st0.overflows
+            || nr_cb < (n - n / 100)) {
+        fprintf(stdout, "FAIL\n");
+        failed = 1;
+    }
+
+    invmpu_exit();
+    mpu_set_i2c_ops(NULL);
+    i2cq_del(q);
+    mpu_sim_del(sim);
+    return failed;
+}
+
+#ifndef __arm__
+/*
+ * the MPL algorithms in core/mpl are ARM objects only: off on the host,
+ * the MPL keeps the 6-axis quaternion and the gyro bias from mllite
+ */
+inv_error_t inv_enable_quaternion(void) { return 0; }
+inv_error_t inv_enable_9x_sensor_fusion(void) { return 0; }
+inv_error_t inv_enable_fast_nomot(void) { return 0; }
+inv_error_t inv_enable_gyro_tc(void) { return 0; }
+inv_error_t inv_enable_vector_compass_cal(void) { return 0; }
+inv_error_t inv_enable_magnetic_disturbance(void) { return 0; }
+#endif
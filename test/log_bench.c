@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../raspd/logger.h"
+
+/*
+ * check the deferred formatting against printf, then compare the cost
+ * of a log call on the calling thread: fprintf() vs rlog(). last,
+ * short-lived threads, many more than there are rings: the ring of a
+ * thread goes back when it exits, nothing is dropped.
+ *
+ *      log_bench [iterations]
+ */
+
+#define BURST   64
+#define THREADS 4       /* at a time */
+#define ROUNDS  16
+
+static int failed;
+
+#define CHECK(fmt, ...)                                                     \
+    do {                                                                    \
+        const struct log_arg args[] = { LOG_MAP(__VA_ARGS__) };             \
+        char want[256], got[256];                                           \
+        snprintf(want, sizeof(want), fmt, ##__VA_ARGS__);                   \
+        log_format(got, sizeof(got), fmt, args, LOG_NARGS(__VA_ARGS__));   \
+        if (strcmp(want, got)) {                                            \
+            fprintf(stderr, "FAIL %s: want \"%s\" got \"%s\"\n",            \
+                    #fmt, want, got);                                       \
+            failed++;                                                       \
+        }                                                                   \
+    } while (0)
+
+static void check_format(void)
+{
+    long l = -1234567890L;
+    unsigned long long ull = 18446744073709551615ULL;
+    const char *s = "pitch";
+    void *p = &failed;
+
+    CHECK("plain text");
+    CHECK("100%%");
+    CHECK("%d %i %u", -42, 7, 3000000000u);
+    CHECK("%x %X %o", -1, 0xbeef, 8);
+    CHECK("%5d|%-5d|%05d", 42, 42, 42);
+    CHECK("%ld %lu", l, (unsigned long)l);
+    CHECK("%lld %llx", ull, ull);
+    CHECK("%f %.2f %8.3f", 3.14159, -0.005, 1e3);
+    CHECK("%f", 1.5f);
+    CHECK("%e %g", 12345.678, 0.0001);
+    CHECK("%s=%.2f", s, 1.25);
+    CHECK("[%10s|%-10s]", s, s);
+    CHECK("%c%c", 'o', 'k');
+    CHECK("%p", p);
+    CHECK("%d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8);
+}
+
+static void *short_lived(void *arg)
+{
+    if (log_register_thread() < 0)
+        failed++;
+    rlog_info("thread %ld\n", (long)arg);
+    return NULL;
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 6400;
+    float pitch = 1.5f, roll = -0.25f, yaw = 90.0f;
+    FILE *null;
+    long long t;
+    char name[16];
+    int fd, i, j;
+
+    check_format();
+    if (failed) {
+        fprintf(stderr, "%d format checks failed\n", failed);
+        return 1;
+    }
+    fprintf(stdout, "format: ok\n");
+
+    if ((fd = open("/dev/null", O_WRONLY)) < 0 ||
+        (null = fdopen(dup(fd), "w")) == NULL) {
+        perror("/dev/null");
+        return 1;
+    }
+    /* stderr is unbuffered, as in raspd */
+    setvbuf(null, NULL, _IONBF, 0);
+
+    t = now_ns();
+    for (i = 0; i < iterations; i++)
+        fprintf(null, "E: %.2f %.2f %.2f (%d)\n", pitch, roll, yaw, i);
+    t = now_ns() - t;
+    fprintf(stdout, "fprintf: %.0f ns/call\n", (double)t / iterations);
+
+    if (log_init(fd) < 0) {
+        fprintf(stderr, "log_init() error\n");
+        return 1;
+    }
+    /* bursts smaller than the ring, the drainer (20 ms idle) catches up */
+    for (t = 0, i = 0; i < iterations; i += BURST) {
+        long long t0 = now_ns();
+        for (j = i; j < i + BURST; j++)
+            rlog_info("E: %.2f %.2f %.2f (%d)\n", pitch, roll, yaw, j);
+        t += now_ns() - t0;
+        usleep(25000);
+    }
+    fprintf(stdout, "rlog:    %.0f ns/call\n", (double)t / iterations);
+
+    for (t = 0, i = 0; i < iterations; i += BURST) {
+        long long t0 = now_ns();
+        for (j = i; j < i + BURST; j++) {
+            snprintf(name, sizeof(name), "m%d", j);
+            rlog_info("%s: %d\n", name, j);
+        }
+        t += now_ns() - t0;
+        usleep(25000);
+    }
+    fprintf(stdout, "rlog %%s: %.0f ns/call\n", (double)t / iterations);
+
+    for (i = 0; i < ROUNDS; i++) {
+        pthread_t th[THREADS];
+
+        for (j = 0; j < THREADS; j++)
+            pthread_create(&th[j], NULL, short_lived, (void *)(long)(i * THREADS + j));
+        for (j = 0; j < THREADS; j++)
+            pthread_join(th[j], NULL);
+        /* the drainer takes the rings back */
+        usleep(50000);
+    }
+    fprintf(stdout, "threads: %d, %d without a ring\n", ROUNDS * THREADS, failed);
+
+    log_exit();
+    fprintf(stdout, "dropped: %lu\n", log_dropped());
+    if (failed || log_dropped())
+        return 1;
+
+    fclose(null);
+    close(fd);
+    return 0;
+}
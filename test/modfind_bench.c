@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <xmalloc.h>
+
+#include "../raspd/module.h"
+
+/*
+ * module lookup with a few hundred registered modules:
+ * linear scan (the old find_module), RB_FIND, perfect hash, cache
+ */
+
+#define NR_NAMES    8
+
+static const char *wanted;
+static struct module *found;
+
+static int scan_fn(struct module *m, void *opaque)
+{
+    if (strcmp(m->name, wanted) == 0) {
+        found = m;
+        return -1;
+    }
+    return 0;
+}
+
+static struct module *find_linear(const char *name)
+{
+    wanted = name;
+    found = NULL;
+    foreach_module(scan_fn, NULL);
+    return found;
+}
+
+static inline long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static struct module_cache cache;
+
+#define BENCH(title, expr)                                              \
+    do {                                                                \
+        long long t = now_ns();                                         \
+        for (i = 0; i < count; i++) {                                   \
+            const char *name = names[i % NR_NAMES];                     \
+            if ((expr) == NULL && name[0] != '?') {                     \
+                fprintf(stderr, title ": %s not found\n", name);        \
+                return 1;                                               \
+            }                                                           \
+        }                                                               \
+        t = now_ns() - t;                                               \
+        fprintf(stdout, "%-8s %8.1f ns/lookup\n", title, (double)t / count); \
+    } while (0)
+
+int main(int argc, char *argv[])
+{
+    int nr_mods = 300;
+    int count = 1000000;
+    char *names[NR_NAMES];
+    int i, err;
+
+    if (argc > 1)
+        nr_mods = atoi(argv[1]);
+    if (argc > 2)
+        count = atoi(argv[2]);
+    if (nr_mods < NR_NAMES || count <= 0)
+        return 1;
+
+    for (i = 0; i < nr_mods; i++) {
+        struct module *m = xmalloc(sizeof(*m));
+        char *name = xmalloc(32);
+
+        memset(m, 0, sizeof(*m));
+        snprintf(name, 32, "mod_%03d_cmd", i);
+        m->name = name;
+        register_module(m);
+    }
+
+    /* a spread of names, the last one unknown */
+    for (i = 0; i < NR_NAMES - 1; i++) {
+        names[i] = xmalloc(32);
+        snprintf(names[i], 32, "mod_%03d_cmd", (i * 37 + 11) % nr_mods);
+    }
+    names[NR_NAMES - 1] = "?unknown";
+
+    fprintf(stdout, "%d modules, %d lookups\n", nr_mods, count);
+
+    BENCH("linear", find_linear(name));
+    BENCH("rb_find", module_find(name));
+
+    if ((err = module_index_build()) < 0) {
+        fprintf(stderr, "module_index_build(), err = %d\n", err);
+        return 1;
+    }
+
+    BENCH("hash", module_find(name));
+    BENCH("cache", module_find_cached(&cache, name));
+
+    return 0;
+}
@@ -0,0 +1,887 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "../raspd/clock.h"
+#include "mpu_sim.h"
+
+/* registers, the same on both */
+#define REG_RATE_DIV        0x19
+#define REG_CONFIG          0x1a
+#define REG_GYRO_CFG        0x1b
+#define REG_ACCEL_CFG       0x1c
+#define REG_FIFO_EN         0x23
+#define REG_S0_ADDR         0x25
+#define REG_S4_CTRL         0x34
+#define REG_INT_PIN_CFG     0x37
+#define REG_INT_ENABLE      0x38
+#define REG_INT_STATUS      0x3a
+#define REG_ACCEL_OUT       0x3b
+#define REG_TEMP_OUT        0x41
+#define REG_GYRO_OUT        0x43
+#define REG_EXT_SENS        0x49
+#define REG_EXT_SENS_END    0x61
+#define REG_S0_DO           0x63
+#define REG_DELAY_CTRL      0x67
+#define REG_USER_CTRL       0x6a
+#define REG_PWR_MGMT_1      0x6b
+#define REG_PWR_MGMT_2      0x6c
+#define REG_BANK_SEL        0x6d
+#define REG_MEM_START       0x6e
+#define REG_MEM_R_W         0x6f
+#define REG_FIFO_COUNT_H    0x72
+#define REG_FIFO_COUNT_L    0x73
+#define REG_FIFO_R_W        0x74
+#define REG_WHO_AM_I        0x75
+#define NR_REGS             128
+
+#define FIFO_EN_TEMP        0x80
+#define FIFO_EN_XG          0x40
+#define FIFO_EN_ACCEL       0x08
+
+#define INT_CFG_LATCH       0x20
+#define INT_CFG_ANY_RD_CLR  0x10
+#define INT_CFG_BYPASS      0x02
+
+#define INT_FIFO_OFLOW      0x10
+#define INT_DMP             0x02
+#define INT_DATA_RDY        0x01
+
+#define USER_DMP_EN         0x80
+#define USER_FIFO_EN        0x40
+#define USER_I2C_MST_EN     0x20
+#define USER_DMP_RST        0x08
+#define USER_FIFO_RST       0x04
+#define USER_I2C_MST_RST    0x02
+
+#define PWR_RESET           0x80
+#define PWR_SLEEP           0x40
+
+#define FIFO_SIZE           1024
+#define MEM_SIZE            4096
+#define INT_PULSE_NS        (50 * NS_PER_US)
+/* the registers answer again this long after a reset */
+#define RESET_NS            (30 * NS_PER_MS)
+
+/*
+ * the motion driver image (inv_mpu_dmp_motion_driver.c): where the
+ * driver switches the outputs of the DMP
+ */
+#define DMP_D_0_22          (22 + 512)  /* FIFO rate divider */
+#define DMP_CFG_LP_QUAT     2712        /* 3-axis quaternion */
+#define DMP_CFG_8           2718        /* 6-axis quaternion */
+#define DMP_CFG_15          2727        /* accel, gyro */
+#define DMP_CFG_27          2742        /* gesture */
+#define DMP_MAX_PACKET      32
+
+/* AK8963 */
+#define AK_WIA              0x00
+#define AK_ST1              0x02
+#define AK_HXL              0x03
+#define AK_ST2              0x09
+#define AK_CNTL             0x0a
+#define AK_ASAX             0x10
+#define AK_NR_REGS          0x13
+#define AK_ST1_DRDY         0x01
+#define AK_ST2_BITM         0x10
+#define AK_MODE_SINGLE      0x01
+#define AK_MODE_FUSE_ROM    0x0f
+#define AK_MEASURE_NS       (7200 * NS_PER_US)
+#define AK_UT_PER_LSB       0.15
+
+#define G                   9.80665
+
+struct mpu_sim {
+    int chip;
+    uint8_t regs[NR_REGS];
+    uint8_t reg;                    /* register pointer */
+    uint8_t mem[MEM_SIZE];          /* DMP memory */
+
+    uint8_t fifo[FIFO_SIZE];        /* ring */
+    unsigned int fifo_head, fifo_count;
+
+    uint8_t ak_regs[AK_NR_REGS];
+    uint8_t ak_reg;
+    uint64_t ak_done;               /* measurement ready, 0: none */
+
+    /* the device clock */
+    uint64_t t0, now;
+    uint64_t next_sample;           /* 0: stopped */
+    uint64_t reset_until;
+    unsigned long nr_samples;       /* since the DMP reset */
+    int realtime;
+    unsigned long bus_hz;
+
+    /* INT pin */
+    int irq_active;
+    uint64_t irq_off;               /* pulse end, 0: latched or idle */
+    uint64_t irq_edge;              /* newest rising edge */
+    uint64_t irq_taken;             /* the last one wait_irq gave */
+    mpu_sim_irq_fn irq_fn;
+    void *irq_opaque;
+
+    mpu_sim_motion_fn motion;
+    void *motion_opaque;
+    struct mpu_sim_motion truth;
+    struct mpu_sim_motion packet_truth;     /* of the newest packet */
+    double skew_ppm, gyro_bias, gyro_noise, accel_noise;
+    uint32_t lcg;
+
+    struct i2c_mock_dev mpu_dev, ak_dev;
+    struct mpu_sim_stats stats;
+};
+
+static double noise(struct mpu_sim *sim, double rms)
+{
+    sim->lcg = sim->lcg * 1103515245 + 12345;
+    /* uniform, rms * sqrt(12) wide */
+    return rms * 3.4641 * ((double)(sim->lcg >> 8) / (1 << 24) - 0.5);
+}
+
+/* v in body frame of the body-to-world q: q* v q */
+static void to_body(const double q[], const double v[], double out[])
+{
+    double w = q[0], x = q[1], y = q[2], z = q[3];
+
+    out[0] = (1 - 2 * (y * y + z * z)) * v[0] + 2 * (x * y + w * z) * v[1]
+        + 2 * (x * z - w * y) * v[2];
+    out[1] = 2 * (x * y - w * z) * v[0] + (1 - 2 * (x * x + z * z)) * v[1]
+        + 2 * (y * z + w * x) * v[2];
+    out[2] = 2 * (x * z + w * y) * v[0] + 2 * (y * z - w * x) * v[1]
+        + (1 - 2 * (x * x + y * y)) * v[2];
+}
+
+static int16_t saturate(double v)
+{
+    if (v > 32767)
+        return 32767;
+    if (v < -32768)
+        return -32768;
+    return (int16_t)lrint(v);
+}
+
+static void put16(uint8_t *p, int16_t v)
+{
+    p[0] = (uint16_t)v >> 8;
+    p[1] = v & 0xff;
+}
+
+static void put32(uint8_t *p, int32_t v)
+{
+    p[0] = (uint32_t)v >> 24;
+    p[1] = (uint32_t)v >> 16;
+    p[2] = (uint32_t)v >> 8;
+    p[3] = v & 0xff;
+}
+
+/*
+ * INT pin
+ */
+static void set_irq(struct mpu_sim *sim, int active)
+{
+    if (sim->irq_active == active)
+        return;
+    sim->irq_active = active;
+    sim->irq_off = 0;
+    if (active) {
+        sim->irq_edge = sim->now;
+        sim->stats.irqs++;
+    }
+    if (sim->irq_fn)
+        sim->irq_fn(active, sim->now, sim->irq_opaque);
+}
+
+static void raise_irq(struct mpu_sim *sim, uint8_t status)
+{
+    sim->regs[REG_INT_STATUS] |= status;
+    if (!(sim->regs[REG_INT_ENABLE] & status))
+        return;
+    /* a pulse per event, the latched one stays until cleared */
+    if (!(sim->regs[REG_INT_PIN_CFG] & INT_CFG_LATCH))
+        set_irq(sim, 0);
+    set_irq(sim, 1);
+    if (!(sim->regs[REG_INT_PIN_CFG] & INT_CFG_LATCH))
+        sim->irq_off = sim->now + INT_PULSE_NS;
+}
+
+/*
+ * FIFO: full, the oldest bytes go, the packets misalign as on the chip
+ */
+static void fifo_push(struct mpu_sim *sim, const uint8_t *data, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (sim->fifo_count == FIFO_SIZE) {
+            sim->fifo_head = (sim->fifo_head + 1) % FIFO_SIZE;
+            sim->fifo_count--;
+            if (!(sim->regs[REG_INT_STATUS] & INT_FIFO_OFLOW))
+                sim->stats.overflows++;
+            raise_irq(sim, INT_FIFO_OFLOW);
+        }
+        sim->fifo[(sim->fifo_head + sim->fifo_count++) % FIFO_SIZE] = data[i];
+    }
+}
+
+static uint8_t fifo_pop(struct mpu_sim *sim)
+{
+    uint8_t v;
+
+    if (sim->fifo_count == 0)
+        return 0;
+    v = sim->fifo[sim->fifo_head];
+    sim->fifo_head = (sim->fifo_head + 1) % FIFO_SIZE;
+    sim->fifo_count--;
+    return v;
+}
+
+static void fifo_reset(struct mpu_sim *sim)
+{
+    sim->fifo_head = 0;
+    sim->fifo_count = 0;
+}
+
+/*
+ * AK8963
+ */
+static void ak_measure(struct mpu_sim *sim)
+{
+    /* 22 uT north on x, 42 uT down */
+    static const double flux[3] = { 22, 0, -42 };
+    double b[3], adj;
+    int16_t v[3];
+    int k;
+
+    to_body(sim->truth.quat, flux, b);
+    /* the magnetometer axes on the MPU9250: x on y, y on x, z down */
+    v[0] = saturate(b[1] / AK_UT_PER_LSB);
+    v[1] = saturate(b[0] / AK_UT_PER_LSB);
+    v[2] = saturate(-b[2] / AK_UT_PER_LSB);
+    for (k = 0; k < 3; k++) {
+        /* the driver scales by the fuse ROM */
+        adj = (sim->ak_regs[AK_ASAX + k] + 128) / 256.0;
+        v[k] = saturate(v[k] / adj);
+        sim->ak_regs[AK_HXL + k * 2] = v[k] & 0xff;
+        sim->ak_regs[AK_HXL + k * 2 + 1] = (uint16_t)v[k] >> 8;
+    }
+    sim->ak_regs[AK_ST1] |= AK_ST1_DRDY;
+    sim->ak_regs[AK_ST2] = AK_ST2_BITM;
+}
+
+static uint8_t ak_read_reg(struct mpu_sim *sim, uint8_t reg)
+{
+    uint8_t v;
+
+    if (sim->ak_done && sim->now >= sim->ak_done) {
+        sim->ak_done = 0;
+        ak_measure(sim);
+        /* single measurement, then power down */
+        sim->ak_regs[AK_CNTL] &= 0xf0;
+    }
+    if (reg >= AK_NR_REGS)
+        return 0;
+    /* the fuse ROM only in its mode */
+    if (reg >= AK_ASAX && (sim->ak_regs[AK_CNTL] & 0x0f) != AK_MODE_FUSE_ROM)
+        return 0;
+    v = sim->ak_regs[reg];
+    /* reading ST2 ends the data read */
+    if (reg == AK_ST2)
+        sim->ak_regs[AK_ST1] &= ~AK_ST1_DRDY;
+    return v;
+}
+
+static void ak_write_reg(struct mpu_sim *sim, uint8_t reg, uint8_t v)
+{
+    if (reg != AK_CNTL)
+        return;
+    sim->ak_regs[AK_CNTL] = v;
+    if ((v & 0x0f) == AK_MODE_SINGLE)
+        sim->ak_done = sim->now + AK_MEASURE_NS;
+}
+
+static int ak_xfer(struct mpu_sim *sim, const uint8_t *wbuf, int wlen,
+                uint8_t *rbuf, int rlen)
+{
+    int i;
+
+    if (wlen) {
+        sim->ak_reg = wbuf[0];
+        for (i = 1; i < wlen; i++)
+            ak_write_reg(sim, sim->ak_reg++, wbuf[i]);
+    }
+    for (i = 0; i < rlen; i++)
+        rbuf[i] = ak_read_reg(sim, sim->ak_reg++);
+    return 0;
+}
+
+/*
+ * the aux I2C master: slave 0 to 3 run at each sample, or one in
+ * I2C_MST_DLY + 1 with their delay bit, reads land in EXT_SENS_DATA
+ */
+static void aux_master(struct mpu_sim *sim)
+{
+    uint8_t *s, reg, buf[16];
+    int i, len, ext = REG_EXT_SENS;
+    unsigned int dly = (sim->regs[REG_S4_CTRL] & 0x1f) + 1;
+
+    if (sim->chip != MPU_SIM_9250)
+        return;
+    for (i = 0; i < 4; i++) {
+        s = &sim->regs[REG_S0_ADDR + i * 3];
+        len = s[2] & 0x0f;
+        if (!(s[2] & 0x80) || len == 0)
+            continue;
+        if ((sim->regs[REG_DELAY_CTRL] & (1 << i)) && sim->nr_samples % dly)
+            continue;
+        if ((s[0] & 0x7f) != MPU_SIM_AK_ADDR)
+            continue;
+        reg = s[1];
+        if (s[0] & 0x80) {
+            len = len < REG_EXT_SENS_END - ext ? len : REG_EXT_SENS_END - ext;
+            ak_xfer(sim, &reg, 1, buf, len);
+            memcpy(&sim->regs[ext], buf, len);
+            ext += len;
+        } else {
+            buf[0] = reg;
+            buf[1] = sim->regs[REG_S0_DO + i];
+            ak_xfer(sim, buf, 2, NULL, 0);
+        }
+    }
+}
+
+/*
+ * DMP: the outputs the driver switched on, read from its memory
+ */
+static int dmp_packet(struct mpu_sim *sim, uint8_t *p)
+{
+    const uint8_t *m = sim->mem;
+    double norm = 0;
+    int k, len = 0;
+
+    if (m[DMP_CFG_8] == 0x20 || m[DMP_CFG_LP_QUAT] == 0xc0) {
+        for (k = 0; k < 4; k++)
+            norm += sim->truth.quat[k] * sim->truth.quat[k];
+        norm = sqrt(norm);
+        for (k = 0; k < 4; k++)
+            put32(&p[k * 4], (int32_t)lrint(sim->truth.quat[k] / norm * (1 << 30)));
+        len += 16;
+    }
+    if (m[DMP_CFG_15 + 1] == 0xc0) {
+        memcpy(&p[len], &sim->regs[REG_ACCEL_OUT], 6);
+        len += 6;
+    }
+    if (m[DMP_CFG_15 + 4] == 0xc4) {
+        memcpy(&p[len], &sim->regs[REG_GYRO_OUT], 6);
+        len += 6;
+    }
+    /* no tap and no orientation change */
+    if (m[DMP_CFG_27] == 0x20) {
+        memset(&p[len], 0, 4);
+        len += 4;
+    }
+    return len;
+}
+
+static uint64_t sample_period(const struct mpu_sim *sim)
+{
+    unsigned int dlpf = sim->regs[REG_CONFIG] & 7;
+    double base = dlpf == 0 || dlpf == 7 ? 8000 : 1000;
+
+    return (uint64_t)((sim->regs[REG_RATE_DIV] + 1) / base * 1e9
+                * (1 + sim->skew_ppm * 1e-6));
+}
+
+static void take_sample(struct mpu_sim *sim)
+{
+    static const double up[3] = { 0, 0, 1 };
+    uint8_t *r = sim->regs, packet[DMP_MAX_PACKET];
+    unsigned int gyro_fsr = 250 << ((r[REG_GYRO_CFG] >> 3) & 3);
+    unsigned int accel_fsr = 2 << ((r[REG_ACCEL_CFG] >> 3) & 3);
+    double f[3], a[3], temp;
+    int k, len;
+
+    if (sim->motion)
+        sim->motion((sim->now - sim->t0) * 1e-9, &sim->truth, sim->motion_opaque);
+    sim->stats.samples++;
+    sim->nr_samples++;
+
+    /* the specific force, in g */
+    for (k = 0; k < 3; k++)
+        a[k] = sim->truth.accel[k] / G + up[k];
+    to_body(sim->truth.quat, a, f);
+    for (k = 0; k < 3; k++) {
+        put16(&r[REG_ACCEL_OUT + k * 2], r[REG_PWR_MGMT_2] & (0x20 >> k) ? 0 :
+                saturate((f[k] + noise(sim, sim->accel_noise)) * 32768 / accel_fsr));
+        put16(&r[REG_GYRO_OUT + k * 2], r[REG_PWR_MGMT_2] & (0x04 >> k) ? 0 :
+                saturate((sim->truth.gyro[k] * 180 / M_PI + sim->gyro_bias
+                        + noise(sim, sim->gyro_noise)) * 32768 / gyro_fsr));
+    }
+    if (sim->chip == MPU_SIM_6050)
+        temp = (sim->truth.temp - 35) * 340 - 521;
+    else
+        temp = (sim->truth.temp - 35) * 321;
+    put16(&r[REG_TEMP_OUT], saturate(temp));
+
+    if (r[REG_USER_CTRL] & USER_I2C_MST_EN)
+        aux_master(sim);
+
+    if (!(r[REG_USER_CTRL] & USER_FIFO_EN)) {
+        raise_irq(sim, INT_DATA_RDY);
+        return;
+    }
+    if (r[REG_USER_CTRL] & USER_DMP_EN) {
+        /* 200 Hz / (div + 1) */
+        unsigned int div = (sim->mem[DMP_D_0_22] << 8) | sim->mem[DMP_D_0_22 + 1];
+
+        r[REG_INT_STATUS] |= INT_DATA_RDY;
+        if ((sim->nr_samples - 1) % (div + 1))
+            return;
+        if ((len = dmp_packet(sim, packet)) == 0)
+            return;
+        fifo_push(sim, packet, len);
+        sim->stats.packets++;
+        sim->packet_truth = sim->truth;
+        raise_irq(sim, INT_DMP);
+        return;
+    }
+
+    /* register order: accel, temp, gyro */
+    len = 0;
+    if (r[REG_FIFO_EN] & FIFO_EN_ACCEL) {
+        memcpy(&packet[len], &r[REG_ACCEL_OUT], 6);
+        len += 6;
+    }
+    if (r[REG_FIFO_EN] & FIFO_EN_TEMP) {
+        memcpy(&packet[len], &r[REG_TEMP_OUT], 2);
+        len += 2;
+    }
+    for (k = 0; k < 3; k++) {
+        if (r[REG_FIFO_EN] & (FIFO_EN_XG >> k)) {
+            memcpy(&packet[len], &r[REG_GYRO_OUT + k * 2], 2);
+            len += 2;
+        }
+    }
+    if (len) {
+        fifo_push(sim, packet, len);
+        sim->stats.packets++;
+        sim->packet_truth = sim->truth;
+    }
+    raise_irq(sim, INT_DATA_RDY);
+}
+
+/* every event up to t, in order */
+static void run(struct mpu_sim *sim, uint64_t t)
+{
+    for (;;) {
+        if (sim->irq_off && sim->irq_off <= t
+                && (!sim->next_sample || sim->irq_off <= sim->next_sample)) {
+            sim->now = sim->irq_off;
+            set_irq(sim, 0);
+        } else if (sim->next_sample && sim->next_sample <= t) {
+            sim->now = sim->next_sample;
+            take_sample(sim);
+            sim->next_sample = sim->now + sample_period(sim);
+        } else {
+            break;
+        }
+    }
+    if (t > sim->now)
+        sim->now = t;
+}
+
+static void sleep_until(uint64_t t)
+{
+    struct timespec ts = {
+        .tv_sec = t / 1000000000ULL, .tv_nsec = t % 1000000000ULL,
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/* in real time, the device catches up with the clock first */
+static void sync_clock(struct mpu_sim *sim)
+{
+    if (sim->realtime)
+        run(sim, raspd_now_ns());
+}
+
+/*
+ * registers
+ */
+static void start_samples(struct mpu_sim *sim, uint64_t t)
+{
+    if (sim->regs[REG_PWR_MGMT_1] & PWR_SLEEP)
+        sim->next_sample = 0;
+    else if (!sim->next_sample)
+        sim->next_sample = t + sample_period(sim);
+}
+
+static void reset_regs(struct mpu_sim *sim)
+{
+    memset(sim->regs, 0, sizeof(sim->regs));
+    if (sim->chip == MPU_SIM_6050) {
+        sim->regs[REG_WHO_AM_I] = 0x68;
+        sim->regs[REG_PWR_MGMT_1] = PWR_SLEEP;
+    } else {
+        sim->regs[REG_WHO_AM_I] = 0x71;
+        sim->regs[REG_PWR_MGMT_1] = 0x01;
+    }
+    fifo_reset(sim);
+    sim->next_sample = 0;
+    sim->nr_samples = 0;
+    sim->ak_done = 0;
+    memset(sim->ak_regs, 0, sizeof(sim->ak_regs));
+    sim->ak_regs[AK_WIA] = 0x48;
+    sim->ak_regs[AK_ASAX] = 0xb0;
+    sim->ak_regs[AK_ASAX + 1] = 0xb2;
+    sim->ak_regs[AK_ASAX + 2] = 0xa6;
+    set_irq(sim, 0);
+}
+
+static uint16_t mem_addr(const struct mpu_sim *sim)
+{
+    return ((sim->regs[REG_BANK_SEL] << 8) | sim->regs[REG_MEM_START]) % MEM_SIZE;
+}
+
+static void write_reg(struct mpu_sim *sim, uint8_t reg, uint8_t v)
+{
+    uint8_t *r = sim->regs;
+
+    switch (reg) {
+    case REG_PWR_MGMT_1:
+        if (v & PWR_RESET) {
+            reset_regs(sim);
+            sim->reset_until = sim->now + RESET_NS;
+            start_samples(sim, sim->reset_until);
+            return;
+        }
+        r[reg] = v;
+        start_samples(sim, sim->now);
+        return;
+    case REG_USER_CTRL:
+        if (v & USER_FIFO_RST)
+            fifo_reset(sim);
+        if (v & USER_DMP_RST)
+            sim->nr_samples = 0;
+        /* the reset bits clear themselves */
+        r[reg] = v & ~(USER_DMP_RST | USER_FIFO_RST | USER_I2C_MST_RST | 0x01);
+        return;
+    case REG_MEM_R_W:
+        /* the address moves on, the register pointer stays */
+        sim->mem[mem_addr(sim)] = v;
+        r[REG_MEM_START]++;
+        return;
+    case REG_FIFO_R_W:
+        fifo_push(sim, &v, 1);
+        return;
+    case REG_INT_STATUS:
+    case REG_WHO_AM_I:
+    case REG_FIFO_COUNT_H:
+    case REG_FIFO_COUNT_L:
+        return;
+    }
+    if (reg >= REG_ACCEL_OUT && reg < REG_EXT_SENS_END)
+        return;
+    r[reg] = v;
+}
+
+static uint8_t read_reg(struct mpu_sim *sim, uint8_t reg, uint16_t count)
+{
+    uint8_t v;
+
+    switch (reg) {
+    case REG_MEM_R_W:
+        v = sim->mem[mem_addr(sim)];
+        sim->regs[REG_MEM_START]++;
+        return v;
+    case REG_FIFO_R_W:
+        return fifo_pop(sim);
+    /* the count as of the start of the read */
+    case REG_FIFO_COUNT_H:
+        return count >> 8;
+    case REG_FIFO_COUNT_L:
+        return count & 0xff;
+    case REG_INT_STATUS:
+        v = sim->regs[reg];
+        sim->regs[reg] = 0;
+        if (sim->regs[REG_INT_PIN_CFG] & INT_CFG_LATCH)
+            set_irq(sim, 0);
+        return v;
+    }
+    return sim->regs[reg];
+}
+
+/* the pointer stays on the ports, goes on elsewhere */
+static void next_reg(struct mpu_sim *sim)
+{
+    if (sim->reg != REG_MEM_R_W && sim->reg != REG_FIFO_R_W)
+        sim->reg = (sim->reg + 1) % NR_REGS;
+}
+
+static int mpu_xfer(struct mpu_sim *sim, const uint8_t *wbuf, int wlen,
+                uint8_t *rbuf, int rlen)
+{
+    uint16_t count = sim->fifo_count;
+    int i;
+
+    if (sim->now < sim->reset_until)
+        return -ENXIO;
+    if (wlen) {
+        sim->reg = wbuf[0] % NR_REGS;
+        for (i = 1; i < wlen; i++) {
+            write_reg(sim, sim->reg, wbuf[i]);
+            next_reg(sim);
+        }
+    }
+    for (i = 0; i < rlen; i++) {
+        rbuf[i] = read_reg(sim, sim->reg, count);
+        next_reg(sim);
+    }
+    if (rlen && (sim->regs[REG_INT_PIN_CFG] & (INT_CFG_LATCH | INT_CFG_ANY_RD_CLR))
+            == (INT_CFG_LATCH | INT_CFG_ANY_RD_CLR)) {
+        sim->regs[REG_INT_STATUS] = 0;
+        set_irq(sim, 0);
+    }
+    return 0;
+}
+
+/* start, address and data with their ack, repeated start, stop */
+static uint64_t bus_time(const struct mpu_sim *sim, int wlen, int rlen)
+{
+    unsigned long bits = 2 + 9 * (1 + wlen);
+
+    if (sim->bus_hz == 0)
+        return 0;
+    if (rlen)
+        bits += 1 + 9 * (1 + rlen);
+    return bits * 1000000000ULL / sim->bus_hz;
+}
+
+int mpu_sim_xfer(struct mpu_sim *sim, uint16_t addr, const uint8_t *wbuf,
+                int wlen, uint8_t *rbuf, int rlen)
+{
+    uint64_t start, t;
+    int err;
+
+    sync_clock(sim);
+    start = sim->now;
+    if (addr == MPU_SIM_ADDR)
+        err = mpu_xfer(sim, wbuf, wlen, rbuf, rlen);
+    /* the AK8963 answers on the main bus in bypass only */
+    else if (addr == MPU_SIM_AK_ADDR && sim->chip == MPU_SIM_9250
+            && sim->now >= sim->reset_until
+            && (sim->regs[REG_INT_PIN_CFG] & INT_CFG_BYPASS)
+            && !(sim->regs[REG_USER_CTRL] & USER_I2C_MST_EN))
+        err = ak_xfer(sim, wbuf, wlen, rbuf, rlen);
+    else
+        err = -ENXIO;
+
+    /* no ack: the address byte only */
+    t = err ? bus_time(sim, 0, 0) : bus_time(sim, wlen, rlen);
+    sim->stats.xfers++;
+    sim->stats.bytes += err ? 0 : wlen + rlen;
+    sim->stats.bus_ns += t;
+    if (sim->realtime)
+        sleep_until(start + t);
+    mpu_sim_advance(sim, start + t - sim->now);
+    return err;
+}
+
+static int dev_xfer(struct i2c_mock_dev *dev, const uint8_t *wbuf, int wlen,
+                uint8_t *rbuf, int rlen)
+{
+    return mpu_sim_xfer(dev->priv, dev->addr, wbuf, wlen, rbuf, rlen);
+}
+
+int mpu_sim_attach(struct mpu_sim *sim, struct i2cq *q)
+{
+    int err;
+
+    if ((err = i2cq_mock_add(q, &sim->mpu_dev)) < 0)
+        return err;
+    if (sim->chip == MPU_SIM_9250)
+        err = i2cq_mock_add(q, &sim->ak_dev);
+    return err;
+}
+
+void mpu_sim_set_bus(struct mpu_sim *sim, unsigned long bus_hz)
+{
+    sim->bus_hz = bus_hz;
+}
+
+void mpu_sim_set_realtime(struct mpu_sim *sim, int on)
+{
+    sim->realtime = on;
+    sync_clock(sim);
+}
+
+/*
+ * the clock
+ */
+uint64_t mpu_sim_now(const struct mpu_sim *sim)
+{
+    return sim->now;
+}
+
+void mpu_sim_advance(struct mpu_sim *sim, uint64_t ns)
+{
+    uint64_t t = sim->now + ns;
+
+    if (sim->realtime) {
+        sleep_until(t);
+        t = raspd_now_ns();
+    }
+    run(sim, t);
+}
+
+uint64_t mpu_sim_wait_irq(struct mpu_sim *sim, uint64_t timeout_ns)
+{
+    uint64_t end, t;
+
+    sync_clock(sim);
+    end = sim->now + timeout_ns;
+    /* an edge during the last drain counts, as a queued GPIO edge */
+    while (sim->irq_edge == sim->irq_taken) {
+        /* event by event: a pulse ends, a sample comes */
+        t = sim->irq_off ? sim->irq_off : end;
+        if (sim->next_sample && sim->next_sample < t)
+            t = sim->next_sample;
+        if (t > end)
+            t = end;
+        if (t <= sim->now && t == end)
+            return 0;
+        mpu_sim_advance(sim, t - sim->now);
+    }
+    return sim->irq_taken = sim->irq_edge;
+}
+
+void mpu_sim_truth(const struct mpu_sim *sim, struct mpu_sim_motion *m)
+{
+    *m = sim->packet_truth;
+}
+
+void mpu_sim_get_stats(const struct mpu_sim *sim, struct mpu_sim_stats *st)
+{
+    *st = sim->stats;
+}
+
+void mpu_sim_set_motion(struct mpu_sim *sim, mpu_sim_motion_fn fn, void *opaque)
+{
+    sim->motion = fn ? fn : mpu_sim_wobble;
+    sim->motion_opaque = opaque;
+    sim->motion((sim->now - sim->t0) * 1e-9, &sim->truth, sim->motion_opaque);
+    sim->packet_truth = sim->truth;
+}
+
+void mpu_sim_set_errors(struct mpu_sim *sim, double skew_ppm, double gyro_bias,
+                double gyro_noise, double accel_noise)
+{
+    sim->skew_ppm = skew_ppm;
+    sim->gyro_bias = gyro_bias;
+    sim->gyro_noise = gyro_noise;
+    sim->accel_noise = accel_noise;
+}
+
+void mpu_sim_set_irq(struct mpu_sim *sim, mpu_sim_irq_fn fn, void *opaque)
+{
+    sim->irq_fn = fn;
+    sim->irq_opaque = opaque;
+}
+
+struct mpu_sim *mpu_sim_new(int chip)
+{
+    struct mpu_sim *sim;
+
+    if (chip != MPU_SIM_6050 && chip != MPU_SIM_9250) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((sim = calloc(1, sizeof(*sim))) == NULL)
+        return NULL;
+    sim->chip = chip;
+    /* the clock of raspd, the edges line up with its stats */
+    sim->t0 = sim->now = raspd_now_ns();
+    sim->bus_hz = 400000;
+    sim->lcg = 4321;
+    reset_regs(sim);
+    start_samples(sim, sim->now);
+    mpu_sim_set_motion(sim, NULL, NULL);
+
+    sim->mpu_dev.addr = MPU_SIM_ADDR;
+    sim->mpu_dev.xfer = dev_xfer;
+    sim->mpu_dev.priv = sim;
+    sim->ak_dev.addr = MPU_SIM_AK_ADDR;
+    sim->ak_dev.xfer = dev_xfer;
+    sim->ak_dev.priv = sim;
+    return sim;
+}
+
+void mpu_sim_del(struct mpu_sim *sim)
+{
+    free(sim);
+}
+
+/*
+ * motion profiles
+ */
+
+/* ZYX Euler angles and their rates, in rad */
+static void euler_motion(double roll, double pitch, double yaw, double droll,
+                double dpitch, double dyaw, struct mpu_sim_motion *m)
+{
+    double cr = cos(roll / 2), sr = sin(roll / 2);
+    double cp = cos(pitch / 2), sp = sin(pitch / 2);
+    double cy = cos(yaw / 2), sy = sin(yaw / 2);
+
+    m->quat[0] = cy * cp * cr + sy * sp * sr;
+    m->quat[1] = cy * cp * sr - sy * sp * cr;
+    m->quat[2] = cy * sp * cr + sy * cp * sr;
+    m->quat[3] = sy * cp * cr - cy * sp * sr;
+    m->gyro[0] = droll - dyaw * sin(pitch);
+    m->gyro[1] = dpitch * cos(roll) + dyaw * sin(roll) * cos(pitch);
+    m->gyro[2] = -dpitch * sin(roll) + dyaw * cos(roll) * cos(pitch);
+    m->accel[0] = m->accel[1] = m->accel[2] = 0;
+    m->temp = 25;
+}
+
+void mpu_sim_wobble(double t, struct mpu_sim_motion *m, void *opaque)
+{
+    double wr = 2 * M_PI * 0.5, wp = 2 * M_PI * 0.3;
+    double ar = 20 * M_PI / 180, ap = 15 * M_PI / 180;
+
+    euler_motion(ar * sin(wr * t), ap * sin(wp * t), 0.2 * t,
+            ar * wr * cos(wr * t), ap * wp * cos(wp * t), 0.2, m);
+}
+
+void mpu_sim_scripted(double t, struct mpu_sim_motion *m, void *opaque)
+{
+    const struct mpu_sim_script *s = opaque;
+    const struct mpu_sim_keyframe *a, *b;
+    double d2r = M_PI / 180, u, dt;
+    int i;
+
+    if (s->nr == 0) {
+        euler_motion(0, 0, 0, 0, 0, 0, m);
+        return;
+    }
+    for (i = 0; i + 1 < s->nr && s->frames[i + 1].t <= t; i++)
+        ;
+    a = &s->frames[i];
+    if (i + 1 == s->nr || t < a->t) {
+        euler_motion(a->roll * d2r, a->pitch * d2r, a->yaw * d2r, 0, 0, 0, m);
+        return;
+    }
+    b = &s->frames[i + 1];
+    dt = b->t - a->t;
+    u = (t - a->t) / dt;
+    euler_motion((a->roll + (b->roll - a->roll) * u) * d2r,
+            (a->pitch + (b->pitch - a->pitch) * u) * d2r,
+            (a->yaw + (b->yaw - a->yaw) * u) * d2r,
+            (b->roll - a->roll) / dt * d2r,
+            (b->pitch - a->pitch) / dt * d2r,
+            (b->yaw - a->yaw) / dt * d2r, m);
+}
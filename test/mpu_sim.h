@@ -0,0 +1,116 @@
+#ifndef __MPU_SIM_H__
+#define __MPU_SIM_H__
+
+#include <stdint.h>
+
+#include "../raspd/i2cq.h"
+
+/*
+ * a simulated MPU6050 / MPU9250 behind the I2C HAL: the register map
+ * (auto increment, the DMP memory and the FIFO through their ports),
+ * the FIFO (1 kB, overflow), the DMP packets, the INT pin (active
+ * level, 50 us pulse or latched, clear on read) and, on the MPU9250,
+ * the AK8963 (bypass or the aux I2C master).
+ *
+ * the device runs on its own clock, in ns: the samples come at the
+ * sample rate of the registers off a skewed oscillator, the transfers
+ * take their time on the bus, the driver's delays advance the clock.
+ * nothing runs behind the caller's back.
+ *
+ * the DMP does not run the firmware: it is loaded and read back like
+ * on the chip, the packets are built from the features the driver
+ * switched on in its memory (quaternion, accel, gyro, gesture) and
+ * from the motion, at 200 Hz / (div + 1).
+ */
+
+#define MPU_SIM_ADDR        0x68
+#define MPU_SIM_AK_ADDR     0x0c
+
+enum {
+    MPU_SIM_6050,
+    MPU_SIM_9250,
+};
+
+/* the truth at a time, body frame */
+struct mpu_sim_motion {
+    double quat[4];         /* body to world, w x y z */
+    double gyro[3];         /* rad/s */
+    double accel[3];        /* linear, world frame, m/s^2, gravity apart */
+    double temp;            /* degrees C */
+};
+
+/* t: s since mpu_sim_new() */
+typedef void (*mpu_sim_motion_fn)(double t, struct mpu_sim_motion *m,
+                void *opaque);
+
+/* level: 1 active, the pin polarity apart */
+typedef void (*mpu_sim_irq_fn)(int level, uint64_t t_ns, void *opaque);
+
+struct mpu_sim_stats {
+    unsigned long xfers, bytes;     /* on the bus */
+    uint64_t bus_ns;                /* time on the bus */
+    unsigned long samples, packets; /* taken, pushed into the FIFO */
+    unsigned long overflows;
+    unsigned long irqs;
+};
+
+struct mpu_sim;
+
+/* NULL with errno set on error */
+struct mpu_sim *mpu_sim_new(int chip);
+void mpu_sim_del(struct mpu_sim *sim);
+
+/*
+ * the bus: a register write is wbuf[0] the register and the data, a
+ * read is one register byte written then rlen read. -ENXIO for no ack.
+ * bus_hz 0: the transfers take no time
+ */
+int mpu_sim_xfer(struct mpu_sim *sim, uint16_t addr, const uint8_t *wbuf,
+                int wlen, uint8_t *rbuf, int rlen);
+void mpu_sim_set_bus(struct mpu_sim *sim, unsigned long bus_hz);
+/*
+ * on: the device clock is raspd_now_ns(), every access runs the device
+ * up to it first, the transfers and the delays take their time for
+ * real. off (default): the device clock only moves with the bus, the
+ * delays and the waits, as fast as the host goes
+ */
+void mpu_sim_set_realtime(struct mpu_sim *sim, int on);
+/* the MPU and the AK8963 on a mock I2C queue */
+int mpu_sim_attach(struct mpu_sim *sim, struct i2cq *q);
+
+/* NULL: the default profile, mpu_sim_wobble */
+void mpu_sim_set_motion(struct mpu_sim *sim, mpu_sim_motion_fn fn, void *opaque);
+/* oscillator error, gyro bias (dps) and noise (rms, dps and g) */
+void mpu_sim_set_errors(struct mpu_sim *sim, double skew_ppm, double gyro_bias,
+                double gyro_noise, double accel_noise);
+void mpu_sim_set_irq(struct mpu_sim *sim, mpu_sim_irq_fn fn, void *opaque);
+
+uint64_t mpu_sim_now(const struct mpu_sim *sim);
+void mpu_sim_advance(struct mpu_sim *sim, uint64_t ns);
+/*
+ * runs the device until the INT pin goes active, the time of the edge,
+ * 0 if it did not within timeout_ns
+ */
+uint64_t mpu_sim_wait_irq(struct mpu_sim *sim, uint64_t timeout_ns);
+/* the truth at the newest packet pushed into the FIFO */
+void mpu_sim_truth(const struct mpu_sim *sim, struct mpu_sim_motion *m);
+void mpu_sim_get_stats(const struct mpu_sim *sim, struct mpu_sim_stats *st);
+
+/* a 0.5 Hz roll, a 0.3 Hz pitch, 20 and 15 degrees, yaw at 0.2 rad/s */
+void mpu_sim_wobble(double t, struct mpu_sim_motion *m, void *opaque);
+
+/*
+ * a script: roll, pitch, yaw in degrees at times in s, linear in
+ * between, held after the last one
+ */
+struct mpu_sim_keyframe {
+    double t;
+    double roll, pitch, yaw;
+};
+struct mpu_sim_script {
+    const struct mpu_sim_keyframe *frames;
+    int nr;
+};
+void mpu_sim_scripted(double t, struct mpu_sim_motion *m, void *opaque);
+
+#endif /* __MPU_SIM_H__ */
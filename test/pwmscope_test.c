@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <bcm2835.h>
+
+#include "../raspd/softpwm.h"
+#include "../raspd/pwmscope.h"
+
+/*
+ * capture the softpwm outputs and report period, duty, jitter and
+ * missed cycles per pin, see raspd/pwmscope.h
+ *
+ * with -w the test drives the pins itself: softpwm with the given
+ * engine, cycle and step, the width going back and forth by one step
+ * at -u Hz (0: set once), to see the effect of the DMA settings and
+ * the update rate. CPU load is up to the caller (stress, ...).
+ *
+ *      pwmscope_test -p pin[,pin...] [-t ms] [-c cpu] [-P period_us]
+ *                    [-w width [-e sample|edge] [-C cycle_us] [-s step_ns] [-u hz]]
+ */
+
+static uint64_t pinmask;
+static int width, update_hz;
+static volatile int done;
+
+static void *update_thread(void *arg)
+{
+    struct timespec ts = { 0, 1000000000L / update_hz };
+    int pin, n = 0;
+
+    while (!done) {
+        for (pin = 0; pin < 64; pin++) {
+            if (pinmask & (1ULL << pin))
+                softpwm_stage(pin, width + (n & 1));
+        }
+        softpwm_commit();
+        n++;
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "pins",    required_argument, NULL, 'p' },
+        { "time",    required_argument, NULL, 't' },
+        { "cpu",     required_argument, NULL, 'c' },
+        { "period",  required_argument, NULL, 'P' },
+        { "width",   required_argument, NULL, 'w' },
+        { "engine",  required_argument, NULL, 'e' },
+        { "cycle",   required_argument, NULL, 'C' },
+        { "step",    required_argument, NULL, 's' },
+        { "update",  required_argument, NULL, 'u' },
+        { 0, 0, 0, 0 }
+    };
+    int ms = 1000, cpu = -1, engine = SOFTPWM_SAMPLE;
+    int cycle_us = 2500, step_ns = 5000;
+    double nominal = 0;
+    struct pwmscope s;
+    pthread_t updater;
+    int c, pin, err;
+
+    while ((c = getopt_long(argc, argv, "p:t:c:P:w:e:C:s:u:", options, NULL)) != -1) {
+        switch (c) {
+        case 'p':
+            if (pwmscope_parse_pins(optarg, &pinmask) < 0) {
+                fprintf(stderr, "pins: pin[,pin...], 0 - 53\n");
+                return 1;
+            }
+            break;
+        case 't': ms = atoi(optarg); break;
+        case 'c': cpu = atoi(optarg); break;
+        case 'P': nominal = atof(optarg); break;
+        case 'w': width = atoi(optarg); break;
+        case 'e': engine = strcmp(optarg, "edge") ? SOFTPWM_SAMPLE : SOFTPWM_EDGE; break;
+        case 'C': cycle_us = atoi(optarg); break;
+        case 's': step_ns = atoi(optarg); break;
+        case 'u': update_hz = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s -p pin[,pin...] [-t ms] [-c cpu] [-P period_us] "
+                    "[-w width [-e engine] [-C cycle_us] [-s step_ns] [-u hz]]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (pinmask == 0) {
+        fprintf(stderr, "must specify the pins\n");
+        return 1;
+    }
+
+    if (!bcm2835_init())
+        return 1;
+
+    if (width > 0) {
+        if ((err = softpwm_init_engine(engine, cycle_us, step_ns)) < 0) {
+            fprintf(stderr, "softpwm_init_engine(), err = %d\n", err);
+            return 1;
+        }
+        for (pin = 0; pin < 64; pin++) {
+            if (!(pinmask & (1ULL << pin)))
+                continue;
+            bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_OUTP);
+            softpwm_stage(pin, width);
+        }
+        softpwm_commit();
+        usleep(2 * cycle_us);
+        if (update_hz > 0)
+            pthread_create(&updater, NULL, update_thread, NULL);
+        if (nominal == 0)
+            nominal = cycle_us;
+    }
+
+    err = pwmscope_capture(&s, pinmask, ms, cpu);
+
+    if (width > 0) {
+        done = 1;
+        if (update_hz > 0)
+            pthread_join(updater, NULL);
+        softpwm_exit();
+    }
+    bcm2835_close();
+
+    if (err < 0) {
+        fprintf(stderr, "pwmscope_capture(), err = %d\n", err);
+        return 1;
+    }
+    pwmscope_report(STDOUT_FILENO, &s, nominal);
+    pwmscope_free(&s);
+    return 0;
+}
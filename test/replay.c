@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * run the quadcopter controller offline: imu_ready_cb ->
+ * altitude_control / attitude_control -> softpwm_commit, fed from a
+ * blackbox recording or a synthetic IMU stream, as fast as possible.
+ *
+ * the ESC outputs of every cycle go to a CSV file (-o) and into a
+ * checksum, two runs with the same input and gains give the same
+ * checksum on the same architecture. a tuning change shows up as a
+ * different checksum, the CSV tells where.
+ *
+ *      replay [-b blackbox] [-n cycles] [-p pitch] [-a] [-o out.csv]
+ *             [-A kp,ki,kd,min,max] [-R kp,ki,kd,min,max] [-c checksum]
+ */
+
+/* no CUBE_HOSTNAME, nothing is sent over UDP while replaying */
+#define __CONFIG_H__
+#include "../raspd/quadcopter.c"
+
+#include "../raspd/raspd.h"
+
+#define NR_ESC      4
+#define RATE_HZ     200
+
+static __invmpu_data_ready_cb data_ready;
+static int esc_out[NR_ESC];
+static uint64_t checksum = 14695981039346656037ULL;     /* FNV-1a */
+static long altitude;
+static unsigned long nr_cycles;
+
+/*
+ * stubs, the hardware and the Lua side
+ */
+void invmpu_self_test(void) {}
+int invmpu_get_calibrate_data(long gyro[], long accel[]) { return -ENODEV; }
+void invmpu_register_tap_cb(void (*func)(unsigned char, unsigned char)) {}
+void invmpu_register_android_orient_cb(void (*func)(unsigned char)) {}
+
+void invmpu_register_data_ready_cb(__invmpu_data_ready_cb func)
+{
+    data_ready = func;
+}
+
+int luaenv_getconf_str(const char *table, const char *key, const char **v)
+{
+    return -ENOENT;
+}
+
+void luaenv_pop(int n) {}
+
+struct evbuffer *client_output(int wfd)
+{
+    return NULL;
+}
+
+static int esc_staged[NR_ESC];
+
+int softpwm_stage(int pin, int data)
+{
+    if (pin < 0 || pin >= NR_ESC)
+        return -EINVAL;
+    esc_staged[pin] = data;
+    return 0;
+}
+
+int softpwm_commit(void)
+{
+    memcpy(esc_out, esc_staged, sizeof(esc_out));
+    return 0;
+}
+
+static long get_altitude(unsigned long *timestamp)
+{
+    return altitude;
+}
+
+static void end_cycle(FILE *out, unsigned long cycle, unsigned long timestamp)
+{
+    int i;
+
+    nr_cycles++;
+    for (i = 0; i < NR_ESC; i++) {
+        uint32_t v = (uint32_t)esc_out[i];
+        int b;
+
+        for (b = 0; b < 4; b++) {
+            checksum ^= (v >> (b * 8)) & 0xff;
+            checksum *= 1099511628211ULL;
+        }
+    }
+    if (out)
+        fprintf(out, "%lu,%lu,%d,%d,%d,%d\n", cycle, timestamp,
+                esc_out[0], esc_out[1], esc_out[2], esc_out[3]);
+}
+
+/*
+ * synthetic stream: a slow pitch/roll oscillation with a yaw drift,
+ * plus deterministic noise (LCG), at RATE_HZ
+ */
+static uint32_t lcg = 12345;
+
+static double noise(double amplitude)
+{
+    lcg = lcg * 1103515245 + 12345;
+    return amplitude * ((double)(lcg >> 8) / (1 << 24) - 0.5);
+}
+
+static void euler_to_quat(double pitch, double roll, double yaw, long quat[])
+{
+    double cp = cos(pitch / 2), sp = sin(pitch / 2);
+    double cr = cos(roll / 2), sr = sin(roll / 2);
+    double cy = cos(yaw / 2), sy = sin(yaw / 2);
+
+    /* q30 */
+    quat[0] = (long)((cr * cp * cy + sr * sp * sy) * (1 << 30));
+    quat[1] = (long)((sr * cp * cy - cr * sp * sy) * (1 << 30));
+    quat[2] = (long)((cr * sp * cy + sr * cp * sy) * (1 << 30));
+    quat[3] = (long)((cr * cp * sy - sr * sp * cy) * (1 << 30));
+}
+
+static void synth_sample(unsigned long n, long quat[], long gyro[], long accel[])
+{
+    double t = (double)n / RATE_HZ;
+    double w = 2 * M_PI * 0.5;
+    double a = 10 * M_PI / 180;         /* 10 degrees */
+    double pitch = a * sin(w * t) + noise(0.01);
+    double roll  = a * cos(w * t) + noise(0.01);
+    double yaw   = 0.1 * t;
+
+    euler_to_quat(pitch, roll, yaw, quat);
+    /* dps, q16 */
+    gyro[0] = (long)((a * w * cos(w * t) * 180 / M_PI + noise(2)) * 65536);
+    gyro[1] = (long)((-a * w * sin(w * t) * 180 / M_PI + noise(2)) * 65536);
+    gyro[2] = (long)((0.1 * 180 / M_PI + noise(2)) * 65536);
+    /* g, q16 */
+    accel[0] = (long)(noise(0.05) * 65536);
+    accel[1] = (long)(noise(0.05) * 65536);
+    accel[2] = (long)((1 + noise(0.05)) * 65536);
+    altitude = 1000 + (long)(50 * sin(w * t));
+}
+
+static int replay_synthetic(unsigned long cycles, FILE *out)
+{
+    short sensors = INV_XYZ_GYRO | INV_XYZ_ACCEL | INV_WXYZ_QUAT;
+    long quat[4], gyro[3], accel[3], compass[3] = { 0, 0, 0 };
+    unsigned long n, timestamp;
+
+    for (n = 0; n < cycles; n++) {
+        timestamp = 1 + n * 1000 / RATE_HZ;
+        synth_sample(n, quat, gyro, accel);
+        data_ready(sensors, timestamp * NS_PER_MS, quat, accel, gyro, compass);
+        end_cycle(out, n, timestamp);
+    }
+    return 0;
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+    uint64_t sa = (*(const struct bb_record * const *)a)->seq;
+    uint64_t sb = (*(const struct bb_record * const *)b)->seq;
+
+    return sa < sb ? -1 : sa > sb;
+}
+
+/*
+ * blackbox stream, in seq order, setpoints as recorded
+ */
+static int replay_blackbox(const char *file, unsigned long cycles, FILE *out)
+{
+    const struct bb_header *hdr;
+    const struct bb_record *recs, **order;
+    long quat[4], gyro[3], accel[3], compass[3] = { 0, 0, 0 };
+    unsigned long n, valid = 0;
+    uint64_t t_us = 0;
+    struct stat st;
+    uint32_t i, nr;
+    void *base;
+    int fd, k;
+
+    if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+        return -errno;
+    if (st.st_size < BB_HEADER_SIZE)
+        return -EINVAL;
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+        return -errno;
+
+    hdr = base;
+    if (memcmp(hdr->magic, BB_MAGIC, sizeof(BB_MAGIC)) ||
+        hdr->version != BB_VERSION ||
+        hdr->record_size != sizeof(struct bb_record))
+        return -EINVAL;
+    nr = hdr->nr_records;
+    if ((uint64_t)st.st_size < hdr->header_size + (uint64_t)nr * hdr->record_size)
+        nr = (st.st_size - hdr->header_size) / hdr->record_size;
+    recs = (const struct bb_record *)((const char *)base + hdr->header_size);
+
+    if ((order = malloc(sizeof(*order) * (nr ? nr : 1))) == NULL)
+        return -ENOMEM;
+    for (i = 0; i < nr; i++) {
+        if (recs[i].seq != 0)
+            order[valid++] = &recs[i];
+    }
+    qsort(order, valid, sizeof(*order), cmp_seq);
+    if (cycles == 0 || cycles > valid)
+        cycles = valid;
+
+    for (n = 0; n < cycles; n++) {
+        const struct bb_record *r = order[n];
+
+        for (k = 0; k < 4; k++)
+            quat[k] = r->quat[k];
+        for (k = 0; k < 3; k++) {
+            gyro[k] = r->gyro[k];
+            accel[k] = r->accel[k];
+            dst_euler[k] = r->target[k];
+        }
+        /* unwrapped, the record has 32 bits of us */
+        t_us = n ? t_us + (uint32_t)(r->timestamp - order[n - 1]->timestamp)
+                 : r->timestamp;
+        data_ready((short)r->sensors, t_us * NS_PER_US, quat, accel, gyro, compass);
+        end_cycle(out, n, (unsigned long)(t_us / 1000));
+    }
+
+    free(order);
+    munmap(base, st.st_size);
+    close(fd);
+    return 0;
+}
+
+static int parse_gains(const char *s, double g[5])
+{
+    return sscanf(s, "%lf,%lf,%lf,%lf,%lf", &g[0], &g[1], &g[2], &g[3], &g[4]) == 5
+        ? 0 : -EINVAL;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "blackbox", required_argument, NULL, 'b' },
+        { "cycles",   required_argument, NULL, 'n' },
+        { "pitch",    required_argument, NULL, 'p' },
+        { "altitude", no_argument,       NULL, 'a' },
+        { "output",   required_argument, NULL, 'o' },
+        { "angle",    required_argument, NULL, 'A' },
+        { "rate",     required_argument, NULL, 'R' },
+        { "checksum", required_argument, NULL, 'c' },
+        { 0, 0, 0, 0 }
+    };
+    /* devtree_quadcopter.lua */
+    double angle[5] = { 0.5, 0.005, 0.55, -30, 30 };
+    double rate[5]  = { 0.2, 0, 0.9, -10, 10 };
+    double alti[5]  = { 0.5, 0, 0, -999999999, 999999999 };
+    const char *blackbox = NULL, *output = NULL, *expect = NULL;
+    unsigned long cycles = 0;
+    int use_altitude = 0;
+    double pitch = 0;
+    FILE *out = NULL;
+    uint64_t t;
+    int c, i, err;
+
+    while ((c = getopt_long(argc, argv, "b:n:p:ao:A:R:c:", options, NULL)) != -1) {
+        switch (c) {
+        case 'b': blackbox = optarg; break;
+        case 'n': cycles = strtoul(optarg, NULL, 0); break;
+        case 'p': pitch = atof(optarg); break;
+        case 'a': use_altitude = 1; break;
+        case 'o': output = optarg; break;
+        case 'A':
+        case 'R':
+            if (parse_gains(optarg, c == 'A' ? angle : rate) < 0) {
+                fprintf(stderr, "gains: kp,ki,kd,min,max\n");
+                return 1;
+            }
+            break;
+        case 'c': expect = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-b blackbox] [-n cycles] [-p pitch] [-a] "
+                    "[-o out.csv] [-A gains] [-R gains] [-c checksum]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (blackbox == NULL && cycles == 0)
+        cycles = 100000;
+
+    pidctrl_init(0, 1, 2, 3, use_altitude ? get_altitude : NULL, angle, rate, alti);
+    if (data_ready == NULL) {
+        fprintf(stderr, "no data ready callback\n");
+        return 1;
+    }
+    /* armed without an IMU sample */
+    for (i = 0; i < NR_ESC; i++) {
+        if (esc_out[i] != min_throttle) {
+            fprintf(stderr, "ESC %d not armed: %d\n", i, esc_out[i]);
+            return 1;
+        }
+    }
+    dst_euler[PITCH] = pitch;
+
+    if (output && (out = fopen(output, "w")) == NULL) {
+        perror(output);
+        return 1;
+    }
+    if (out)
+        fprintf(out, "cycle,timestamp,front,rear,left,right\n");
+
+    t = stats_now();
+    if (blackbox)
+        err = replay_blackbox(blackbox, cycles, out);
+    else
+        err = replay_synthetic(cycles, out);
+    t = stats_now() - t;
+    if (err < 0) {
+        fprintf(stderr, "replay, err = %d\n", err);
+        return 1;
+    }
+    if (out)
+        fclose(out);
+
+    fprintf(stdout, "%lu cycles in %.3f s, %.0f cycles/s%s\n", nr_cycles,
+            t / 1e9, nr_cycles * 1e9 / t, output ? " (with CSV output)" : "");
+    fprintf(stdout, "esc: %d %d %d %d\n", esc_out[0], esc_out[1], esc_out[2], esc_out[3]);
+    fprintf(stdout, "checksum: %016llx\n", (unsigned long long)checksum);
+
+    if (expect && strtoull(expect, NULL, 16) != checksum) {
+        fprintf(stderr, "checksum mismatch, expected %s\n", expect);
+        return 1;
+    }
+    return 0;
+}
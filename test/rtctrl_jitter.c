@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+
+#include "../raspd/event.h"
+#include "../raspd/rtctrl.h"
+
+/*
+ * worst-case jitter of a periodic control loop while the event loop
+ * is kept busy by slow handlers (think Lua callbacks, bulky clients)
+ *
+ *      rtctrl_jitter [single|rt] [period_us] [seconds]
+ *
+ * single: the "interrupt" (a timerfd) is dispatched by libevent, as
+ *         inv_imu.c did before the control thread
+ * rt:     the same handler runs on the rtctrl thread
+ */
+
+#define WORK_US     50      /* fusion + PID */
+#define BUSY_MS     20      /* a slow event loop handler ... */
+#define BUSY_US     3000    /* ... that hogs the loop */
+
+static long long last, period_min, period_max, period_sum;
+static unsigned long count, late;
+static long long late_ns;
+
+static inline long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void spin_us(long us)
+{
+    long long end = now_ns() + us * 1000LL;
+    while (now_ns() < end)
+        ;
+}
+
+static void control(int fd, void *opaque)
+{
+    uint64_t expirations;
+    long long t = now_ns();
+
+    read(fd, &expirations, sizeof(expirations));
+    if (last) {
+        long long period = t - last;
+        if (count == 0 || period < period_min)
+            period_min = period;
+        if (period > period_max)
+            period_max = period;
+        period_sum += period;
+        count++;
+        if (period > late_ns)
+            late++;
+    }
+    last = t;
+    spin_us(WORK_US);
+}
+
+static void cb_control(int fd, short what, void *arg)
+{
+    control(fd, arg);
+}
+
+static void cb_busy(int fd, short what, void *arg)
+{
+    spin_us(BUSY_US);
+}
+
+static void cb_done(int fd, short what, void *arg)
+{
+    rasp_event_loopexit();
+}
+
+int main(int argc, char *argv[])
+{
+    const char *mode = argc > 1 ? argv[1] : "rt";
+    int period_us = argc > 2 ? atoi(argv[2]) : 1000;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    struct itimerspec its;
+    struct timeval tv_busy = { 0, BUSY_MS * 1000 };
+    struct timeval tv_done = { seconds, 0 };
+    int rt = strcmp(mode, "rt") == 0;
+    int fd, err;
+
+    if (period_us <= 0 || seconds <= 0)
+        return 1;
+    late_ns = period_us * 1500LL;
+
+    if ((err = sched_realtime(rt ? 40 : 0)) < 0)
+        fprintf(stderr, "sched_realtime(), err = %d (not root?)\n", err);
+    if ((err = rasp_event_init()) < 0) {
+        fprintf(stderr, "rasp_event_init(), err = %d\n", err);
+        return 1;
+    }
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (fd < 0) {
+        perror("timerfd_create");
+        return 1;
+    }
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_nsec = period_us * 1000L;
+    its.it_value.tv_nsec = period_us * 1000L;
+    timerfd_settime(fd, 0, &its, NULL);
+
+    if (rt) {
+        if ((err = rtctrl_init(-1, 0)) < 0
+                || (err = rtctrl_add_irq(fd, POLLIN, control, NULL)) < 0
+                || (err = rtctrl_start()) < 0) {
+            fprintf(stderr, "rtctrl, err = %d\n", err);
+            return 1;
+        }
+    } else {
+        err = eventfd_add(fd, EV_READ | EV_PERSIST, NULL, cb_control, NULL, NULL);
+        if (err < 0) {
+            fprintf(stderr, "eventfd_add(), err = %d\n", err);
+            return 1;
+        }
+    }
+
+    register_timer(EV_PERSIST, &tv_busy, cb_busy, NULL, NULL);
+    register_timer(0, &tv_done, cb_done, NULL, NULL);
+
+    rasp_event_loop();
+
+    if (rt)
+        rtctrl_exit();
+
+    if (count == 0) {
+        fprintf(stderr, "no samples\n");
+        return 1;
+    }
+    fprintf(stdout, "%-6s period %d us, %lu samples: min %lld avg %lld max %lld us, "
+            "jitter %lld us, %lu late (> 1.5 period)\n", mode, period_us, count,
+            period_min / 1000, period_sum / count / 1000, period_max / 1000,
+            (period_max - period_min) / 1000, late);
+
+    close(fd);
+    rasp_event_exit();
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../raspd/event.h"
+#include "../raspd/rtctrl.h"
+
+/*
+ * an interrupt fd that polls like a sysfs GPIO value fd on the rtctrl
+ * thread: readable all the time, POLLPRI on every "edge" until the
+ * handler re-arms it.
+ *
+ * the fd is a loopback TCP socket with unread data queued (POLLIN for
+ * good), an edge is one urgent byte (POLLPRI), the handler re-arms by
+ * reading it with MSG_OOB. the thread must sleep between the edges and
+ * run the handler once per edge.
+ *
+ *      rtctrl_sysfs [edges]
+ */
+
+#define EDGE_MS     5
+#define IDLE_MS     200
+
+static volatile unsigned long handled;
+
+static void sleep_ms(long ms)
+{
+    struct timespec ts = { ms / 1000, ms % 1000 * 1000000L };
+
+    nanosleep(&ts, NULL);
+}
+
+static long long cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* the re-arm, as bcm2835_gpio_irq_ack() for sysfs */
+static void edge(int fd, void *opaque)
+{
+    char c;
+
+    recv(fd, &c, 1, MSG_OOB);
+    __atomic_add_fetch(&handled, 1, __ATOMIC_RELEASE);
+}
+
+/* a connected loopback pair, rx the interrupt fd */
+static int tcp_pair(int *tx, int *rx)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int lfd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+            || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || listen(lfd, 1) < 0
+            || getsockname(lfd, (struct sockaddr *)&addr, &len) < 0
+            || (*tx = socket(AF_INET, SOCK_STREAM, 0)) < 0
+            || connect(*tx, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || (*rx = accept(lfd, NULL, NULL)) < 0)
+        return -errno;
+    close(lfd);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int nr_edges = argc > 1 ? atoi(argv[1]) : 50;
+    struct pollfd pfd;
+    long long cpu;
+    unsigned long seen;
+    int tx, rx, i, err, failed = 0;
+
+    if (nr_edges <= 0)
+        return 1;
+    if ((err = rasp_event_init()) < 0) {
+        fprintf(stderr, "rasp_event_init(), err = %d\n", err);
+        return 1;
+    }
+    if ((err = tcp_pair(&tx, &rx)) < 0) {
+        fprintf(stderr, "tcp_pair(), err = %d\n", err);
+        return 1;
+    }
+
+    /* never read: POLLIN for good, like the value file */
+    send(tx, "0\n", 2, 0);
+    sleep_ms(EDGE_MS);
+    pfd.fd = rx;
+    pfd.events = POLLIN | POLLPRI;
+    if (poll(&pfd, 1, 0) != 1 || pfd.revents != POLLIN) {
+        fprintf(stderr, "not a sysfs-like fd, revents %x\n", pfd.revents);
+        return 1;
+    }
+
+    if ((err = rtctrl_init(-1, 0)) < 0
+            || (err = rtctrl_add_irq(rx, POLLPRI, edge, NULL)) < 0
+            || (err = rtctrl_start()) < 0) {
+        fprintf(stderr, "rtctrl, err = %d\n", err);
+        return 1;
+    }
+
+    /* readable, no edge: the thread sleeps */
+    cpu = cpu_ns();
+    sleep_ms(IDLE_MS);
+    cpu = cpu_ns() - cpu;
+    seen = __atomic_load_n(&handled, __ATOMIC_ACQUIRE);
+    fprintf(stdout, "idle %d ms: %lu calls, %.1f ms cpu\n", IDLE_MS, seen, cpu / 1e6);
+    if (seen || cpu > IDLE_MS * 1000000LL / 4)
+        failed = 1;
+
+    /* one call per edge */
+    for (i = 0; i < nr_edges; i++) {
+        send(tx, "1", 1, MSG_OOB);
+        sleep_ms(EDGE_MS);
+    }
+    sleep_ms(IDLE_MS);
+    seen = __atomic_load_n(&handled, __ATOMIC_ACQUIRE);
+    fprintf(stdout, "%d edges: %lu calls\n", nr_edges, seen);
+    if (seen != (unsigned long)nr_edges)
+        failed = 1;
+
+    rtctrl_exit();
+    close(tx);
+    close(rx);
+    rasp_event_exit();
+    fprintf(stdout, "%s\n", failed ? "FAIL" : "OK");
+    return failed;
+}
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * softpwm sample table updates, without the DMA hardware (the
+ * simulated backend, its DMA position register moved by hand): the double buffered stage/commit path
+ * of both engines against the former full rewrite of a single table,
+ * same output checked on random updates, then updates per second with
+ * the quadcopter settings (2500 us cycle, 5 us step, 4 ESCs moving a
+ * few steps around 1-1.3 ms, one commit per control step).
+ *
+ *      softpwm_bench [iterations]
+ */
+
+#include "../raspd/softpwm.c"
+
+#define CYCLE_US    2500
+#define STEP_NS     5000
+#define NR_ESC      4
+
+static struct softpwm_dev *p;
+static uint64_t *ref;
+static uint64_t ref_mask;
+
+/* what set_mask_data() did before */
+static void full_rewrite(uint64_t pinmask, int data)
+{
+    int i;
+
+    pinmask &= (1ULL << MAX_CHANNEl) - 1;
+    if (data > p->nr_samples)
+        data = p->nr_samples;
+    if (data <= 0)
+        ref_mask &= ~pinmask;
+    else
+        ref_mask |= pinmask;
+
+    if (ref_mask) {
+        ref[0] = ref_mask;
+        for (i = 1; i < data; i++)
+            ref[i] &= ~pinmask;
+        for (i = max(data, 1); i < p->nr_samples; i++)
+            ref[i] |= pinmask;
+    } else {
+        ref[0] = ref_mask;
+    }
+}
+
+static void setup(int type, int cycle, int step_ns)
+{
+    free(ref);
+    if (softpwm_init_sim(type, cycle, step_ns) < 0) {
+        fprintf(stderr, "softpwm_init_sim()\n");
+        exit(1);
+    }
+    p = softpwm_default;
+
+    ref = calloc(p->nr_samples, sizeof(*ref));
+    ref_mask = 0;
+}
+
+/* the DMA reaches the end of the period */
+static void dma_period(void)
+{
+    p->ioreg_dma[DMA_CONBLK_AD] = p->bufs[p->active].last->next;
+}
+
+/*
+ * run one period of an edge chain: the set mask and the step each pin
+ * is first cleared at must be the ones of the table
+ */
+static int edges_match(struct pwm_buf *b)
+{
+    struct control_blk *cbp = b->cb;
+    int clear_at[MAX_CHANNEl];
+    uint64_t set = 0;
+    int tick = 0, pin, i, n;
+
+    for (pin = 0; pin < MAX_CHANNEl; pin++)
+        clear_at[pin] = p->nr_samples;
+
+    for (n = 0; n < b->nr_cbs; n++) {
+        if (cbp->info & DMA_D_DREQ) {
+            tick += cbp->length / FIFO_WORD;
+        } else {
+            uint64_t word = *(uint64_t *)phys_to_virt(p, cbp->src);
+            if (cbp->dst == PHYS_GPSET0)
+                set = word;
+            for (pin = 0; cbp->dst == PHYS_GPCLR0 && pin < MAX_CHANNEl; pin++) {
+                if ((word & (1ULL << pin)) && clear_at[pin] == p->nr_samples)
+                    clear_at[pin] = tick;
+            }
+        }
+        if (cbp->next == virt_to_phys(p, b->cb))
+            break;
+        cbp = phys_to_virt(p, cbp->next);
+    }
+    if (tick != p->nr_samples || set != (ref_mask ? ref[0] : 0))
+        return 0;
+
+    for (pin = 0; pin < MAX_CHANNEl; pin++) {
+        for (i = 1; i < p->nr_samples && !(ref[i] & (1ULL << pin)); i++)
+            ;
+        if (clear_at[pin] != i)
+            return 0;
+    }
+    return 1;
+}
+
+static int buf_matches(struct pwm_buf *b)
+{
+    if (p->engine == SOFTPWM_EDGE)
+        return edges_match(b);
+    return !memcmp(b->sample, ref, p->nr_samples * sizeof(*ref));
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int check(int count)
+{
+    int i, pin, data;
+    uint64_t mask;
+
+    for (i = 0; i < count; i++) {
+        if (rand() % 8 == 0) {
+            mask = (uint64_t)rand() << 33 ^ (uint64_t)rand() << 2 ^ rand();
+            data = rand() % (p->nr_samples + 20) - 10;
+        } else {
+            pin = rand() % MAX_CHANNEl;
+            mask = 1ULL << pin;
+            data = rand() % (p->nr_samples + 20) - 10;
+        }
+        stage_mask_data(p, mask, data);
+        full_rewrite(mask, data);
+        if (rand() % 4 == 0)
+            continue;   /* more staged before the commit */
+
+        if (softpwm_commit() != 0) {
+            fprintf(stderr, "FAIL update %d: commit\n", i);
+            return -1;
+        }
+        stage_mask_data(p, mask, data);
+        if (softpwm_commit() != -EAGAIN) {
+            fprintf(stderr, "FAIL update %d: commit before the DMA switch\n", i);
+            return -1;
+        }
+        /* running loop untouched until the DMA jumps */
+        if (!dma_in_buf(p, &p->bufs[!p->active])) {
+            fprintf(stderr, "FAIL update %d: DMA moved\n", i);
+            return -1;
+        }
+        dma_period();
+        if (!dma_in_buf(p, &p->bufs[p->active]) || !buf_matches(&p->bufs[p->active])) {
+            fprintf(stderr, "FAIL update %d: mask %016llx data %d\n", i,
+                    (unsigned long long)mask, data);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void report(const char *name, long long t, int iterations)
+{
+    fprintf(stdout, "%-8s %7.0f ns/update, %9.0f updates/s, %5.2f%% cpu at 1 kHz x %d\n",
+            name, (double)t / iterations, iterations * 1e9 / t,
+            (double)t / iterations * NR_ESC * 1000 / 1e7, NR_ESC);
+}
+
+static long long run_esc(int iterations, int commit)
+{
+    int width[NR_ESC] = { 200, 220, 240, 260 };
+    long long t;
+    int i, e;
+
+    srand(2);
+    t = now_ns();
+    for (i = 0; i < iterations; i++) {
+        e = i % NR_ESC;
+        width[e] = 200 + (width[e] - 200 + rand() % 7 - 3 + 61) % 61;
+        if (!commit) {
+            full_rewrite(1ULL << e, width[e]);
+            continue;
+        }
+        softpwm_stage(e, width[e]);
+        if (e == NR_ESC - 1) {
+            softpwm_commit();
+            dma_period();
+        }
+    }
+    return now_ns() - t;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        int engine;
+        int step_ns;
+    } engines[] = {
+        { "sample",     SOFTPWM_SAMPLE, STEP_NS },
+        { "edge",       SOFTPWM_EDGE,   STEP_NS },
+        { "edge 100ns", SOFTPWM_EDGE,   100 },
+    };
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    unsigned int k;
+
+    for (k = 0; k < sizeof(engines) / sizeof(engines[0]); k++) {
+        setup(engines[k].engine, CYCLE_US, engines[k].step_ns);
+        srand(1);
+        if (check(engines[k].engine == SOFTPWM_SAMPLE ? 200000 : 20000) < 0)
+            return 1;
+        fprintf(stdout, "%s: commit == full rewrite on random updates, "
+                "%d steps, %d pages\n", engines[k].name, p->nr_samples, p->nr_pages);
+    }
+
+    setup(SOFTPWM_SAMPLE, CYCLE_US, STEP_NS);
+    report("full", run_esc(iterations, 0), iterations);
+    report("sample", run_esc(iterations, 1), iterations);
+    fprintf(stdout, "         %ld control blocks per period\n",
+            (long)(p->bufs[p->active].last - p->bufs[p->active].cb + 1));
+
+    setup(SOFTPWM_EDGE, CYCLE_US, STEP_NS);
+    report("edge", run_esc(iterations, 1), iterations);
+    fprintf(stdout, "         %ld control blocks per period\n",
+            (long)(p->bufs[p->active].last - p->bufs[p->active].cb + 1));
+    return 0;
+}
@@ -0,0 +1,506 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "../raspd/softpwm.h"
+
+/*
+ * softpwm on the simulated backend: random widths on 8 pins of both
+ * GPIO banks, every pulse the software DMA puts out must be exactly the
+ * staged width, and the time from commit to the first pulse of the new
+ * width must be at most one period. then the same with a control block load time
+ * (-l), the edge error and the DMA work per period of each engine.
+ * the ESC frame engines put out one frame per commit: pulse widths,
+ * DShot packets and CRCs decoded from the edges. last, two groups at
+ * once: 400 Hz ESCs paced by the PWM and 50 Hz servos paced by the PCM,
+ * on their own DMA channels, each pin at the period of its group.
+ * also each engine with pins of bank 1 only: GPSET1/GPCLR1 get written
+ * only if the DMA steps from bank 0 to bank 1.
+ *
+ *      softpwm_sim [-n rounds] [-l cb_ns]
+ */
+
+#define CYCLE_US    2500
+#define NR_PIN      8
+#define NR_GPIO     64
+
+struct pin_log {
+    int risen;
+    uint64_t rise;
+    int pulses;
+    int bad;
+    uint64_t max_err;
+    uint64_t first_new;     /* rise of the first pulse of the new width */
+};
+
+/* ESCs, servos and the compute module pins of bank 1 */
+static const int gpio[NR_PIN] = { 4, 17, 18, 27, 32, 40, 45, 53 };
+static struct pin_log pins[NR_GPIO];
+static uint64_t expect[NR_GPIO];        /* ns */
+
+static void on_edge(int pin, int level, uint64_t t, void *arg)
+{
+    struct pin_log *p;
+    uint64_t width, err;
+
+    if (pin >= NR_GPIO)
+        return;
+    p = &pins[pin];
+    if (level) {
+        p->risen = 1;
+        p->rise = t;
+        return;
+    }
+    if (!p->risen)
+        return;
+    width = t - p->rise;
+    err = width > expect[pin] ? width - expect[pin] : expect[pin] - width;
+    p->pulses++;
+    if (err) {
+        p->bad++;
+        if (err > p->max_err)
+            p->max_err = err;
+    } else if (!p->first_new) {
+        p->first_new = p->rise;
+    }
+}
+
+static int run_engine(const char *name, int type, int step_ns, int cb_ns,
+                int rounds, int exact)
+{
+    struct softpwm_sim_stats st;
+    uint64_t period = (uint64_t)CYCLE_US * 1000, start;
+    uint64_t lat, lat_min = ~0ULL, lat_max = 0, lat_sum = 0, max_err = 0;
+    int nr = CYCLE_US * 1000 / step_ns;
+    int width[NR_PIN] = { 0 };
+    int r, k, pin, err;
+
+    if ((err = softpwm_init_sim(type, CYCLE_US, step_ns)) < 0) {
+        fprintf(stderr, "%s: init, err = %d\n", name, err);
+        return -1;
+    }
+    softpwm_sim_watch(on_edge, NULL);
+    softpwm_sim_cb_time(cb_ns);
+    start = softpwm_sim_now();
+    srand(1);
+
+    for (r = 0; r < rounds; r++) {
+        softpwm_sim_run(rand() % period);
+
+        for (k = 0; k < NR_PIN; k++) {
+            int w = 1 + rand() % (nr - 1);
+
+            /* the first pin always changes, it gives the latency */
+            if (k > 0 && rand() % 8 == 0)
+                w = rand() % 2 ? 0 : nr + 5;
+            else if (k == 0 && w == width[0])
+                w = w % (nr - 1) + 1;
+            width[k] = w;
+            expect[gpio[k]] = (uint64_t)w * step_ns;
+            softpwm_stage(gpio[k], w);
+        }
+
+        memset(pins, 0, sizeof(pins));
+        lat = softpwm_sim_now();
+        if ((err = softpwm_commit()) < 0) {
+            fprintf(stderr, "%s: round %d, commit err = %d\n", name, r, err);
+            return -1;
+        }
+        softpwm_sim_run(2 * period);
+        pin = gpio[0];
+        if (exact && (!pins[pin].first_new || pins[pin].first_new - lat > period)) {
+            fprintf(stderr, "%s: round %d, new width not out in a period\n", name, r);
+            return -1;
+        }
+        if (pins[pin].first_new) {
+            lat = pins[pin].first_new - lat;
+            lat_sum += lat;
+            if (lat < lat_min)
+                lat_min = lat;
+            if (lat > lat_max)
+                lat_max = lat;
+        }
+
+        /* steady state */
+        memset(pins, 0, sizeof(pins));
+        softpwm_sim_run(2 * period);
+        for (k = 0; k < NR_PIN; k++) {
+            int on = width[k] >= nr, off = width[k] <= 0;
+            int high = !!(softpwm_sim_level() & (1ULL << gpio[k]));
+
+            pin = gpio[k];
+            if (pins[pin].max_err > max_err)
+                max_err = pins[pin].max_err;
+            if (!exact)
+                continue;
+            if ((on || off) ? pins[pin].pulses || high != on
+                            : pins[pin].pulses < 1 || pins[pin].bad) {
+                fprintf(stderr, "%s: round %d, pin %d width %d: %d pulses, "
+                        "%d off by up to %llu ns\n", name, r, pin, width[k],
+                        pins[pin].pulses, pins[pin].bad,
+                        (unsigned long long)pins[pin].max_err);
+                return -1;
+            }
+        }
+    }
+
+    /* blocking update, waits on the simulated DMA */
+    if (exact && (softpwm_set_data(gpio[0], 1) < 0 || softpwm_set_data(gpio[0], 2) < 0)) {
+        fprintf(stderr, "%s: set_data\n", name);
+        return -1;
+    }
+
+    softpwm_sim_stats(&st);
+    fprintf(stdout, "%-10s cb %3d ns: latency %4llu/%4llu/%4llu us, edge error <= %5llu ns, "
+            "per period %5.0f cbs %5.0f gpio %5.0f fifo\n",
+            name, cb_ns,
+            (unsigned long long)(lat_min == ~0ULL ? 0 : lat_min / 1000),
+            (unsigned long long)(rounds ? lat_sum / rounds / 1000 : 0),
+            (unsigned long long)(lat_max / 1000),
+            (unsigned long long)max_err,
+            (double)st.cbs * period / (softpwm_sim_now() - start),
+            (double)st.gpio_writes * period / (softpwm_sim_now() - start),
+            (double)st.paced_words * period / (softpwm_sim_now() - start));
+    softpwm_exit();
+    return 0;
+}
+
+/*
+ * bank 1 only, nothing in the low word of the masks
+ */
+static int run_bank1(const char *name, int type, int step_ns)
+{
+    static const int hi[] = { 32, 45, 53 };
+    int nr = CYCLE_US * 1000 / step_ns;
+    unsigned int k;
+    int err;
+
+    if ((err = softpwm_init_sim(type, CYCLE_US, step_ns)) < 0) {
+        fprintf(stderr, "%s bank 1: init, err = %d\n", name, err);
+        return -1;
+    }
+    softpwm_sim_watch(on_edge, NULL);
+    softpwm_sim_cb_time(0);
+    for (k = 0; k < sizeof(hi) / sizeof(hi[0]); k++) {
+        expect[hi[k]] = (uint64_t)(k + 1) * nr / 4 * step_ns;
+        softpwm_stage(hi[k], (k + 1) * nr / 4);
+    }
+    if ((err = softpwm_commit()) < 0) {
+        fprintf(stderr, "%s bank 1: commit err = %d\n", name, err);
+        return -1;
+    }
+    softpwm_sim_run(2ULL * CYCLE_US * 1000);
+    memset(pins, 0, sizeof(pins));
+    softpwm_sim_run(4ULL * CYCLE_US * 1000);
+    for (k = 0; k < sizeof(hi) / sizeof(hi[0]); k++) {
+        if (pins[hi[k]].pulses < 3 || pins[hi[k]].bad) {
+            fprintf(stderr, "%s bank 1: pin %d, %d pulses, %d off\n", name, hi[k],
+                    pins[hi[k]].pulses, pins[hi[k]].bad);
+            return -1;
+        }
+    }
+    if (softpwm_sim_level() & 0xffffffffULL) {
+        fprintf(stderr, "%s bank 1: bank 0 pins set\n", name);
+        return -1;
+    }
+    fprintf(stdout, "%-10s bank 1 ok\n", name);
+    softpwm_exit();
+    return 0;
+}
+
+/*
+ * ESC frames
+ */
+#define NR_ESC      4
+#define DATA_UNIT   5000    /* ns, the quadcopter throttle */
+
+static struct {
+    int nr;
+    int high;
+    uint64_t rise[2 * 16];
+    uint64_t width[2 * 16];
+} frame[NR_GPIO];
+
+static void on_frame_edge(int pin, int level, uint64_t t, void *arg)
+{
+    int n = frame[pin].nr;
+
+    if (pin >= NR_GPIO || n >= 2 * 16)
+        return;
+    if (level) {
+        frame[pin].rise[n] = t;
+        frame[pin].high = 1;
+    } else if (frame[pin].high) {
+        frame[pin].width[n] = t - frame[pin].rise[n];
+        frame[pin].high = 0;
+        frame[pin].nr++;
+    }
+}
+
+static int esc_us(int data)
+{
+    int us = data * DATA_UNIT / 1000 - 1000;
+
+    return us < 0 ? 0 : us > 1000 ? 1000 : us;
+}
+
+static int check_frame(const char *name, int type, const int data[], int r)
+{
+    static const int bit_ns[] = { 6700, 3300, 1700 };  /* 100 ns steps */
+    int k, pin, i;
+
+    for (k = 0; k < NR_ESC; k++) {
+        pin = gpio[k];
+        if (type == SOFTPWM_ONESHOT125 || type == SOFTPWM_MULTISHOT) {
+            int min_ns = type == SOFTPWM_ONESHOT125 ? 125000 : 5000;
+            int max_ns = type == SOFTPWM_ONESHOT125 ? 250000 : 25000;
+            uint64_t ns = (min_ns + esc_us(data[k]) * (max_ns - min_ns) / 1000 + 50)
+                            / 100 * 100;
+
+            if (data[k] <= 0 ? frame[pin].nr != 0
+                    : frame[pin].nr != 1 || frame[pin].width[0] != ns) {
+                fprintf(stderr, "%s: round %d, pin %d data %d: %d pulses of %llu ns, "
+                        "expected %llu\n", name, r, pin, data[k], frame[pin].nr,
+                        (unsigned long long)frame[pin].width[0],
+                        (unsigned long long)ns);
+                return -1;
+            }
+        } else {
+            int value = data[k] > 0 && esc_us(data[k]) ? 47 + esc_us(data[k]) * 2 : 0;
+            uint16_t packet = 0;
+            int bit = bit_ns[type - SOFTPWM_DSHOT150];
+
+            if (frame[pin].nr != 16) {
+                fprintf(stderr, "%s: pin %d, %d bits\n", name, pin, frame[pin].nr);
+                return -1;
+            }
+            for (i = 0; i < 16; i++) {
+                /* 3/8 or 3/4 of the bit */
+                packet = packet << 1 | (frame[pin].width[i] > (uint64_t)bit * 9 / 16);
+                if (i && frame[pin].rise[i] - frame[pin].rise[i - 1] != (uint64_t)bit) {
+                    fprintf(stderr, "%s: pin %d, bit %d period %llu ns\n", name, pin, i,
+                            (unsigned long long)(frame[pin].rise[i] - frame[pin].rise[i - 1]));
+                    return -1;
+                }
+            }
+            if (packet != softpwm_dshot_packet(value, 0)
+                    || ((packet >> 4 ^ packet >> 8 ^ packet >> 12) & 0xf) != (packet & 0xf)) {
+                fprintf(stderr, "%s: round %d, pin %d value %d: packet %04x\n",
+                        name, r, pin, value, packet);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int run_frames(const char *name, int type, int rounds)
+{
+    uint64_t t, len = 0;
+    int data[NR_ESC];
+    int r, k, err;
+
+    if ((err = softpwm_init_sim(type, 0, DATA_UNIT)) < 0) {
+        fprintf(stderr, "%s: init, err = %d\n", name, err);
+        return -1;
+    }
+    softpwm_sim_watch(on_frame_edge, NULL);
+    srand(1);
+
+    for (r = 0; r < rounds; r++) {
+        for (k = 0; k < NR_ESC; k++) {
+            data[k] = 180 + rand() % 240;   /* 0.9 - 2.1 ms */
+            if (rand() % 16 == 0)
+                data[k] = 0;
+            softpwm_stage(gpio[k], data[k]);
+        }
+
+        memset(frame, 0, sizeof(frame));
+        t = softpwm_sim_now();
+        if ((err = softpwm_commit()) < 0 || softpwm_commit() != -EAGAIN) {
+            fprintf(stderr, "%s: round %d, commit err = %d\n", name, r, err);
+            return -1;
+        }
+        /* 1 kHz control loop, nothing goes out without a commit */
+        softpwm_sim_run(1000000);
+        if (check_frame(name, type, data, r) < 0)
+            return -1;
+        for (k = 0; k < NR_ESC; k++) {
+            int n = frame[gpio[k]].nr;
+
+            if (n && frame[gpio[k]].rise[n - 1] + frame[gpio[k]].width[n - 1] - t > len)
+                len = frame[gpio[k]].rise[n - 1] + frame[gpio[k]].width[n - 1] - t;
+        }
+        memset(frame, 0, sizeof(frame));
+        softpwm_sim_run(1000000);
+        for (k = 0; k < NR_ESC; k++) {
+            if (frame[gpio[k]].nr) {
+                fprintf(stderr, "%s: round %d, output without a commit\n", name, r);
+                return -1;
+            }
+        }
+    }
+
+    fprintf(stdout, "%-10s frames ok, commit to end of frame <= %6.1f us\n", name, len / 1e3);
+    softpwm_exit();
+    return 0;
+}
+
+/*
+ * two groups
+ */
+#define SERVO_US    20000
+#define NR_SERVO    4
+
+static struct {
+    uint64_t rise;
+    uint64_t period;        /* ns, expected */
+    int periods;
+    int bad;
+} group_pin[NR_GPIO];
+
+static void on_group_edge(int pin, int level, uint64_t t, void *arg)
+{
+    if (pin >= NR_GPIO)
+        return;
+    on_edge(pin, level, t, arg);
+    if (!level)
+        return;
+    if (group_pin[pin].rise) {
+        group_pin[pin].periods++;
+        if (t - group_pin[pin].rise != group_pin[pin].period)
+            group_pin[pin].bad++;
+    }
+    group_pin[pin].rise = t;
+}
+
+static int run_groups(int rounds)
+{
+    struct softpwm_dev *esc, *servo;
+    int r, k, pin, w;
+
+    esc = softpwm_new_sim(SOFTPWM_DMA_CHANNEL, SOFTPWM_PACER_PWM, SOFTPWM_SAMPLE,
+                    CYCLE_US, 5000);
+    servo = softpwm_new_sim(SOFTPWM_DMA_CHANNEL + 1, SOFTPWM_PACER_PCM, SOFTPWM_EDGE,
+                    SERVO_US, 10000);
+    if (esc == NULL || servo == NULL) {
+        fprintf(stderr, "groups: new, errno = %d\n", errno);
+        return -1;
+    }
+    /* one group per channel and per pacer, a pin on one group */
+    if (softpwm_new_sim(SOFTPWM_DMA_CHANNEL + 2, SOFTPWM_PACER_PWM, SOFTPWM_EDGE,
+                    CYCLE_US, 5000) != NULL || errno != EBUSY
+            || softpwm_dev_stage(esc, gpio[0], 300) < 0
+            || softpwm_dev_stage(servo, gpio[0], 150) != -EBUSY) {
+        fprintf(stderr, "groups: pacer or pin shared\n");
+        return -1;
+    }
+    softpwm_sim_watch(on_group_edge, NULL);
+    srand(1);
+
+    for (r = 0; r < rounds; r++) {
+        for (k = 0; k < NR_PIN; k++) {
+            pin = gpio[k];
+            if (k < NR_PIN - NR_SERVO) {
+                w = 200 + rand() % 200;                 /* 1 - 2 ms */
+                expect[pin] = (uint64_t)w * 5000;
+                group_pin[pin].period = (uint64_t)CYCLE_US * 1000;
+                softpwm_dev_stage(esc, pin, w);
+            } else {
+                w = 50 + rand() % 200;                  /* 0.5 - 2.5 ms */
+                expect[pin] = (uint64_t)w * 10000;
+                group_pin[pin].period = (uint64_t)SERVO_US * 1000;
+                softpwm_dev_stage(servo, pin, w);
+            }
+        }
+        if (softpwm_dev_commit(esc) < 0 || softpwm_dev_commit(servo) < 0) {
+            fprintf(stderr, "groups: round %d, commit\n", r);
+            return -1;
+        }
+        /* the new widths are out after a servo period */
+        softpwm_sim_run(2 * SERVO_US * 1000ULL);
+        memset(pins, 0, sizeof(pins));
+        memset(group_pin, 0, sizeof(group_pin));
+        for (k = 0; k < NR_PIN; k++)
+            group_pin[gpio[k]].period = (uint64_t)(k < NR_PIN - NR_SERVO
+                            ? CYCLE_US : SERVO_US) * 1000;
+        softpwm_sim_run(3 * SERVO_US * 1000ULL);
+
+        for (k = 0; k < NR_PIN; k++) {
+            pin = gpio[k];
+            if (pins[pin].bad || group_pin[pin].bad || group_pin[pin].periods
+                    < (k < NR_PIN - NR_SERVO ? 3 * SERVO_US / CYCLE_US - 1 : 2)) {
+                fprintf(stderr, "groups: round %d, pin %d: %d pulses off by up to "
+                        "%llu ns, %d of %d periods off\n", r, pin, pins[pin].bad,
+                        (unsigned long long)pins[pin].max_err,
+                        group_pin[pin].bad, group_pin[pin].periods);
+                return -1;
+            }
+        }
+    }
+
+    fprintf(stdout, "groups     %d us pwm + %d us pcm: widths and periods ok\n",
+            CYCLE_US, SERVO_US);
+    softpwm_del(esc);
+    softpwm_del(servo);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        int engine;
+        int step_ns;
+    } engines[] = {
+        { "sample",     SOFTPWM_SAMPLE, 5000 },
+        { "edge",       SOFTPWM_EDGE,   5000 },
+        { "edge 1us",   SOFTPWM_EDGE,   1000 },
+        { "edge 100ns", SOFTPWM_EDGE,   100 },
+    };
+    static const struct {
+        const char *name;
+        int engine;
+    } frames[] = {
+        { "oneshot125", SOFTPWM_ONESHOT125 },
+        { "multishot",  SOFTPWM_MULTISHOT },
+        { "dshot150",   SOFTPWM_DSHOT150 },
+        { "dshot300",   SOFTPWM_DSHOT300 },
+        { "dshot600",   SOFTPWM_DSHOT600 },
+    };
+    int rounds = 200, cb_ns = 250;
+    unsigned int k;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:l:")) != -1) {
+        switch (c) {
+        case 'n': rounds = atoi(optarg); break;
+        case 'l': cb_ns = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n rounds] [-l cb_ns]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (k = 0; k < sizeof(engines) / sizeof(engines[0]); k++) {
+        if (run_engine(engines[k].name, engines[k].engine, engines[k].step_ns,
+                        0, rounds, 1) < 0)
+            return 1;
+        if (run_bank1(engines[k].name, engines[k].engine, engines[k].step_ns) < 0)
+            return 1;
+    }
+    for (k = 0; cb_ns && k < sizeof(engines) / sizeof(engines[0]); k++) {
+        if (run_engine(engines[k].name, engines[k].engine, engines[k].step_ns,
+                        cb_ns, rounds, 0) < 0)
+            return 1;
+    }
+    for (k = 0; k < sizeof(frames) / sizeof(frames[0]); k++) {
+        if (run_frames(frames[k].name, frames[k].engine, rounds) < 0)
+            return 1;
+    }
+    if (run_groups(rounds / 10 + 1) < 0)
+        return 1;
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../raspd/stats.h"
+
+/*
+ * log-linear histogram: quantiles against the exact ones of the
+ * sorted samples, and the cost of a probe (two reads of the clock
+ * and one record)
+ *
+ * clock source: a 200 Hz sensor 1000 ppm slow, 20 us of jitter and
+ * samples missed, the skew and the period must come out of the marks
+ */
+
+#define NR_SAMPLES  200000
+
+static uint64_t samples[NR_SAMPLES];
+static struct hist h;
+static struct clock_src src;
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int test_clock_src(void)
+{
+    const uint64_t nominal = 5000000, real = 5005000;   /* +1000 ppm */
+    uint64_t t, base = stats_now() - 30 * 1000000000ULL;
+    double skew;
+    int i;
+
+    clock_src_register(&src, "sensor", nominal);
+    for (i = 0; i < 4000; i++) {
+        /* one in 100 lost */
+        if (i % 100 == 50)
+            continue;
+        t = base + i * real + (uint64_t)(rand() % 40000);
+        clock_src_mark(&src, t);
+    }
+    skew = clock_src_skew_ppm(&src);
+    fprintf(stdout, "clock source: period %llu ns, skew %.1f ppm, jitter p99 %llu ns\n",
+            (unsigned long long)clock_src_period(&src), skew,
+            (unsigned long long)hist_quantile(&src.jitter, 0.99));
+    clock_src_unregister(&src);
+
+    if (fabs(skew - 1000) > 50 || hist_quantile(&src.jitter, 0.99) > 45000) {
+        fprintf(stderr, "clock source off\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t t0, t;
+    int count = 1000000;
+    int fails = 0;
+    int i;
+
+    if (argc > 1)
+        count = atoi(argv[1]);
+    if (count <= 0)
+        return 1;
+
+    /* heavy tailed, from 1 us */
+    srand(1);
+    for (i = 0; i < NR_SAMPLES; i++) {
+        double u = (rand() + 1.0) / ((double)RAND_MAX + 2.0);
+        samples[i] = (uint64_t)(1000.0 * exp(-log(u) * 1.5));
+        hist_record(&h, samples[i]);
+    }
+    qsort(samples, NR_SAMPLES, sizeof(samples[0]), cmp_u64);
+
+    for (i = 0; i < (int)(sizeof(qs) / sizeof(qs[0])); i++) {
+        uint64_t exact = samples[(int)(qs[i] * NR_SAMPLES)];
+        uint64_t est = hist_quantile(&h, qs[i]);
+        double err = fabs((double)est - (double)exact) / exact;
+
+        fprintf(stdout, "q%-6g exact %8llu ns  hist %8llu ns  err %.2f%%\n",
+                qs[i], (unsigned long long)exact, (unsigned long long)est,
+                err * 100);
+        if (err > 1.0 / STATS_SUB_COUNT)
+            fails++;
+    }
+    if (hist_quantile(&h, 1.0) != samples[NR_SAMPLES - 1]) {
+        fprintf(stderr, "max mismatch\n");
+        fails++;
+    }
+
+    hist_reset(&h);
+    t0 = stats_now();
+    for (i = 0; i < count; i++) {
+        t = stats_now();
+        stats_record(STAT_total, stats_now() - t);
+    }
+    fprintf(stdout, "probe: %.1f ns\n", (double)(stats_now() - t0) / count);
+
+    fails += test_clock_src();
+    return fails ? 1 : 0;
+}
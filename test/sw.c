@@ -157,7 +157,7 @@ int main(int argc, char *argv[])
     init_termios(0);
     if (!bcm2835_init())
         return 1;
-    if ((err = sched_realtime()) < 0)
+    if ((err = sched_realtime(0)) < 0)
     	fprintf(stderr, "sched_realtime(), err = %d\n", err);
     rasp_event_init();
 
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sock.h>
+
+#include "../raspd/binproto.h"
+#include "../raspd/telemetry.h"
+
+/*
+ * subscribe to the raspd telemetry stream and print the records
+ *
+ *      tlm_dump host port [channels] [decimation] [count]
+ */
+
+static const uint8_t *get_floats(const uint8_t *p, float *f, int n)
+{
+    uint32_t v;
+    int i;
+
+    for (i = 0; i < n; i++, p += 4) {
+        v = get_le32(p);
+        memcpy(&f[i], &v, sizeof(v));
+    }
+    return p;
+}
+
+static void print_record(const uint8_t *p, int len)
+{
+    unsigned int channels;
+    float f[6];
+    int i;
+
+    if (len < TLM_HDR_SIZE)
+        return;
+    channels = get_le16(p + 8);
+    fprintf(stdout, "#%u %ums", get_le32(p), get_le32(p + 4));
+    if (get_le16(p + 10))
+        fprintf(stdout, " (lost %u)", get_le16(p + 10));
+    p += TLM_HDR_SIZE;
+
+    if (channels & TLM_EULER) {
+        p = get_floats(p, f, 3);
+        fprintf(stdout, " E: %.2f %.2f %.2f", f[0], f[1], f[2]);
+    }
+    if (channels & TLM_TARGET) {
+        p = get_floats(p, f, 3);
+        fprintf(stdout, " S: %.2f %.2f %.2f", f[0], f[1], f[2]);
+    }
+    if (channels & TLM_GYRO) {
+        p = get_floats(p, f, 3);
+        fprintf(stdout, " G: %.2f %.2f %.2f", f[0], f[1], f[2]);
+    }
+    if (channels & TLM_PID) {
+        p = get_floats(p, f, 6);
+        fprintf(stdout, " P: %.2f %.2f %.2f P: %.2f %.2f %.2f",
+                f[0], f[1], f[2], f[3], f[4], f[5]);
+    }
+    if (channels & TLM_ESC) {
+        fprintf(stdout, " T:");
+        for (i = 0; i < 4; i++, p += 2)
+            fprintf(stdout, " %d", (int16_t)get_le16(p));
+    }
+    fprintf(stdout, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *channels = argc > 3 ? argv[3] : "all";
+    int decimate = argc > 4 ? atoi(argv[4]) : 1;
+    long count = argc > 5 ? atol(argv[5]) : -1;
+    union sockaddr_u addr;
+    size_t ss_len = sizeof(addr);
+    uint8_t buf[4096];
+    size_t len = 0;
+    char cmd[128];
+    int fd, n;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s host port [channels] [decimation] [count]\n",
+                argv[0]);
+        return 1;
+    }
+
+    if (resolve(argv[1], (unsigned short)atoi(argv[2]),
+                &addr.storage, &ss_len, AF_INET, 0) < 0) {
+        fprintf(stderr, "resolve(%s) error\n", argv[1]);
+        return 1;
+    }
+    if ((fd = do_connect(SOCK_STREAM, &addr)) < 0) {
+        perror("do_connect");
+        return 1;
+    }
+    block_socket(fd);
+
+    n = snprintf(cmd, sizeof(cmd), "telemetry -c %s -d %d\n", channels, decimate);
+    if (write(fd, cmd, n) != n) {
+        perror("write");
+        return 1;
+    }
+
+    while (count != 0) {
+        uint8_t *p = buf, *end;
+
+        if ((n = read(fd, buf + len, sizeof(buf) - len)) <= 0)
+            break;
+        end = buf + len + n;
+
+        while (p < end && count != 0) {
+            if (*p == BINPROTO_MAGIC) {
+                int flen;
+
+                if (end - p < BINPROTO_HDR_SIZE)
+                    break;
+                flen = get_le16(p + 4);
+                if (end - p < BINPROTO_HDR_SIZE + flen)
+                    break;
+                if (get_le16(p + 2) == BINMOD_telemetry) {
+                    print_record(p + BINPROTO_HDR_SIZE, flen);
+                    if (count > 0)
+                        count--;
+                }
+                p += BINPROTO_HDR_SIZE + flen;
+            } else {
+                /* command replies */
+                uint8_t *q = memchr(p, '\n', end - p);
+
+                if (q == NULL)
+                    break;
+                fprintf(stderr, "%.*s\n", (int)(q - p), p);
+                p = q + 1;
+            }
+        }
+        len = end - p;
+        memmove(buf, p, len);
+    }
+
+    close(fd);
+    return 0;
+}